@@ -32,12 +32,15 @@
 #include <math.h>
 #include <assert.h>
 
-#define BLOOM_MAX_HASH_FUNCS 50
+inline static uint32_t _BRBloomFilterLane(uint32_t tweak, const uint8_t *data, size_t dataLen, uint32_t hashNum)
+{
+    return BRMurmur3_32(data, dataLen, hashNum*0xfba4c795 + tweak);
+}
 
 inline static uint32_t _BRBloomFilterHash(const BRBloomFilter *filter, const uint8_t *data, size_t dataLen,
                                           uint32_t hashNum)
 {
-    return BRMurmur3_32(data, dataLen, hashNum*0xfba4c795 + filter->tweak) % (filter->length*8);
+    return _BRBloomFilterLane(filter->tweak, data, dataLen, hashNum) % (filter->length*8);
 }
 
 // returns a newly allocated bloom filter struct that must be freed by calling BRBloomFilterFree()
@@ -154,6 +157,51 @@ void BRBloomFilterInsertData(BRBloomFilter *filter, const uint8_t *data, size_t
     if (data) filter->elemCount++;
 }
 
+// writes hash lanes firstHash through firstHash + hashCount - 1 of data for the given tweak to hashes
+// lanes don't depend on filter length, so they can be cached and reused for any filter with the same tweak
+void BRBloomFilterDataHashes(uint32_t tweak, const uint8_t *data, size_t dataLen, uint32_t hashes[],
+                             uint32_t firstHash, uint32_t hashCount)
+{
+    assert(data != NULL || dataLen == 0);
+    assert(hashes != NULL || hashCount == 0);
+    
+    for (uint32_t i = 0; i < hashCount; i++) {
+        hashes[i] = _BRBloomFilterLane(tweak, data, dataLen, firstHash + i);
+    }
+}
+
+// true if the element with the given hash lanes is matched by filter, hashCount must be at least filter->hashFuncs
+int BRBloomFilterContainsHashes(const BRBloomFilter *filter, const uint32_t hashes[], uint32_t hashCount)
+{
+    uint32_t i, idx;
+    
+    assert(filter != NULL);
+    assert(hashes != NULL && hashCount >= filter->hashFuncs);
+    
+    for (i = 0; i < filter->hashFuncs; i++) {
+        idx = hashes[i] % (filter->length*8);
+        if (! (filter->filter[idx >> 3] & (1 << (7 & idx)))) return 0;
+    }
+    
+    return 1;
+}
+
+// add the element with the given hash lanes to filter, hashCount must be at least filter->hashFuncs
+void BRBloomFilterInsertHashes(BRBloomFilter *filter, const uint32_t hashes[], uint32_t hashCount)
+{
+    uint32_t i, idx;
+    
+    assert(filter != NULL);
+    assert(hashes != NULL && hashCount >= filter->hashFuncs);
+    
+    for (i = 0; i < filter->hashFuncs; i++) {
+        idx = hashes[i] % (filter->length*8);
+        filter->filter[idx >> 3] |= (1 << (7 & idx));
+    }
+    
+    filter->elemCount++;
+}
+
 // frees memory allocated for filter
 void BRBloomFilterFree(BRBloomFilter *filter)
 {
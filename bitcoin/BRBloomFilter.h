@@ -40,6 +40,7 @@ extern "C" {
 #define BLOOM_UPDATE_ALL                 1
 #define BLOOM_UPDATE_P2PUBKEY_ONLY       2
 #define BLOOM_MAX_FILTER_LENGTH          36000 // this allows for 10,000 elements with a <0.0001% false positive rate
+#define BLOOM_MAX_HASH_FUNCS             50
 
 typedef struct {
     uint8_t *filter;
@@ -72,6 +73,17 @@ int BRBloomFilterContainsData(const BRBloomFilter *filter, const uint8_t *data,
 // add data to filter
 void BRBloomFilterInsertData(BRBloomFilter *filter, const uint8_t *data, size_t dataLen);
 
+// writes hash lanes firstHash through firstHash + hashCount - 1 of data for the given tweak to hashes
+// lanes don't depend on filter length, so they can be cached and reused for any filter with the same tweak
+void BRBloomFilterDataHashes(uint32_t tweak, const uint8_t *data, size_t dataLen, uint32_t hashes[],
+                             uint32_t firstHash, uint32_t hashCount);
+
+// true if the element with the given hash lanes is matched by filter, hashCount must be at least filter->hashFuncs
+int BRBloomFilterContainsHashes(const BRBloomFilter *filter, const uint32_t hashes[], uint32_t hashCount);
+
+// add the element with the given hash lanes to filter, hashCount must be at least filter->hashFuncs
+void BRBloomFilterInsertHashes(BRBloomFilter *filter, const uint32_t hashes[], uint32_t hashCount);
+
 // frees memory allocated for filter
 void BRBloomFilterFree(BRBloomFilter *filter);
 
@@ -0,0 +1,242 @@
+//
+//  BRGCSFilter.c
+//
+//  Copyright © 2026 Breadwallet AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#include "BRGCSFilter.h"
+#include "BRCrypto.h"
+#include "BRAddress.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+typedef struct {
+    const uint8_t *item;
+    size_t len;
+} _BRGCSItem;
+
+// high 64 bits of the 128 bit product a*b
+inline static uint64_t _mulHigh64(uint64_t a, uint64_t b)
+{
+    uint64_t aLo = (uint32_t)a, aHi = a >> 32, bLo = (uint32_t)b, bHi = b >> 32,
+             lo = aLo*bLo, mid1 = aHi*bLo, mid2 = aLo*bHi, carry = ((lo >> 32) + (uint32_t)mid1 + (uint32_t)mid2) >> 32;
+
+    return aHi*bHi + (mid1 >> 32) + (mid2 >> 32) + carry;
+}
+
+// maps item uniformly onto the range [0, f), where f is the element count times GCS_FILTER_M
+inline static uint64_t _BRGCSHash(const BRGCSFilter *filter, uint64_t f, const uint8_t *item, size_t itemLen)
+{
+    return _mulHigh64(BRSip64(filter->blockHash.u8, item, itemLen), f);
+}
+
+static int _uint64Compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+static int _BRGCSItemCompare(const void *a, const void *b)
+{
+    const _BRGCSItem *x = a, *y = b;
+    int r = memcmp(x->item, y->item, (x->len < y->len) ? x->len : y->len);
+
+    return (r != 0) ? r : (x->len < y->len) ? -1 : (x->len > y->len) ? 1 : 0;
+}
+
+// reads the next golomb-rice coded delta starting at bit *pos and adds it to *value, returns false if data is truncated
+inline static int _BRGCSNext(const uint8_t *data, size_t bitLen, size_t *pos, uint64_t *value)
+{
+    uint64_t q = 0, r = 0;
+
+    while (*pos < bitLen && (data[*pos/8] & (0x80 >> (*pos % 8)))) q++, (*pos)++; // unary coded quotient
+    if (*pos + 1 + GCS_FILTER_P > bitLen) return 0;
+    (*pos)++;
+
+    for (int i = 0; i < GCS_FILTER_P; i++, (*pos)++) { // remainder, most significant bit first
+        r = (r << 1) | ((data[*pos/8] & (0x80 >> (*pos % 8))) ? 1 : 0);
+    }
+
+    *value += (q << GCS_FILTER_P) | r;
+    return 1;
+}
+
+// decodes the sorted set values of filter into values, returns false if filter is malformed
+static int _BRGCSFilterDecode(const BRGCSFilter *filter, uint64_t *values)
+{
+    const uint8_t *data = &filter->data[filter->off];
+    size_t pos = 0, bitLen = (filter->length - filter->off)*8;
+    uint64_t value = 0;
+
+    for (uint64_t i = 0; i < filter->n; i++) {
+        if (! _BRGCSNext(data, bitLen, &pos, &value)) return 0;
+        if (values) values[i] = value;
+    }
+
+    return 1;
+}
+
+// returns a newly allocated basic filter for a block containing the given items, typically output scripts and the
+// scripts of outputs spent by the block's inputs, that must be freed by calling BRGCSFilterFree()
+BRGCSFilter *BRGCSFilterNew(UInt256 blockHash, const uint8_t *items[], const size_t itemsLen[], size_t itemsCount)
+{
+    BRGCSFilter *filter = calloc(1, sizeof(*filter));
+    _BRGCSItem *set = malloc(itemsCount*sizeof(*set) + 1);
+    uint64_t *values = malloc(itemsCount*sizeof(*values) + 1), f, prev = 0;
+    size_t i, n = 0, bits = 0, pos;
+
+    assert(filter != NULL);
+    assert(set != NULL);
+    assert(values != NULL);
+    assert(items != NULL || itemsCount == 0);
+    assert(itemsLen != NULL || itemsCount == 0);
+    filter->blockHash = blockHash;
+
+    for (i = 0; i < itemsCount; i++) set[i] = (_BRGCSItem) { items[i], itemsLen[i] };
+    qsort(set, itemsCount, sizeof(*set), _BRGCSItemCompare);
+
+    for (i = 0; i < itemsCount; i++) { // the filter is for the set of unique items
+        if (n == 0 || _BRGCSItemCompare(&set[n - 1], &set[i]) != 0) set[n++] = set[i];
+    }
+
+    filter->n = n;
+    f = filter->n*GCS_FILTER_M;
+    for (i = 0; i < n; i++) values[i] = _BRGCSHash(filter, f, set[i].item, set[i].len);
+    qsort(values, n, sizeof(*values), _uint64Compare);
+    for (i = 0; i < n; i++) bits += ((values[i] - (i > 0 ? values[i - 1] : 0)) >> GCS_FILTER_P) + 1 + GCS_FILTER_P;
+
+    filter->off = BRVarIntSize(n);
+    filter->length = filter->off + (bits + 7)/8;
+    filter->data = calloc(filter->length, sizeof(*filter->data));
+    assert(filter->data != NULL);
+    BRVarIntSet(filter->data, filter->off, n);
+
+    for (i = 0, pos = filter->off*8; i < n; prev = values[i], i++) {
+        uint64_t delta = values[i] - prev, q = delta >> GCS_FILTER_P;
+
+        for (; q > 0; q--, pos++) filter->data[pos/8] |= (0x80 >> (pos % 8));
+        pos++; // unary terminator is a 0 bit
+
+        for (int j = GCS_FILTER_P - 1; j >= 0; j--, pos++) {
+            if ((delta >> j) & 1) filter->data[pos/8] |= (0x80 >> (pos % 8));
+        }
+    }
+
+    free(values);
+    free(set);
+    return filter;
+}
+
+// buf must contain a serialized filter for the block with the given hash, as sent in a cfilter message
+// returns a filter struct that must be freed by calling BRGCSFilterFree()
+BRGCSFilter *BRGCSFilterParse(UInt256 blockHash, const uint8_t *buf, size_t bufLen)
+{
+    BRGCSFilter *filter = calloc(1, sizeof(*filter));
+
+    assert(filter != NULL);
+    assert(buf != NULL || bufLen == 0);
+    filter->blockHash = blockHash;
+    filter->n = (buf) ? BRVarInt(buf, bufLen, &filter->off) : 0;
+    filter->data = (buf && filter->off > 0) ? malloc(bufLen) : NULL;
+
+    if (filter->data) {
+        memcpy(filter->data, buf, bufLen);
+        filter->length = bufLen;
+    }
+
+    // each element takes at least GCS_FILTER_P + 1 bits
+    if (! filter->data || filter->n > (filter->length - filter->off)*8/(GCS_FILTER_P + 1) ||
+        ! _BRGCSFilterDecode(filter, NULL)) {
+        BRGCSFilterFree(filter);
+        filter = NULL;
+    }
+
+    return filter;
+}
+
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRGCSFilterSerialize(const BRGCSFilter *filter, uint8_t *buf, size_t bufLen)
+{
+    assert(filter != NULL);
+    assert(buf != NULL || bufLen == 0);
+    if (buf && filter->length <= bufLen) memcpy(buf, filter->data, filter->length);
+    return (! buf || filter->length <= bufLen) ? filter->length : 0;
+}
+
+// double sha256 of the serialized filter, as committed to by cfheaders messages
+UInt256 BRGCSFilterHash(const BRGCSFilter *filter)
+{
+    UInt256 hash;
+
+    assert(filter != NULL);
+    BRSHA256_2(&hash, filter->data, filter->length);
+    return hash;
+}
+
+// the filter header of a block, which chains the filter hash to the filter header of the previous block
+UInt256 BRGCSFilterHeader(UInt256 filterHash, UInt256 prevHeader)
+{
+    UInt256 buf[2] = { filterHash, prevHeader }, header;
+
+    BRSHA256_2(&header, buf, sizeof(buf));
+    return header;
+}
+
+// true if filter matches any of the given items, false positives occur at a rate of about itemsCount/GCS_FILTER_M
+int BRGCSFilterMatchAny(const BRGCSFilter *filter, const uint8_t *items[], const size_t itemsLen[], size_t itemsCount)
+{
+    uint64_t f, value = 0;
+    size_t i, j;
+    int r = 0;
+
+    assert(filter != NULL);
+    assert(items != NULL || itemsCount == 0);
+    assert(itemsLen != NULL || itemsCount == 0);
+    if (filter->n == 0 || itemsCount == 0) return 0;
+    f = filter->n*GCS_FILTER_M;
+
+    if (itemsCount > filter->n) { // decode the filter once and look up each item, so items don't need to be sorted
+        uint64_t *values = malloc(filter->n*sizeof(*values));
+
+        assert(values != NULL);
+        _BRGCSFilterDecode(filter, values);
+
+        for (i = 0; ! r && i < itemsCount; i++) {
+            value = _BRGCSHash(filter, f, items[i], itemsLen[i]);
+            if (bsearch(&value, values, filter->n, sizeof(*values), _uint64Compare)) r = 1;
+        }
+
+        free(values);
+    }
+    else { // sort the hashed items and walk them alongside the coded set
+        const uint8_t *data = &filter->data[filter->off];
+        size_t pos = 0, bitLen = (filter->length - filter->off)*8;
+        uint64_t _hashes[128], *hashes = (itemsCount <= 128) ? _hashes : malloc(itemsCount*sizeof(*hashes));
+
+        assert(hashes != NULL);
+        for (i = 0; i < itemsCount; i++) hashes[i] = _BRGCSHash(filter, f, items[i], itemsLen[i]);
+        qsort(hashes, itemsCount, sizeof(*hashes), _uint64Compare);
+
+        for (i = 0, j = 0; ! r && i < filter->n && j < itemsCount && _BRGCSNext(data, bitLen, &pos, &value); i++) {
+            while (j < itemsCount && hashes[j] < value) j++;
+            if (j < itemsCount && hashes[j] == value) r = 1;
+        }
+
+        if (hashes != _hashes) free(hashes);
+    }
+
+    return r;
+}
+
+// frees memory allocated for filter
+void BRGCSFilterFree(BRGCSFilter *filter)
+{
+    assert(filter != NULL);
+    if (filter->data) free(filter->data);
+    free(filter);
+}
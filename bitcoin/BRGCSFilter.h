@@ -0,0 +1,62 @@
+//
+//  BRGCSFilter.h
+//
+//  Copyright © 2026 Breadwallet AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#ifndef BRGCSFilter_h
+#define BRGCSFilter_h
+
+#include "BRInt.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// compact block filters are explained in BIP158: https://github.com/bitcoin/bips/blob/master/bip-0158.mediawiki
+
+#define GCS_FILTER_TYPE_BASIC 0x00
+#define GCS_FILTER_P          19     // golomb-rice coding parameter of the basic filter type
+#define GCS_FILTER_M          784931 // inverse false positive rate of the basic filter type
+
+typedef struct {
+    UInt256 blockHash; // the first 16 bytes are the siphash key
+    uint64_t n; // number of elements in the set
+    uint8_t *data; // serialized filter, element count followed by the golomb-rice coded set
+    size_t length;
+    size_t off; // offset of the coded set in data
+} BRGCSFilter;
+
+// returns a newly allocated basic filter for a block containing the given items, typically output scripts and the
+// scripts of outputs spent by the block's inputs, that must be freed by calling BRGCSFilterFree()
+BRGCSFilter *BRGCSFilterNew(UInt256 blockHash, const uint8_t *items[], const size_t itemsLen[], size_t itemsCount);
+
+// buf must contain a serialized filter for the block with the given hash, as sent in a cfilter message
+// returns a filter struct that must be freed by calling BRGCSFilterFree()
+BRGCSFilter *BRGCSFilterParse(UInt256 blockHash, const uint8_t *buf, size_t bufLen);
+
+// returns number of bytes written to buf, or total bufLen needed if buf is NULL
+size_t BRGCSFilterSerialize(const BRGCSFilter *filter, uint8_t *buf, size_t bufLen);
+
+// double sha256 of the serialized filter, as committed to by cfheaders messages
+UInt256 BRGCSFilterHash(const BRGCSFilter *filter);
+
+// the filter header of a block, which chains the filter hash to the filter header of the previous block
+UInt256 BRGCSFilterHeader(UInt256 filterHash, UInt256 prevHeader);
+
+// true if filter matches any of the given items, false positives occur at a rate of about itemsCount/GCS_FILTER_M
+int BRGCSFilterMatchAny(const BRGCSFilter *filter, const uint8_t *items[], const size_t itemsLen[], size_t itemsCount);
+
+// frees memory allocated for filter
+void BRGCSFilterFree(BRGCSFilter *filter);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRGCSFilter_h
@@ -242,6 +242,67 @@ void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size
     if (block->flags) memcpy(block->flags, flags, flagsLen);
 }
 
+// hash of the merkle tree node at the given height (leaves are at height 0) and position in its row
+static UInt256 _BRMerkleBlockNodeHash(const UInt256 txHashes[], size_t txCount, int height, size_t pos)
+{
+    UInt256 hashes[2];
+
+    if (height == 0) return txHashes[pos];
+    hashes[0] = _BRMerkleBlockNodeHash(txHashes, txCount, height - 1, pos*2);
+    hashes[1] = (pos*2 + 1 < ((txCount + (1 << (height - 1)) - 1) >> (height - 1))) ? // if right branch is missing,
+                _BRMerkleBlockNodeHash(txHashes, txCount, height - 1, pos*2 + 1) : hashes[0]; // dup left branch
+    BRSHA256_2(&hashes[0], hashes, sizeof(hashes));
+    return hashes[0];
+}
+
+// depth first traversal that builds the partial merkle tree as described in BIP37, descending only into branches
+// containing a matched tx
+static void _BRMerkleBlockBuildR(BRMerkleBlock *block, const UInt256 txHashes[], const uint8_t *matched,
+                                 size_t txCount, int height, size_t pos)
+{
+    size_t i, start = pos << height, end = ((pos + 1) << height < txCount) ? (pos + 1) << height : txCount;
+    uint8_t flag = 0;
+
+    for (i = start; matched && ! flag && i < end; i++) flag = matched[i];
+    if (flag) block->flags[block->flagsLen/8] |= (1 << (block->flagsLen % 8));
+    block->flagsLen++; // counts bits until the traversal is done
+
+    if (height == 0 || ! flag) {
+        block->hashes[block->hashesCount++] = _BRMerkleBlockNodeHash(txHashes, txCount, height, pos);
+    }
+    else {
+        _BRMerkleBlockBuildR(block, txHashes, matched, txCount, height - 1, pos*2); // left branch
+
+        if (pos*2 + 1 < ((txCount + (1 << (height - 1)) - 1) >> (height - 1))) { // right branch, if it exists
+            _BRMerkleBlockBuildR(block, txHashes, matched, txCount, height - 1, pos*2 + 1);
+        }
+    }
+}
+
+// sets totalTx, hashes and flags of block to the partial merkle tree for the complete list of transaction hashes in a
+// full block, where only tx with matched[i] set are included (matched may be NULL to include none)
+// returns the merkle root of the full list, to be checked against block->merkleRoot
+UInt256 BRMerkleBlockSetMatchedTxHashes(BRMerkleBlock *block, const UInt256 txHashes[], const uint8_t *matched,
+                                        size_t txCount)
+{
+    int height = _ceil_log2((int)txCount);
+
+    assert(block != NULL);
+    assert(txHashes != NULL && txCount > 0);
+    if (block->hashes) free(block->hashes);
+    if (block->flags) free(block->flags);
+    block->totalTx = (uint32_t)txCount;
+    block->hashes = malloc(txCount*sizeof(*block->hashes));
+    block->hashesCount = 0;
+    block->flags = calloc((txCount*2 + height)/8 + 1, sizeof(*block->flags)); // a node for each hash, plus parents
+    block->flagsLen = 0;
+    assert(block->hashes != NULL);
+    assert(block->flags != NULL);
+    _BRMerkleBlockBuildR(block, txHashes, matched, txCount, height, 0);
+    block->flagsLen = (block->flagsLen + 7)/8;
+    return _BRMerkleBlockNodeHash(txHashes, txCount, height, 0);
+}
+
 // recursively walks the merkle tree to calculate the merkle root
 // NOTE: this merkle tree design has a security vulnerability (CVE-2012-2459), which can be defended against by
 // considering the merkle root invalid if there are duplicate hashes in any rows with an even number of elements
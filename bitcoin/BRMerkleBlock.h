@@ -77,6 +77,12 @@ size_t BRMerkleBlockTxHashes(const BRMerkleBlock *block, UInt256 *txHashes, size
 void BRMerkleBlockSetTxHashes(BRMerkleBlock *block, const UInt256 hashes[], size_t hashesCount,
                               const uint8_t *flags, size_t flagsLen);
 
+// sets totalTx, hashes and flags of block to the partial merkle tree for the complete list of transaction hashes in a
+// full block, where only tx with matched[i] set are included (matched may be NULL to include none)
+// returns the merkle root of the full list, to be checked against block->merkleRoot
+UInt256 BRMerkleBlockSetMatchedTxHashes(BRMerkleBlock *block, const UInt256 txHashes[], const uint8_t *matched,
+                                        size_t txCount);
+
 // true if merkle tree and timestamp are valid, and proof-of-work matches the stated difficulty target
 // NOTE: this only checks if the block difficulty matches the difficulty target in the header, it does not check if the
 // target is correct for the block's height in the chain - use BRMerkleBlockVerifyDifficulty() for that
@@ -24,6 +24,7 @@
 
 #include "BRPeer.h"
 #include "BRMerkleBlock.h"
+#include "BRGCSFilter.h"
 #include "BRBase.h"
 #include "BRAddress.h"
 #include "BRSet.h"
@@ -39,14 +40,21 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <netdb.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <netinet/in.h>	
 #include <arpa/inet.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define REACTOR_USE_EPOLL 1
+#endif
+
 #define HEADER_LENGTH      24
 #define MAX_MSG_LENGTH     0x02000000
 #define MAX_GETDATA_HASHES 50000
+#define MAX_HEADERS        2000 // max headers in a headers message, and cfheaders hashes (BIP157)
 #define ENABLED_SERVICES   0ULL  // we don't provide full blocks to remote nodes
 #define PROTOCOL_VERSION   70013
 #define MIN_PROTO_VERSION  70002 // peers earlier than this protocol version not supported (need v0.9 txFee relay rules)
@@ -57,6 +65,17 @@
 
 #define PTHREAD_STACK_SIZE  (512 * 1024)
 
+#define REACTOR_WHEEL_SLOTS 64         // reactor timer wheel resolution is one second per slot
+#define REACTOR_MAX_EVENTS  64
+
+#define RECV_CHUNK_SIZE     0x10000    // bytes requested from the socket per read() call
+#define RECV_MAX_FRAMES     64         // complete messages checksummed together before being accepted
+#define SEND_MAX_BUFFERED   0x02000000 // outbound bytes a reactor peer may have waiting on a slow socket
+
+#define HEADERS_POOL_THREADS 3         // header validation threads shared by all peers, besides the peer's own thread
+#define HEADERS_POOL_CHUNK   128       // headers validated per claim
+#define HEADERS_POOL_MIN     512       // smaller headers messages are validated on the peer thread alone
+
 // the standard blockchain download protocol works as follows (for SPV mode):
 // - local peer sends getblocks
 // - remote peer reponds with inv containing up to 500 block hashes
@@ -95,6 +114,15 @@ typedef enum {
     inv_filtered_witness_block = inv_filtered_block | WITNESS_FLAG
 } inv_type;
 
+static const char *_peerMsgTypes[PEER_MSG_TYPES] = {
+    MSG_VERSION, MSG_VERACK, MSG_ADDR, MSG_INV, MSG_GETDATA, MSG_NOTFOUND, MSG_GETBLOCKS, MSG_GETHEADERS, MSG_TX,
+    MSG_BLOCK, MSG_HEADERS, MSG_GETADDR, MSG_MEMPOOL, MSG_PING, MSG_PONG, MSG_FILTERLOAD, MSG_FILTERADD,
+    MSG_FILTERCLEAR, MSG_MERKLEBLOCK, MSG_ALERT, MSG_REJECT, MSG_FEEFILTER, MSG_GETCFILTERS, MSG_CFILTER,
+    MSG_GETCFHEADERS, MSG_CFHEADERS, "other"
+};
+
+typedef struct BRPeerReactorLoopStruct BRPeerReactorLoop;
+
 typedef struct {
     BRPeer peer; // superstruct on top of BRPeer
     uint32_t magicNumber;
@@ -108,7 +136,7 @@ typedef struct {
     double startTime, pingTime;
     volatile double disconnectTime, mempoolTime;
     int sentVerack, gotVerack, sentGetaddr, sentFilter, sentGetdata, sentMempool, sentGetblocks;
-    UInt256 lastBlockHash;
+    UInt256 lastBlockHash, headersStop;
     BRMerkleBlock *currentBlock;
     UInt256 *currentBlockTxHashes, *knownBlockHashes, *knownTxHashes;
     BRSet *knownTxHashSet;
@@ -121,18 +149,38 @@ typedef struct {
     void (*hasTx)(void *info, UInt256 txHash);
     void (*rejectedTx)(void *info, UInt256 txHash, uint8_t code);
     void (*relayedBlock)(void *info, BRMerkleBlock *block);
+    int (*relayedBlockHashes)(void *info, const UInt256 blockHashes[], size_t blockCount);
+    int compactFilters; // BIP157 sync, set along with the compact filter callbacks
+    void (*relayedCFHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                             size_t count);
+    void (*relayedCFilter)(void *info, UInt256 blockHash, const uint8_t *filter, size_t filterLen);
+    void (*relayedFullBlock)(void *info, BRMerkleBlock *block, BRTransaction *txs[], size_t txCount);
     void (*notfound)(void *info, const UInt256 txHashes[], size_t txCount, const UInt256 blockHashes[],
                      size_t blockCount);
     void (*setFeePerKb)(void *info, uint64_t feePerKb);
     BRTransaction *(*requestedTx)(void *info, UInt256 txHash);
     int (*networkIsReachable)(void *info);
     void (*threadCleanup)(void *info);
+    void *recorderInfo;
+    void (*recordMessage)(void *info, const BRPeer *peer, int inbound, const uint8_t *frame, size_t frameLen);
+    void *transportInfo;
+    int (*openSocket)(void *info, const BRPeer *peer);
     void **volatile pongInfo;
     void (**volatile pongCallback)(void *info, int success);
     void *volatile mempoolInfo;
     void (*volatile mempoolCallback)(void *info, int success);
     pthread_t thread;
     pthread_mutex_t lock;
+    BRPeerReactor *reactor;
+    BRPeerReactorLoop *loop; // event loop serving the connection while attached to a reactor
+    volatile int disconnectRequested;
+    int connecting, wheelSlot, watchingOut, revents; // owned by the reactor loop
+    double msgTimeout, sendTimeout;
+    uint8_t *recvBuf; // receive buffer, messages are framed in place between recvOff and recvLen
+    size_t recvOff, recvLen, recvSize;
+    uint8_t *sendBuf; // reactor send buffer, bytes between sendOff and sendLen are waiting for the socket to drain
+    size_t sendOff, sendLen, sendSize;
+    BRPeerMsgCount received[PEER_MSG_TYPES], sent[PEER_MSG_TYPES];
 } BRPeerContext;
 
 void BRPeerSendVersionMessage(BRPeer *peer);
@@ -288,6 +336,7 @@ static int _BRPeerAcceptAddrMessage(BRPeer *peer, const uint8_t *msg, size_t msg
         peer_log(peer, "got addr with %zu address(es)", count);
 
         for (size_t i = 0; i < count; i++) {
+            p = BR_PEER_NONE;
             p.timestamp = UInt32GetLE(&msg[off]);
             off += sizeof(uint32_t);
             p.services = UInt64GetLE(&msg[off]);
@@ -359,7 +408,7 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
             r = 0;
         }
         else {
-            if (! ctx->sentFilter && ! ctx->sentGetblocks) blockCount = 0;
+            if (! ctx->sentFilter && ! ctx->sentGetblocks && ! ctx->compactFilters) blockCount = 0;
             if (blockCount == 1 && UInt256Eq(ctx->lastBlockHash, UInt256Get(blocks[0]))) blockCount = 0;
             if (blockCount == 1) ctx->lastBlockHash = UInt256Get(blocks[0]);
 
@@ -387,10 +436,17 @@ static int _BRPeerAcceptInvMessage(BRPeer *peer, const uint8_t *msg, size_t msgL
             }
             
             _BRPeerAddKnownTxHashes(peer, txHashes, j);
-            if (j > 0 || blockCount > 0) BRPeerSendGetdata(peer, txHashes, j, blockHashes, blockCount);
+
+            // the owner may fetch the blocks itself, spread across several peers
+            size_t getdataCount = blockCount;
+
+            if (blockCount > 0 && ctx->relayedBlockHashes &&
+                ctx->relayedBlockHashes(ctx->info, blockHashes, blockCount)) getdataCount = 0;
+
+            if (j > 0 || getdataCount > 0) BRPeerSendGetdata(peer, txHashes, j, blockHashes, getdataCount);
     
             // to improve chain download performance, if we received 500 block hashes, request the next 500 block hashes
-            if (blockCount >= 500) {
+            if (blockCount >= 500 && ! ctx->compactFilters) {
                 UInt256 locators[] = { blockHashes[blockCount - 1], blockHashes[0] };
             
                 BRPeerSendGetblocks(peer, locators, 2, UINT256_ZERO);
@@ -456,6 +512,119 @@ static int _BRPeerAcceptTxMessage(BRPeer *peer, const uint8_t *msg, size_t msgLe
     return r;
 }
 
+typedef struct BRHeadersJobStruct BRHeadersJob;
+
+struct BRHeadersJobStruct {
+    const uint8_t *headers; // count serialized headers of 81 bytes each
+    size_t count, claimed, done;
+    uint32_t now;
+    BRMerkleBlock **blocks; // parsed headers, NULL if malformed
+    uint8_t *valid; // true if proof-of-work, target and timestamp checks passed
+    BRHeadersJob *next;
+};
+
+static pthread_mutex_t _headersPoolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _headersPoolCond = PTHREAD_COND_INITIALIZER, _headersPoolDoneCond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t _headersPoolOnce = PTHREAD_ONCE_INIT;
+static BRHeadersJob *_headersPoolJobs = NULL; // jobs with headers left to claim, guarded by _headersPoolLock
+
+// claims the next run of headers from job, with _headersPoolLock held
+static size_t _BRHeadersJobClaim(BRHeadersJob *job, size_t *start)
+{
+    size_t end = (job->count - job->claimed > HEADERS_POOL_CHUNK) ? job->claimed + HEADERS_POOL_CHUNK : job->count;
+    BRHeadersJob **j = &_headersPoolJobs;
+
+    *start = job->claimed;
+    job->claimed = end;
+
+    if (job->claimed == job->count) { // nothing left to claim, take job off the list
+        while (*j && *j != job) j = &(*j)->next;
+        if (*j) *j = job->next;
+    }
+
+    return end;
+}
+
+// stateless header checks, safe to run on any thread
+static void _BRHeadersJobRun(BRHeadersJob *job, size_t start, size_t end)
+{
+    for (size_t i = start; i < end; i++) {
+        job->blocks[i] = BRMerkleBlockParse(&job->headers[81*i], 81);
+        job->valid[i] = (job->blocks[i] && BRMerkleBlockIsValid(job->blocks[i], job->now));
+    }
+}
+
+static void *_headersPoolRoutine(void *arg)
+{
+    size_t start, end;
+
+    pthread_mutex_lock(&_headersPoolLock);
+
+    for (;;) {
+        BRHeadersJob *job = _headersPoolJobs;
+
+        if (! job) {
+            pthread_cond_wait(&_headersPoolCond, &_headersPoolLock);
+            continue;
+        }
+
+        end = _BRHeadersJobClaim(job, &start);
+        pthread_mutex_unlock(&_headersPoolLock);
+        _BRHeadersJobRun(job, start, end);
+        pthread_mutex_lock(&_headersPoolLock);
+        job->done += end - start;
+        if (job->done == job->count) pthread_cond_broadcast(&_headersPoolDoneCond);
+    }
+
+    return NULL; // unreachable
+}
+
+static void _headersPoolStart(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    for (int i = 0; i < HEADERS_POOL_THREADS; i++) { // if a thread can't be created, the peer thread does the work
+        if (pthread_attr_init(&attr) != 0) break;
+
+        if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+            pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) != 0 ||
+            pthread_create(&thread, &attr, _headersPoolRoutine, NULL) != 0) i = HEADERS_POOL_THREADS;
+
+        pthread_attr_destroy(&attr);
+    }
+}
+
+// parses and checks count serialized headers, spreading large batches across the shared header validation threads
+static void _BRPeerValidateHeaders(const uint8_t *headers, size_t count, uint32_t now, BRMerkleBlock *blocks[],
+                                   uint8_t valid[])
+{
+    BRHeadersJob job = { headers, count, 0, 0, now, blocks, valid, NULL };
+    size_t start, end;
+
+    if (count < HEADERS_POOL_MIN) {
+        _BRHeadersJobRun(&job, 0, count);
+        return;
+    }
+
+    pthread_once(&_headersPoolOnce, _headersPoolStart);
+    pthread_mutex_lock(&_headersPoolLock);
+    job.next = _headersPoolJobs;
+    _headersPoolJobs = &job;
+    pthread_cond_broadcast(&_headersPoolCond);
+
+    while (job.claimed < job.count) { // the calling thread works on its own job too
+        end = _BRHeadersJobClaim(&job, &start);
+        pthread_mutex_unlock(&_headersPoolLock);
+        _BRHeadersJobRun(&job, start, end);
+        pthread_mutex_lock(&_headersPoolLock);
+        job.done += end - start;
+    }
+
+    while (job.done < job.count) pthread_cond_wait(&_headersPoolDoneCond, &_headersPoolLock);
+    pthread_mutex_unlock(&_headersPoolLock);
+}
+
 static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
@@ -467,22 +636,41 @@ static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t
                  BRVarIntSize(count) + 81*count, count);
         r = 0;
     }
+    else if (count > MAX_HEADERS) {
+        peer_log(peer, "non-standard headers message, %zu is too many headers, max is %d", count, MAX_HEADERS);
+        r = 0;
+    }
     else {
         peer_log(peer, "got %zu header(s)", count);
     
         // To improve chain download performance, if this message contains 2000 headers then request the next 2000
         // headers immediately, and switch to requesting blocks when we receive a header newer than earliestKeyTime
         uint32_t timestamp = (count > 0) ? UInt32GetLE(&msg[off + 81*(count - 1) + 68]) : 0;
+        UInt256 locators[2];
+        int stopped = 0;
+
+        // a getheaders request with a hashStop ends at that header, possibly with a short final message
+        if (count > 0 && ! UInt256IsZero(ctx->headersStop)) {
+            BRSHA256_2(&locators[0], &msg[off + 81*(count - 1)], 80);
+            stopped = UInt256Eq(locators[0], ctx->headersStop);
+        }
     
-        if (count >= 2000 || (timestamp > 0 && timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime)) {
+        if (count >= 2000 || stopped || (ctx->compactFilters && count > 0) ||
+            (timestamp > 0 && timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime)) {
             size_t last = 0;
             time_t now = time(NULL);
-            UInt256 locators[2];
             
             BRSHA256_2(&locators[0], &msg[off + 81*(count - 1)], 80);
             BRSHA256_2(&locators[1], &msg[off], 80);
 
-            if (timestamp > 0 && timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime) {
+            if (stopped) {
+                peer_log(peer, "reached headers hashStop: %s", u256hex(ctx->headersStop));
+                ctx->headersStop = UINT256_ZERO;
+            }
+            else if (ctx->compactFilters) { // headers continue to the chain tip, a short batch means we've reached it
+                if (count >= 2000) BRPeerSendGetheaders(peer, locators, 2, ctx->headersStop);
+            }
+            else if (timestamp > 0 && timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= ctx->earliestKeyTime) {
                 // request blocks for the remainder of the chain
                 timestamp = (++last < count) ? UInt32GetLE(&msg[off + 81*last + 68]) : 0;
 
@@ -493,27 +681,31 @@ static int _BRPeerAcceptHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t
                 BRSHA256_2(&locators[0], &msg[off + 81*(last - 1)], 80);
                 BRPeerSendGetblocks(peer, locators, 2, UINT256_ZERO);
             }
-            else BRPeerSendGetheaders(peer, locators, 2, UINT256_ZERO);
+            else BRPeerSendGetheaders(peer, locators, 2, ctx->headersStop);
 
-            for (size_t i = 0; r && i < count; i++) {
-                BRMerkleBlock *block = BRMerkleBlockParse(&msg[off + 81*i], 81);
-                
-                if (! block) {
+            BRMerkleBlock *blocks[count];
+            uint8_t valid[count];
+
+            _BRPeerValidateHeaders(&msg[off], count, (uint32_t)now, blocks, valid);
+
+            for (size_t i = 0; i < count; i++) {
+                if (r && ! blocks[i]) {
                     peer_log(peer, "malformed headers message with length: %zu", msgLen);
                     r = 0;
                 }
-                else if (! BRMerkleBlockIsValid(block, (uint32_t)now)) {
-                    peer_log(peer, "invalid block header: %s", u256hex(block->blockHash));
-                    BRMerkleBlockFree(block);
+                else if (r && ! valid[i]) {
+                    peer_log(peer, "invalid block header: %s", u256hex(blocks[i]->blockHash));
                     r = 0;
                 }
-                else if (ctx->relayedBlock) {
-                    ctx->relayedBlock(ctx->info, block);
+                else if (r && ctx->relayedBlock) {
+                    ctx->relayedBlock(ctx->info, blocks[i]);
+                    blocks[i] = NULL;
                 }
-                else BRMerkleBlockFree(block);
+
+                if (blocks[i]) BRMerkleBlockFree(blocks[i]);
             }
         }
-        else {
+        else if (! ctx->compactFilters) {
             peer_log(peer, "non-standard headers message, %zu is fewer header(s) than expected", count);
             r = 0;
         }
@@ -762,6 +954,122 @@ static int _BRPeerAcceptMerkleblockMessage(BRPeer *peer, const uint8_t *msg, siz
     return r;
 }
 
+static int _BRPeerAcceptBlockMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    BRMerkleBlock *block = BRMerkleBlockParse(msg, msgLen < 80 ? msgLen : 80);
+    size_t i, len, off = 80, count = (block) ? (size_t)BRVarInt(&msg[off], msgLen - off, &len) : 0;
+    BRTransaction **txs = NULL;
+    UInt256 *txHashes = NULL;
+    int r = 1;
+
+    off += (block) ? len : 0;
+
+    if (! block || len == 0 || count == 0 || count > (msgLen - off)/60) { // a tx is at least 60 bytes
+        peer_log(peer, "malformed block message with length: %zu", msgLen);
+        r = 0;
+    }
+    else if (! ctx->compactFilters) {
+        peer_log(peer, "dropping unrequested block message: %s", u256hex(block->blockHash));
+    }
+    else {
+        txs = calloc(count, sizeof(*txs));
+        txHashes = malloc(count*sizeof(*txHashes));
+        assert(txs != NULL);
+        assert(txHashes != NULL);
+
+        for (i = 0; r && i < count; i++) {
+            txs[i] = BRTransactionParse(&msg[off], msgLen - off);
+            len = (txs[i]) ? BRTransactionSerialize(txs[i], NULL, 0) : 0;
+
+            if (len == 0 || off + len > msgLen) {
+                peer_log(peer, "malformed block message, tx %zu of %zu", i, count);
+                r = 0;
+            }
+            else txHashes[i] = txs[i]->txHash, off += len;
+        }
+
+        // the block is kept with the complete list of tx hashes, so the merkle root can be checked as usual
+        if (r && (! UInt256Eq(BRMerkleBlockSetMatchedTxHashes(block, txHashes, NULL, count), block->merkleRoot) ||
+                  ! BRMerkleBlockIsValid(block, (uint32_t)time(NULL)))) {
+            peer_log(peer, "invalid block: %s", u256hex(block->blockHash));
+            r = 0;
+        }
+        else if (r) {
+            peer_log(peer, "got block %s with %zu tx", u256hex(block->blockHash), count);
+
+            if (ctx->relayedFullBlock) {
+                ctx->relayedFullBlock(ctx->info, block, txs, count);
+                block = NULL;
+                count = 0;
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            if (txs[i]) BRTransactionFree(txs[i]);
+        }
+
+        free(txHashes);
+        free(txs);
+    }
+
+    if (block) BRMerkleBlockFree(block);
+    return r;
+}
+
+// described in BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
+static int _BRPeerAcceptCFHeadersMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    size_t off = 1 + 2*sizeof(UInt256), len = 0,
+           count = (off < msgLen) ? (size_t)BRVarInt(&msg[off], msgLen - off, &len) : 0;
+    int r = 1;
+
+    if (len == 0 || off + len + count*sizeof(UInt256) > msgLen) {
+        peer_log(peer, "malformed cfheaders message, length is %zu, should be %zu for %zu hash(es)", msgLen,
+                 off + BRVarIntSize(count) + count*sizeof(UInt256), count);
+        r = 0;
+    }
+    else if (count > MAX_HEADERS) {
+        peer_log(peer, "non-standard cfheaders message, %zu is too many hashes, max is %d", count, MAX_HEADERS);
+        r = 0;
+    }
+    else if (msg[0] != GCS_FILTER_TYPE_BASIC) {
+        peer_log(peer, "dropping cfheaders message with unknown filter type: %d", msg[0]);
+    }
+    else {
+        UInt256 stopHash = UInt256Get(&msg[1]), prevHeader = UInt256Get(&msg[1 + sizeof(UInt256)]), hashes[count];
+
+        peer_log(peer, "got cfheaders with %zu hash(es)", count);
+        off += len;
+        for (size_t i = 0; i < count; i++) hashes[i] = UInt256Get(&msg[off + i*sizeof(UInt256)]);
+        if (ctx->relayedCFHeaders) ctx->relayedCFHeaders(ctx->info, stopHash, prevHeader, hashes, count);
+    }
+
+    return r;
+}
+
+static int _BRPeerAcceptCFilterMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    size_t off = 1 + sizeof(UInt256), len = 0,
+           filterLen = (off < msgLen) ? (size_t)BRVarInt(&msg[off], msgLen - off, &len) : 0;
+    int r = 1;
+
+    if (len == 0 || off + len + filterLen > msgLen) {
+        peer_log(peer, "malformed cfilter message with length: %zu", msgLen);
+        r = 0;
+    }
+    else if (msg[0] != GCS_FILTER_TYPE_BASIC) {
+        peer_log(peer, "dropping cfilter message with unknown filter type: %d", msg[0]);
+    }
+    else if (ctx->relayedCFilter) {
+        ctx->relayedCFilter(ctx->info, UInt256Get(&msg[1]), &msg[off + len], filterLen);
+    }
+
+    return r;
+}
+
 // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 static int _BRPeerAcceptRejectMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen)
 {
@@ -834,6 +1142,18 @@ static int _BRPeerAcceptFeeFilterMessage(BRPeer *peer, const uint8_t *msg, size_
     return r;
 }
 
+// tallies a message frame of frameLen bytes in counts by type
+static void _BRPeerCountMessage(BRPeerContext *ctx, BRPeerMsgCount counts[], const char *type, size_t frameLen)
+{
+    size_t i = 0;
+
+    while (i < PEER_MSG_TYPES - 1 && strncmp(_peerMsgTypes[i], type, 12) != 0) i++;
+    pthread_mutex_lock(&ctx->lock);
+    counts[i].count++;
+    counts[i].bytes += frameLen;
+    pthread_mutex_unlock(&ctx->lock);
+}
+
 static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
@@ -860,6 +1180,9 @@ static int _BRPeerAcceptMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen,
     else if (strncmp(MSG_MERKLEBLOCK, type, 12) == 0) r = _BRPeerAcceptMerkleblockMessage(peer, msg, msgLen);
     else if (strncmp(MSG_REJECT, type, 12) == 0) r = _BRPeerAcceptRejectMessage(peer, msg, msgLen);
     else if (strncmp(MSG_FEEFILTER, type, 12) == 0) r = _BRPeerAcceptFeeFilterMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_BLOCK, type, 12) == 0) r = _BRPeerAcceptBlockMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_CFHEADERS, type, 12) == 0) r = _BRPeerAcceptCFHeadersMessage(peer, msg, msgLen);
+    else if (strncmp(MSG_CFILTER, type, 12) == 0) r = _BRPeerAcceptCFilterMessage(peer, msg, msgLen);
     else peer_log(peer, "dropping %s, length %zu, not implemented", type, msgLen);
 
     return r;
@@ -876,7 +1199,8 @@ static int _BRPeerOpenSocket(BRPeer *peer, int domain, double timeout, int *erro
     int sock;
 
     pthread_mutex_lock(&ctx->lock);
-    sock = ctx->socket = socket(domain, SOCK_STREAM, 0);
+    if (ctx->openSocket) sock = ctx->socket = ctx->openSocket(ctx->transportInfo, peer);
+    else sock = ctx->socket = socket(domain, SOCK_STREAM, 0);
     pthread_mutex_unlock(&ctx->lock);
 
     if (sock < 0) {
@@ -897,7 +1221,11 @@ static int _BRPeerOpenSocket(BRPeer *peer, int domain, double timeout, int *erro
         if (! r) err = errno;
     }
 
-    if (r) {
+    if (r && ctx->openSocket) { // already connected by the transport
+        peer_log(peer, "socket connected");
+        fcntl(sock, F_SETFL, arg);
+    }
+    else if (r) {
         memset(&addr, 0, sizeof(addr));
         
         if (domain == PF_INET6) {
@@ -986,113 +1314,211 @@ static double _peerGetMempoolTime (BRPeerContext *ctx) {
 }
 
 
-static void *_peerThreadRoutine(void *arg)
-{
-    BRPeer *peer = arg;
-    BRPeerContext *ctx = arg;
-    int socket, error = 0;
+static double _peerGetTime (void) {
+    struct timeval tv;
 
-    pthread_cleanup_push(ctx->threadCleanup, ctx->info);
-    
-    if (_BRPeerOpenSocket(peer, PF_INET6, CONNECT_TIMEOUT, &error)) {
-        struct timeval tv;
-        double time = 0, msgTimeout;
-        uint8_t header[HEADER_LENGTH], *payload = malloc(0x1000);
-        size_t len = 0, payloadLen = 0x1000;
-        ssize_t n = 0;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec/1000000;
+}
 
-        assert(payload != NULL);
-        gettimeofday(&tv, NULL);
-        ctx->startTime = tv.tv_sec + (double)tv.tv_usec/1000000;
-        BRPeerSendVersionMessage(peer);
+static int _peerGetSendPending (BRPeerContext *ctx) {
+    int pending;
 
-        while (_peerCheckAndGetSocket(ctx, &socket) && ! error) {
-            len = 0;
-
-            while (socket >= 0 && ! error && len < HEADER_LENGTH) {
-                n = read(socket, &header[len], sizeof(header) - len);
-                if (n > 0) len += n;
-                if (n == 0) error = ECONNRESET;
-                if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                gettimeofday(&tv, NULL);
-                time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                if (! error && time >= _peerGetDisconnectTime(ctx)) error = ETIMEDOUT;
-
-                if (! error && time >= _peerGetMempoolTime(ctx)) {
-                    peer_log(peer, "done waiting for mempool response");
-                    BRPeerSendPing(peer, ctx->mempoolInfo, ctx->mempoolCallback);
-                    ctx->mempoolCallback = NULL;
-
-                    pthread_mutex_lock(&ctx->lock);
-                    ctx->mempoolTime = DBL_MAX;
-                    pthread_mutex_unlock(&ctx->lock);
-                }
+    pthread_mutex_lock(&ctx->lock);
+    pending = ctx->sendOff < ctx->sendLen;
+    pthread_mutex_unlock(&ctx->lock);
 
-                while (sizeof(uint32_t) <= len && UInt32GetLE(header) != ctx->magicNumber) {
-                    memmove(header, &header[1], --len); // consume one byte at a time until we find the magic number
-                }
+    return pending;
+}
+
+static double _peerGetSendTimeout (BRPeerContext *ctx) {
+    double value;
+
+    pthread_mutex_lock(&ctx->lock);
+    value = ctx->sendTimeout;
+    pthread_mutex_unlock(&ctx->lock);
 
-                socket = _peerGetSocket(ctx);
+    return value;
+}
+
+// returns ETIMEDOUT once the disconnect or message timeout has passed, and stops waiting for a mempool response once
+// the mempool timeout has passed
+static int _BRPeerCheckTimeouts(BRPeerContext *ctx, double now)
+{
+    if (now >= _peerGetDisconnectTime(ctx) || now >= ctx->msgTimeout) return ETIMEDOUT;
+    
+    if (now >= _peerGetMempoolTime(ctx)) {
+        peer_log(&ctx->peer, "done waiting for mempool response");
+        BRPeerSendPing(&ctx->peer, ctx->mempoolInfo, ctx->mempoolCallback);
+        ctx->mempoolCallback = NULL;
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->mempoolTime = DBL_MAX;
+        pthread_mutex_unlock(&ctx->lock);
+    }
+    
+    return 0;
+}
+
+// reads up to RECV_CHUNK_SIZE bytes from socket into the receive buffer, then verifies the checksums of all complete
+// messages in the buffer in one pass and accepts each of them in place, returns an errno.h code on failure
+static int _BRPeerReadMessages(BRPeerContext *ctx, int socket)
+{
+    BRPeer *peer = &ctx->peer;
+    size_t frames[RECV_MAX_FRAMES], off, count, i;
+    const uint8_t *header;
+    uint32_t msgLen;
+    UInt256 hash;
+    ssize_t n;
+    int error = 0;
+    
+    if (ctx->recvOff == ctx->recvLen) ctx->recvOff = ctx->recvLen = 0;
+    
+    if (ctx->recvSize - ctx->recvLen < RECV_CHUNK_SIZE) { // compact lazily, only when the tail runs out of room
+        if (ctx->recvOff > 0) memmove(ctx->recvBuf, &ctx->recvBuf[ctx->recvOff], ctx->recvLen - ctx->recvOff);
+        ctx->recvLen -= ctx->recvOff;
+        ctx->recvOff = 0;
+        
+        if (ctx->recvSize - ctx->recvLen < RECV_CHUNK_SIZE) {
+            ctx->recvSize = ctx->recvLen + RECV_CHUNK_SIZE;
+            ctx->recvBuf = realloc(ctx->recvBuf, ctx->recvSize);
+            assert(ctx->recvBuf != NULL);
+        }
+    }
+    
+    n = read(socket, &ctx->recvBuf[ctx->recvLen], RECV_CHUNK_SIZE);
+    if (n > 0) ctx->recvLen += n;
+    if (n == 0) error = ECONNRESET;
+    if (n < 0 && errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR) error = errno;
+    
+    do {
+        for (count = 0, off = ctx->recvOff; ! error && count < RECV_MAX_FRAMES; off += HEADER_LENGTH + msgLen) {
+            while (off + sizeof(uint32_t) <= ctx->recvLen && UInt32GetLE(&ctx->recvBuf[off]) != ctx->magicNumber) {
+                off++; // consume one byte at a time until we find the magic number
             }
             
-            if (error) {
-                peer_log(peer, "%s", strerror(error));
-            }
-            else if (header[15] != 0) { // verify header type field is NULL terminated
+            if (count == 0) ctx->recvOff = off;
+            if (ctx->recvLen - off < HEADER_LENGTH) break;
+            header = &ctx->recvBuf[off];
+            msgLen = UInt32GetLE(&header[16]);
+            
+            if (header[15] != 0) { // verify header type field is NULL terminated
                 peer_log(peer, "malformed message header: type not NULL terminated");
                 error = EPROTO;
             }
-            else if (len == HEADER_LENGTH) {
-                const char *type = (const char *)(&header[4]);
-                uint32_t msgLen = UInt32GetLE(&header[16]);
-                uint32_t checksum = UInt32GetLE(&header[20]);
-                UInt256 hash;
-                
-                if (msgLen > MAX_MSG_LENGTH) { // check message length
-                    peer_log(peer, "error reading %s, message length %"PRIu32" is too long", type, msgLen);
-                    error = EPROTO;
-                }
-                else {
-                    if (msgLen > payloadLen) payload = realloc(payload, (payloadLen = msgLen));
-                    assert(payload != NULL);
-                    len = 0;
-                    socket = _peerGetSocket(ctx);
-                    msgTimeout = time + MESSAGE_TIMEOUT;
-                    
-                    while (socket >= 0 && ! error && len < msgLen) {
-                        n = read(socket, &payload[len], msgLen - len);
-                        if (n > 0) len += n;
-                        if (n == 0) error = ECONNRESET;
-                        if (n < 0 && errno != EWOULDBLOCK) error = errno;
-                        gettimeofday(&tv, NULL);
-                        time = tv.tv_sec + (double)tv.tv_usec/1000000;
-                        if (n > 0) msgTimeout = time + MESSAGE_TIMEOUT;
-                        if (! error && time >= msgTimeout) error = ETIMEDOUT;
-                        socket = _peerGetSocket(ctx);
-                    }
-                    
-                    if (error) {
-                        peer_log(peer, "%s", strerror(error));
-                    }
-                    else if (len == msgLen) {
-                        BRSHA256_2(&hash, payload, msgLen);
-                        
-                        if (UInt32GetLE(&hash) != checksum) { // verify checksum
-                            peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
-                                     ", SHA256_2:%s", type, UInt32GetLE(&hash), checksum, msgLen, u256hex(hash));
-                            error = EPROTO;
-                        }
-                        else if (! _BRPeerAcceptMessage(peer, payload, msgLen, type)) error = EPROTO;
-                    }
-                }
+            else if (msgLen > MAX_MSG_LENGTH) { // check message length
+                peer_log(peer, "error reading %s, message length %"PRIu32" is too long", (const char *)&header[4], msgLen);
+                error = EPROTO;
             }
+            else if (ctx->recvLen - off - HEADER_LENGTH < msgLen) break; // wait for the rest of the payload
+            else frames[count++] = off;
+        }
+        
+        for (i = 0; i < count; i++) { // verify checksums before handing any of the messages off
+            header = &ctx->recvBuf[frames[i]];
+            msgLen = UInt32GetLE(&header[16]);
+            BRSHA256_2(&hash, &header[HEADER_LENGTH], msgLen);
+            if (UInt32GetLE(&hash) != UInt32GetLE(&header[20])) break;
+        }
+        
+        if (i < count) { // everything framed ahead of the bad message is still accepted below
+            peer_log(peer, "error reading %s, invalid checksum %x, expected %x, payload length:%"PRIu32
+                     ", SHA256_2:%s", (const char *)&header[4], UInt32GetLE(&hash), UInt32GetLE(&header[20]), msgLen, u256hex(hash));
+            count = i;
+            error = EPROTO;
         }
         
-        free(payload);
+        for (i = 0; i < count; i++) {
+            header = &ctx->recvBuf[frames[i]];
+            msgLen = UInt32GetLE(&header[16]);
+            ctx->recvOff = frames[i] + HEADER_LENGTH + msgLen;
+            if (ctx->recordMessage) ctx->recordMessage(ctx->recorderInfo, peer, 1, header, HEADER_LENGTH + msgLen);
+            _BRPeerCountMessage(ctx, ctx->received, (const char *)&header[4], HEADER_LENGTH + msgLen);
+            
+            if (! _BRPeerAcceptMessage(peer, &header[HEADER_LENGTH], msgLen, (const char *)&header[4])) {
+                error = EPROTO;
+                break;
+            }
+        }
+    } while (! error && count == RECV_MAX_FRAMES);
+
+    if (ctx->recvLen - ctx->recvOff < HEADER_LENGTH) ctx->msgTimeout = DBL_MAX;
+    else if (n > 0 || ctx->msgTimeout == DBL_MAX) { // partial message, time out if the rest doesn't arrive in time
+        ctx->msgTimeout = _peerGetTime() + MESSAGE_TIMEOUT;
+    }
+    
+    if (ctx->recvOff == ctx->recvLen && ctx->recvSize > RECV_CHUNK_SIZE*4) { // release buffer grown for a large message
+        ctx->recvOff = ctx->recvLen = 0;
+        ctx->recvSize = RECV_CHUNK_SIZE;
+        ctx->recvBuf = realloc(ctx->recvBuf, ctx->recvSize);
+        assert(ctx->recvBuf != NULL);
     }
+    
+    return error;
+}
+
+// appends msgLen bytes of msg to the send buffer of a peer served by a reactor, then writes as much of the buffer as
+// the non-blocking socket takes without waiting, must be called with ctx->lock held, returns an errno.h code on failure
+static int _BRPeerSendBuffered(BRPeerContext *ctx, const uint8_t *msg, size_t msgLen)
+{
+    size_t pending = ctx->sendLen - ctx->sendOff;
+    ssize_t n;
+
+    if (ctx->socket < 0) return ENOTCONN;
+    if (pending > 0 && pending + msgLen > SEND_MAX_BUFFERED) return ENOBUFS;
+    
+    if (msgLen > 0 && ctx->sendLen + msgLen > ctx->sendSize) {
+        if (pending > 0) memmove(ctx->sendBuf, &ctx->sendBuf[ctx->sendOff], pending);
+        ctx->sendOff = 0;
+        ctx->sendLen = pending;
+        
+        if (pending + msgLen > ctx->sendSize) {
+            ctx->sendSize = (pending + msgLen > RECV_CHUNK_SIZE) ? pending + msgLen : RECV_CHUNK_SIZE;
+            ctx->sendBuf = realloc(ctx->sendBuf, ctx->sendSize);
+            assert(ctx->sendBuf != NULL);
+        }
+    }
+    
+    if (msgLen > 0) memcpy(&ctx->sendBuf[ctx->sendLen], msg, msgLen);
+    ctx->sendLen += msgLen;
+    if (pending == 0 && msgLen > 0) ctx->sendTimeout = _peerGetTime() + MESSAGE_TIMEOUT;
+    
+    while (ctx->sendOff < ctx->sendLen) {
+        n = send(ctx->socket, &ctx->sendBuf[ctx->sendOff], ctx->sendLen - ctx->sendOff, MSG_NOSIGNAL);
+        
+        if (n > 0) { // time out if the socket stops draining, not if the peer is merely slow
+            ctx->sendOff += n;
+            ctx->sendTimeout = _peerGetTime() + MESSAGE_TIMEOUT;
+        }
+        else if (n < 0 && errno == EINTR) continue;
+        else if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) break;
+        else return (n < 0) ? errno : EPIPE;
+    }
+    
+    if (ctx->sendOff == ctx->sendLen) {
+        ctx->sendOff = ctx->sendLen = 0;
+        ctx->sendTimeout = DBL_MAX;
+        
+        if (ctx->sendSize > RECV_CHUNK_SIZE*4) { // release buffer grown for a backlog
+            free(ctx->sendBuf);
+            ctx->sendBuf = NULL;
+            ctx->sendSize = 0;
+        }
+    }
+    
+    return 0;
+}
+
+// closes the socket and notifies pending ping/mempool callbacks and the disconnected callback, after which the peer
+// may already have been freed
+static void _BRPeerDidDisconnect(BRPeer *peer, int error)
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    int socket;
 
     pthread_mutex_lock(&ctx->lock);
     socket = ctx->socket;
+    ctx->socket = -1;
     ctx->status = BRPeerStatusDisconnected;
     pthread_mutex_unlock(&ctx->lock);
 
@@ -1111,6 +1537,31 @@ static void *_peerThreadRoutine(void *arg)
     if (ctx->mempoolCallback) ctx->mempoolCallback(ctx->mempoolInfo, 0);
     ctx->mempoolCallback = NULL;
     if (ctx->disconnected) ctx->disconnected(ctx->info, error);
+}
+
+static void *_peerThreadRoutine(void *arg)
+{
+    BRPeer *peer = arg;
+    BRPeerContext *ctx = arg;
+    int socket, error = 0;
+
+    pthread_cleanup_push(ctx->threadCleanup, ctx->info);
+    
+    if (_BRPeerOpenSocket(peer, PF_INET6, CONNECT_TIMEOUT, &error)) {
+        ctx->startTime = _peerGetTime();
+        ctx->msgTimeout = DBL_MAX;
+        ctx->recvOff = ctx->recvLen = 0;
+        BRPeerSendVersionMessage(peer);
+
+        while (_peerCheckAndGetSocket(ctx, &socket) && ! error) {
+            error = _BRPeerReadMessages(ctx, socket);
+            if (! error) error = _BRPeerCheckTimeouts(ctx, _peerGetTime());
+        }
+        
+        if (error) peer_log(peer, "%s", strerror(error));
+    }
+
+    _BRPeerDidDisconnect(peer, error);
     pthread_cleanup_pop(1);
     return NULL; // detached threads don't need to return a value
 }
@@ -1119,6 +1570,471 @@ static void _dummyThreadCleanup(void *info)
 {
 }
 
+struct BRPeerReactorLoopStruct {
+    BRPeerReactor *reactor;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    int pollFd, wakeFds[2];
+    BRPeerContext **pending; // peers with a connect, reschedule or disconnect request, guarded by lock
+    BRPeerContext **peers, **ready, **requests, **expired; // only accessed from the loop thread
+    BRPeerContext **wheel[REACTOR_WHEEL_SLOTS]; // each peer sits in the slot of the second its next timeout is due
+    time_t wheelTime; // last second processed by the timer wheel
+    volatile int running;
+};
+
+struct BRPeerReactorStruct {
+    BRPeerReactorLoop *loops;
+    size_t loopCount, next;
+    pthread_mutex_t lock;
+    void *info;
+    void (*threadCleanup)(void *info);
+};
+
+static BRPeerReactor *_defaultReactor = NULL;
+
+// queues peer to be (re)evaluated by its event loop, and wakes the loop up
+static void _BRPeerReactorRequest(BRPeerContext *ctx)
+{
+    BRPeerReactorLoop *loop;
+    uint8_t b = 0;
+    size_t i;
+
+    pthread_mutex_lock(&ctx->lock);
+    loop = ctx->loop;
+    
+    if (loop) {
+        pthread_mutex_lock(&loop->lock);
+        for (i = array_count(loop->pending); i > 0 && loop->pending[i - 1] != ctx; i--);
+        if (i == 0) array_add(loop->pending, ctx);
+        pthread_mutex_unlock(&loop->lock);
+        if (write(loop->wakeFds[1], &b, sizeof(b)) < 0 && errno != EAGAIN) peer_log(&ctx->peer, "%s", strerror(errno));
+    }
+    
+    pthread_mutex_unlock(&ctx->lock);
+}
+
+// registers the peer's socket with the loop for write readiness while connecting and read readiness afterwards, along
+// with write readiness while the send buffer holds data, returns an errno.h code on failure
+static int _BRPeerReactorWatch(BRPeerReactorLoop *loop, BRPeerContext *ctx, int modify)
+{
+    ctx->watchingOut = (! ctx->connecting && _peerGetSendPending(ctx));
+#if defined(REACTOR_USE_EPOLL)
+    struct epoll_event ev;
+    
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (ctx->connecting) ? EPOLLOUT : (ctx->watchingOut) ? EPOLLIN | EPOLLOUT : EPOLLIN;
+    ev.data.ptr = ctx;
+    if (epoll_ctl(loop->pollFd, (modify) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, _peerGetSocket(ctx), &ev) < 0) return errno;
+    return 0;
+#else
+    return 0; // the poll() set is rebuilt from loop->peers on every pass
+#endif
+}
+
+// watches for write readiness only while there's buffered data to send, returns an errno.h code on failure
+static int _BRPeerReactorRewatch(BRPeerReactorLoop *loop, BRPeerContext *ctx)
+{
+    if (ctx->connecting || _peerGetSendPending(ctx) == ctx->watchingOut) return 0;
+    return _BRPeerReactorWatch(loop, ctx, 1);
+}
+
+// returns ETIMEDOUT if a timeout has passed or the send buffer has stopped draining, ECONNRESET if a disconnect has
+// been requested
+static int _BRPeerReactorCheckTimeouts(BRPeerContext *ctx, double now)
+{
+    int error = (ctx->disconnectRequested) ? ECONNRESET : _BRPeerCheckTimeouts(ctx, now);
+    
+    if (! error && now >= _peerGetSendTimeout(ctx)) {
+        peer_log(&ctx->peer, "send timeout");
+        error = ETIMEDOUT;
+    }
+    
+    return error;
+}
+
+static void _BRPeerReactorUnschedule(BRPeerReactorLoop *loop, BRPeerContext *ctx)
+{
+    BRPeerContext **slot;
+    
+    if (ctx->wheelSlot >= 0) {
+        slot = loop->wheel[ctx->wheelSlot];
+        
+        for (size_t i = array_count(slot); i > 0; i--) {
+            if (slot[i - 1] == ctx) array_rm(slot, i - 1);
+        }
+        
+        loop->wheel[ctx->wheelSlot] = slot;
+        ctx->wheelSlot = -1;
+    }
+}
+
+// moves peer to the wheel slot of the earliest of its disconnect, mempool and message timeouts, timeouts beyond the
+// wheel horizon park in the slot processed last and are re-evaluated once the wheel has turned
+static void _BRPeerReactorSchedule(BRPeerReactorLoop *loop, BRPeerContext *ctx)
+{
+    double deadline = _peerGetDisconnectTime(ctx), mempoolTime = _peerGetMempoolTime(ctx);
+    time_t t;
+    int slot;
+
+    if (mempoolTime < deadline) deadline = mempoolTime;
+    if (ctx->msgTimeout < deadline) deadline = ctx->msgTimeout;
+    if (_peerGetSendTimeout(ctx) < deadline) deadline = _peerGetSendTimeout(ctx);
+    t = (deadline < loop->wheelTime + REACTOR_WHEEL_SLOTS) ? (time_t)deadline + 1 : loop->wheelTime + REACTOR_WHEEL_SLOTS;
+    if (t <= loop->wheelTime) t = loop->wheelTime + 1;
+    slot = (int)(t % REACTOR_WHEEL_SLOTS);
+
+    if (slot != ctx->wheelSlot) {
+        _BRPeerReactorUnschedule(loop, ctx);
+        array_add(loop->wheel[slot], ctx);
+        ctx->wheelSlot = slot;
+    }
+}
+
+// tears down the connection from the loop thread, callbacks are made in the same order as by _peerThreadRoutine(), but
+// for threadCleanup(), which the loop thread calls when it exits rather than after each connection
+static void _BRPeerReactorFinish(BRPeerReactorLoop *loop, BRPeerContext *ctx, int error)
+{
+    if (error) peer_log(&ctx->peer, "%s", strerror(error));
+    _BRPeerReactorUnschedule(loop, ctx);
+    
+    for (size_t i = array_count(loop->peers); i > 0; i--) {
+        if (loop->peers[i - 1] == ctx) array_rm(loop->peers, i - 1);
+    }
+
+#if defined(REACTOR_USE_EPOLL)
+    if (_peerGetSocket(ctx) >= 0) epoll_ctl(loop->pollFd, EPOLL_CTL_DEL, _peerGetSocket(ctx), NULL);
+#endif
+    pthread_mutex_lock(&ctx->lock);
+    ctx->loop = NULL;
+    ctx->sendOff = ctx->sendLen = 0; // unsent data is dropped along with the connection
+    ctx->sendTimeout = DBL_MAX;
+    pthread_mutex_unlock(&ctx->lock);
+    pthread_mutex_lock(&loop->lock);
+    
+    for (size_t i = array_count(loop->pending); i > 0; i--) {
+        if (loop->pending[i - 1] == ctx) array_rm(loop->pending, i - 1);
+    }
+    
+    pthread_mutex_unlock(&loop->lock);
+    _BRPeerDidDisconnect(&ctx->peer, error);
+}
+
+static void _BRPeerReactorHandleEvent(BRPeerReactorLoop *loop, BRPeerContext *ctx, double now)
+{
+    socklen_t optLen = sizeof(int);
+    int error = 0;
+
+    if (ctx->disconnectRequested) {
+        error = ECONNRESET;
+    }
+    else if (ctx->connecting) { // non-blocking connect completed
+        if (getsockopt(_peerGetSocket(ctx), SOL_SOCKET, SO_ERROR, &error, &optLen) < 0) error = errno;
+        
+        if (error) {
+            peer_log(&ctx->peer, "connect error: %s", strerror(error));
+        }
+        else {
+            peer_log(&ctx->peer, "socket connected");
+            ctx->connecting = 0;
+            ctx->startTime = now;
+            error = _BRPeerReactorWatch(loop, ctx, 1);
+            if (! error) BRPeerSendVersionMessage(&ctx->peer);
+        }
+    }
+    else {
+        if (ctx->revents & POLLOUT) { // socket drained, send what's been buffered since
+            pthread_mutex_lock(&ctx->lock);
+            error = _BRPeerSendBuffered(ctx, NULL, 0);
+            pthread_mutex_unlock(&ctx->lock);
+        }
+        
+        if (! error && (ctx->revents & POLLIN)) error = _BRPeerReadMessages(ctx, _peerGetSocket(ctx));
+    }
+
+    if (! error && ctx->disconnectRequested) error = ECONNRESET;
+    if (! error) error = _BRPeerReactorRewatch(loop, ctx);
+    if (error) _BRPeerReactorFinish(loop, ctx, error);
+    else _BRPeerReactorSchedule(loop, ctx);
+}
+
+static void *_peerReactorLoopRoutine(void *arg)
+{
+    BRPeerReactorLoop *loop = arg;
+    BRPeerContext *ctx, **swap;
+    uint8_t drain[64];
+    double now;
+    size_t i;
+    int count, timeout;
+#if defined(REACTOR_USE_EPOLL)
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+#else
+    struct pollfd *fds;
+    
+    array_new(fds, REACTOR_MAX_EVENTS);
+#endif
+
+    pthread_cleanup_push(loop->reactor->threadCleanup, loop->reactor->info);
+    loop->wheelTime = (time_t)_peerGetTime();
+
+    while (loop->running) {
+        now = _peerGetTime();
+        timeout = (int)((loop->wheelTime + 1 - now)*1000) + 1; // wake up for the next wheel slot
+        if (timeout < 0) timeout = 0;
+        array_clear(loop->ready);
+#if defined(REACTOR_USE_EPOLL)
+        count = epoll_wait(loop->pollFd, events, REACTOR_MAX_EVENTS, timeout);
+        
+        for (int j = 0; j < count; j++) {
+            ctx = events[j].data.ptr;
+            
+            if (ctx) { // errors and hangups are surfaced by the next read
+                ctx->revents = ((events[j].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) ? POLLIN : 0) |
+                               ((events[j].events & EPOLLOUT) ? POLLOUT : 0);
+                array_add(loop->ready, ctx);
+            }
+            else while (read(loop->wakeFds[0], drain, sizeof(drain)) > 0);
+        }
+#else
+        array_set_count(fds, array_count(loop->peers) + 1);
+        fds[0].fd = loop->wakeFds[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        
+        for (i = 0; i < array_count(loop->peers); i++) {
+            fds[i + 1].fd = _peerGetSocket(loop->peers[i]);
+            fds[i + 1].events = (loop->peers[i]->connecting) ? POLLOUT :
+                                (loop->peers[i]->watchingOut) ? POLLIN | POLLOUT : POLLIN;
+            fds[i + 1].revents = 0;
+        }
+        
+        count = poll(fds, (nfds_t)array_count(fds), timeout);
+        if (count > 0 && fds[0].revents) while (read(loop->wakeFds[0], drain, sizeof(drain)) > 0);
+        
+        for (i = 1; count > 0 && i < array_count(fds); i++) {
+            if (! fds[i].revents) continue;
+            loop->peers[i - 1]->revents = ((fds[i].revents & (POLLIN | POLLERR | POLLHUP)) ? POLLIN : 0) |
+                                          ((fds[i].revents & POLLOUT) ? POLLOUT : 0);
+            array_add(loop->ready, loop->peers[i - 1]);
+        }
+#endif
+        now = _peerGetTime();
+        
+        for (i = 0; i < array_count(loop->ready); i++) {
+            _BRPeerReactorHandleEvent(loop, loop->ready[i], now);
+        }
+        
+        pthread_mutex_lock(&loop->lock);
+        swap = loop->requests, loop->requests = loop->pending, loop->pending = swap;
+        array_clear(loop->pending);
+        pthread_mutex_unlock(&loop->lock);
+        
+        for (i = 0; i < array_count(loop->requests); i++) {
+            ctx = loop->requests[i];
+            
+            if (ctx->wheelSlot < 0) { // newly connecting peer, every attached peer sits in a wheel slot
+                array_add(loop->peers, ctx);
+                count = _BRPeerReactorWatch(loop, ctx, 0);
+                if (count) _BRPeerReactorFinish(loop, ctx, count);
+                else _BRPeerReactorSchedule(loop, ctx);
+            }
+            else if (ctx->disconnectRequested) _BRPeerReactorFinish(loop, ctx, ECONNRESET);
+            else if ((count = _BRPeerReactorRewatch(loop, ctx))) _BRPeerReactorFinish(loop, ctx, count);
+            else _BRPeerReactorSchedule(loop, ctx);
+        }
+        
+        array_clear(loop->requests);
+        if ((time_t)now - loop->wheelTime > REACTOR_WHEEL_SLOTS) loop->wheelTime = (time_t)now - REACTOR_WHEEL_SLOTS;
+        
+        while (loop->wheelTime < (time_t)now) {
+            swap = loop->expired;
+            loop->expired = loop->wheel[++loop->wheelTime % REACTOR_WHEEL_SLOTS];
+            loop->wheel[loop->wheelTime % REACTOR_WHEEL_SLOTS] = swap;
+            
+            for (i = 0; i < array_count(loop->expired); i++) {
+                ctx = loop->expired[i];
+                ctx->wheelSlot = -1;
+                count = _BRPeerReactorCheckTimeouts(ctx, now);
+                if (count) _BRPeerReactorFinish(loop, ctx, count);
+                else _BRPeerReactorSchedule(loop, ctx);
+            }
+            
+            array_clear(loop->expired);
+        }
+    }
+
+#if ! defined(REACTOR_USE_EPOLL)
+    array_free(fds);
+#endif
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+// returns a newly allocated reactor running threadCount event loops, which must be freed by calling BRPeerReactorFree()
+// threadCleanup(info) is called by each event loop thread before it exits, may be NULL
+BRPeerReactor *BRPeerReactorNew(size_t threadCount, void *info, void (*threadCleanup)(void *info))
+{
+    BRPeerReactor *reactor = calloc(1, sizeof(*reactor));
+    BRPeerReactorLoop *loop;
+    pthread_attr_t attr;
+    int r = 1;
+    
+    assert(reactor != NULL);
+    assert(threadCount > 0);
+    reactor->loopCount = threadCount;
+    reactor->loops = calloc(threadCount, sizeof(*reactor->loops));
+    assert(reactor->loops != NULL);
+    pthread_mutex_init(&reactor->lock, NULL);
+    reactor->info = info;
+    reactor->threadCleanup = (threadCleanup) ? threadCleanup : _dummyThreadCleanup;
+
+    for (size_t i = 0; r && i < threadCount; i++) {
+        loop = &reactor->loops[i];
+        loop->reactor = reactor;
+        loop->running = 1;
+        pthread_mutex_init(&loop->lock, NULL);
+        array_new(loop->pending, 10);
+        array_new(loop->peers, 10);
+        array_new(loop->ready, REACTOR_MAX_EVENTS);
+        array_new(loop->requests, 10);
+        array_new(loop->expired, 10);
+        for (size_t j = 0; j < REACTOR_WHEEL_SLOTS; j++) array_new(loop->wheel[j], 10);
+#if defined(REACTOR_USE_EPOLL)
+        loop->pollFd = epoll_create1(EPOLL_CLOEXEC);
+#else
+        loop->pollFd = -1;
+#endif
+        if (pipe(loop->wakeFds) < 0) r = 0, loop->wakeFds[0] = loop->wakeFds[1] = -1;
+        
+        if (r) {
+            fcntl(loop->wakeFds[0], F_SETFL, fcntl(loop->wakeFds[0], F_GETFL, NULL) | O_NONBLOCK);
+            fcntl(loop->wakeFds[1], F_SETFL, fcntl(loop->wakeFds[1], F_GETFL, NULL) | O_NONBLOCK);
+        }
+#if defined(REACTOR_USE_EPOLL)
+        if (r && loop->pollFd >= 0) {
+            struct epoll_event ev;
+            
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL; // wake pipe
+            if (epoll_ctl(loop->pollFd, EPOLL_CTL_ADD, loop->wakeFds[0], &ev) < 0) r = 0;
+        }
+        else r = 0;
+#endif
+        if (r && (pthread_attr_init(&attr) != 0 || pthread_attr_setstacksize(&attr, PTHREAD_STACK_SIZE) != 0 ||
+                  pthread_create(&loop->thread, &attr, _peerReactorLoopRoutine, loop) != 0)) r = 0;
+        if (r) pthread_attr_destroy(&attr);
+        if (! r) loop->running = 0, reactor->loopCount = i + 1;
+    }
+    
+    if (! r) {
+        _peer_log("BRPeerReactorNew: error creating event loop: %s", strerror(errno));
+        BRPeerReactorFree(reactor);
+        reactor = NULL;
+    }
+    
+    return reactor;
+}
+
+// stops the event loops, all peers using the reactor must be disconnected first
+void BRPeerReactorFree(BRPeerReactor *reactor)
+{
+    BRPeerReactorLoop *loop;
+    uint8_t b = 0;
+    
+    assert(reactor != NULL);
+    if (_defaultReactor == reactor) _defaultReactor = NULL;
+    
+    for (size_t i = 0; i < reactor->loopCount; i++) {
+        loop = &reactor->loops[i];
+        
+        if (loop->running) {
+            loop->running = 0;
+            if (write(loop->wakeFds[1], &b, sizeof(b)) < 0) _peer_log("BRPeerReactorFree: %s", strerror(errno));
+            pthread_join(loop->thread, NULL);
+        }
+        
+        assert(array_count(loop->peers) == 0);
+        if (loop->pollFd >= 0) close(loop->pollFd);
+        if (loop->wakeFds[0] >= 0) close(loop->wakeFds[0]);
+        if (loop->wakeFds[1] >= 0) close(loop->wakeFds[1]);
+        for (size_t j = 0; j < REACTOR_WHEEL_SLOTS; j++) array_free(loop->wheel[j]);
+        array_free(loop->expired);
+        array_free(loop->requests);
+        array_free(loop->ready);
+        array_free(loop->peers);
+        array_free(loop->pending);
+        pthread_mutex_destroy(&loop->lock);
+    }
+    
+    pthread_mutex_destroy(&reactor->lock);
+    free(reactor->loops);
+    free(reactor);
+}
+
+// reactor used by peers that haven't been given one with BRPeerSetReactor(), NULL selects thread-per-peer (default)
+void BRPeerSetDefaultReactor(BRPeerReactor *reactor)
+{
+    _defaultReactor = reactor;
+}
+
+BRPeerReactor *BRPeerDefaultReactor(void)
+{
+    return _defaultReactor;
+}
+
+// creates a non-blocking socket, starts connecting and hands the peer over to the least recently chosen event loop,
+// returns an errno.h code on failure
+static int _BRPeerReactorConnect(BRPeerContext *ctx, BRPeerReactor *reactor)
+{
+    BRPeer *peer = &ctx->peer;
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    int sock, err = 0, on = 1, domain = (_BRPeerIsIPv4(peer)) ? PF_INET : PF_INET6;
+    
+    memset(&addr, 0, sizeof(addr));
+    sock = (ctx->openSocket) ? ctx->openSocket(ctx->transportInfo, peer) : socket(domain, SOCK_STREAM, 0);
+    if (sock < 0) return errno;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE // BSD based systems have a SO_NOSIGPIPE socket option to supress SIGPIPE signals
+    setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    if (fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, NULL) | O_NONBLOCK) < 0) err = errno;
+
+    if (domain == PF_INET6) {
+        ((struct sockaddr_in6 *)&addr)->sin6_family = AF_INET6;
+        ((struct sockaddr_in6 *)&addr)->sin6_addr = *(struct in6_addr *)&peer->address;
+        ((struct sockaddr_in6 *)&addr)->sin6_port = htons(peer->port);
+        addrLen = sizeof(struct sockaddr_in6);
+    }
+    else {
+        ((struct sockaddr_in *)&addr)->sin_family = AF_INET;
+        ((struct sockaddr_in *)&addr)->sin_addr = *(struct in_addr *)&peer->address.u32[3];
+        ((struct sockaddr_in *)&addr)->sin_port = htons(peer->port);
+        addrLen = sizeof(struct sockaddr_in);
+    }
+
+    if (! err && ! ctx->openSocket && connect(sock, (struct sockaddr *)&addr, addrLen) < 0 && errno != EINPROGRESS) {
+        err = errno;
+    }
+    
+    if (err) {
+        close(sock);
+        return err;
+    }
+
+    pthread_mutex_lock(&reactor->lock);
+    ctx->loop = &reactor->loops[reactor->next++ % reactor->loopCount];
+    pthread_mutex_unlock(&reactor->lock);
+    ctx->socket = sock;
+    ctx->connecting = 1;
+    ctx->wheelSlot = -1;
+    ctx->disconnectRequested = 0;
+    ctx->msgTimeout = ctx->sendTimeout = DBL_MAX;
+    ctx->recvOff = ctx->recvLen = 0;
+    ctx->sendOff = ctx->sendLen = 0;
+    return 0;
+}
+
 // returns a newly allocated BRPeer struct that must be freed by calling BRPeerFree()
 BRPeer *BRPeerNew(uint32_t magicNumber)
 {
@@ -1137,6 +2053,9 @@ BRPeer *BRPeerNew(uint32_t magicNumber)
     ctx->mempoolTime = DBL_MAX;
     ctx->disconnectTime = DBL_MAX;
     ctx->socket = -1;
+    ctx->wheelSlot = -1;
+    ctx->msgTimeout = DBL_MAX;
+    ctx->sendTimeout = DBL_MAX;
     ctx->threadCleanup = _dummyThreadCleanup;
 
     {
@@ -1150,6 +2069,12 @@ BRPeer *BRPeerNew(uint32_t magicNumber)
     return &ctx->peer;
 }
 
+// serve the peer's connection from reactor instead of a dedicated thread, call before BRPeerConnect()
+void BRPeerSetReactor(BRPeer *peer, BRPeerReactor *reactor)
+{
+    ((BRPeerContext *)peer)->reactor = reactor;
+}
+
 // info is a void pointer that will be passed along with each callback call
 // void connected(void *) - called when peer handshake completes successfully
 // void disconnected(void *, int) - called when peer connection is closed, error is an errno.h code
@@ -1194,6 +2119,53 @@ void BRPeerSetCallbacks(BRPeer *peer, void *info,
     ctx->threadCleanup = (threadCleanup) ? threadCleanup : _dummyThreadCleanup;
 }
 
+// relayedBlockHashes is called with the block hashes of each "inv" message that would otherwise be requested with
+// getdata, if it returns true the caller takes over requesting those blocks
+void BRPeerSetRelayedBlockHashesCallback(BRPeer *peer,
+                                         int (*relayedBlockHashes)(void *info, const UInt256 blockHashes[],
+                                                                   size_t blockCount))
+{
+    ((BRPeerContext *)peer)->relayedBlockHashes = relayedBlockHashes;
+}
+
+// switches peer to BIP157 compact block filter sync
+void BRPeerSetCompactFilterCallbacks(BRPeer *peer,
+                                     void (*relayedCFHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader,
+                                                              const UInt256 filterHashes[], size_t count),
+                                     void (*relayedCFilter)(void *info, UInt256 blockHash, const uint8_t *filter,
+                                                            size_t filterLen),
+                                     void (*relayedFullBlock)(void *info, BRMerkleBlock *block, BRTransaction *txs[],
+                                                              size_t txCount))
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+
+    ctx->compactFilters = 1;
+    ctx->relayedCFHeaders = relayedCFHeaders;
+    ctx->relayedCFilter = relayedCFilter;
+    ctx->relayedFullBlock = relayedFullBlock;
+}
+
+// recordMessage is called with each checksummed inbound frame before it's accepted, and each outbound frame before
+// it's sent
+void BRPeerSetRecorder(BRPeer *peer, void *recorderInfo,
+                       void (*recordMessage)(void *info, const BRPeer *peer, int inbound, const uint8_t *frame,
+                                             size_t frameLen))
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+
+    ctx->recorderInfo = recorderInfo;
+    ctx->recordMessage = recordMessage;
+}
+
+// openSocket is called instead of connecting to the peer's address, and must return a connected stream socket
+void BRPeerSetTransport(BRPeer *peer, void *transportInfo, int (*openSocket)(void *info, const BRPeer *peer))
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+
+    ctx->transportInfo = transportInfo;
+    ctx->openSocket = openSocket;
+}
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void BRPeerSetEarliestKeyTime(BRPeer *peer, uint32_t earliestKeyTime)
 {
@@ -1223,8 +2195,10 @@ BRPeerStatus BRPeerConnectStatus(BRPeer *peer)
 void BRPeerConnect(BRPeer *peer)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
+    BRPeerReactor *reactor = (ctx->reactor) ? ctx->reactor : _defaultReactor;
     struct timeval tv;
     pthread_attr_t attr;
+    int error = 0, attach = 0;
 
     pthread_mutex_lock(&ctx->lock);
     if (ctx->status == BRPeerStatusDisconnected || ctx->waitingForNetwork) {
@@ -1242,7 +2216,16 @@ void BRPeerConnect(BRPeer *peer)
             // No race - set before the thread starts.
             ctx->disconnectTime = tv.tv_sec + (double)tv.tv_usec/1000000 + CONNECT_TIMEOUT;
 
-            if (pthread_attr_init(&attr) != 0) {
+            if (reactor) {
+                error = _BRPeerReactorConnect(ctx, reactor);
+                
+                if (error) {
+                    peer_log(peer, "connect error: %s", strerror(error));
+                    ctx->status = BRPeerStatusDisconnected;
+                }
+                else attach = 1;
+            }
+            else if (pthread_attr_init(&attr) != 0) {
                 // error = ENOMEM;
                 peer_log(peer, "error creating thread");
                 ctx->status = BRPeerStatusDisconnected;
@@ -1260,19 +2243,30 @@ void BRPeerConnect(BRPeer *peer)
         }
     }
     pthread_mutex_unlock(&ctx->lock);
+    if (attach) _BRPeerReactorRequest(ctx); // the event loop takes it from here
 }
 
 // close connection to peer
 void BRPeerDisconnect(BRPeer *peer)
 {
     BRPeerContext *ctx = (BRPeerContext *)peer;
-    int socket = -1;
+    int socket = -1, isLooped = 0;
 
-    if (_peerCheckAndGetSocket(ctx, &socket)) {
-        pthread_mutex_lock(&ctx->lock);
+    pthread_mutex_lock(&ctx->lock);
+    socket = ctx->socket;
+
+    if (socket >= 0) {
         ctx->status = BRPeerStatusDisconnected;
-        pthread_mutex_unlock(&ctx->lock);
+        isLooped = (ctx->loop != NULL);
+        if (isLooped) ctx->disconnectRequested = 1; // the event loop owns the socket, and closes it on seeing this
+    }
 
+    pthread_mutex_unlock(&ctx->lock);
+
+    if (isLooped) {
+        _BRPeerReactorRequest(ctx);
+    }
+    else if (socket >= 0) {
         if (shutdown(socket, SHUT_RDWR) < 0) peer_log(peer, "%s", strerror(errno));
         close(socket);
     }
@@ -1288,6 +2282,7 @@ void BRPeerScheduleDisconnect(BRPeer *peer, double seconds)
     pthread_mutex_lock(&ctx->lock);
     ctx->disconnectTime = (seconds < 0) ? DBL_MAX : tv.tv_sec + (double)tv.tv_usec/1000000 + seconds;
     pthread_mutex_unlock(&ctx->lock);
+    if (ctx->loop) _BRPeerReactorRequest(ctx); // move the peer to its new timer wheel slot
 }
 
 // call this when wallet addresses need to be added to bloom filter
@@ -1329,6 +2324,28 @@ uint32_t BRPeerLastBlock(BRPeer *peer)
     return ((BRPeerContext *)peer)->lastblock;
 }
 
+// message type tallied at index in BRPeerMsgCount arrays, or "other" for the last index
+const char *BRPeerMsgType(size_t index)
+{
+    return (index < PEER_MSG_TYPES) ? _peerMsgTypes[index] : NULL;
+}
+
+// adds the messages received from and sent to peer since it was created to received and sent, which each must hold
+// PEER_MSG_TYPES counts
+void BRPeerMsgCounts(BRPeer *peer, BRPeerMsgCount received[], BRPeerMsgCount sent[])
+{
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+
+    pthread_mutex_lock(&ctx->lock);
+
+    for (size_t i = 0; i < PEER_MSG_TYPES; i++) {
+        received[i].count += ctx->received[i].count, received[i].bytes += ctx->received[i].bytes;
+        sent[i].count += ctx->sent[i].count, sent[i].bytes += ctx->sent[i].bytes;
+    }
+
+    pthread_mutex_unlock(&ctx->lock);
+}
+
 // average ping time for connected peer
 double BRPeerPingTime(BRPeer *peer)
 {
@@ -1364,7 +2381,7 @@ void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const ch
         size_t off = 0;
         ssize_t n = 0;
         struct timeval tv;
-        int socket, error = 0;
+        int socket, error = 0, buffered, pending = 0;
         
         UInt32SetLE(&buf[off], ctx->magicNumber);
         off += sizeof(uint32_t);
@@ -1377,9 +2394,21 @@ void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const ch
         off += sizeof(uint32_t);
         memcpy(&buf[off], msg, msgLen);
         peer_log(peer, "sending %s", type);
+        if (ctx->recordMessage) ctx->recordMessage(ctx->recorderInfo, peer, 0, buf, sizeof(buf));
         msgLen = 0;
-        socket = _peerGetSocket(ctx);
-        if (socket < 0) error = ENOTCONN;
+        pthread_mutex_lock(&ctx->lock);
+        buffered = (ctx->loop != NULL);
+        
+        if (buffered) { // never block a reactor loop, whatever the socket doesn't take now is sent as it drains
+            pending = (ctx->sendOff < ctx->sendLen);
+            error = _BRPeerSendBuffered(ctx, buf, sizeof(buf));
+            pending = (! pending && ctx->sendOff < ctx->sendLen);
+        }
+        
+        pthread_mutex_unlock(&ctx->lock);
+        if (pending) _BRPeerReactorRequest(ctx); // have the loop watch for write readiness
+        socket = (buffered) ? -1 : _peerGetSocket(ctx);
+        if (! buffered && socket < 0) error = ENOTCONN;
         
         while (socket >= 0 && ! error && msgLen < sizeof(buf)) {
             n = send(socket, &buf[msgLen], sizeof(buf) - msgLen, MSG_NOSIGNAL);
@@ -1390,6 +2419,8 @@ void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const ch
             socket = _peerGetSocket(ctx);
         }
         
+        if (! error) _BRPeerCountMessage(ctx, ctx->sent, type, sizeof(buf));
+
         if (error) {
             peer_log(peer, "%s", strerror(error));
             BRPeerDisconnect(peer);
@@ -1455,6 +2486,15 @@ void BRPeerSendFilterload(BRPeer *peer, const uint8_t *filter, size_t filterLen)
     BRPeerSendMessage(peer, filter, filterLen, MSG_FILTERLOAD);
 }
 
+void BRPeerSendFilteradd(BRPeer *peer, const uint8_t *data, size_t dataLen)
+{
+    uint8_t msg[BRVarIntSize(dataLen) + dataLen];
+    size_t off = BRVarIntSet(msg, sizeof(msg), dataLen);
+    
+    memcpy(&msg[off], data, dataLen);
+    BRPeerSendMessage(peer, msg, sizeof(msg), MSG_FILTERADD);
+}
+
 void BRPeerSendMempool(BRPeer *peer, const UInt256 knownTxHashes[], size_t knownTxCount, void *info,
                        void (*completionCallback)(void *info, int success))
 {
@@ -1476,6 +2516,7 @@ void BRPeerSendMempool(BRPeer *peer, const UInt256 knownTxHashes[], size_t known
 
             ctx->mempoolInfo = info;
             ctx->mempoolCallback = completionCallback;
+            if (ctx->loop) _BRPeerReactorRequest(ctx);
         }
         
         BRPeerSendMessage(peer, NULL, 0, MSG_MEMPOOL);
@@ -1488,6 +2529,7 @@ void BRPeerSendMempool(BRPeer *peer, const UInt256 knownTxHashes[], size_t known
 
 void BRPeerSendGetheaders(BRPeer *peer, const UInt256 locators[], size_t locatorsCount, UInt256 hashStop)
 {
+    BRPeerContext *ctx = (BRPeerContext *)peer;
     size_t i, off = 0;
     size_t msgLen = sizeof(uint32_t) + BRVarIntSize(locatorsCount) + sizeof(*locators)*locatorsCount + sizeof(hashStop);
     uint8_t msg[msgLen];
@@ -1507,6 +2549,7 @@ void BRPeerSendGetheaders(BRPeer *peer, const UInt256 locators[], size_t locator
     if (locatorsCount > 0) {
         peer_log(peer, "calling getheaders with %zu locators: [%s,%s %s]", locatorsCount, u256hex(locators[0]),
                  (locatorsCount > 2 ? " ...," : ""), (locatorsCount > 1 ? u256hex(locators[locatorsCount - 1]) : ""));
+        ctx->headersStop = hashStop; // continuation requests keep the same hashStop
         BRPeerSendMessage(peer, msg, off, MSG_GETHEADERS);
     }
 }
@@ -1594,6 +2637,51 @@ void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, c
     }
 }
 
+void BRPeerSendGetblockdata(BRPeer *peer, const UInt256 blockHashes[], size_t blockCount)
+{
+    size_t i, off = 0;
+
+    if (blockCount > MAX_GETDATA_HASHES) {
+        peer_log(peer, "couldn't send getdata, %zu is too many items, max is %d", blockCount, MAX_GETDATA_HASHES);
+    }
+    else if (blockCount > 0) {
+        size_t msgLen = BRVarIntSize(blockCount) + (sizeof(uint32_t) + sizeof(UInt256))*blockCount;
+        uint8_t msg[msgLen];
+
+        off += BRVarIntSet(&msg[off], msgLen, blockCount);
+
+        for (i = 0; i < blockCount; i++) {
+            UInt32SetLE(&msg[off], inv_witness_block);
+            off += sizeof(uint32_t);
+            UInt256Set(&msg[off], blockHashes[i]);
+            off += sizeof(UInt256);
+        }
+
+        ((BRPeerContext *)peer)->sentGetdata = 1;
+        BRPeerSendMessage(peer, msg, off, MSG_GETDATA);
+    }
+}
+
+static void _BRPeerSendCFRequest(BRPeer *peer, uint32_t startHeight, UInt256 stopHash, const char *type)
+{
+    uint8_t msg[1 + sizeof(uint32_t) + sizeof(UInt256)];
+
+    msg[0] = GCS_FILTER_TYPE_BASIC;
+    UInt32SetLE(&msg[1], startHeight);
+    UInt256Set(&msg[1 + sizeof(uint32_t)], stopHash);
+    BRPeerSendMessage(peer, msg, sizeof(msg), type);
+}
+
+void BRPeerSendGetcfheaders(BRPeer *peer, uint32_t startHeight, UInt256 stopHash)
+{
+    _BRPeerSendCFRequest(peer, startHeight, stopHash, MSG_GETCFHEADERS);
+}
+
+void BRPeerSendGetcfilters(BRPeer *peer, uint32_t startHeight, UInt256 stopHash)
+{
+    _BRPeerSendCFRequest(peer, startHeight, stopHash, MSG_GETCFILTERS);
+}
+
 void BRPeerSendGetaddr(BRPeer *peer)
 {
     ((BRPeerContext *)peer)->sentGetaddr = 1;
@@ -1640,12 +2728,26 @@ void BRPeerFree(BRPeer *peer)
     if (ctx->knownTxHashSet) BRSetFree(ctx->knownTxHashSet);
     if (ctx->pongCallback) array_free(ctx->pongCallback);
     if (ctx->pongInfo) array_free(ctx->pongInfo);
+    if (ctx->recvBuf) free(ctx->recvBuf);
+    if (ctx->sendBuf) free(ctx->sendBuf);
     
     pthread_mutex_destroy(&ctx->lock);
     free(ctx);
 }
 
-void BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
+int BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type)
+{
+    return _BRPeerAcceptMessage(peer, msg, msgLen, type);
+}
+
+// frames and accepts messages read from socket until the other end is closed, returns an errno.h code on failure
+int BRPeerReadMessagesTest(BRPeer *peer, int socket)
 {
-    _BRPeerAcceptMessage(peer, msg, msgLen, type);
+    BRPeerContext *ctx = (BRPeerContext *)peer;
+    int error = 0;
+
+    ctx->socket = socket;
+    while (! error) error = _BRPeerReadMessages(ctx, socket);
+    ctx->socket = -1;
+    return (error == ECONNRESET) ? 0 : error;
 }
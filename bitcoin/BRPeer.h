@@ -56,6 +56,7 @@ extern "C" {
 #define SERVICES_NODE_BLOOM   0x04 // BIP111: https://github.com/bitcoin/bips/blob/master/bip-0111.mediawiki
 #define SERVICES_NODE_WITNESS 0x08 // BIP144: https://github.com/bitcoin/bips/blob/master/bip-0144.mediawiki
 #define SERVICES_NODE_BCASH   0x20 // https://github.com/Bitcoin-UAHF/spec/blob/master/uahf-technical-spec.md
+#define SERVICES_NODE_COMPACT_FILTERS 0x40 // BIP157: https://github.com/bitcoin/bips/blob/master/bip-0157.mediawiki
     
 #define BR_VERSION "2.1"
 #define USER_AGENT "/bread:" BR_VERSION "/"
@@ -83,6 +84,10 @@ extern "C" {
 #define MSG_ALERT       "alert"
 #define MSG_REJECT      "reject"   // described in BIP61: https://github.com/bitcoin/bips/blob/master/bip-0061.mediawiki
 #define MSG_FEEFILTER   "feefilter"// described in BIP133 https://github.com/bitcoin/bips/blob/master/bip-0133.mediawiki
+#define MSG_GETCFILTERS "getcfilters" // compact block filter messages are described in BIP157
+#define MSG_CFILTER     "cfilter"
+#define MSG_GETCFHEADERS "getcfheaders"
+#define MSG_CFHEADERS   "cfheaders"
 
 #define REJECT_INVALID     0x10 // transaction is invalid for some reason (invalid signature, output value > input, etc)
 #define REJECT_SPENT       0x12 // an input is already spent
@@ -102,15 +107,45 @@ typedef struct {
     uint64_t services; // bitcoin network services supported by peer
     uint64_t timestamp; // timestamp reported by peer
     uint8_t flags; // scratch variable
+    uint16_t failures; // consecutive failed connections to peer
+    uint32_t rttMs; // smoothed round trip time in milliseconds measured by handshakes and pings, 0 if never measured
+    uint32_t blockRate; // merkleblocks per second peer delivered during chain download, 0 if never measured
 } BRPeer;
 
-#define BR_PEER_NONE ((const BRPeer) { UINT128_ZERO, 0, 0, 0, 0 })
+#define BR_PEER_NONE ((const BRPeer) { UINT128_ZERO, 0, 0, 0, 0, 0, 0, 0 })
+
+#define PEER_MSG_TYPES 27 // message types tallied separately in BRPeerMsgCount arrays, the last one counts all others
+
+typedef struct {
+    uint64_t count; // messages
+    uint64_t bytes; // bytes on the wire, headers included
+} BRPeerMsgCount;
+
+// a reactor multiplexes the sockets of many peers over a small, fixed number of event loop threads (epoll on linux,
+// poll elsewhere) instead of dedicating a blocking thread to each connected peer
+typedef struct BRPeerReactorStruct BRPeerReactor;
+
+// returns a newly allocated reactor running threadCount event loops, which must be freed by calling BRPeerReactorFree()
+// void threadCleanup(void *) - called by each event loop thread before it terminates, may be NULL
+BRPeerReactor *BRPeerReactorNew(size_t threadCount, void *info, void (*threadCleanup)(void *info));
+
+// stops the event loops, all peers using the reactor must be disconnected first
+void BRPeerReactorFree(BRPeerReactor *reactor);
+
+// reactor used by peers that haven't been given one with BRPeerSetReactor(), NULL selects thread-per-peer (default)
+void BRPeerSetDefaultReactor(BRPeerReactor *reactor);
+BRPeerReactor *BRPeerDefaultReactor(void);
 
 // NOTE: BRPeer functions are not thread-safe
 
 // returns a newly allocated BRPeer struct that must be freed by calling BRPeerFree()
 BRPeer *BRPeerNew(uint32_t magicNumber);
 
+// serve the peer's connection from reactor instead of a dedicated thread, call before BRPeerConnect()
+// callbacks are then made from a reactor thread, the connection is torn down once disconnected() returns, and
+// messages are sent without blocking, from a send buffer drained by the reactor
+void BRPeerSetReactor(BRPeer *peer, BRPeerReactor *reactor);
+
 // info is a void pointer that will be passed along with each callback call
 // void connected(void *) - called when peer handshake completes successfully
 // void disconnected(void *, int) - called when peer connection is closed, error is an errno.h code
@@ -122,7 +157,8 @@ BRPeer *BRPeerNew(uint32_t magicNumber);
 // void notfound(void *, const UInt256[], size_t, const UInt256[], size_t) - called when "notfound" message is received
 // BRTransaction *requestedTx(void *, UInt256) - called when "getdata" message with a tx hash is received from peer
 // int networkIsReachable(void *) - must return true when networking is available, false otherwise
-// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup    
+// void threadCleanup(void *) - called before a thread terminates to faciliate any needed cleanup (not called for a peer
+//   served by a reactor, whose threads are cleaned up by the threadCleanup() given to BRPeerReactorNew())
 void BRPeerSetCallbacks(BRPeer *peer, void *info,
                         void (*connected)(void *info),
                         void (*disconnected)(void *info, int error),
@@ -138,6 +174,42 @@ void BRPeerSetCallbacks(BRPeer *peer, void *info,
                         int (*networkIsReachable)(void *info),
                         void (*threadCleanup)(void *info));
 
+// int relayedBlockHashes(void *, const UInt256[], size_t) - called with the block hashes of each "inv" message that
+//   would otherwise be requested with getdata, return true to request those blocks separately instead (info is the
+//   same as passed to BRPeerSetCallbacks())
+void BRPeerSetRelayedBlockHashesCallback(BRPeer *peer,
+                                         int (*relayedBlockHashes)(void *info, const UInt256 blockHashes[],
+                                                                   size_t blockCount));
+
+// switches peer to BIP157 compact block filter sync: headers are downloaded all the way to the chain tip, no bloom
+// filter is expected, and block announcements go to relayedBlockHashes (info is the same as passed to
+// BRPeerSetCallbacks())
+// void relayedCFHeaders(void *, UInt256, UInt256, const UInt256[], size_t) - called when a "cfheaders" message is
+//   received with the stop hash, the filter header preceeding the batch, and the filter hashes of the batch
+// void relayedCFilter(void *, UInt256, const uint8_t *, size_t) - called with the block hash and serialized filter of
+//   each "cfilter" message
+// void relayedFullBlock(void *, BRMerkleBlock *, BRTransaction *[], size_t) - called when a "block" message with a
+//   valid merkle root is received, block holds the complete list of tx hashes and the callee takes ownership of block
+//   and each of the tx
+void BRPeerSetCompactFilterCallbacks(BRPeer *peer,
+                                     void (*relayedCFHeaders)(void *info, UInt256 stopHash, UInt256 prevHeader,
+                                                              const UInt256 filterHashes[], size_t count),
+                                     void (*relayedCFilter)(void *info, UInt256 blockHash, const uint8_t *filter,
+                                                            size_t filterLen),
+                                     void (*relayedFullBlock)(void *info, BRMerkleBlock *block, BRTransaction *txs[],
+                                                              size_t txCount));
+
+// void recordMessage(void *, const BRPeer *, int, const uint8_t *, size_t) - called with each complete message frame,
+//   header included, that passes its checksum before it's accepted (inbound is true), and with each frame before it's
+//   sent (inbound is false), from the peer's thread, see BRPeerRecorderRecordMessage() in BRPeerReplay.h
+void BRPeerSetRecorder(BRPeer *peer, void *recorderInfo,
+                       void (*recordMessage)(void *info, const BRPeer *peer, int inbound, const uint8_t *frame,
+                                             size_t frameLen));
+
+// int openSocket(void *, const BRPeer *) - called instead of connecting to the peer's address, must return a connected
+//   stream socket, or -1 with errno set, see BRPeerReplayOpenSocket() in BRPeerReplay.h
+void BRPeerSetTransport(BRPeer *peer, void *transportInfo, int (*openSocket)(void *info, const BRPeer *peer));
+
 // set earliestKeyTime to wallet creation time in order to speed up initial sync
 void BRPeerSetEarliestKeyTime(BRPeer *peer, uint32_t earliestKeyTime);
 
@@ -177,17 +249,35 @@ uint64_t BRPeerFeePerKb(BRPeer *peer);
 // average ping time for connected peer
 double BRPeerPingTime(BRPeer *peer);
 
+// message type tallied at index in BRPeerMsgCount arrays, or "other" for the last index
+const char *BRPeerMsgType(size_t index);
+
+// adds the messages received from and sent to peer since it was created to received and sent, which each must hold
+// PEER_MSG_TYPES counts
+void BRPeerMsgCounts(BRPeer *peer, BRPeerMsgCount received[], BRPeerMsgCount sent[]);
+
 // sends a bitcoin protocol message to peer
 void BRPeerSendMessage(BRPeer *peer, const uint8_t *msg, size_t msgLen, const char *type);
 void BRPeerSendFilterload(BRPeer *peer, const uint8_t *filter, size_t filterLen);
+
+// adds a single data element to the filter previously loaded with BRPeerSendFilterload(), as described in BIP37
+void BRPeerSendFilteradd(BRPeer *peer, const uint8_t *data, size_t dataLen);
 void BRPeerSendMempool(BRPeer *peer, const UInt256 knownTxHashes[], size_t knownTxCount, void *info,
                        void (*completionCallback)(void *info, int success));
+// headers requests with a non-zero hashStop are continued automatically only until the hashStop header arrives
 void BRPeerSendGetheaders(BRPeer *peer, const UInt256 locators[], size_t locatorsCount, UInt256 hashStop);
 void BRPeerSendGetblocks(BRPeer *peer, const UInt256 locators[], size_t locatorsCount, UInt256 hashStop);
 void BRPeerSendInv(BRPeer *peer, const UInt256 txHashes[], size_t txCount);
 void BRPeerSendGetdata(BRPeer *peer, const UInt256 txHashes[], size_t txCount, const UInt256 blockHashes[],
                        size_t blockCount);
 void BRPeerSendGetaddr(BRPeer *peer);
+
+// requests full witness blocks, as needed when a compact block filter matches
+void BRPeerSendGetblockdata(BRPeer *peer, const UInt256 blockHashes[], size_t blockCount);
+
+// requests basic filter headers, or basic filters, for the blocks from startHeight through the block with stopHash
+void BRPeerSendGetcfheaders(BRPeer *peer, uint32_t startHeight, UInt256 stopHash);
+void BRPeerSendGetcfilters(BRPeer *peer, uint32_t startHeight, UInt256 stopHash);
 void BRPeerSendPing(BRPeer *peer, void *info, void (*pongCallback)(void *info, int success));
 
 // useful to get additional tx after a bloom filter update
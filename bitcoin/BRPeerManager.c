@@ -24,25 +24,56 @@
 
 #include "BRPeerManager.h"
 #include "BRBloomFilter.h"
+#include "BRGCSFilter.h"
 #include "BRSet.h"
 #include "BRArray.h"
 #include "BRInt.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <math.h>
 #include <time.h>
 #include <assert.h>
 #include <pthread.h>
 #include <errno.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 
 #define PROTOCOL_TIMEOUT      20.0
 #define MAX_CONNECT_FAILURES  20 // notify user of network problems after this many connect failures in a row
 #define PEER_FLAG_SYNCED      0x01
 #define PEER_FLAG_NEEDSUPDATE 0x02
+#define PEER_FLAG_FETCHPENDING 0x04 // waiting for pong after loading the block fetch filter
+#define PEER_FLAG_FETCHREADY  0x08 // block fetch filter is loaded
+#define PEER_FLAG_FETCHSTALE  0x10 // block fetch filter was replaced since it was loaded
+#define FETCH_WINDOW          100 // max number of merkleblocks requested from a peer at a time during chain download
+#define FETCH_MIN_IN_FLIGHT   20  // merkleblocks a peer may have in flight before its speed has been measured
+#define FETCH_MAX_IN_FLIGHT   500 // most merkleblocks a peer may have in flight
+#define FETCH_RTT_MULTIPLE    2.0 // round trips worth of merkleblocks to keep in flight, so the measured rate can grow
+#define HEADER_RANGES_MIN     2 // minimum checkpoint ranges in the headers phase needed to download them in parallel
+#define SNAPSHOT_HEADER_SIZE  80 // header snapshots are a sequence of serialized block headers
+#define PEER_MAX_FAILURES     3 // consecutive failed connections before a peer is dropped from the known peers
+#define PEER_DEFAULT_RTT      0.5 // seconds, round trip time assumed for peers that haven't been measured
+#define PEER_DEFAULT_BLOCK_RATE 100.0 // merkleblocks per second assumed for peers that haven't been measured
+#define PEER_FAILURE_COST     5.0 // seconds added to a peer's expected connection cost for each recent failure
+#define PEER_STALE_COST       5.0 // seconds added to a peer's expected connection cost for each day since it was seen
+#define TX_PEER_SLOTS         64 // peers that can be tracked in the tx relay/request sets, one bit each
+#define TX_PEERS_MAX_AGE      (24*60*60) // seconds before an entry for a tx that isn't pending in the wallet expires
+#define TX_PEERS_PURGE_INTERVAL (10*60) // seconds between scans for expired tx relay/request entries
+#define ORPHAN_MAX_BYTES      (2*1024*1024) // memory budget for orphan blocks, including their tx hashes and flags
+#define ORPHAN_MAX_PER_PEER   100 // orphans held from any one peer, the oldest is evicted to make room
+#define ORPHAN_MAX_AGE        (60*60) // seconds an orphan is held waiting for the blocks before it
+#define CF_HEADERS_BATCH      2000 // max filter hashes per getcfheaders request, as limited by BIP157
+#define CF_FILTERS_BATCH      100 // filters per getcfilters request
+#define CF_FILTERS_AHEAD      500 // max filters downloaded ahead of the chain, they're kept until the block is added
+#define CF_ENTRY_HEADER       0 // waiting for the block filter
+#define CF_ENTRY_FILTER       1 // filter didn't match the wallet
+#define CF_ENTRY_BLOCK        2 // filter matched, waiting for the full block
+#define CF_ENTRY_DONE         3 // block holds the matched wallet tx
 
 #define genesis_block_hash(params) UInt256Reverse((params)->checkpoints[0].hash)
 
@@ -50,6 +81,7 @@ typedef struct {
     BRPeerManager *manager;
     const char *hostname;
     uint64_t services;
+    int connect; // connect to the peers found, rather than have the connecting thread wait for them
 } BRFindPeersInfo;
 
 typedef struct {
@@ -66,301 +98,1450 @@ typedef struct {
 
 typedef struct {
     UInt256 txHash;
-    BRPeer *peers;
-} BRTxPeerList;
+    uint64_t peers; // bitmask of peer slots, see _BRPeerManagerTxPeerSlot()
+    time_t updateTime;
+} BRTxPeers;
 
-// true if peer is contained in the list of peers associated with txHash
-static int _BRTxPeerListHasPeer(const BRTxPeerList *list, UInt256 txHash, const BRPeer *peer)
+typedef struct {
+    BRMerkleBlock *start, *end; // checkpoint blocks the range is anchored at
+    BRMerkleBlock *last; // most recent header in the range linked back to start
+    BRPeer *peer; // peer the range is requested from, or NULL if it's unassigned
+    BRSet *blocks; // headers received for the range, indexed by blockHash
+    int done, failed;
+} BRHeaderRange;
+
+typedef struct {
+    UInt256 blockHash;
+    BRPeer *peer; // peer the block was last requested from, or NULL if it needs to be requested
+    time_t requestTime;
+    BRMerkleBlock *block; // block received ahead of the blocks before it
+} BRBlockFetch;
+
+typedef struct {
+    uint8_t data[sizeof(UInt256) + sizeof(uint32_t)]; // 20 byte pubkey hash, or 36 byte outpoint
+    uint8_t dataLen;
+    uint8_t laneCount; // number of cached hash lanes
+    uint8_t filtered; // true if element was inserted into the current bloom filter
+    uint8_t shared; // true if the last refresh found element in more than one wallet
+    uint32_t generation; // last watch set refresh that found element in a wallet
+    BRWallet *wallet; // wallet the last refresh found element in, or NULL if it was removed since
+    uint32_t lanes[BLOOM_MAX_HASH_FUNCS]; // murmur3 hash lanes for the manager's filter tweak
+} BRWatchElement;
+
+typedef struct {
+    BRMerkleBlock *block; // header, or the block with matched wallet tx once the full block has been processed
+    UInt256 filterHash, filterHeader; // from cfheaders, the filter header chains the filter hashes together
+    BRGCSFilter *filter; // kept until the block is added to the chain, in case wallet addresses are added before then
+    size_t pkhCount; // number of wallet addresses the filter was matched against
+    int state;
+} BRCFEntry;
+
+typedef struct {
+    BRMerkleBlock *block;
+    BRPeer peer; // peer that relayed the block, or BR_PEER_NONE if it was loaded from storage
+    time_t addTime;
+    size_t size;
+} BROrphan;
+
+typedef struct {
+    BRPeerManager *manager;
+    uint8_t *headers; // the imported part of the snapshot
+    size_t count;
+    BRMerkleBlock *anchor; // copy of the checkpoint the snapshot extends
+} BRSnapshotVerifyInfo;
+
+typedef struct {
+    BRPeer *peer;
+    double startTime;
+    uint32_t blockCount; // merkleblocks received since startTime
+} BRPeerThroughput;
+
+// comparator for sorting peers by timestamp, most recent first
+inline static int _peerTimestampCompare(const void *peer, const void *otherPeer)
+{
+    if (((const BRPeer *)peer)->timestamp < ((const BRPeer *)otherPeer)->timestamp) return 1;
+    if (((const BRPeer *)peer)->timestamp > ((const BRPeer *)otherPeer)->timestamp) return -1;
+    return 0;
+}
+
+// expected seconds until a connection to peer is useful: round trip time, time to download a window of merkleblocks,
+// a penalty for recent failures, and one for each day older the peer's timestamp is; a day unseen makes a peer about
+// as likely to be unreachable as a failure does, so one last seen a week ago ranks below any peer still being retried
+// (only differences in cost matter, so the timestamp stands in for the peer's age)
+inline static double _peerCost(const BRPeer *peer)
+{
+    double rtt = (peer->rttMs > 0) ? peer->rttMs/1000.0 : PEER_DEFAULT_RTT,
+           blockRate = (peer->blockRate > 0) ? peer->blockRate : PEER_DEFAULT_BLOCK_RATE;
+
+    return rtt + FETCH_WINDOW/blockRate + peer->failures*PEER_FAILURE_COST -
+           (double)peer->timestamp*PEER_STALE_COST/(24*60*60);
+}
+
+// comparator for sorting peers by expected connection cost, lowest first
+inline static int _peerCostCompare(const void *peer, const void *otherPeer)
+{
+    double cost = _peerCost(peer), otherCost = _peerCost(otherPeer);
+
+    return (cost < otherCost) ? -1 : (cost > otherCost) ? 1 : 0;
+}
+
+// returns a hash value for a txHash suitable for use in a hashtable
+inline static size_t _BRTxPeersHash(const void *txPeers)
+{
+    return (size_t)((const BRTxPeers *)txPeers)->txHash.u32[0];
+}
+
+// true if txPeers and otherTxPeers have equal txHash values
+inline static int _BRTxPeersEq(const void *txPeers, const void *otherTxPeers)
+{
+    return UInt256Eq(((const BRTxPeers *)txPeers)->txHash, ((const BRTxPeers *)otherTxPeers)->txHash);
+}
+
+// returns a hash value for a block's prevBlock value suitable for use in a hashtable
+inline static size_t _BRPrevBlockHash(const void *block)
+{
+    return (size_t)((const BRMerkleBlock *)block)->prevBlock.u32[0];
+}
+
+// true if block and otherBlock have equal prevBlock values
+inline static int _BRPrevBlockEq(const void *block, const void *otherBlock)
+{
+    return UInt256Eq(((const BRMerkleBlock *)block)->prevBlock, ((const BRMerkleBlock *)otherBlock)->prevBlock);
+}
+
+// returns a hash value for a block's height value suitable for use in a hashtable
+inline static size_t _BRBlockHeightHash(const void *block)
+{
+    // (FNV_OFFSET xor height)*FNV_PRIME
+    return (size_t)((0x811C9dc5 ^ ((const BRMerkleBlock *)block)->height)*0x01000193);
+}
+
+// true if block and otherBlock have equal height values
+inline static int _BRBlockHeightEq(const void *block, const void *otherBlock)
+{
+    return (((const BRMerkleBlock *)block)->height == ((const BRMerkleBlock *)otherBlock)->height);
+}
+
+// returns a hash value for a watch set element suitable for use in a hashtable
+inline static size_t _BRWatchElementHash(const void *elem)
 {
-    for (size_t i = array_count(list); i > 0; i--) {
-        if (! UInt256Eq(list[i - 1].txHash, txHash)) continue;
+    const BRWatchElement *e = elem;
+    uint32_t n = (e->dataLen > sizeof(UInt256)) ? UInt32GetLE(&e->data[sizeof(UInt256)]) : 0;
+
+    return (size_t)(UInt32GetLE(e->data) ^ n*0x01000193);
+}
+
+// true if elem and otherElem have equal data
+inline static int _BRWatchElementEq(const void *elem, const void *otherElem)
+{
+    const BRWatchElement *e = elem, *o = otherElem;
+
+    return (e == o || (e->dataLen == o->dataLen && memcmp(e->data, o->data, e->dataLen) == 0));
+}
+
+struct BRPeerManagerStruct {
+    const BRChainParams *params;
+    BRWallet *wallet;
+    BRWallet **wallets; // wallet followed by those added with BRPeerManagerAddWallet(), changed holding both locks
+    int isConnected, connectFailureCount, misbehavinCount, dnsThreadCount, peerThreadCount, maxConnectCount;
+    BRPeer *peers, *downloadPeer, fixedPeer, **connectedPeers;
+    char downloadPeerName[INET6_ADDRSTRLEN + 6];
+    uint32_t earliestKeyTime, syncStartHeight, filterUpdateHeight, estimatedHeight;
+    BRBloomFilter *bloomFilter;
+    BRBloomFilter *pendingFilter; // filter loaded into peers while an update with new wallet addresses is pending
+    BRSet *watchSet; // wallet elements to match with the bloom filter, along with their cached hash lanes
+    uint32_t filterTweak, watchGeneration, watchHashFuncs;
+    size_t filterCapacity; // number of elements bloomFilter was sized for
+    pthread_mutex_t watchLock; // protects the watch set and wallets, may be taken while holding lock but not the
+                               // other way around
+    double fpRate, averageTxPerBlock;
+    BRSet *blocks, *orphans, *checkpoints;
+    BRMerkleBlock *lastBlock, *lastOrphan;
+    BROrphan *orphanPool; // orphans in the order they were added, evicted from the front
+    BRPeerThroughput *throughput; // merkleblocks received from each peer helping with chain download
+    BRPeerManagerOrphanStats orphanStats;
+    BRSet *txRelays, *txRequests; // peers that relayed, or were asked for, each tx, indexed by txHash
+    BRPeer txPeerSlots[TX_PEER_SLOTS]; // peers assigned to bits in the tx relay/request peer masks
+    size_t txPeerSlotCount;
+    time_t txPeersPurgeTime;
+    BRHeaderRange *headerRanges;
+    BRBlockFetch *fetches; // merkleblocks to download, in chain order, starting at fetchHead
+    size_t fetchHead, fetchEnd; // fetches at or after fetchEnd haven't been requested yet
+    int fetchDraining;
+    int compactFilters; // sync with BIP157 compact block filters instead of bloom filters
+    int snapshotVerifying, snapshotCancel; // an imported header snapshot is being verified in the background
+    BRCFEntry *cfEntries; // headers newer than one week before earliestKeyTime, in chain order, starting at cfHead
+    size_t cfHead, cfHeadersEnd, cfFiltersNext, cfFiltersEnd; // ends of entries with filter hashes/filters/requests
+    UInt256 cfLastHeader; // filter header of the most recent entry added to the chain, or zero if unknown
+    int cfHeadersPending, cfDraining;
+    double blockLockWait, blockLockHold; // time spent waiting for and holding the lock while handling relayed blocks
+    size_t blockLockCount;
+    pthread_mutex_t statsLock; // protects stats, may be taken while holding lock but not the other way around
+    BRPeerManagerStats stats; // message counts are only those of peers that have disconnected
+    double statsInterval, statsStart; // start of the current stats interval
+    uint64_t statsHeaders, statsMerkleBlocks; // counts at the start of the current stats interval
+    void (*statsUpdated)(void *info, const BRPeerManagerStats *stats);
+    BRPublishedTx *publishedTx;
+    UInt256 *publishedTxHashes;
+    BRPeerReactor *reactor;
+    void *recorderInfo, *transportInfo;
+    void (*recordMessage)(void *info, const BRPeer *peer, int inbound, const uint8_t *frame, size_t frameLen);
+    int (*openSocket)(void *info, const BRPeer *peer);
+    void *info;
+    void (*syncStarted)(void *info);
+    void (*syncStopped)(void *info, int error);
+    void (*txStatusUpdate)(void *info);
+    void (*saveBlocks)(void *info, int replace, BRMerkleBlock *blocks[], size_t blocksCount);
+    void (*savePeers)(void *info, int replace, const BRPeer peers[], size_t peersCount);
+    int (*networkIsReachable)(void *info);
+    void (*threadCleanup)(void *info);
+    pthread_mutex_t lock;
+};
+
+static void _BRPeerManagerPeerMisbehavin(BRPeerManager *manager, BRPeer *peer)
+{
+    for (size_t i = array_count(manager->peers); i > 0; i--) {
+        if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
+    }
+
+    if (++manager->misbehavinCount >= 10) { // clear out stored peers so we get a fresh list from DNS for next connect
+        manager->misbehavinCount = 0;
+        array_clear(manager->peers);
+    }
+
+    BRPeerDisconnect(peer);
+}
+
+inline static size_t _BRTxPeersCount(const BRTxPeers *txPeers)
+{
+    size_t count = 0;
+
+    for (uint64_t m = (txPeers) ? txPeers->peers : 0; m; m &= m - 1) count++;
+    return count;
+}
+
+// clears the bits in mask from every entry in set, entries left with no peers are removed
+static void _BRTxPeersClear(BRSet *set, uint64_t mask)
+{
+    size_t count = BRSetCount(set);
+    BRTxPeers **all = malloc(count*sizeof(*all) + 1);
+
+    assert(all != NULL);
+    count = BRSetAll(set, (void **)all, count);
+
+    for (size_t i = 0; i < count; i++) {
+        all[i]->peers &= ~mask;
+        if (all[i]->peers != 0) continue;
+        BRSetRemove(set, all[i]);
+        free(all[i]);
+    }
+
+    free(all);
+}
+
+// returns the bit assigned to peer in tx peer masks, or 0 if peer has none and assign is false or no slot is free
+static uint64_t _BRPeerManagerTxPeerSlot(BRPeerManager *manager, const BRPeer *peer, int assign)
+{
+    size_t i, j;
+
+    for (i = 0; i < manager->txPeerSlotCount; i++) {
+        if (BRPeerEq(&manager->txPeerSlots[i], peer)) return (uint64_t)1 << i;
+    }
+
+    if (! assign) return 0;
 
-        for (size_t j = array_count(list[i - 1].peers); j > 0; j--) {
-            if (BRPeerEq(&list[i - 1].peers[j - 1], peer)) return 1;
+    if (manager->txPeerSlotCount < TX_PEER_SLOTS) {
+        manager->txPeerSlots[manager->txPeerSlotCount] = *peer;
+        return (uint64_t)1 << manager->txPeerSlotCount++;
+    }
+
+    for (i = 0; i < TX_PEER_SLOTS; i++) { // reuse the slot of a peer that's no longer connected
+        for (j = array_count(manager->connectedPeers); j > 0; j--) {
+            if (BRPeerEq(manager->connectedPeers[j - 1], &manager->txPeerSlots[i])) break;
         }
-        
-        break;
+
+        if (j > 0) continue;
+        _BRTxPeersClear(manager->txRelays, (uint64_t)1 << i);
+        _BRTxPeersClear(manager->txRequests, (uint64_t)1 << i);
+        manager->txPeerSlots[i] = *peer;
+        return (uint64_t)1 << i;
     }
-    
+
     return 0;
 }
 
+// returns the tx with txHash from the first of manager's wallets that has it, or NULL if none do
+static BRTransaction *_BRPeerManagerTransactionForHash(BRPeerManager *manager, UInt256 txHash)
+{
+    BRTransaction *tx = NULL;
+
+    for (size_t i = 0; ! tx && i < array_count(manager->wallets); i++) {
+        tx = BRWalletTransactionForHash(manager->wallets[i], txHash);
+    }
+
+    return tx;
+}
+
+// removes entries for tx that aren't waiting to confirm in a wallet once they haven't been updated for a while
+static void _BRPeerManagerPurgeTxPeers(BRPeerManager *manager, BRSet *set, time_t now)
+{
+    size_t count = BRSetCount(set);
+    BRTxPeers **all = malloc(count*sizeof(*all) + 1);
+    BRTransaction *tx;
+
+    assert(all != NULL);
+    count = BRSetAll(set, (void **)all, count);
+
+    for (size_t i = 0; i < count; i++) {
+        if (all[i]->updateTime + TX_PEERS_MAX_AGE >= now) continue;
+        tx = _BRPeerManagerTransactionForHash(manager, all[i]->txHash);
+        if (tx && tx->blockHeight == TX_UNCONFIRMED) continue;
+        BRSetRemove(set, all[i]);
+        free(all[i]);
+    }
+
+    free(all);
+}
+
+// true if peer is contained in the set of peers associated with txHash
+static int _BRPeerManagerTxHasPeer(BRPeerManager *manager, BRSet *set, UInt256 txHash, const BRPeer *peer)
+{
+    BRTxPeers *txPeers = BRSetGet(set, &txHash);
+
+    return (txPeers && (txPeers->peers & _BRPeerManagerTxPeerSlot(manager, peer, 0)) != 0);
+}
+
 // number of peers associated with txHash
-static size_t _BRTxPeerListCount(const BRTxPeerList *list, UInt256 txHash)
+static size_t _BRPeerManagerTxPeerCount(BRSet *set, UInt256 txHash)
+{
+    return _BRTxPeersCount(BRSetGet(set, &txHash));
+}
+
+// adds peer to the set of peers associated with txHash and returns the new total number of peers
+static size_t _BRPeerManagerTxAddPeer(BRPeerManager *manager, BRSet *set, UInt256 txHash, const BRPeer *peer)
 {
-    for (size_t i = array_count(list); i > 0; i--) {
-        if (UInt256Eq(list[i - 1].txHash, txHash)) return array_count(list[i - 1].peers);
+    time_t now = time(NULL);
+    uint64_t bit = _BRPeerManagerTxPeerSlot(manager, peer, 1);
+    BRTxPeers *txPeers;
+
+    if (now >= manager->txPeersPurgeTime + TX_PEERS_PURGE_INTERVAL) {
+        _BRPeerManagerPurgeTxPeers(manager, manager->txRelays, now);
+        _BRPeerManagerPurgeTxPeers(manager, manager->txRequests, now);
+        manager->txPeersPurgeTime = now;
     }
-    
-    return 0;
+
+    txPeers = BRSetGet(set, &txHash);
+
+    if (! txPeers) {
+        txPeers = calloc(1, sizeof(*txPeers));
+        assert(txPeers != NULL);
+        txPeers->txHash = txHash;
+        BRSetAdd(set, txPeers);
+    }
+
+    txPeers->peers |= bit;
+    txPeers->updateTime = now;
+    return _BRTxPeersCount(txPeers);
 }
 
-// adds peer to the list of peers associated with txHash and returns the new total number of peers
-static size_t _BRTxPeerListAddPeer(BRTxPeerList **list, UInt256 txHash, const BRPeer *peer)
+// removes peer from the set of peers associated with txHash, returns true if peer was found
+static int _BRPeerManagerTxRemovePeer(BRPeerManager *manager, BRSet *set, UInt256 txHash, const BRPeer *peer)
 {
-    for (size_t i = array_count(*list); i > 0; i--) {
-        if (! UInt256Eq((*list)[i - 1].txHash, txHash)) continue;
-        
-        for (size_t j = array_count((*list)[i - 1].peers); j > 0; j--) {
-            if (BRPeerEq(&(*list)[i - 1].peers[j - 1], peer)) return array_count((*list)[i - 1].peers);
-        }
-        
-        array_add((*list)[i - 1].peers, *peer);
-        return array_count((*list)[i - 1].peers);
+    BRTxPeers *txPeers = BRSetGet(set, &txHash);
+    uint64_t bit = _BRPeerManagerTxPeerSlot(manager, peer, 0);
+
+    if (! txPeers || (txPeers->peers & bit) == 0) return 0;
+    txPeers->peers &= ~bit;
+
+    if (txPeers->peers == 0) {
+        BRSetRemove(set, txPeers);
+        free(txPeers);
     }
 
-    array_add(*list, ((const BRTxPeerList) { txHash, NULL }));
-    array_new((*list)[array_count(*list) - 1].peers, PEER_MAX_CONNECTIONS);
-    array_add((*list)[array_count(*list) - 1].peers, *peer);
     return 1;
 }
 
-// removes peer from the list of peers associated with txHash, returns true if peer was found
-static int _BRTxPeerListRemovePeer(BRTxPeerList *list, UInt256 txHash, const BRPeer *peer)
+static double _peerManagerTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec/1000000;
+}
+
+// returns the known peers entry matching peer, or NULL if there is none
+static BRPeer *_BRPeerManagerKnownPeer(BRPeerManager *manager, const BRPeer *peer)
+{
+    for (size_t i = array_count(manager->peers); i > 0; i--) {
+        if (BRPeerEq(&manager->peers[i - 1], peer)) return &manager->peers[i - 1];
+    }
+
+    return NULL;
+}
+
+// copies the connection quality measured for a connected peer to its known peers entry so it can be saved
+static void _BRPeerManagerUpdateKnownPeer(BRPeerManager *manager, const BRPeer *peer)
+{
+    BRPeer *known = _BRPeerManagerKnownPeer(manager, peer);
+
+    if (known) {
+        known->failures = peer->failures;
+        known->rttMs = peer->rttMs;
+        known->blockRate = peer->blockRate;
+    }
+}
+
+// folds peer's current ping time into its smoothed round trip time
+static void _BRPeerManagerRecordPingTime(BRPeerManager *manager, BRPeer *peer)
+{
+    double pingTime = BRPeerPingTime(peer);
+    uint32_t ms;
+
+    if (pingTime <= 0 || pingTime >= PROTOCOL_TIMEOUT) return; // not measured
+    ms = (uint32_t)(pingTime*1000) + 1;
+    peer->rttMs = (peer->rttMs > 0) ? (peer->rttMs + ms)/2 : ms;
+    _BRPeerManagerUpdateKnownPeer(manager, peer);
+}
+
+// counts a scheduled merkleblock received from peer, updating its block rate once a full window has arrived
+static void _BRPeerManagerRecordFetchedBlock(BRPeerManager *manager, BRPeer *peer)
+{
+    BRPeerThroughput *t = NULL;
+    double now = _peerManagerTime(), rate;
+
+    for (size_t i = array_count(manager->throughput); ! t && i > 0; i--) {
+        if (manager->throughput[i - 1].peer == peer) t = &manager->throughput[i - 1];
+    }
+
+    if (! t) {
+        array_add(manager->throughput, ((const BRPeerThroughput) { peer, now, 0 }));
+        t = &manager->throughput[array_count(manager->throughput) - 1];
+    }
+
+    if (++t->blockCount < FETCH_WINDOW || now <= t->startTime) return;
+    rate = t->blockCount/(now - t->startTime) + 0.5;
+    if (rate > UINT32_MAX) rate = UINT32_MAX;
+    peer->blockRate = (peer->blockRate > 0) ? (uint32_t)((peer->blockRate + rate)/2) : (uint32_t)rate;
+    _BRPeerManagerUpdateKnownPeer(manager, peer);
+    t->startTime = now;
+    t->blockCount = 0;
+}
+
+// expected seconds to download the next window of merkleblocks from a connected peer
+static double _BRPeerManagerDownloadCost(BRPeer *peer)
+{
+    double blockRate = (peer->blockRate > 0) ? peer->blockRate : PEER_DEFAULT_BLOCK_RATE;
+
+    return BRPeerPingTime(peer) + FETCH_WINDOW/blockRate;
+}
+
+// number of merkleblocks to keep in flight to peer: enough to cover a few round trips at the rate it delivers blocks
+static size_t _BRPeerManagerFetchLimit(BRPeer *peer)
+{
+    double rtt = BRPeerPingTime(peer), blockRate = (peer->blockRate > 0) ? peer->blockRate : PEER_DEFAULT_BLOCK_RATE,
+           limit;
+
+    if (rtt <= 0 || rtt >= PROTOCOL_TIMEOUT) rtt = (peer->rttMs > 0) ? peer->rttMs/1000.0 : PEER_DEFAULT_RTT;
+    limit = blockRate*rtt*FETCH_RTT_MULTIPLE;
+    return (limit < FETCH_MIN_IN_FLIGHT) ? FETCH_MIN_IN_FLIGHT :
+           (limit > FETCH_MAX_IN_FLIGHT) ? FETCH_MAX_IN_FLIGHT : (size_t)limit;
+}
+
+// adds the time since start to histogram, returns the current time
+static double _BRPeerManagerRecordTime(BRPeerManager *manager, BRPeerManagerHistogram *histogram, double start)
+{
+    double now = _peerManagerTime(), us = (now - start)*1000000;
+    size_t i = 0;
+
+    while (i < PEER_MANAGER_HISTOGRAM_BUCKETS - 1 && us >= (double)((uint32_t)1 << i)) i++;
+    pthread_mutex_lock(&manager->statsLock);
+    histogram->count++;
+    histogram->total += now - start;
+    histogram->buckets[i]++;
+    pthread_mutex_unlock(&manager->statsLock);
+    return now;
+}
+
+// locks manager for handling a relayed block, returns the time the lock was acquired
+static double _BRPeerManagerLockForBlock(BRPeerManager *manager)
+{
+    double start = _peerManagerTime(), now;
+
+    pthread_mutex_lock(&manager->lock);
+    now = _BRPeerManagerRecordTime(manager, &manager->stats.lockWait, start);
+    manager->blockLockWait += now - start;
+    return now;
+}
+
+// unlocks manager after handling a relayed block, periodically logging how long blocks kept each other waiting
+static void _BRPeerManagerUnlockForBlock(BRPeerManager *manager, double lockTime)
+{
+    manager->blockLockHold += _BRPeerManagerRecordTime(manager, &manager->stats.lockHold, lockTime) - lockTime;
+
+    if (++manager->blockLockCount == 2000) {
+        _peer_log("BPM: relayed blocks held lock %.1fus, waited %.1fus on average over %zu blocks",
+                  manager->blockLockHold*1000000/manager->blockLockCount,
+                  manager->blockLockWait*1000000/manager->blockLockCount, manager->blockLockCount);
+        manager->blockLockHold = manager->blockLockWait = 0;
+        manager->blockLockCount = 0;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// the wallet calls below are timed for stats
+
+// registers tx with the manager's own wallet, see _BRPeerManagerRouteTransaction() for wallets added to it
+static int _BRPeerManagerRegisterTransaction(BRPeerManager *manager, BRTransaction *tx)
+{
+    double start = _peerManagerTime();
+    int r = BRWalletRegisterTransaction(manager->wallet, tx);
+
+    _BRPeerManagerRecordTime(manager, &manager->stats.wallet, start);
+    return r;
+}
+
+// each wallet ignores the tx it doesn't have
+static void _BRPeerManagerUpdateTransactions(BRPeerManager *manager, const UInt256 txHashes[], size_t txCount,
+                                             uint32_t blockHeight, uint32_t timestamp)
+{
+    double start = _peerManagerTime();
+
+    for (size_t i = 0; i < array_count(manager->wallets); i++) {
+        BRWalletUpdateTransactions(manager->wallets[i], txHashes, txCount, blockHeight, timestamp);
+    }
+
+    _BRPeerManagerRecordTime(manager, &manager->stats.wallet, start);
+}
+
+static void _BRPeerManagerSetTxUnconfirmedAfter(BRPeerManager *manager, uint32_t blockHeight)
+{
+    double start = _peerManagerTime();
+
+    for (size_t i = 0; i < array_count(manager->wallets); i++) {
+        BRWalletSetTxUnconfirmedAfter(manager->wallets[i], blockHeight);
+    }
+
+    _BRPeerManagerRecordTime(manager, &manager->stats.wallet, start);
+}
+
+static void _BRPeerManagerSyncStopped(BRPeerManager *manager)
+{
+    manager->syncStartHeight = 0;
+
+    if (manager->downloadPeer) {
+        // don't cancel timeout if there's a pending tx publish callback
+        for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
+            if (manager->publishedTx[i - 1].callback != NULL) return;
+        }
+    
+        BRPeerScheduleDisconnect(manager->downloadPeer, -1); // cancel sync timeout
+    }
+}
+
+// adds transaction to list of tx to be published, along with any unconfirmed inputs
+static void _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransaction *tx, void *info,
+                                             void (*callback)(void *, int))
 {
-    for (size_t i = array_count(list); i > 0; i--) {
-        if (! UInt256Eq(list[i - 1].txHash, txHash)) continue;
+    if (tx && tx->blockHeight == TX_UNCONFIRMED) {
+        for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
+            if (BRTransactionEq(manager->publishedTx[i - 1].tx, tx)) return;
+        }
         
-        for (size_t j = array_count(list[i - 1].peers); j > 0; j--) {
-            if (! BRPeerEq(&list[i - 1].peers[j - 1], peer)) continue;
-            array_rm(list[i - 1].peers, j - 1);
-            return 1;
+        array_add(manager->publishedTx, ((const BRPublishedTx) { tx, info, callback }));
+        array_add(manager->publishedTxHashes, tx->txHash);
+
+        for (size_t i = 0; i < tx->inCount; i++) {
+            _BRPeerManagerAddTxToPublishList(manager, BRWalletTransactionForHash(manager->wallet, tx->inputs[i].txHash),
+                                             NULL, NULL);
         }
+    }
+}
+
+static size_t _BRPeerManagerBlockLocators(BRPeerManager *manager, UInt256 locators[], size_t locatorsCount)
+{
+    // append 10 most recent block hashes, decending, then continue appending, doubling the step back each time,
+    // finishing with the genesis block (top, -1, -2, -3, -4, -5, -6, -7, -8, -9, -11, -15, -23, -39, -71, -135, ..., 0)
+    BRMerkleBlock *block = manager->lastBlock;
+    int32_t step = 1, i = 0, j;
+    
+    while (block && block->height > 0) {
+        if (locators && i < locatorsCount) locators[i] = block->blockHash;
+        if (++i >= 10) step *= 2;
         
-        break;
+        for (j = 0; block && j < step; j++) {
+            block = BRSetGet(manager->blocks, &block->prevBlock);
+        }
     }
     
-    return 0;
+    if (locators && i < locatorsCount) locators[i] = genesis_block_hash(manager->params);
+    return ++i;
 }
 
-// comparator for sorting peers by timestamp, most recent first
-inline static int _peerTimestampCompare(const void *peer, const void *otherPeer)
+static void _setApplyFreeBlock(void *info, void *block)
 {
-    if (((const BRPeer *)peer)->timestamp < ((const BRPeer *)otherPeer)->timestamp) return 1;
-    if (((const BRPeer *)peer)->timestamp > ((const BRPeer *)otherPeer)->timestamp) return -1;
-    return 0;
+    BRMerkleBlockFree(block);
 }
 
-// returns a hash value for a block's prevBlock value suitable for use in a hashtable
-inline static size_t _BRPrevBlockHash(const void *block)
+static void _setApplyFree(void *info, void *item)
 {
-    return (size_t)((const BRMerkleBlock *)block)->prevBlock.u32[0];
+    free(item);
 }
 
-// true if block and otherBlock have equal prevBlock values
-inline static int _BRPrevBlockEq(const void *block, const void *otherBlock)
+inline static size_t _BRMerkleBlockMemSize(const BRMerkleBlock *block)
 {
-    return UInt256Eq(((const BRMerkleBlock *)block)->prevBlock, ((const BRMerkleBlock *)otherBlock)->prevBlock);
+    return sizeof(*block) + block->hashesCount*sizeof(*block->hashes) + block->flagsLen;
+}
+
+// removes the pool entry at index, the block is also removed from the prevBlock index if it's still there
+static BRMerkleBlock *_BRPeerManagerOrphanPoolRemove(BRPeerManager *manager, size_t index)
+{
+    BRMerkleBlock *block = manager->orphanPool[index].block;
+
+    if (BRSetGet(manager->orphans, block) == block) BRSetRemove(manager->orphans, block);
+    if (manager->lastOrphan == block) manager->lastOrphan = NULL;
+    manager->orphanStats.bytes -= manager->orphanPool[index].size;
+    manager->orphanStats.count--;
+    array_rm(manager->orphanPool, index);
+    return block;
+}
+
+static size_t _BRPeerManagerOrphanPoolIndex(BRPeerManager *manager, const BRMerkleBlock *block)
+{
+    for (size_t i = array_count(manager->orphanPool); i > 0; i--) {
+        if (manager->orphanPool[i - 1].block == block) return i - 1;
+    }
+
+    return SIZE_MAX;
+}
+
+// holds block until the block before it arrives, evicting the oldest orphans as needed to stay within the pool limits
+static void _BRPeerManagerAddOrphan(BRPeerManager *manager, BRMerkleBlock *block, const BRPeer *peer)
+{
+    time_t now = time(NULL);
+    size_t i, peerCount = 0, oldest = SIZE_MAX;
+    BRMerkleBlock *b;
+
+    for (i = 0; peer && i < array_count(manager->orphanPool); i++) {
+        if (! BRPeerEq(&manager->orphanPool[i].peer, peer)) continue;
+        if (oldest == SIZE_MAX) oldest = i;
+        peerCount++;
+    }
+
+    if (peerCount >= ORPHAN_MAX_PER_PEER) { // make room in the peer's quota
+        BRMerkleBlockFree(_BRPeerManagerOrphanPoolRemove(manager, oldest));
+        manager->orphanStats.evicted++;
+    }
+
+    b = BRSetAdd(manager->orphans, block); // orphans are indexed by prevBlock, so this replaces any competing orphan
+
+    if (b != block && (i = _BRPeerManagerOrphanPoolIndex(manager, b)) != SIZE_MAX) {
+        BRMerkleBlockFree(_BRPeerManagerOrphanPoolRemove(manager, i));
+        manager->orphanStats.replaced++;
+    }
+
+    array_add(manager->orphanPool, ((const BROrphan) { block, (peer) ? *peer : BR_PEER_NONE, now,
+                                                       _BRMerkleBlockMemSize(block) }));
+    manager->orphanStats.bytes += manager->orphanPool[array_count(manager->orphanPool) - 1].size;
+    manager->orphanStats.count++;
+    manager->orphanStats.added++;
+    manager->lastOrphan = block;
+
+    while (array_count(manager->orphanPool) > 1 && (manager->orphanStats.bytes > ORPHAN_MAX_BYTES ||
+                                                    manager->orphanPool[0].addTime + ORPHAN_MAX_AGE < now)) {
+        BRMerkleBlockFree(_BRPeerManagerOrphanPoolRemove(manager, 0));
+        manager->orphanStats.evicted++;
+    }
+}
+
+// removes and returns the orphan that follows the block with blockHash, or NULL if there is none
+static BRMerkleBlock *_BRPeerManagerTakeOrphan(BRPeerManager *manager, UInt256 blockHash)
+{
+    BRMerkleBlock orphan, *block;
+    size_t i;
+
+    orphan.prevBlock = blockHash;
+    block = BRSetGet(manager->orphans, &orphan);
+    if (! block) return NULL;
+    i = _BRPeerManagerOrphanPoolIndex(manager, block);
+    if (i != SIZE_MAX) _BRPeerManagerOrphanPoolRemove(manager, i);
+    else BRSetRemove(manager->orphans, block);
+    manager->orphanStats.connected++;
+    return block;
+}
+
+static void _BRPeerManagerClearOrphans(BRPeerManager *manager)
+{
+    while (array_count(manager->orphanPool) > 0) {
+        BRMerkleBlockFree(_BRPeerManagerOrphanPoolRemove(manager, array_count(manager->orphanPool) - 1));
+        manager->orphanStats.evicted++;
+    }
+
+    BRSetApply(manager->orphans, NULL, _setApplyFreeBlock); // anything left was never in the pool
+    BRSetClear(manager->orphans);
+    manager->lastOrphan = NULL;
+}
+
+// requests block headers up to a week before earliestKeyTime from the download peer, and then merkleblocks after that
+static void _BRPeerManagerRequestChain(BRPeerManager *manager, BRPeer *peer)
+{
+    UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
+    size_t count = _BRPeerManagerBlockLocators(manager, locators, sizeof(locators)/sizeof(*locators));
+
+    BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule sync timeout
+
+    // we do not reset connect failure count yet incase this request times out
+    if (! manager->compactFilters && manager->lastBlock->timestamp + 7*24*60*60 >= manager->earliestKeyTime) {
+        BRPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
+    }
+    else BRPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+}
+
+// discards any headers received for range and marks it unassigned
+static void _BRHeaderRangeReset(BRHeaderRange *range)
+{
+    BRSetRemove(range->blocks, range->start); // start is owned by manager->blocks
+    BRSetApply(range->blocks, NULL, _setApplyFreeBlock);
+    BRSetClear(range->blocks);
+    BRSetAdd(range->blocks, range->start);
+    range->last = range->start;
+    range->peer = NULL;
+    range->done = range->failed = 0;
+}
+
+static void _BRPeerManagerClearHeaderRanges(BRPeerManager *manager)
+{
+    for (size_t i = array_count(manager->headerRanges); i > 0; i--) {
+        _BRHeaderRangeReset(&manager->headerRanges[i - 1]);
+        BRSetRemove(manager->headerRanges[i - 1].blocks, manager->headerRanges[i - 1].start);
+        BRSetFree(manager->headerRanges[i - 1].blocks);
+    }
+
+    array_clear(manager->headerRanges);
+}
+
+// splits the headers-only part of the chain download into ranges between consecutive checkpoints so they can be
+// requested from several peers at once, returns the number of ranges, or 0 if there are too few to be worthwhile
+static size_t _BRPeerManagerBuildHeaderRanges(BRPeerManager *manager)
+{
+    BRMerkleBlock *start = NULL, *end;
+
+    _BRPeerManagerClearHeaderRanges(manager);
+
+    for (size_t i = 0; i < manager->params->checkpointsCount; i++) {
+        UInt256 hash = UInt256Reverse(manager->params->checkpoints[i].hash);
+
+        // a range must end early enough that peers won't switch from headers to merkleblocks within it
+        end = BRSetGet(manager->blocks, &hash);
+        if (! end || end->timestamp + 7*24*60*60 + BLOCK_MAX_TIME_DRIFT >= manager->earliestKeyTime) break;
+
+        if (start) {
+            array_add(manager->headerRanges, ((const BRHeaderRange) { start, end, start, NULL,
+                      BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, BLOCK_DIFFICULTY_INTERVAL + 1), 0, 0 }));
+            BRSetAdd(manager->headerRanges[array_count(manager->headerRanges) - 1].blocks, start);
+            start = end;
+        }
+        else if (end == manager->lastBlock) start = end;
+    }
+
+    if (array_count(manager->headerRanges) < HEADER_RANGES_MIN) _BRPeerManagerClearHeaderRanges(manager);
+    return array_count(manager->headerRanges);
+}
+
+// returns the header range peer is currently downloading, or NULL
+static BRHeaderRange *_BRPeerManagerHeaderRangeForPeer(BRPeerManager *manager, const BRPeer *peer)
+{
+    for (size_t i = array_count(manager->headerRanges); i > 0; i--) {
+        if (manager->headerRanges[i - 1].peer == peer) return &manager->headerRanges[i - 1];
+    }
+
+    return NULL;
+}
+
+// requests the first unassigned header range from peer, returns true if peer has a range to download
+static int _BRPeerManagerAssignHeaderRange(BRPeerManager *manager, BRPeer *peer)
+{
+    BRHeaderRange *range = _BRPeerManagerHeaderRangeForPeer(manager, peer);
+
+    for (size_t i = 0; ! range && i < array_count(manager->headerRanges); i++) {
+        if (manager->headerRanges[i].done || manager->headerRanges[i].peer) continue;
+        if (BRPeerLastBlock(peer) < manager->headerRanges[i].end->height) break;
+        range = &manager->headerRanges[i];
+        range->peer = peer;
+        peer_log(peer, "requesting headers #%"PRIu32" to #%"PRIu32, range->start->height + 1, range->end->height);
+        BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule range timeout
+        BRPeerSendGetheaders(peer, &range->start->blockHash, 1, range->end->blockHash);
+    }
+
+    return (range != NULL);
+}
+
+// hands any unassigned header ranges to connected peers that aren't already downloading one
+static void _BRPeerManagerAssignHeaderRanges(BRPeerManager *manager)
+{
+    for (size_t i = 0; i < array_count(manager->connectedPeers); i++) {
+        BRPeer *p = manager->connectedPeers[i];
+
+        if (BRPeerConnectStatus(p) != BRPeerStatusConnected || _BRPeerManagerHeaderRangeForPeer(manager, p)) continue;
+        _BRPeerManagerAssignHeaderRange(manager, p);
+    }
+}
+
+// adds completed header ranges that follow lastBlock to the chain, then resumes the normal chain download
+static void _BRPeerManagerStitchHeaderRanges(BRPeerManager *manager)
+{
+    size_t stitched = 0;
+
+    while (array_count(manager->headerRanges) > 0 && manager->headerRanges[0].done &&
+           manager->headerRanges[0].start == manager->lastBlock) {
+        BRHeaderRange *range = &manager->headerRanges[0];
+        size_t count = (range->end->height - range->start->height)/BLOCK_DIFFICULTY_INTERVAL, i;
+        BRMerkleBlock *transitions[count], *b;
+
+        // keep the range's difficulty transitions, the last of which is the real header for the end checkpoint
+        memset(transitions, 0, sizeof(transitions));
+
+        for (b = BRSetIterate(range->blocks, NULL); b; b = BRSetIterate(range->blocks, b)) {
+            if (b == range->start || (b->height % BLOCK_DIFFICULTY_INTERVAL) != 0) continue;
+            transitions[(b->height - range->start->height)/BLOCK_DIFFICULTY_INTERVAL - 1] = b;
+        }
+
+        for (i = 0; i < count && transitions[i]; i++) BRSetRemove(range->blocks, transitions[i]);
+        if (i == count && manager->saveBlocks) manager->saveBlocks(manager->info, 0, transitions, count);
+
+        for (i = 0; i < count && transitions[i]; i++) {
+            b = BRSetGet(manager->blocks, transitions[i]);
+
+            if (b) BRMerkleBlockFree(transitions[i]); // don't replace checkpoints
+            else BRSetAdd(manager->blocks, transitions[i]);
+        }
+
+        _peer_log("BPM: added headers #%"PRIu32" to #%"PRIu32" to the chain", range->start->height + 1,
+                  range->end->height);
+        manager->lastBlock = range->end;
+        if (manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, manager->lastBlock->height);
+        _BRHeaderRangeReset(range);
+        BRSetRemove(range->blocks, range->start);
+        BRSetFree(range->blocks);
+        array_rm(manager->headerRanges, 0);
+        stitched++;
+    }
+
+    if (stitched > 0 && array_count(manager->headerRanges) == 0 && manager->downloadPeer) {
+        _BRPeerManagerRequestChain(manager, manager->downloadPeer);
+    }
+}
+
+// frees the headers in blocks from before the difficulty transition preceding block, except earlier transitions
+static void _BRBlockSetPrune(BRSet *blocks, const BRMerkleBlock *block)
+{
+    const BRMerkleBlock *b = block;
+    UInt256 prevBlock;
+
+    for (uint32_t i = 0; b && i < BLOCK_DIFFICULTY_INTERVAL; i++) {
+        b = BRSetGet(blocks, &b->prevBlock);
+    }
+
+    if (b) prevBlock = b->prevBlock;
+
+    while (b) {
+        BRMerkleBlock *p = BRSetGet(blocks, &prevBlock);
+
+        if (p) prevBlock = p->prevBlock;
+
+        if (p && (p->height % BLOCK_DIFFICULTY_INTERVAL) != 0) {
+            BRSetRemove(blocks, p);
+            BRMerkleBlockFree(p);
+        }
+
+        b = p;
+    }
+}
+
+// validates a header received for range independently of the chain, and adds the range to the chain once complete
+static void _BRPeerManagerHeaderRangeAddBlock(BRPeerManager *manager, BRHeaderRange *range, BRPeer *peer,
+                                              BRMerkleBlock *block)
+{
+    BRMerkleBlock *prev = BRSetGet(range->blocks, &block->prevBlock);
+    int r = 1;
+
+    if (range->failed || BRSetContains(range->blocks, block)) { // ignore the rest of a bad or duplicate response
+        BRMerkleBlockFree(block);
+        return;
+    }
+
+    if (prev != range->last || prev->height >= range->end->height) {
+        peer_log(peer, "relayed header %s that doesn't extend range ending at #%"PRIu32, u256hex(block->blockHash),
+                 range->end->height);
+        r = 0;
+    }
+    else block->height = prev->height + 1;
+
+    if (r && (block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) _BRBlockSetPrune(range->blocks, block);
+
+    if (r && ! manager->params->verifyDifficulty(block, range->blocks)) {
+        peer_log(peer, "relayed header with invalid difficulty target %x, blockHash: %s", block->target,
+                 u256hex(block->blockHash));
+        r = 0;
+    }
+
+    if (r && block->height == range->end->height && ! UInt256Eq(block->blockHash, range->end->blockHash)) {
+        peer_log(peer, "relayed a header that differs from the checkpoint at height %"PRIu32", blockHash: %s",
+                 block->height, u256hex(block->blockHash));
+        r = 0;
+    }
+
+    if (! r) { // the peer's range will be handed to another peer once it disconnects
+        BRMerkleBlockFree(block);
+        range->failed = 1;
+        _BRPeerManagerPeerMisbehavin(manager, peer);
+        return;
+    }
+
+    BRSetAdd(range->blocks, block);
+    range->last = block;
+    BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule range timeout
+    manager->connectFailureCount = 0;
+
+    if (block->height == range->end->height) {
+        peer_log(peer, "completed headers #%"PRIu32" to #%"PRIu32, range->start->height + 1, range->end->height);
+        range->done = 1;
+        range->peer = NULL;
+        if (array_count(manager->publishedTx) == 0) BRPeerScheduleDisconnect(peer, -1); // cancel range timeout
+        _BRPeerManagerStitchHeaderRanges(manager);
+        if (array_count(manager->headerRanges) > 0) _BRPeerManagerAssignHeaderRange(manager, peer);
+    }
+}
+
+// frees merkleblocks waiting to be added to the chain and drops all scheduled block requests, peers that loaded the
+// block fetch filter have to load it again before they're used again
+static void _BRPeerManagerResetFetches(BRPeerManager *manager)
+{
+    for (size_t i = manager->fetchHead; i < array_count(manager->fetches); i++) {
+        if (manager->fetches[i].block) BRMerkleBlockFree(manager->fetches[i].block);
+    }
+
+    array_clear(manager->fetches);
+    manager->fetchHead = manager->fetchEnd = 0;
+
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        BRPeer *p = manager->connectedPeers[i - 1];
+
+        if ((p->flags & (PEER_FLAG_FETCHPENDING | PEER_FLAG_FETCHREADY)) == 0) continue;
+        p->flags = (p->flags & ~PEER_FLAG_FETCHREADY) | PEER_FLAG_FETCHSTALE;
+        if (p != manager->downloadPeer && array_count(manager->publishedTx) == 0) BRPeerScheduleDisconnect(p, -1);
+    }
+}
+
+static void _BRPeerManagerDispatchFetches(BRPeerManager *manager);
+
+static void _fetchFilterLoadDone(void *info, int success)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+
+    free(info);
+    pthread_mutex_lock(&manager->lock);
+
+    if ((peer->flags & PEER_FLAG_FETCHSTALE) != 0) { // filter was replaced in the meantime, load it again
+        peer->flags &= ~(PEER_FLAG_FETCHPENDING | PEER_FLAG_FETCHSTALE);
+        if (success) _BRPeerManagerDispatchFetches(manager);
+    }
+    else if (success) {
+        peer->flags = (peer->flags & ~PEER_FLAG_FETCHPENDING) | PEER_FLAG_FETCHREADY;
+        _BRPeerManagerDispatchFetches(manager);
+    }
+    else peer->flags &= ~PEER_FLAG_FETCHPENDING;
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// loads the download peer's bloom filter into peer so it can help download merkleblocks
+static void _BRPeerManagerLoadFetchFilter(BRPeerManager *manager, BRPeer *peer)
+{
+    uint8_t data[BRBloomFilterSerialize(manager->bloomFilter, NULL, 0)];
+    size_t len = BRBloomFilterSerialize(manager->bloomFilter, data, sizeof(data));
+    BRPeerCallbackInfo *info = calloc(1, sizeof(*info));
+
+    assert(info != NULL);
+    info->peer = peer;
+    info->manager = manager;
+    peer->flags = (peer->flags & ~PEER_FLAG_FETCHSTALE) | PEER_FLAG_FETCHPENDING;
+    peer_log(peer, "loading filter to help with chain download");
+    BRPeerSendFilterload(peer, data, len);
+    BRPeerSendPing(peer, info, _fetchFilterLoadDone); // wait for pong so filter is loaded
+}
+
+// true if merkleblocks can be requested from peer using the current bloom filter
+static int _BRPeerManagerCanFetch(BRPeerManager *manager, BRPeer *peer)
+{
+    if (BRPeerConnectStatus(peer) != BRPeerStatusConnected) return 0;
+    if (peer == manager->downloadPeer) return ((peer->flags & PEER_FLAG_NEEDSUPDATE) == 0);
+    return ((peer->flags & PEER_FLAG_FETCHREADY) != 0 && BRPeerLastBlock(peer) > manager->lastBlock->height);
+}
+
+// requests scheduled merkleblocks, in chain order, from each peer that has room for more in flight, topping up each
+// peer's requests as blocks arrive so there's always about a bandwidth-delay product of them outstanding
+static void _BRPeerManagerDispatchFetches(BRPeerManager *manager)
+{
+    BRBlockFetch *f;
+    time_t now = time(NULL);
+    size_t i, j, n, count, limit, batch;
+
+    if (! manager->bloomFilter || manager->fetchHead >= array_count(manager->fetches)) return;
+
+    for (i = manager->fetchHead; i < manager->fetchEnd; i++) { // re-request blocks that are taking too long
+        f = &manager->fetches[i];
+        if (f->peer && ! f->block && f->requestTime + PROTOCOL_TIMEOUT < now) f->peer = NULL;
+    }
+
+    for (i = 0; i < array_count(manager->connectedPeers); i++) {
+        BRPeer *p = manager->connectedPeers[i];
+
+        if (p != manager->downloadPeer && BRPeerConnectStatus(p) == BRPeerStatusConnected &&
+            (p->flags & (PEER_FLAG_FETCHPENDING | PEER_FLAG_FETCHREADY)) == 0 &&
+            BRPeerLastBlock(p) > manager->lastBlock->height) {
+            _BRPeerManagerLoadFetchFilter(manager, p); // p can help once it has the filter
+        }
+
+        if (! _BRPeerManagerCanFetch(manager, p)) continue;
+
+        for (j = manager->fetchHead, count = 0; j < manager->fetchEnd; j++) {
+            if (manager->fetches[j].peer == p && ! manager->fetches[j].block) count++;
+        }
+
+        limit = _BRPeerManagerFetchLimit(p);
+
+        // wait for room for a batch of at least a quarter of the limit rather than sending a getdata for each block
+        while (count < limit && (limit - count)*4 >= limit) {
+            UInt256 hashes[FETCH_WINDOW];
+
+            batch = (limit - count < FETCH_WINDOW) ? limit - count : FETCH_WINDOW;
+
+            for (j = manager->fetchHead, n = 0; n < batch && j < array_count(manager->fetches); j++) {
+                f = &manager->fetches[j];
+                if (f->peer || f->block) continue;
+                f->peer = p;
+                f->requestTime = now;
+                hashes[n++] = f->blockHash;
+                if (j >= manager->fetchEnd) manager->fetchEnd = j + 1;
+            }
+
+            if (n == 0) break;
+            BRPeerSendGetdata(p, NULL, 0, hashes, n);
+            BRPeerScheduleDisconnect(p, PROTOCOL_TIMEOUT); // schedule fetch timeout (sync timeout for download peer)
+            count += n;
+        }
+    }
+}
+
+// takes over a merkleblock requested by the block fetch scheduler, returns true if block was consumed
+static int _BRPeerManagerFetchedBlock(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block)
+{
+    BRBlockFetch *f = NULL;
+    size_t i, count = 0;
+    int r = 0;
+
+    pthread_mutex_lock(&manager->lock);
+
+    for (i = manager->fetchHead; ! f && i < manager->fetchEnd; i++) {
+        if (UInt256Eq(manager->fetches[i].blockHash, block->blockHash)) f = &manager->fetches[i];
+    }
+
+    if (peer != manager->downloadPeer && manager->lastBlock->height < manager->estimatedHeight &&
+        (peer->flags & (PEER_FLAG_FETCHPENDING | PEER_FLAG_FETCHREADY | PEER_FLAG_FETCHSTALE)) != 0 &&
+        (! f || (peer->flags & PEER_FLAG_FETCHREADY) == 0)) {
+        BRMerkleBlockFree(block); // not scheduled, or matched against an outdated filter
+        r = 1;
+    }
+    else if (f) {
+        if (f->block) BRMerkleBlockFree(block); // already received from a peer it was re-requested from
+        else f->block = block;
+        _BRPeerManagerRecordFetchedBlock(manager, peer);
+        r = 1;
+
+        if (manager->downloadPeer) BRPeerScheduleDisconnect(manager->downloadPeer, PROTOCOL_TIMEOUT); // sync timeout
+        manager->connectFailureCount = 0;
+
+        if (peer != manager->downloadPeer) {
+            for (i = manager->fetchHead; i < manager->fetchEnd; i++) {
+                if (manager->fetches[i].peer == peer && ! manager->fetches[i].block) count++;
+            }
+
+            if (count > 0) BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule fetch timeout
+            else if (array_count(manager->publishedTx) == 0) BRPeerScheduleDisconnect(peer, -1);
+        }
+
+        _BRPeerManagerDispatchFetches(manager);
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    return r;
+}
+
+// removes and returns the next scheduled merkleblock once the block before it is in the chain, or NULL
+static BRMerkleBlock *_BRPeerManagerNextFetchedBlock(BRPeerManager *manager)
+{
+    BRMerkleBlock *block = NULL;
+
+    while (! block && manager->fetchHead < array_count(manager->fetches)) {
+        BRBlockFetch *f = &manager->fetches[manager->fetchHead];
+
+        if (f->block && BRSetContains(manager->blocks, &f->block->prevBlock)) block = f->block;
+        else if (f->block || ! BRSetContains(manager->blocks, &f->blockHash)) break; // skip if added some other way
+        manager->fetchHead++;
+    }
+
+    if (manager->fetchEnd < manager->fetchHead) manager->fetchEnd = manager->fetchHead;
+
+    if (manager->fetchHead >= FETCH_MAX_IN_FLIGHT && manager->fetchHead*2 >= array_count(manager->fetches)) {
+        array_rm_range(manager->fetches, 0, manager->fetchHead);
+        manager->fetchEnd -= manager->fetchHead;
+        manager->fetchHead = 0;
+    }
+
+    return block;
 }
 
-// returns a hash value for a block's height value suitable for use in a hashtable
-inline static size_t _BRBlockHeightHash(const void *block)
+// discards entries starting at index, such as when a header forks off the pending headers
+static void _BRPeerManagerTruncateCFEntries(BRPeerManager *manager, size_t index)
 {
-    // (FNV_OFFSET xor height)*FNV_PRIME
-    return (size_t)((0x811C9dc5 ^ ((const BRMerkleBlock *)block)->height)*0x01000193);
+    for (size_t i = array_count(manager->cfEntries); i > index; i--) {
+        BRMerkleBlockFree(manager->cfEntries[i - 1].block);
+        if (manager->cfEntries[i - 1].filter) BRGCSFilterFree(manager->cfEntries[i - 1].filter);
+    }
+
+    if (index < array_count(manager->cfEntries)) {
+        array_rm_range(manager->cfEntries, index, array_count(manager->cfEntries) - index);
+    }
+
+    if (manager->cfHeadersEnd > index) manager->cfHeadersEnd = index;
+    if (manager->cfFiltersNext > index) manager->cfFiltersNext = index;
+    if (manager->cfFiltersEnd > index) manager->cfFiltersEnd = index;
 }
 
-// true if block and otherBlock have equal height values
-inline static int _BRBlockHeightEq(const void *block, const void *otherBlock)
+static void _BRPeerManagerResetCFEntries(BRPeerManager *manager)
 {
-    return (((const BRMerkleBlock *)block)->height == ((const BRMerkleBlock *)otherBlock)->height);
+    _BRPeerManagerTruncateCFEntries(manager, manager->cfHead);
+    array_clear(manager->cfEntries);
+    manager->cfHead = manager->cfHeadersEnd = manager->cfFiltersNext = manager->cfFiltersEnd = 0;
+    manager->cfLastHeader = UINT256_ZERO;
+    manager->cfHeadersPending = 0;
 }
 
-struct BRPeerManagerStruct {
-    const BRChainParams *params;
-    BRWallet *wallet;
-    int isConnected, connectFailureCount, misbehavinCount, dnsThreadCount, peerThreadCount, maxConnectCount;
-    BRPeer *peers, *downloadPeer, fixedPeer, **connectedPeers;
-    char downloadPeerName[INET6_ADDRSTRLEN + 6];
-    uint32_t earliestKeyTime, syncStartHeight, filterUpdateHeight, estimatedHeight;
-    BRBloomFilter *bloomFilter;
-    double fpRate, averageTxPerBlock;
-    BRSet *blocks, *orphans, *checkpoints;
-    BRMerkleBlock *lastBlock, *lastOrphan;
-    BRTxPeerList *txRelays, *txRequests;
-    BRPublishedTx *publishedTx;
-    UInt256 *publishedTxHashes;
-    void *info;
-    void (*syncStarted)(void *info);
-    void (*syncStopped)(void *info, int error);
-    void (*txStatusUpdate)(void *info);
-    void (*saveBlocks)(void *info, int replace, BRMerkleBlock *blocks[], size_t blocksCount);
-    void (*savePeers)(void *info, int replace, const BRPeer peers[], size_t peersCount);
-    int (*networkIsReachable)(void *info);
-    void (*threadCleanup)(void *info);
-    pthread_mutex_t lock;
-};
-
-static void _BRPeerManagerPeerMisbehavin(BRPeerManager *manager, BRPeer *peer)
+// index of the entry with blockHash between start and end, or SIZE_MAX if there is none
+static size_t _BRPeerManagerCFEntryIndex(BRPeerManager *manager, UInt256 blockHash, size_t start, size_t end)
 {
-    for (size_t i = array_count(manager->peers); i > 0; i--) {
-        if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
-    }
-
-    if (++manager->misbehavinCount >= 10) { // clear out stored peers so we get a fresh list from DNS for next connect
-        manager->misbehavinCount = 0;
-        array_clear(manager->peers);
+    for (size_t i = start; i < end && i < array_count(manager->cfEntries); i++) {
+        if (UInt256Eq(manager->cfEntries[i].block->blockHash, blockHash)) return i;
     }
 
-    BRPeerDisconnect(peer);
+    return SIZE_MAX;
 }
 
-static void _BRPeerManagerSyncStopped(BRPeerManager *manager)
+// requests filter hashes once a full batch of headers is pending, or the chain tip is reached, and keeps a window of
+// filters downloading ahead of the chain
+static void _BRPeerManagerRequestCFilters(BRPeerManager *manager)
 {
-    manager->syncStartHeight = 0;
+    BRPeer *peer = manager->downloadPeer;
+    size_t end, count = array_count(manager->cfEntries);
+
+    if (! peer || ! manager->compactFilters) return;
+
+    if (! manager->cfHeadersPending && manager->cfHeadersEnd < count &&
+        (count - manager->cfHeadersEnd >= CF_HEADERS_BATCH ||
+         manager->cfEntries[count - 1].block->height >= BRPeerLastBlock(peer))) {
+        end = (count - manager->cfHeadersEnd > CF_HEADERS_BATCH) ? manager->cfHeadersEnd + CF_HEADERS_BATCH : count;
+        BRPeerSendGetcfheaders(peer, manager->cfEntries[manager->cfHeadersEnd].block->height,
+                               manager->cfEntries[end - 1].block->blockHash);
+        manager->cfHeadersPending = 1;
+    }
 
-    if (manager->downloadPeer) {
-        // don't cancel timeout if there's a pending tx publish callback
-        for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
-            if (manager->publishedTx[i - 1].callback != NULL) return;
-        }
-    
-        BRPeerScheduleDisconnect(manager->downloadPeer, -1); // cancel sync timeout
+    while (manager->cfFiltersEnd < manager->cfHeadersEnd &&
+           manager->cfFiltersEnd < manager->cfHead + CF_FILTERS_AHEAD &&
+           manager->cfFiltersEnd < manager->cfFiltersNext + 2*CF_FILTERS_BATCH) {
+        end = manager->cfFiltersEnd + CF_FILTERS_BATCH;
+        if (end > manager->cfHeadersEnd) end = manager->cfHeadersEnd;
+        if (end > manager->cfHead + CF_FILTERS_AHEAD) end = manager->cfHead + CF_FILTERS_AHEAD;
+        BRPeerSendGetcfilters(peer, manager->cfEntries[manager->cfFiltersEnd].block->height,
+                              manager->cfEntries[end - 1].block->blockHash);
+        manager->cfFiltersEnd = end;
     }
 }
 
-// adds transaction to list of tx to be published, along with any unconfirmed inputs
-static void _BRPeerManagerAddTxToPublishList(BRPeerManager *manager, BRTransaction *tx, void *info,
-                                             void (*callback)(void *, int))
+// total number of addresses in manager's wallets, manager must be locked
+static size_t _BRPeerManagerPKHCount(BRPeerManager *manager)
 {
-    if (tx && tx->blockHeight == TX_UNCONFIRMED) {
-        for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
-            if (BRTransactionEq(manager->publishedTx[i - 1].tx, tx)) return;
-        }
-        
-        array_add(manager->publishedTx, ((const BRPublishedTx) { tx, info, callback }));
-        array_add(manager->publishedTxHashes, tx->txHash);
+    size_t count = 0;
 
-        for (size_t i = 0; i < tx->inCount; i++) {
-            _BRPeerManagerAddTxToPublishList(manager, BRWalletTransactionForHash(manager->wallet, tx->inputs[i].txHash),
-                                             NULL, NULL);
-        }
-    }
+    for (size_t i = 0; i < array_count(manager->wallets); i++) count += BRWalletAllPKHs(manager->wallets[i], NULL, 0);
+    return count;
 }
 
-static size_t _BRPeerManagerBlockLocators(BRPeerManager *manager, UInt256 locators[], size_t locatorsCount)
+// true if filter matches the p2pkh or p2wpkh script of any wallet address, which also covers spends from the wallets
+// since basic filters include the scripts of spent outputs, pkhCount is set to the number of addresses matched against
+static int _BRPeerManagerMatchCFilter(BRPeerManager *manager, const BRGCSFilter *filter, size_t *pkhCount)
 {
-    // append 10 most recent block hashes, decending, then continue appending, doubling the step back each time,
-    // finishing with the genesis block (top, -1, -2, -3, -4, -5, -6, -7, -8, -9, -11, -15, -23, -39, -71, -135, ..., 0)
-    BRMerkleBlock *block = manager->lastBlock;
-    int32_t step = 1, i = 0, j;
-    
-    while (block && block->height > 0) {
-        if (locators && i < locatorsCount) locators[i] = block->blockHash;
-        if (++i >= 10) step *= 2;
-        
-        for (j = 0; block && j < step; j++) {
-            block = BRSetGet(manager->blocks, &block->prevBlock);
-        }
+    size_t i, n, count;
+    UInt160 *pkhs = NULL;
+    uint8_t (*scripts)[25];
+    const uint8_t **items;
+    size_t *lens;
+    int r;
+
+    array_new(pkhs, 100);
+    pthread_mutex_lock(&manager->watchLock); // keeps wallets from being removed
+
+    for (i = 0; i < array_count(manager->wallets); i++) {
+        BRWallet *wallet = manager->wallets[i];
+
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
+        BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
+        n = array_count(pkhs);
+        count = BRWalletAllPKHs(wallet, NULL, 0);
+        array_set_count(pkhs, n + count);
+        array_set_count(pkhs, n + BRWalletAllPKHs(wallet, &pkhs[n], count));
     }
-    
-    if (locators && i < locatorsCount) locators[i] = genesis_block_hash(manager->params);
-    return ++i;
+
+    pthread_mutex_unlock(&manager->watchLock);
+    count = array_count(pkhs);
+    scripts = malloc(2*count*sizeof(*scripts) + 1);
+    items = malloc(2*count*sizeof(*items) + 1);
+    lens = malloc(2*count*sizeof(*lens) + 1);
+    assert(scripts != NULL);
+    assert(items != NULL);
+    assert(lens != NULL);
+
+    for (i = 0; i < count; i++) {
+        uint8_t *p2pkh = scripts[2*i], *p2wpkh = scripts[2*i + 1];
+
+        p2pkh[0] = OP_DUP, p2pkh[1] = OP_HASH160, p2pkh[2] = sizeof(UInt160);
+        UInt160Set(&p2pkh[3], pkhs[i]);
+        p2pkh[23] = OP_EQUALVERIFY, p2pkh[24] = OP_CHECKSIG;
+        items[2*i] = p2pkh, lens[2*i] = 25;
+        p2wpkh[0] = OP_0, p2wpkh[1] = sizeof(UInt160);
+        UInt160Set(&p2wpkh[2], pkhs[i]);
+        items[2*i + 1] = p2wpkh, lens[2*i + 1] = 22;
+    }
+
+    r = BRGCSFilterMatchAny(filter, items, lens, 2*count);
+    *pkhCount = count;
+    free(lens);
+    free(items);
+    free(scripts);
+    array_free(pkhs);
+    return r;
 }
 
-static void _setApplyFreeBlock(void *info, void *block)
+// makes sure elem has at least hashCount cached hash lanes
+static void _BRPeerManagerWatchElementLanes(BRPeerManager *manager, BRWatchElement *elem, uint32_t hashCount)
 {
-    BRMerkleBlockFree(block);
+    if (hashCount > BLOOM_MAX_HASH_FUNCS) hashCount = BLOOM_MAX_HASH_FUNCS;
+    if (elem->laneCount >= hashCount) return;
+    BRBloomFilterDataHashes(manager->filterTweak, elem->data, elem->dataLen, &elem->lanes[elem->laneCount],
+                            elem->laneCount, hashCount - elem->laneCount);
+    elem->laneCount = hashCount;
 }
 
-static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
+// adds data to the watch set if needed and marks it as found in wallet, returns true if it isn't in the filter yet
+static int _BRPeerManagerWatch(BRPeerManager *manager, const uint8_t *data, size_t dataLen, BRWallet *wallet)
 {
-    // every time a new wallet address is added, the bloom filter has to be rebuilt, and each address is only used
-    // for one transaction, so here we generate some spare addresses to avoid rebuilding the filter each time a
-    // wallet transaction is encountered during the chain sync
-    BRWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
-    BRWalletUnusedAddrs(manager->wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
+    BRWatchElement e, *elem;
+
+    e.dataLen = dataLen;
+    memcpy(e.data, data, dataLen);
+    elem = BRSetGet(manager->watchSet, &e);
+
+    if (! elem) {
+        elem = calloc(1, sizeof(*elem));
+        assert(elem != NULL);
+        elem->dataLen = dataLen;
+        memcpy(elem->data, data, dataLen);
+        BRSetAdd(manager->watchSet, elem);
+    }
 
-    BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
-    BRSetClear(manager->orphans); // clear out orphans that may have been received on an old filter
-    manager->lastOrphan = NULL;
-    manager->filterUpdateHeight = manager->lastBlock->height;
-    manager->fpRate = BLOOM_REDUCED_FALSEPOSITIVE_RATE;
-    
-    size_t addrsCount = BRWalletAllAddrs(manager->wallet, NULL, 0);
-    BRAddress *addrs = malloc(addrsCount*sizeof(*addrs));
-    size_t utxosCount = BRWalletUTXOs(manager->wallet, NULL, 0);
-    BRUTXO *utxos = malloc(utxosCount*sizeof(*utxos));
-    UInt160 hash;
-    uint32_t blockHeight = (manager->lastBlock->height > 100) ? manager->lastBlock->height - 100 : 0;
+    if (elem->generation != manager->watchGeneration) elem->wallet = wallet, elem->shared = 0;
+    else if (elem->wallet != wallet) elem->shared = 1;
+    elem->generation = manager->watchGeneration;
+    _BRPeerManagerWatchElementLanes(manager, elem, manager->watchHashFuncs);
+    return ! elem->filtered;
+}
+
+// adds the addresses, UTXOs and TXOs spent since blockHeight of wallet to the watch set, watchLock must be held
+// returns the number of watched elements that aren't in the bloom filter yet
+static size_t _BRPeerManagerWatchWallet(BRPeerManager *manager, BRWallet *wallet, uint32_t blockHeight)
+{
+    BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
+    BRWalletUnusedAddrs(wallet, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED, SEQUENCE_INTERNAL_CHAIN);
+
+    size_t pkhsCount = BRWalletAllPKHs(wallet, NULL, 0);
+    UInt160 *pkhs = malloc(pkhsCount*sizeof(*pkhs) + 1);
+    size_t utxosCount = BRWalletUTXOs(wallet, NULL, 0);
+    BRUTXO *utxos = malloc(utxosCount*sizeof(*utxos) + 1);
+    size_t txCount = BRWalletTxUnconfirmedBefore(wallet, NULL, 0, blockHeight), count = 0;
+    BRTransaction **transactions = malloc(txCount*sizeof(*transactions) + 1);
     uint8_t o[sizeof(UInt256) + sizeof(uint32_t)];
-    size_t txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, blockHeight);
-    BRTransaction **transactions = malloc(txCount*sizeof(*transactions));
-    BRBloomFilter *filter;
-    
-    assert(addrs != NULL);
+
+    assert(pkhs != NULL);
     assert(utxos != NULL);
     assert(transactions != NULL);
-    addrsCount = BRWalletAllAddrs(manager->wallet, addrs, addrsCount);
-    utxosCount = BRWalletUTXOs(manager->wallet, utxos, utxosCount);
-    txCount = BRWalletTxUnconfirmedBefore(manager->wallet, transactions, txCount, blockHeight);
-    filter = BRBloomFilterNew(manager->fpRate, addrsCount + utxosCount + txCount + 100, (uint32_t)BRPeerHash(peer),
-                              BLOOM_UPDATE_ALL); // BUG: XXX txCount not the same as number of spent wallet outputs
-    
-    for (size_t i = 0; i < addrsCount; i++) { // add addresses to watch for tx receiveing money to the wallet
-        if (BRAddressHash160(&hash, manager->params->addrParams, addrs[i].s) &&
-            ! BRBloomFilterContainsData(filter, hash.u8, sizeof(hash))) {
-            BRBloomFilterInsertData(filter, hash.u8, sizeof(hash));
-        }
+    pkhsCount = BRWalletAllPKHs(wallet, pkhs, pkhsCount);
+    utxosCount = BRWalletUTXOs(wallet, utxos, utxosCount);
+    txCount = BRWalletTxUnconfirmedBefore(wallet, transactions, txCount, blockHeight);
+
+    for (size_t i = txCount; i > 0; i--) { // only TXOs spent by the wallet are watched
+        if (BRWalletAmountSentByTx(wallet, transactions[i - 1]) == 0) transactions[i - 1] = NULL;
+    }
+
+    for (size_t i = 0; i < pkhsCount; i++) { // add addresses to watch for tx receiveing money to the wallet
+        count += _BRPeerManagerWatch(manager, pkhs[i].u8, sizeof(*pkhs), wallet);
     }
 
-    free(addrs);
-        
     for (size_t i = 0; i < utxosCount; i++) { // add UTXOs to watch for tx sending money from the wallet
         UInt256Set(o, utxos[i].hash);
         UInt32SetLE(&o[sizeof(UInt256)], utxos[i].n);
-        if (! BRBloomFilterContainsData(filter, o, sizeof(o))) BRBloomFilterInsertData(filter, o, sizeof(o));
+        count += _BRPeerManagerWatch(manager, o, sizeof(o), wallet);
     }
-    
-    free(utxos);
-        
+
     for (size_t i = 0; i < txCount; i++) { // also add TXOs spent within the last 100 blocks
-        if (BRWalletAmountSentByTx(manager->wallet, transactions[i]) > 0) {
-            for (size_t j = 0; j < transactions[i]->inCount; j++) {
-                UInt256Set(o, transactions[i]->inputs[j].txHash);
-                UInt32SetLE(&o[sizeof(UInt256)], transactions[i]->inputs[j].index);
-                if (! BRBloomFilterContainsData(filter, o, sizeof(o))) BRBloomFilterInsertData(filter, o, sizeof(o));
-            }
+        for (size_t j = 0; transactions[i] && j < transactions[i]->inCount; j++) {
+            UInt256Set(o, transactions[i]->inputs[j].txHash);
+            UInt32SetLE(&o[sizeof(UInt256)], transactions[i]->inputs[j].index);
+            count += _BRPeerManagerWatch(manager, o, sizeof(o), wallet);
         }
     }
-    
+
+    free(pkhs);
+    free(utxos);
     free(transactions);
+    return count;
+}
+
+// every time a new wallet address is added, the bloom filter has to be updated, and each address is only used for one
+// transaction, so here we generate some spare addresses to avoid updating the filter each time a wallet transaction is
+// encountered during the chain sync, then add the addresses, UTXOs and TXOs spent since blockHeight of each wallet to
+// the watch set, which also serves to route matched tx to the wallets they belong to
+// hash lanes are computed here for new elements only, so this should be called without holding lock where possible
+// returns the number of watched elements that aren't in the bloom filter yet
+static size_t _BRPeerManagerRefreshWatchSet(BRPeerManager *manager, uint32_t blockHeight)
+{
+    size_t count = 0;
+
+    pthread_mutex_lock(&manager->watchLock);
+    manager->watchGeneration++;
+
+    for (size_t i = 0; i < array_count(manager->wallets); i++) {
+        count += _BRPeerManagerWatchWallet(manager, manager->wallets[i], blockHeight);
+    }
+
+    pthread_mutex_unlock(&manager->watchLock);
+    return count;
+}
+
+// replaces bloomFilter with a new one built from the watch set, dropping elements that are no longer in the wallet
+// only filter bits are set here, hash lanes are already cached
+static void _BRPeerManagerRebuildBloomFilter(BRPeerManager *manager)
+{
+    BRWatchElement *elem, **elems;
+    BRBloomFilter *filter;
+    size_t count;
+
+    pthread_mutex_lock(&manager->watchLock);
+    count = BRSetCount(manager->watchSet);
+    elems = malloc(count*sizeof(*elems));
+    assert(elems != NULL);
+    count = BRSetAll(manager->watchSet, (void **)elems, count);
+
+    for (size_t i = count; i > 0; i--) {
+        elem = elems[i - 1];
+        if (elem->generation == manager->watchGeneration) continue;
+        BRSetRemove(manager->watchSet, elem);
+        free(elem);
+        elems[i - 1] = elems[--count];
+    }
+
+    filter = BRBloomFilterNew(manager->fpRate, count + 100, manager->filterTweak, BLOOM_UPDATE_ALL);
+    manager->watchHashFuncs = filter->hashFuncs;
+
+    for (size_t i = 0; i < count; i++) {
+        _BRPeerManagerWatchElementLanes(manager, elems[i], filter->hashFuncs);
+        BRBloomFilterInsertHashes(filter, elems[i]->lanes, elems[i]->laneCount);
+        elems[i]->filtered = 1;
+    }
+
+    pthread_mutex_unlock(&manager->watchLock);
+    free(elems);
     if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
     manager->bloomFilter = filter;
-    // TODO: XXX if already synced, recursively add inputs of unconfirmed receives
+    manager->filterCapacity = count + 100;
 
-    uint8_t data[BRBloomFilterSerialize(filter, NULL, 0)];
-    size_t len = BRBloomFilterSerialize(filter, data, sizeof(data));
-    
-    BRPeerSendFilterload(peer, data, len);
+    // a filter pending an update no longer has all elements that are marked as filtered
+    if (manager->pendingFilter) BRBloomFilterFree(manager->pendingFilter);
+    manager->pendingFilter = NULL;
 }
 
-static void _updateFilterRerequestDone(void *info, int success)
+// inserts watched elements that aren't in filter yet into it, and sends them to each of peers with filteradd
+// returns false, leaving filter unchanged, if filter doesn't have capacity left for all of them
+static int _BRPeerManagerExtendBloomFilter(BRPeerManager *manager, BRBloomFilter *filter, BRPeer *peers[],
+                                           size_t peersCount)
 {
-    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
-    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-    
-    free(info);
-    
-    if (success) {
-        pthread_mutex_lock(&manager->lock);
+    BRWatchElement *elem = NULL;
+    size_t count = 0;
 
-        if ((peer->flags & PEER_FLAG_NEEDSUPDATE) == 0) {
-            UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
-            size_t count = _BRPeerManagerBlockLocators(manager, locators, sizeof(locators)/sizeof(*locators));
-            
-            BRPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
+    pthread_mutex_lock(&manager->watchLock);
+
+    while ((elem = BRSetIterate(manager->watchSet, elem)) != NULL) {
+        if (! elem->filtered) count++;
+    }
+
+    if (filter->elemCount + count <= manager->filterCapacity) {
+        while (count > 0 && (elem = BRSetIterate(manager->watchSet, elem)) != NULL) {
+            if (elem->filtered) continue;
+            _BRPeerManagerWatchElementLanes(manager, elem, filter->hashFuncs);
+            BRBloomFilterInsertHashes(filter, elem->lanes, elem->laneCount);
+            elem->filtered = 1;
+            for (size_t i = 0; i < peersCount; i++) BRPeerSendFilteradd(peers[i], elem->data, elem->dataLen);
         }
+    }
+    else count = SIZE_MAX;
 
-        pthread_mutex_unlock(&manager->lock);
+    pthread_mutex_unlock(&manager->watchLock);
+    return (count != SIZE_MAX);
+}
+
+// clears out state that depends on the filter peers had loaded
+static void _BRPeerManagerFilterChanged(BRPeerManager *manager)
+{
+    _BRPeerManagerClearOrphans(manager); // clear out orphans that may have been received on an old filter
+    _BRPeerManagerResetFetches(manager); // likewise for merkleblocks waiting to be added to the chain
+    manager->filterUpdateHeight = manager->lastBlock->height;
+}
+
+static void _BRPeerManagerLoadBloomFilter(BRPeerManager *manager, BRPeer *peer)
+{
+    uint32_t blockHeight = (manager->lastBlock->height > 100) ? manager->lastBlock->height - 100 : 0;
+
+    if (manager->compactFilters) return; // wallet tx are found by matching block filters locally instead
+    _BRPeerManagerFilterChanged(manager);
+    manager->fpRate = BLOOM_REDUCED_FALSEPOSITIVE_RATE;
+    _BRPeerManagerRefreshWatchSet(manager, blockHeight);
+
+    // all peers share the same filter, it's only rebuilt when there is none or it's out of capacity for new elements
+    if (! manager->bloomFilter || ! _BRPeerManagerExtendBloomFilter(manager, manager->bloomFilter, NULL, 0)) {
+        _BRPeerManagerRebuildBloomFilter(manager);
     }
+
+    // TODO: XXX if already synced, recursively add inputs of unconfirmed receives
+    uint8_t data[BRBloomFilterSerialize(manager->bloomFilter, NULL, 0)];
+    size_t len = BRBloomFilterSerialize(manager->bloomFilter, data, sizeof(data));
+    
+    BRPeerSendFilterload(peer, data, len);
 }
 
 static void _updateFilterLoadDone(void *info, int success)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-    BRPeerCallbackInfo *peerInfo;
 
     free(info);
     
@@ -371,12 +1552,12 @@ static void _updateFilterLoadDone(void *info, int success)
         
         if (manager->lastBlock->height < manager->estimatedHeight) { // if syncing, rerequest blocks
             if (manager->downloadPeer) {
-                peerInfo = calloc(1, sizeof(*peerInfo));
-                assert(peerInfo != NULL);
-                peerInfo->peer = peer;
-                peerInfo->manager = manager;
+                UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
+                size_t count = _BRPeerManagerBlockLocators(manager, locators, sizeof(locators)/sizeof(*locators));
+
                 BRPeerRerequestBlocks(manager->downloadPeer, manager->lastBlock->blockHash);
-                BRPeerSendPing(manager->downloadPeer, peerInfo, _updateFilterRerequestDone);
+                // peers answer in order, so the rest of the chain can be requested right behind the re-requested blocks
+                BRPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
             }
         }
         else BRPeerSendMempool(peer, NULL, 0, NULL, NULL); // if not syncing, request mempool
@@ -390,35 +1571,66 @@ static void _updateFilterPingDone(void *info, int success)
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     BRPeerCallbackInfo *peerInfo;
+    BRBloomFilter *filter;
+    uint32_t blockHeight;
     
     if (success) {
+        pthread_mutex_lock(&manager->lock);
+        blockHeight = (manager->lastBlock->height > 100) ? manager->lastBlock->height - 100 : 0;
+        pthread_mutex_unlock(&manager->lock);
+        _BRPeerManagerRefreshWatchSet(manager, blockHeight); // hash the new wallet elements without holding the lock
+
         pthread_mutex_lock(&manager->lock);
         peer_log(peer, "updating filter with newly created wallet addresses");
         if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
         manager->bloomFilter = NULL;
+        filter = manager->pendingFilter; // if it has capacity left, new elements are sent with filteradd instead
+        manager->pendingFilter = NULL;
 
         if (manager->lastBlock->height < manager->estimatedHeight) { // if we're syncing, only update download peer
             if (manager->downloadPeer) {
-                _BRPeerManagerLoadBloomFilter(manager, manager->downloadPeer);
+                if (filter && _BRPeerManagerExtendBloomFilter(manager, filter, &manager->downloadPeer, 1)) {
+                    _BRPeerManagerFilterChanged(manager);
+                    manager->bloomFilter = filter;
+                    filter = NULL;
+                }
+                else _BRPeerManagerLoadBloomFilter(manager, manager->downloadPeer);
+
                 BRPeerSendPing(manager->downloadPeer, info, _updateFilterLoadDone); // wait for pong so filter is loaded
             }
             else free(info);
         }
         else {
+            BRPeer *peers[array_count(manager->connectedPeers) + 1];
+            size_t peersCount = 0;
+
             free(info);
             
             for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
                 if (BRPeerConnectStatus(manager->connectedPeers[i - 1]) != BRPeerStatusConnected) continue;
+                peers[peersCount++] = manager->connectedPeers[i - 1];
+            }
+
+            if (filter && _BRPeerManagerExtendBloomFilter(manager, filter, peers, peersCount)) {
+                _BRPeerManagerFilterChanged(manager);
+                manager->bloomFilter = filter;
+                filter = NULL;
+            }
+            else {
+                for (size_t i = 0; i < peersCount; i++) _BRPeerManagerLoadBloomFilter(manager, peers[i]);
+            }
+
+            for (size_t i = 0; i < peersCount; i++) {
                 peerInfo = calloc(1, sizeof(*peerInfo));
                 assert(peerInfo != NULL);
-                peerInfo->peer = manager->connectedPeers[i - 1];
+                peerInfo->peer = peers[i];
                 peerInfo->manager = manager;
-                _BRPeerManagerLoadBloomFilter(manager, peerInfo->peer);
                 BRPeerSendPing(peerInfo->peer, peerInfo, _updateFilterLoadDone); // wait for pong so filter is loaded
             }
         }
 
-         pthread_mutex_unlock(&manager->lock);
+        if (filter) BRBloomFilterFree(filter);
+        pthread_mutex_unlock(&manager->lock);
     }
     else free(info);
 }
@@ -427,7 +1639,8 @@ static void _BRPeerManagerUpdateFilter(BRPeerManager *manager)
 {
     BRPeerCallbackInfo *info;
 
-    if (manager->downloadPeer && (manager->downloadPeer->flags & PEER_FLAG_NEEDSUPDATE) == 0) {
+    if (manager->downloadPeer && ! manager->compactFilters &&
+        (manager->downloadPeer->flags & PEER_FLAG_NEEDSUPDATE) == 0) {
         BRPeerSetNeedsFilterUpdate(manager->downloadPeer, 1);
         manager->downloadPeer->flags |= PEER_FLAG_NEEDSUPDATE;
         peer_log(manager->downloadPeer, "filter update needed, waiting for pong");
@@ -462,12 +1675,13 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
 
     // don't remove transactions until we're connected to maxConnectCount peers, and all peers have finished
     // relaying their mempools
-    if (count >= manager->maxConnectCount) {
+    for (size_t w = 0; count >= manager->maxConnectCount && w < array_count(manager->wallets); w++) {
+        BRWallet *wallet = manager->wallets[w];
         UInt256 hash;
-        size_t txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, TX_UNCONFIRMED);
+        size_t txCount = BRWalletTxUnconfirmedBefore(wallet, NULL, 0, TX_UNCONFIRMED);
         BRTransaction *tx[(txCount*sizeof(BRTransaction *) <= 0x1000) ? txCount : 0x1000/sizeof(BRTransaction *)];
         
-        txCount = BRWalletTxUnconfirmedBefore(manager->wallet, tx, sizeof(tx)/sizeof(*tx), TX_UNCONFIRMED);
+        txCount = BRWalletTxUnconfirmedBefore(wallet, tx, sizeof(tx)/sizeof(*tx), TX_UNCONFIRMED);
 
         for (size_t i = txCount; i > 0; i--) {
             hash = tx[i - 1]->txHash;
@@ -478,15 +1692,15 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
                     manager->publishedTx[j - 1].callback != NULL) isPublishing = 1;
             }
             
-            if (! isPublishing && _BRTxPeerListCount(manager->txRelays, hash) == 0 &&
-                _BRTxPeerListCount(manager->txRequests, hash) == 0) {
+            if (! isPublishing && _BRPeerManagerTxPeerCount(manager->txRelays, hash) == 0 &&
+                _BRPeerManagerTxPeerCount(manager->txRequests, hash) == 0) {
                 peer_log(peer, "removing tx unconfirmed at: %d, txHash: %s", manager->lastBlock->height, u256hex(hash));
                 assert(tx[i - 1]->blockHeight == TX_UNCONFIRMED);
-                BRWalletRemoveTransaction(manager->wallet, hash);
+                BRWalletRemoveTransaction(wallet, hash);
             }
-            else if (! isPublishing && _BRTxPeerListCount(manager->txRelays, hash) < manager->maxConnectCount) {
+            else if (! isPublishing && _BRPeerManagerTxPeerCount(manager->txRelays, hash) < manager->maxConnectCount) {
                 // set timestamp 0 to mark as unverified
-                BRWalletUpdateTransactions(manager->wallet, &hash, 1, TX_UNCONFIRMED, 0);
+                _BRPeerManagerUpdateTransactions(manager, &hash, 1, TX_UNCONFIRMED, 0);
             }
         }
     }
@@ -497,20 +1711,28 @@ static void _requestUnrelayedTxGetdataDone(void *info, int success)
 static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *peer)
 {
     BRPeerCallbackInfo *info;
-    size_t hashCount = 0, txCount = BRWalletTxUnconfirmedBefore(manager->wallet, NULL, 0, TX_UNCONFIRMED);
-    BRTransaction *tx[txCount];
-    UInt256 txHashes[txCount];
-    
-    txCount = BRWalletTxUnconfirmedBefore(manager->wallet, tx, txCount, TX_UNCONFIRMED);
-    
-    for (size_t i = 0; i < txCount; i++) {
-        if (! _BRTxPeerListHasPeer(manager->txRelays, tx[i]->txHash, peer) &&
-            ! _BRTxPeerListHasPeer(manager->txRequests, tx[i]->txHash, peer)) {
-            txHashes[hashCount++] = tx[i]->txHash;
-            _BRTxPeerListAddPeer(&manager->txRequests, tx[i]->txHash, peer);
+    UInt256 *txHashes = NULL;
+    size_t hashCount;
+
+    array_new(txHashes, 10);
+
+    for (size_t w = 0; w < array_count(manager->wallets); w++) {
+        size_t txCount = BRWalletTxUnconfirmedBefore(manager->wallets[w], NULL, 0, TX_UNCONFIRMED);
+        BRTransaction *tx[txCount + 1];
+
+        txCount = BRWalletTxUnconfirmedBefore(manager->wallets[w], tx, txCount, TX_UNCONFIRMED);
+
+        for (size_t i = 0; i < txCount; i++) {
+            if (! _BRPeerManagerTxHasPeer(manager, manager->txRelays, tx[i]->txHash, peer) &&
+                ! _BRPeerManagerTxHasPeer(manager, manager->txRequests, tx[i]->txHash, peer)) {
+                array_add(txHashes, tx[i]->txHash);
+                _BRPeerManagerTxAddPeer(manager, manager->txRequests, tx[i]->txHash, peer);
+            }
         }
     }
 
+    hashCount = array_count(txHashes);
+
     if (hashCount > 0) {
         BRPeerSendGetdata(peer, txHashes, hashCount, NULL, 0);
     
@@ -523,6 +1745,8 @@ static void _BRPeerManagerRequestUnrelayedTx(BRPeerManager *manager, BRPeer *pee
         }
     }
     else peer->flags |= PEER_FLAG_SYNCED;
+
+    array_free(txHashes);
 }
 
 static void _BRPeerManagerPublishPendingTx(BRPeerManager *manager, BRPeer *peer)
@@ -562,29 +1786,14 @@ static void _mempoolDone(void *info, int success)
     else peer_log(peer, "mempool request failed");
 }
 
-static void _loadBloomFilterDone(void *info, int success)
+// requests peer's mempool, peers handle messages in order, so there's no need to wait for a pong after a filterload
+static void _BRPeerManagerRequestMempool(BRPeerManager *manager, BRPeer *peer, BRPeerCallbackInfo *info)
 {
-    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
-    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-
-    pthread_mutex_lock(&manager->lock);
-    
-    if (success) {
-        BRPeerSendMempool(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes), info,
-                          _mempoolDone);
-        pthread_mutex_unlock(&manager->lock);
-    }
-    else {
-        free(info);
-        
-        if (peer == manager->downloadPeer) {
-            peer_log(peer, "sync succeeded");
-            _BRPeerManagerSyncStopped(manager);
-            pthread_mutex_unlock(&manager->lock);
-            if (manager->syncStopped) manager->syncStopped(manager->info, 0);
-        }
-        else pthread_mutex_unlock(&manager->lock);
+    if (manager->compactFilters) { // no filter is loaded, and peers don't relay unconfirmed tx without one
+        BRPeerSendPing(peer, info, _mempoolDone);
     }
+    else BRPeerSendMempool(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes), info,
+                           _mempoolDone);
 }
 
 static void _BRPeerManagerLoadMempools(BRPeerManager *manager)
@@ -600,13 +1809,13 @@ static void _BRPeerManagerLoadMempools(BRPeerManager *manager)
         info->peer = peer;
         info->manager = manager;
         
-        if (peer != manager->downloadPeer || manager->fpRate > BLOOM_REDUCED_FALSEPOSITIVE_RATE*5.0) {
+        if (manager->compactFilters) _BRPeerManagerPublishPendingTx(manager, peer);
+        else if (peer != manager->downloadPeer || manager->fpRate > BLOOM_REDUCED_FALSEPOSITIVE_RATE*5.0) {
             _BRPeerManagerLoadBloomFilter(manager, peer);
             _BRPeerManagerPublishPendingTx(manager, peer);
-            BRPeerSendPing(peer, info, _loadBloomFilterDone); // load mempool after updating bloomfilter
         }
-        else BRPeerSendMempool(peer, manager->publishedTxHashes, array_count(manager->publishedTxHashes), info,
-                               _mempoolDone);
+
+        _BRPeerManagerRequestMempool(manager, peer, info); // the mempool is matched against any filter loaded above
     }
 }
 
@@ -643,26 +1852,58 @@ static void *_findPeersThreadRoutine(void *arg)
 {
     BRPeerManager *manager = ((BRFindPeersInfo *)arg)->manager;
     uint64_t services = ((BRFindPeersInfo *)arg)->services;
+    int connect = ((BRFindPeersInfo *)arg)->connect, found = 0, stopped = 0;
     UInt128 *addrList, *addr;
     time_t now = time(NULL), age;
     
     pthread_cleanup_push(manager->threadCleanup, manager->info);
     addrList = _addressLookup(((BRFindPeersInfo *)arg)->hostname);
-    free(arg);
     pthread_mutex_lock(&manager->lock);
     
     for (addr = addrList; addr && ! UInt128IsZero(*addr); addr++) {
-        age = 24*60*60 + BRRand(2*24*60*60); // add between 1 and 3 days
-        array_add(manager->peers, ((const BRPeer) { *addr, manager->params->standardPort, services, now - age, 0 }));
+        // add between 1 and 3 days, but for the primary seed when it's looked up here as well
+        age = (connect && ((BRFindPeersInfo *)arg)->hostname == manager->params->dnsSeeds[0]) ? 0 :
+              24*60*60 + BRRand(2*24*60*60);
+        array_add(manager->peers, ((const BRPeer) { *addr, manager->params->standardPort, services, now - age, 0,
+                                                    0, 0, 0 }));
+        found = 1;
     }
 
+    free(arg);
+    
+    if (connect) { // the manager may be connecting or disconnecting, and isn't waiting on the lookup
+        qsort(manager->peers, array_count(manager->peers), sizeof(*manager->peers), _peerTimestampCompare);
+        connect = (manager->maxConnectCount > 0 && manager->connectFailureCount < MAX_CONNECT_FAILURES &&
+                   array_count(manager->connectedPeers) < manager->maxConnectCount);
+    }
+    
+    if (connect && found) { // still counted as a lookup so BRPeerManagerDisconnect() waits for the connect attempt
+        pthread_mutex_unlock(&manager->lock);
+        BRPeerManagerConnect(manager);
+        pthread_mutex_lock(&manager->lock);
+    }
+    
     manager->dnsThreadCount--;
+    
+    if (connect && manager->dnsThreadCount == 0 && array_count(manager->connectedPeers) == 0 &&
+        array_count(manager->peers) == 0) { // no seed could be resolved
+        _BRPeerManagerSyncStopped(manager);
+        stopped = 1;
+    }
+    
     pthread_mutex_unlock(&manager->lock);
+    if (stopped && manager->syncStopped) manager->syncStopped(manager->info, ENETUNREACH);
     if (addrList) free(addrList);
     pthread_cleanup_pop(1);
     return NULL;
 }
 
+// reactor serving the manager's peer connections, or NULL for a thread per peer
+static BRPeerReactor *_BRPeerManagerReactor(BRPeerManager *manager)
+{
+    return (manager->reactor) ? manager->reactor : BRPeerDefaultReactor();
+}
+
 // DNS peer discovery
 static void _BRPeerManagerFindPeers(BRPeerManager *manager)
 {
@@ -673,6 +1914,7 @@ static void _BRPeerManagerFindPeers(BRPeerManager *manager)
     pthread_attr_t attr;
     UInt128 *addr, *addrList;
     BRFindPeersInfo *info;
+    int lookups = manager->dnsThreadCount;
     
     if (! UInt128IsZero(manager->fixedPeer.address)) {
         array_set_count(manager->peers, 1);
@@ -680,6 +1922,19 @@ static void _BRPeerManagerFindPeers(BRPeerManager *manager)
         manager->peers[0].services = services;
         manager->peers[0].timestamp = now;
     }
+    else if (_BRPeerManagerReactor(manager)) { // this may be a reactor loop thread, which mustn't wait on DNS
+        for (size_t i = 0; lookups == 0 && manager->params->dnsSeeds[i]; i++) { // unless lookups are under way
+            info = calloc(1, sizeof(BRFindPeersInfo));
+            assert(info != NULL);
+            info->manager = manager;
+            info->hostname = manager->params->dnsSeeds[i];
+            info->services = services;
+            info->connect = 1; // the lookups connect to the peers they find
+            if (pthread_attr_init(&attr) == 0 && pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) == 0 &&
+                pthread_create(&thread, &attr, _findPeersThreadRoutine, info) == 0) manager->dnsThreadCount++;
+            else free (info);
+        }
+    }
     else {
         for (size_t i = 1; manager->params->dnsSeeds[i]; i++) {
             info = calloc(1, sizeof(BRFindPeersInfo));
@@ -693,7 +1948,8 @@ static void _BRPeerManagerFindPeers(BRPeerManager *manager)
         }
 
         for (addr = addrList = _addressLookup(manager->params->dnsSeeds[0]); addr && ! UInt128IsZero(*addr); addr++) {
-            array_add(manager->peers, ((const BRPeer) { *addr, manager->params->standardPort, services, now, 0 }));
+            array_add(manager->peers, ((const BRPeer) { *addr, manager->params->standardPort, services, now, 0, 0,
+                                                        0, 0 }));
         }
 
         if (addrList) free(addrList);
@@ -719,6 +1975,8 @@ static void _peerConnected(void *info)
     
     pthread_mutex_lock(&manager->lock);
     if (peer->timestamp > now + 2*60*60 || peer->timestamp < now - 2*60*60) peer->timestamp = now; // sanity check
+    peer->failures = 0;
+    _BRPeerManagerRecordPingTime(manager, peer); // handshake round trip time
     
     // TODO: XXX does this work with 0.11 pruned nodes?
     if ((peer->services & manager->params->services) != manager->params->services) {
@@ -733,7 +1991,12 @@ static void _peerConnected(void *info)
         peer_log(peer, "node isn't synced");
         BRPeerDisconnect(peer);
     }
-    else if (BRPeerVersion(peer) >= 70011 && (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM) {
+    else if (manager->compactFilters && (peer->services & SERVICES_NODE_COMPACT_FILTERS) == 0) {
+        peer_log(peer, "node doesn't serve compact block filters");
+        BRPeerDisconnect(peer);
+    }
+    else if (! manager->compactFilters && BRPeerVersion(peer) >= 70011 &&
+             (peer->services & SERVICES_NODE_BLOOM) != SERVICES_NODE_BLOOM) {
         peer_log(peer, "node doesn't support SPV mode");
         BRPeerDisconnect(peer);
     }
@@ -748,18 +2011,22 @@ static void _peerConnected(void *info)
             assert(peerInfo != NULL);
             peerInfo->peer = peer;
             peerInfo->manager = manager;
-            BRPeerSendPing(peer, peerInfo, _loadBloomFilterDone);
+            _BRPeerManagerRequestMempool(manager, peer, peerInfo);
+        }
+        else if (array_count(manager->headerRanges) > 0) { // help download the headers
+            _BRPeerManagerAssignHeaderRange(manager, peer);
         }
+        else _BRPeerManagerDispatchFetches(manager); // help download merkleblocks
     }
-    else { // select the peer with the lowest ping time to download the chain from if we're behind
+    else { // select the peer expected to download fastest to download the chain from if we're behind
         // BUG: XXX a malicious peer can report a higher lastblock to make us select them as the download peer, if
         // two peers agree on lastblock, use one of those two instead
         for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
             BRPeer *p = manager->connectedPeers[i - 1];
             
             if (BRPeerConnectStatus(p) != BRPeerStatusConnected) continue;
-            if ((BRPeerPingTime(p) < BRPeerPingTime(peer) && BRPeerLastBlock(p) >= BRPeerLastBlock(peer)) ||
-                BRPeerLastBlock(p) > BRPeerLastBlock(peer)) peer = p;
+            if ((_BRPeerManagerDownloadCost(p) < _BRPeerManagerDownloadCost(peer) &&
+                 BRPeerLastBlock(p) >= BRPeerLastBlock(peer)) || BRPeerLastBlock(p) > BRPeerLastBlock(peer)) peer = p;
         }
         
         if (manager->downloadPeer) {
@@ -775,17 +2042,24 @@ static void _peerConnected(void *info)
         _BRPeerManagerPublishPendingTx(manager, peer);
             
         if (manager->lastBlock->height < BRPeerLastBlock(peer)) { // start blockchain sync
-            UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0)];
-            size_t count = _BRPeerManagerBlockLocators(manager, locators, sizeof(locators)/sizeof(*locators));
-            
-            BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // schedule sync timeout
+            // when the headers span several checkpoints, download each checkpoint range from a different peer
+            if (array_count(manager->headerRanges) > 0 && manager->headerRanges[0].start != manager->lastBlock) {
+                _BRPeerManagerClearHeaderRanges(manager);
+            }
 
-            // request just block headers up to a week before earliestKeyTime, and then merkleblocks after that
-            // we do not reset connect failure count yet incase this request times out
-            if (manager->lastBlock->timestamp + 7*24*60*60 >= manager->earliestKeyTime) {
-                BRPeerSendGetblocks(peer, locators, count, UINT256_ZERO);
+            if (array_count(manager->headerRanges) == 0 &&
+                manager->lastBlock->timestamp + 7*24*60*60 < manager->earliestKeyTime) {
+                _BRPeerManagerBuildHeaderRanges(manager);
+            }
+
+            _BRPeerManagerAssignHeaderRanges(manager);
+
+            for (size_t i = array_count(manager->headerRanges); i > 0; i--) {
+                if (manager->headerRanges[i - 1].peer || manager->headerRanges[i - 1].done) break;
+                if (i == 1) _BRPeerManagerClearHeaderRanges(manager); // no peer can serve the ranges
             }
-            else BRPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+
+            if (array_count(manager->headerRanges) == 0) _BRPeerManagerRequestChain(manager, peer);
         }
         else { // we're already synced
             manager->connectFailureCount = 0; // reset connect failure count
@@ -800,9 +2074,10 @@ static void _peerDisconnected(void *info, int error)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
-    BRTxPeerList *peerList;
-    int willSave = 0, willReconnect = 0, txError = 0;
+    BRPeer *known, savePeer;
+    int willSave = 0, willSavePeer = 0, willReconnect = 0, txError = 0;
     size_t txCount = 0;
+    uint64_t mask;
     
     //free(info);
     pthread_mutex_lock(&manager->lock);
@@ -813,10 +2088,12 @@ static void _peerDisconnected(void *info, int error)
         _BRPeerManagerPeerMisbehavin(manager, peer);
     }
     else if (error) { // timeout or some non-protocol related network error
-        for (size_t i = array_count(manager->peers); i > 0; i--) {
-            if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
+        if (++peer->failures >= PEER_MAX_FAILURES) { // keep the peer around with a lower score until it fails again
+            for (size_t i = array_count(manager->peers); i > 0; i--) {
+                if (BRPeerEq(&manager->peers[i - 1], peer)) array_rm(manager->peers, i - 1);
+            }
         }
-        
+
         manager->connectFailureCount++;
         
         // if it's a timeout and there's pending tx publish callbacks, the tx publish timed out
@@ -825,15 +2102,21 @@ static void _peerDisconnected(void *info, int error)
                                    array_count(manager->connectedPeers) == 1)) txError = ETIMEDOUT;
     }
     
-    for (size_t i = array_count(manager->txRelays); i > 0; i--) {
-        peerList = &manager->txRelays[i - 1];
+    _BRPeerManagerRecordPingTime(manager, peer);
+    _BRPeerManagerUpdateKnownPeer(manager, peer);
+    known = _BRPeerManagerKnownPeer(manager, peer);
+    if (known) savePeer = *known, willSavePeer = 1; // persist the peer's updated connection quality
 
-        for (size_t j = array_count(peerList->peers); j > 0; j--) {
-            if (BRPeerEq(&peerList->peers[j - 1], peer)) array_rm(peerList->peers, j - 1);
-        }
+    for (size_t i = array_count(manager->throughput); i > 0; i--) {
+        if (manager->throughput[i - 1].peer == peer) array_rm(manager->throughput, i - 1);
     }
 
+    mask = _BRPeerManagerTxPeerSlot(manager, peer, 0);
+    if (mask != 0) _BRTxPeersClear(manager->txRelays, mask);
+
     if (peer == manager->downloadPeer) { // download peer disconnected
+        _BRPeerManagerResetFetches(manager); // the next download peer starts over from lastBlock
+        _BRPeerManagerResetCFEntries(manager);
         manager->isConnected = 0;
         manager->downloadPeer = NULL;
         if (manager->connectFailureCount > MAX_CONNECT_FAILURES) manager->connectFailureCount = MAX_CONNECT_FAILURES;
@@ -862,10 +2145,26 @@ static void _peerDisconnected(void *info, int error)
     
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
         if (manager->connectedPeers[i - 1] != peer) continue;
+        pthread_mutex_lock(&manager->statsLock);
+        BRPeerMsgCounts(peer, manager->stats.received, manager->stats.sent); // keep the counts once peer is freed
+        pthread_mutex_unlock(&manager->statsLock);
         array_rm(manager->connectedPeers, i - 1);
         break;
     }
 
+    BRHeaderRange *range = _BRPeerManagerHeaderRangeForPeer(manager, peer);
+
+    if (range) { // hand the peer's unfinished header range to another peer
+        _BRHeaderRangeReset(range);
+        _BRPeerManagerAssignHeaderRanges(manager);
+    }
+
+    for (size_t i = manager->fetchHead; i < manager->fetchEnd; i++) { // re-request the peer's merkleblocks
+        if (manager->fetches[i].peer == peer) manager->fetches[i].peer = NULL;
+    }
+
+    _BRPeerManagerDispatchFetches(manager);
+
     BRPeerFree(peer);
     pthread_mutex_unlock(&manager->lock);
     
@@ -874,6 +2173,7 @@ static void _peerDisconnected(void *info, int error)
     }
     
     if (willSave && manager->savePeers) manager->savePeers(manager->info, 1, NULL, 0);
+    else if (willSavePeer && manager->savePeers) manager->savePeers(manager->info, 0, &savePeer, 1);
     if (willSave && manager->syncStopped) manager->syncStopped(manager->info, error);
     if (willReconnect) BRPeerManagerConnect(manager); // try connecting to another peer
     if (manager->txStatusUpdate) manager->txStatusUpdate(manager->info);
@@ -909,6 +2209,87 @@ static void _peerRelayedPeers(void *info, const BRPeer peers[], size_t peersCoun
         manager->savePeers) manager->savePeers(manager->info, 1, save, peersCount);
 }
 
+// the transaction likely consumed one or more addresses of wallet, so check that at least the next <gap limit> unused
+// addresses are still matched by the bloom filter, and update the filter if not
+static void _BRPeerManagerCheckFilterGap(BRPeerManager *manager, BRWallet *wallet)
+{
+    BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL];
+    UInt160 hash;
+
+    if (manager->bloomFilter == NULL) return; // bloom filter is already being updated
+    BRWalletUnusedAddrs(wallet, addrs, SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_EXTERNAL_CHAIN);
+    BRWalletUnusedAddrs(wallet, addrs + SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_GAP_LIMIT_INTERNAL,
+                        SEQUENCE_INTERNAL_CHAIN);
+
+    for (size_t i = 0; i < SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL; i++) {
+        if (! BRAddressHash160(&hash, manager->params->addrParams, addrs[i].s) ||
+            BRBloomFilterContainsData(manager->bloomFilter, hash.u8, sizeof(hash))) continue;
+        if (manager->pendingFilter) BRBloomFilterFree(manager->pendingFilter);
+        manager->pendingFilter = manager->bloomFilter; // keep the loaded filter so it can be extended
+        manager->bloomFilter = NULL; // reset bloom filter so it's updated with new wallet addresses
+        _BRPeerManagerUpdateFilter(manager);
+        break;
+    }
+}
+
+// registers a copy of tx with each wallet added with BRPeerManagerAddWallet() that tx sends from or to, found by
+// looking up its outpoints and output pkhs in the watch set, returns the number of wallets it was registered with
+// manager must be locked
+static size_t _BRPeerManagerRouteTransaction(BRPeerManager *manager, const BRTransaction *tx)
+{
+    BRWallet *found[16], **wallets = found;
+    BRWatchElement e, *elem;
+    BRTransaction *copy;
+    const uint8_t *pkh;
+    size_t i, j, count = 0, routed = 0;
+    int all = manager->compactFilters; // the watch set is only kept up to date for bloom filters
+    double start;
+
+    if (array_count(manager->wallets) <= 1) return 0;
+    pthread_mutex_lock(&manager->watchLock);
+
+    for (i = 0; ! all && i < tx->inCount + tx->outCount; i++) {
+        if (i < tx->inCount) {
+            e.dataLen = sizeof(UInt256) + sizeof(uint32_t);
+            UInt256Set(e.data, tx->inputs[i].txHash);
+            UInt32SetLE(&e.data[sizeof(UInt256)], tx->inputs[i].index);
+        }
+        else if ((pkh = BRScriptPKH(tx->outputs[i - tx->inCount].script, tx->outputs[i - tx->inCount].scriptLen))) {
+            e.dataLen = sizeof(UInt160);
+            memcpy(e.data, pkh, sizeof(UInt160));
+        }
+        else continue;
+
+        elem = BRSetGet(manager->watchSet, &e);
+        if (elem && elem->shared) all = 1; // only one of the wallets is recorded
+        if (! elem || ! elem->wallet) continue;
+        for (j = 0; j < count && found[j] != elem->wallet; j++);
+        if (j < count || elem->wallet == manager->wallet) continue;
+        if (count < sizeof(found)/sizeof(*found)) found[count++] = elem->wallet;
+        else all = 1;
+    }
+
+    pthread_mutex_unlock(&manager->watchLock);
+
+    if (all) { // check each added wallet instead
+        wallets = &manager->wallets[1];
+        count = array_count(manager->wallets) - 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (BRWalletTransactionForHash(wallets[i], tx->txHash)) continue;
+        if (! BRWalletContainsTransaction(wallets[i], tx)) continue;
+        copy = BRTransactionCopy(tx);
+        start = _peerManagerTime();
+        if (BRWalletRegisterTransaction(wallets[i], copy)) routed++, copy = NULL;
+        _BRPeerManagerRecordTime(manager, &manager->stats.wallet, start);
+        if (copy) BRTransactionFree(copy);
+        else _BRPeerManagerCheckFilterGap(manager, wallets[i]);
+    }
+
+    return routed;
+}
+
 static void _peerRelayedTx(void *info, BRTransaction *tx)
 {
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
@@ -916,7 +2297,8 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
     void *txInfo = NULL;
     void (*txCallback)(void *, int) = NULL;
     int isWalletTx = 0, hasPendingCallbacks = 0;
-    size_t relayCount = 0;
+    size_t relayCount = 0, routed;
+    UInt256 txHash = tx->txHash;
     
     pthread_mutex_lock(&manager->lock);
     peer_log(peer, "relayed tx: %s", u256hex(tx->txHash));
@@ -927,7 +2309,7 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
             txCallback = manager->publishedTx[i - 1].callback;
             manager->publishedTx[i - 1].info = NULL;
             manager->publishedTx[i - 1].callback = NULL;
-            relayCount = _BRTxPeerListAddPeer(&manager->txRelays, tx->txHash, peer);
+            relayCount = _BRPeerManagerTxAddPeer(manager, manager->txRelays, tx->txHash, peer);
         }
         else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
     }
@@ -937,15 +2319,31 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
         BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
     }
 
+    routed = _BRPeerManagerRouteTransaction(manager, tx); // copies go to any other wallets tx belongs to
+
     if (manager->syncStartHeight == 0 || BRWalletContainsTransaction(manager->wallet, tx)) {
-        isWalletTx = BRWalletRegisterTransaction(manager->wallet, tx);
+        isWalletTx = _BRPeerManagerRegisterTransaction(manager, tx);
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
     }
     else {
         BRTransactionFree(tx);
         tx = NULL;
     }
-    
+
+    if (routed > 0 && ! isWalletTx) {
+        if (manager->syncStartHeight > 0 && peer == manager->downloadPeer) {
+            BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule sync timeout
+        }
+
+        // keep track of how many peers relay the tx, as is done below for tx of the manager's own wallet
+        if (manager->syncStartHeight == 0) {
+            relayCount = _BRPeerManagerTxAddPeer(manager, manager->txRelays, txHash, peer);
+        }
+
+        _BRPeerManagerTxRemovePeer(manager, manager->txRequests, txHash, peer);
+        tx = _BRPeerManagerTransactionForHash(manager, txHash);
+    }
+
     if (tx && isWalletTx) {
         // reschedule sync timeout
         if (manager->syncStartHeight > 0 && peer == manager->downloadPeer) {
@@ -958,33 +2356,16 @@ static void _peerRelayedTx(void *info, BRTransaction *tx)
 
         // keep track of how many peers have or relay a tx, this indicates how likely the tx is to confirm
         // (we only need to track this after syncing is complete)
-        if (manager->syncStartHeight == 0) relayCount = _BRTxPeerListAddPeer(&manager->txRelays, tx->txHash, peer);
+        if (manager->syncStartHeight == 0) relayCount = _BRPeerManagerTxAddPeer(manager, manager->txRelays, tx->txHash, peer);
         
-        _BRTxPeerListRemovePeer(manager->txRequests, tx->txHash, peer);
+        _BRPeerManagerTxRemovePeer(manager, manager->txRequests, tx->txHash, peer);
         
-        if (manager->bloomFilter != NULL) { // check if bloom filter is already being updated
-            BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL];
-            UInt160 hash;
-
-            // the transaction likely consumed one or more wallet addresses, so check that at least the next <gap limit>
-            // unused addresses are still matched by the bloom filter
-            BRWalletUnusedAddrs(manager->wallet, addrs, SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_EXTERNAL_CHAIN);
-            BRWalletUnusedAddrs(manager->wallet, addrs + SEQUENCE_GAP_LIMIT_EXTERNAL, SEQUENCE_GAP_LIMIT_INTERNAL, SEQUENCE_INTERNAL_CHAIN);
-
-            for (size_t i = 0; i < SEQUENCE_GAP_LIMIT_EXTERNAL + SEQUENCE_GAP_LIMIT_INTERNAL; i++) {
-                if (! BRAddressHash160(&hash, manager->params->addrParams, addrs[i].s) ||
-                    BRBloomFilterContainsData(manager->bloomFilter, hash.u8, sizeof(hash))) continue;
-                if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
-                manager->bloomFilter = NULL; // reset bloom filter so it's recreated with new wallet addresses
-                _BRPeerManagerUpdateFilter(manager);
-                break;
-            }
-        }
+        _BRPeerManagerCheckFilterGap(manager, manager->wallet);
     }
     
     // set timestamp when tx is verified
     if (tx && relayCount >= manager->maxConnectCount && tx->blockHeight == TX_UNCONFIRMED && tx->timestamp == 0) {
-        BRWalletUpdateTransactions(manager->wallet, &tx->txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
+        _BRPeerManagerUpdateTransactions(manager, &tx->txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
     }
     
     pthread_mutex_unlock(&manager->lock);
@@ -1010,7 +2391,7 @@ static void _peerHasTx(void *info, UInt256 txHash)
             if (! tx) tx = pubTx.tx;
             manager->publishedTx[i - 1].callback = NULL;
             manager->publishedTx[i - 1].info = NULL;
-            relayCount = _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
+            relayCount = _BRPeerManagerTxAddPeer(manager, manager->txRelays, txHash, peer);
         }
         else if (manager->publishedTx[i - 1].callback != NULL) hasPendingCallbacks = 1;
     }
@@ -1021,7 +2402,7 @@ static void _peerHasTx(void *info, UInt256 txHash)
     }
 
     if (tx) {
-        isWalletTx = BRWalletRegisterTransaction(manager->wallet, tx);
+        isWalletTx = _BRPeerManagerRegisterTransaction(manager, tx);
         if (isWalletTx) tx = BRWalletTransactionForHash(manager->wallet, tx->txHash);
 
         // reschedule sync timeout
@@ -1031,14 +2412,25 @@ static void _peerHasTx(void *info, UInt256 txHash)
         
         // keep track of how many peers have or relay a tx, this indicates how likely the tx is to confirm
         // (we only need to track this after syncing is complete)
-        if (manager->syncStartHeight == 0) relayCount = _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
+        if (manager->syncStartHeight == 0) relayCount = _BRPeerManagerTxAddPeer(manager, manager->txRelays, txHash, peer);
 
         // set timestamp when tx is verified
         if (relayCount >= manager->maxConnectCount && tx && tx->blockHeight == TX_UNCONFIRMED && tx->timestamp == 0) {
-            BRWalletUpdateTransactions(manager->wallet, &txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
+            _BRPeerManagerUpdateTransactions(manager, &txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
+        }
+
+        _BRPeerManagerTxRemovePeer(manager, manager->txRequests, txHash, peer);
+    }
+    else if ((tx = _BRPeerManagerTransactionForHash(manager, txHash)) != NULL) { // tx of a wallet added to manager
+        if (manager->syncStartHeight == 0) {
+            relayCount = _BRPeerManagerTxAddPeer(manager, manager->txRelays, txHash, peer);
+        }
+
+        if (relayCount >= manager->maxConnectCount && tx->blockHeight == TX_UNCONFIRMED && tx->timestamp == 0) {
+            _BRPeerManagerUpdateTransactions(manager, &txHash, 1, TX_UNCONFIRMED, (uint32_t)time(NULL));
         }
 
-        _BRTxPeerListRemovePeer(manager->txRequests, txHash, peer);
+        _BRPeerManagerTxRemovePeer(manager, manager->txRequests, txHash, peer);
     }
     
     pthread_mutex_unlock(&manager->lock);
@@ -1053,13 +2445,13 @@ static void _peerRejectedTx(void *info, UInt256 txHash, uint8_t code)
 
     pthread_mutex_lock(&manager->lock);
     peer_log(peer, "rejected tx: %s", u256hex(txHash));
-    tx = BRWalletTransactionForHash(manager->wallet, txHash);
-    _BRTxPeerListRemovePeer(manager->txRequests, txHash, peer);
+    tx = _BRPeerManagerTransactionForHash(manager, txHash);
+    _BRPeerManagerTxRemovePeer(manager, manager->txRequests, txHash, peer);
 
     if (tx) {
-        if (_BRTxPeerListRemovePeer(manager->txRelays, txHash, peer) && tx->blockHeight == TX_UNCONFIRMED) {
+        if (_BRPeerManagerTxRemovePeer(manager, manager->txRelays, txHash, peer) && tx->blockHeight == TX_UNCONFIRMED) {
             // set timestamp 0 to mark tx as unverified
-            BRWalletUpdateTransactions(manager->wallet, &txHash, 1, TX_UNCONFIRMED, 0);
+            _BRPeerManagerUpdateTransactions(manager, &txHash, 1, TX_UNCONFIRMED, 0);
         }
 
         // if we get rejected for any reason other than double-spend, the peer is likely misconfigured
@@ -1141,24 +2533,16 @@ static void _peerRelayedBlockFailed (BRMerkleBlock *blockToFree, BRPeer *peer, c
     assert (0);
 }
 
-static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
+// adds a block relayed by peer to the chain (merkleblocks buffered by the block fetch scheduler are added on behalf of
+// the peer whose thread is draining them)
+static void _BRPeerManagerRelayedBlock(void *info, BRMerkleBlock *block)
 {
-    if (NULL == info || NULL == block) {
-        _peerRelayedBlockFailed (block, NULL, "missed 'info' or 'block'");
-        return;
-    }
-
     BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
     size_t i, j, fpCount = 0, saveCount = 0;
-    BRMerkleBlock orphan, *b, *b2, *prev, *next = NULL;
+    BRMerkleBlock *b, *b2, *prev, *next = NULL;
     uint32_t txTime = 0;
 
-    if (NULL == peer || NULL == manager) {
-        _peerRelayedBlockFailed (block, peer, "missed 'peer' or 'manager'");
-        return;
-    }
-
     // Check manager - ensure anything dereferenced subsequently is valid
     if (NULL == manager->blocks ||
         NULL == manager->wallet ||
@@ -1181,7 +2565,32 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     assert(txHashes != NULL);
     txCount = BRMerkleBlockTxHashes(block, txHashes, txCount);
 
-    pthread_mutex_lock(&manager->lock);
+    // work that doesn't depend on the chain is done before taking the lock: headers newer than one week before
+    // earliestKeyTime are ignored (it's a header if it has 0 totalTx), and wallet tx are not false-positives
+    if (block->totalTx == 0 && block->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime &&
+        ! manager->compactFilters) { // with compact filters, these are headers whose filters didn't match
+        if (txHashes != _txHashes) free(txHashes);
+        BRMerkleBlockFree(block);
+        return;
+    }
+
+    pthread_mutex_lock(&manager->watchLock); // keeps wallets from being removed
+
+    for (i = 0; block->totalTx > 0 && i < txCount; i++) {
+        if (! _BRPeerManagerTransactionForHash(manager, txHashes[i])) fpCount++;
+    }
+
+    pthread_mutex_unlock(&manager->watchLock);
+
+    if (block->totalTx > 0) {
+        pthread_mutex_lock(&manager->statsLock);
+        manager->stats.matchedTx += txCount - fpCount;
+        manager->stats.falsePositiveTx += fpCount;
+        pthread_mutex_unlock(&manager->statsLock);
+    }
+
+    double lockTime = _BRPeerManagerLockForBlock(manager);
+
     prev = BRSetGet(manager->blocks, &block->prevBlock);
 
     if (prev) {
@@ -1190,11 +2599,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     }
     
     // track the observed bloom filter false positive rate using a low pass filter to smooth out variance
-    if (peer == manager->downloadPeer && block->totalTx > 0) {
-        for (i = 0; i < txCount; i++) { // wallet tx are not false-positives
-            if (! BRWalletTransactionForHash(manager->wallet, txHashes[i])) fpCount++;
-        }
-        
+    if (peer == manager->downloadPeer && block->totalTx > 0 && ! manager->compactFilters) {
         // moving average number of tx-per-block
         manager->averageTxPerBlock = manager->averageTxPerBlock*0.999 + block->totalTx*0.001;
         
@@ -1215,12 +2620,8 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         }
     }
 
-    // ignore block headers that are newer than one week before earliestKeyTime (it's a header if it has 0 totalTx)
-    if (block->totalTx == 0 && block->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime) {
-        BRMerkleBlockFree(block);
-        block = NULL;
-    }
-    else if (manager->bloomFilter == NULL) { // ingore potentially incomplete blocks when a filter update is pending
+    // ingore potentially incomplete blocks when a filter update is pending
+    if (manager->bloomFilter == NULL && ! manager->compactFilters) {
         BRMerkleBlockFree(block);
         block = NULL;
 
@@ -1250,8 +2651,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
                 BRPeerSendGetblocks(peer, locators, locatorsCount, UINT256_ZERO);
             }
             
-            BRSetAdd(manager->orphans, block); // BUG: limit total orphans to avoid memory exhaustion attack
-            manager->lastOrphan = block;
+            _BRPeerManagerAddOrphan(manager, block, peer);
         }
     }
     else if (! _BRPeerManagerVerifyBlock(manager, block, prev, peer)) { // block is invalid
@@ -1267,7 +2667,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         
         BRSetAdd(manager->blocks, block);
         manager->lastBlock = block;
-        if (txCount > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, txCount, block->height, txTime);
+        if (txCount > 0) _BRPeerManagerUpdateTransactions(manager, txHashes, txCount, block->height, txTime);
         if (manager->downloadPeer) BRPeerSetCurrentBlockHeight(manager->downloadPeer, block->height);
             
         if (block->height < manager->estimatedHeight && peer == manager->downloadPeer) {
@@ -1298,14 +2698,15 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         }
 
         if (BRMerkleBlockEq(b, block)) { // if it's not on a fork, set block heights for its transactions
-            if (txCount > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, txCount, block->height, txTime);
+            if (txCount > 0) _BRPeerManagerUpdateTransactions(manager, txHashes, txCount, block->height, txTime);
             if (block->height == manager->lastBlock->height) manager->lastBlock = block;
         }
         
         b = BRSetAdd(manager->blocks, block);
 
         if (b != block) {
-            if (BRSetGet(manager->orphans, b) == b) BRSetRemove(manager->orphans, b);
+            if ((i = _BRPeerManagerOrphanPoolIndex(manager, b)) != SIZE_MAX) _BRPeerManagerOrphanPoolRemove(manager, i);
+            else if (BRSetGet(manager->orphans, b) == b) BRSetRemove(manager->orphans, b);
             if (manager->lastOrphan == b) manager->lastOrphan = NULL;
             BRMerkleBlockFree(b);
         }
@@ -1313,8 +2714,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     else if (manager->lastBlock->height < BRPeerLastBlock(peer) &&
              block->height > manager->lastBlock->height + 1) { // special case, new block mined durring rescan
         peer_log(peer, "marking new block #%"PRIu32" as orphan until rescan completes", block->height);
-        BRSetAdd(manager->orphans, block); // mark as orphan til we're caught up
-        manager->lastOrphan = block;
+        _BRPeerManagerAddOrphan(manager, block, peer); // mark as orphan til we're caught up
     }
     else if (block->height <= manager->params->checkpoints[manager->params->checkpointsCount - 1].height) { // old fork
         peer_log(peer, "ignoring block on fork older than most recent checkpoint, block #%"PRIu32", hash: %s",
@@ -1343,7 +2743,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
             }
             peer_log(peer, "reorganizing chain from height %"PRIu32", new height is %"PRIu32, b->height, block->height);
         
-            BRWalletSetTxUnconfirmedAfter(manager->wallet, b->height); // mark tx after the join point as unconfirmed
+            _BRPeerManagerSetTxUnconfirmedAfter(manager, b->height); // mark tx after the join point as unconfirmed
 
             b = block;
         
@@ -1364,7 +2764,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
                 count = BRMerkleBlockTxHashes(b, txHashes, count);
                 b = BRSetGet(manager->blocks, &b->prevBlock);
                 if (b) timestamp = timestamp/2 + b->timestamp/2;
-                if (count > 0) BRWalletUpdateTransactions(manager->wallet, txHashes, count, height, timestamp);
+                if (count > 0) _BRPeerManagerUpdateTransactions(manager, txHashes, count, height, timestamp);
             }
         
             manager->lastBlock = block;
@@ -1381,9 +2781,7 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
     if (block && block->height != BLOCK_UNKNOWN_HEIGHT) {
         if (block->height > manager->estimatedHeight) manager->estimatedHeight = block->height;
         
-        // check if the next block was received as an orphan
-        orphan.prevBlock = block->blockHash;
-        next = BRSetRemove(manager->orphans, &orphan);
+        next = _BRPeerManagerTakeOrphan(manager, block->blockHash); // check if the next block was received as an orphan
     }
     
     BRMerkleBlock *saveBlocks[saveCount];
@@ -1404,15 +2802,407 @@ static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
         _peerRelayedBlockFailed (NULL, peer, "In 'save' missed 'difficulty'");
         return;
     }
-    if (i > 0 && manager->saveBlocks) manager->saveBlocks(manager->info, (i > 1 ? 1 : 0), saveBlocks, i);
-    pthread_mutex_unlock(&manager->lock);
-    
-    if (block && block->height != BLOCK_UNKNOWN_HEIGHT && block->height >= BRPeerLastBlock(peer) &&
-        manager->txStatusUpdate) {
-        manager->txStatusUpdate(manager->info); // notify that transaction confirmations may have changed
+    if (i > 0 && manager->saveBlocks) {
+        double start = _peerManagerTime();
+
+        manager->saveBlocks(manager->info, (i > 1 ? 1 : 0), saveBlocks, i);
+        _BRPeerManagerRecordTime(manager, &manager->stats.callbacks, start);
+    }
+
+    _BRPeerManagerUnlockForBlock(manager, lockTime);
+    
+    if (block && block->height != BLOCK_UNKNOWN_HEIGHT && block->height >= BRPeerLastBlock(peer) &&
+        manager->txStatusUpdate) {
+        double start = _peerManagerTime();
+
+        manager->txStatusUpdate(manager->info); // notify that transaction confirmations may have changed
+        _BRPeerManagerRecordTime(manager, &manager->stats.callbacks, start);
+    }
+    
+    if (next) _BRPeerManagerRelayedBlock(info, next);
+}
+
+// adds buffered merkleblocks to the chain for as long as the next scheduled one connects, only one peer thread does
+// this at a time, and blocks are added on behalf of that peer
+static void _BRPeerManagerDrainFetches(void *info)
+{
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRMerkleBlock *block;
+
+    pthread_mutex_lock(&manager->lock);
+
+    if (! manager->fetchDraining) {
+        manager->fetchDraining = 1;
+
+        while ((block = _BRPeerManagerNextFetchedBlock(manager)) != NULL) {
+            pthread_mutex_unlock(&manager->lock);
+            _BRPeerManagerRelayedBlock(info, block);
+            pthread_mutex_lock(&manager->lock);
+        }
+
+        manager->fetchDraining = 0;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// adds entries to the chain in order once their filters have been checked, and their full blocks processed if they
+// matched, only one peer thread does this at a time
+static void _BRPeerManagerDrainCFEntries(void *info)
+{
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRMerkleBlock *block;
+    BRCFEntry *e;
+
+    pthread_mutex_lock(&manager->lock);
+
+    if (! manager->cfDraining) {
+        manager->cfDraining = 1;
+
+        while (manager->cfHead < manager->cfFiltersNext) {
+            e = &manager->cfEntries[manager->cfHead];
+            if (e->state == CF_ENTRY_HEADER || e->state == CF_ENTRY_BLOCK) break;
+
+            // a wallet tx in an earlier block may have used up addresses, so check the filter again with the new ones
+            if (e->state == CF_ENTRY_FILTER && _BRPeerManagerPKHCount(manager) > e->pkhCount &&
+                _BRPeerManagerMatchCFilter(manager, e->filter, &e->pkhCount)) {
+                e->state = CF_ENTRY_BLOCK;
+                if (manager->downloadPeer) BRPeerSendGetblockdata(manager->downloadPeer, &e->block->blockHash, 1);
+                break;
+            }
+
+            block = e->block;
+            manager->cfLastHeader = e->filterHeader;
+            if (e->filter) BRGCSFilterFree(e->filter);
+            e->block = NULL;
+            e->filter = NULL;
+            manager->cfHead++;
+            pthread_mutex_unlock(&manager->lock);
+            _BRPeerManagerRelayedBlock(info, block);
+            pthread_mutex_lock(&manager->lock);
+        }
+
+        if (manager->cfHead >= CF_FILTERS_AHEAD && manager->cfHead*2 >= array_count(manager->cfEntries)) {
+            array_rm_range(manager->cfEntries, 0, manager->cfHead);
+            manager->cfHeadersEnd -= manager->cfHead;
+            manager->cfFiltersNext -= manager->cfHead;
+            manager->cfFiltersEnd -= manager->cfHead;
+            manager->cfHead = 0;
+        }
+
+        _BRPeerManagerRequestCFilters(manager);
+        manager->cfDraining = 0;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// holds a header from the download peer until its filter has been checked, headers from other peers, duplicates,
+// and headers that don't connect are dropped
+static void _BRPeerManagerAddCFHeader(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block)
+{
+    BRMerkleBlock *prev = NULL;
+    size_t i, count;
+
+    pthread_mutex_lock(&manager->lock);
+    count = array_count(manager->cfEntries);
+
+    // find the pending header that block extends, usually the last one
+    for (i = count; i > manager->cfHead; i--) {
+        if (UInt256Eq(manager->cfEntries[i - 1].block->blockHash, block->prevBlock)) break;
+    }
+
+    if (i == manager->cfHead) prev = BRSetGet(manager->blocks, &block->prevBlock);
+
+    if (peer != manager->downloadPeer || (i == manager->cfHead && ! prev) || BRSetContains(manager->blocks, block) ||
+        (i < count && UInt256Eq(manager->cfEntries[i].block->blockHash, block->blockHash))) {
+        BRMerkleBlockFree(block);
+    }
+    else {
+        if (i < count) {
+            peer_log(peer, "header %s forks off pending headers, dropping %zu", u256hex(block->blockHash), count - i);
+            _BRPeerManagerTruncateCFEntries(manager, i);
+        }
+
+        block->height = (prev) ? prev->height + 1 : manager->cfEntries[i - 1].block->height + 1;
+        array_add(manager->cfEntries, ((const BRCFEntry) { block, UINT256_ZERO, UINT256_ZERO, NULL, 0,
+                                                           CF_ENTRY_HEADER }));
+        if (block->height > manager->estimatedHeight) manager->estimatedHeight = block->height;
+        BRPeerScheduleDisconnect(peer, PROTOCOL_TIMEOUT); // reschedule sync timeout
+        manager->connectFailureCount = 0;
+        _BRPeerManagerRequestCFilters(manager);
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+static void _peerRelayedCFHeaders(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                                  size_t count)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+
+    pthread_mutex_lock(&manager->lock);
+
+    size_t i, start = manager->cfHeadersEnd;
+    UInt256 header = (start > manager->cfHead) ? manager->cfEntries[start - 1].filterHeader : manager->cfLastHeader;
+
+    if (peer != manager->downloadPeer) {
+        peer_log(peer, "ignoring cfheaders from peer other than the download peer");
+    }
+    else if (count == 0 || start + count > array_count(manager->cfEntries) ||
+             ! UInt256Eq(manager->cfEntries[start + count - 1].block->blockHash, stopHash)) {
+        peer_log(peer, "ignoring cfheaders for %zu stale header(s)", count);
+        manager->cfHeadersPending = 0; // pending headers may have changed since the request
+    }
+    else if (! UInt256IsZero(header) && ! UInt256Eq(header, prevHeader)) {
+        peer_log(peer, "cfheaders don't connect to previous filter header %s", u256hex(header));
+        _BRPeerManagerPeerMisbehavin(manager, peer);
+    }
+    else {
+        // the first filter header after connecting is taken on trust, later ones are checked against it
+        for (i = 0, header = prevHeader; i < count; i++) {
+            header = BRGCSFilterHeader(filterHashes[i], header);
+            manager->cfEntries[start + i].filterHash = filterHashes[i];
+            manager->cfEntries[start + i].filterHeader = header;
+        }
+
+        manager->cfHeadersEnd += count;
+        manager->cfHeadersPending = 0;
+    }
+
+    _BRPeerManagerRequestCFilters(manager);
+    pthread_mutex_unlock(&manager->lock);
+}
+
+static void _peerRelayedCFilter(void *info, UInt256 blockHash, const uint8_t *buf, size_t bufLen)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    BRGCSFilter *filter = BRGCSFilterParse(blockHash, buf, bufLen);
+    size_t i, pkhCount = 0;
+    int match;
+
+    pthread_mutex_lock(&manager->lock);
+    i = manager->cfFiltersNext; // filters arrive in the order they were requested
+
+    if (peer != manager->downloadPeer || i >= manager->cfFiltersEnd ||
+        ! UInt256Eq(manager->cfEntries[i].block->blockHash, blockHash)) {
+        peer_log(peer, "ignoring unexpected cfilter for block %s", u256hex(blockHash));
+        pthread_mutex_unlock(&manager->lock);
+        if (filter) BRGCSFilterFree(filter);
+        return;
+    }
+
+    if (! filter || ! UInt256Eq(BRGCSFilterHash(filter), manager->cfEntries[i].filterHash)) {
+        peer_log(peer, "cfilter doesn't match filter header for block %s", u256hex(blockHash));
+        _BRPeerManagerPeerMisbehavin(manager, peer);
+        pthread_mutex_unlock(&manager->lock);
+        if (filter) BRGCSFilterFree(filter);
+        return;
+    }
+
+    manager->cfFiltersNext++;
+    pthread_mutex_unlock(&manager->lock);
+    match = _BRPeerManagerMatchCFilter(manager, filter, &pkhCount);
+    pthread_mutex_lock(&manager->lock);
+    i = _BRPeerManagerCFEntryIndex(manager, blockHash, manager->cfHead, manager->cfFiltersNext);
+
+    if (i != SIZE_MAX && manager->cfEntries[i].state == CF_ENTRY_HEADER) {
+        manager->cfEntries[i].filter = filter;
+        manager->cfEntries[i].pkhCount = pkhCount;
+        manager->cfEntries[i].state = (match) ? CF_ENTRY_BLOCK : CF_ENTRY_FILTER;
+        if (match) BRPeerSendGetblockdata(peer, &blockHash, 1);
+        filter = NULL;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    if (filter) BRGCSFilterFree(filter);
+    _BRPeerManagerDrainCFEntries(info);
+}
+
+static void _peerRelayedFullBlock(void *info, BRMerkleBlock *block, BRTransaction *txs[], size_t txCount)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    UInt256 *txHashes;
+    uint8_t *matched;
+    size_t i;
+
+    pthread_mutex_lock(&manager->lock);
+    i = _BRPeerManagerCFEntryIndex(manager, block->blockHash, manager->cfHead, manager->cfFiltersNext);
+    if (i != SIZE_MAX && manager->cfEntries[i].state != CF_ENTRY_BLOCK) i = SIZE_MAX;
+    pthread_mutex_unlock(&manager->lock);
+
+    if (i == SIZE_MAX) {
+        peer_log(peer, "ignoring unrequested block %s", u256hex(block->blockHash));
+        for (i = 0; i < txCount; i++) BRTransactionFree(txs[i]);
+        BRMerkleBlockFree(block);
+        return;
+    }
+
+    txHashes = malloc(txCount*sizeof(*txHashes));
+    matched = calloc(txCount, sizeof(*matched));
+    assert(txHashes != NULL);
+    assert(matched != NULL);
+
+    for (i = 0; i < txCount; i++) { // register wallet tx in block order, so spends of earlier outputs are found
+        txHashes[i] = txs[i]->txHash;
+        pthread_mutex_lock(&manager->lock);
+        if (_BRPeerManagerRouteTransaction(manager, txs[i]) > 0 ||
+            _BRPeerManagerTransactionForHash(manager, txHashes[i])) matched[i] = 1;
+        pthread_mutex_unlock(&manager->lock);
+
+        if (BRWalletTransactionForHash(manager->wallet, txHashes[i])) {
+            matched[i] = 1;
+        }
+        else if (BRWalletContainsTransaction(manager->wallet, txs[i]) &&
+                 _BRPeerManagerRegisterTransaction(manager, txs[i])) {
+            matched[i] = 1;
+            txs[i] = NULL; // the wallet takes ownership
+        }
+
+        if (txs[i]) BRTransactionFree(txs[i]);
+    }
+
+    BRMerkleBlockSetMatchedTxHashes(block, txHashes, matched, txCount);
+    free(matched);
+    free(txHashes);
+    pthread_mutex_lock(&manager->lock);
+    i = _BRPeerManagerCFEntryIndex(manager, block->blockHash, manager->cfHead, manager->cfFiltersNext);
+
+    if (i != SIZE_MAX && manager->cfEntries[i].state == CF_ENTRY_BLOCK) {
+        block->height = manager->cfEntries[i].block->height;
+        BRMerkleBlockFree(manager->cfEntries[i].block);
+        manager->cfEntries[i].block = block;
+        manager->cfEntries[i].state = CF_ENTRY_DONE;
+        block = NULL;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    if (block) BRMerkleBlockFree(block);
+    _BRPeerManagerDrainCFEntries(info);
+}
+
+static int _peerRelayedBlockHashes(void *info, const UInt256 blockHashes[], size_t blockCount)
+{
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+    int r = 0;
+
+    pthread_mutex_lock(&manager->lock);
+
+    if (manager->compactFilters) { // new blocks are found by requesting their headers, then checking their filters
+        if (peer == manager->downloadPeer) {
+            size_t count = array_count(manager->cfEntries);
+            UInt256 locators[_BRPeerManagerBlockLocators(manager, NULL, 0) + 1];
+
+            if (count > manager->cfHead) locators[0] = manager->cfEntries[count - 1].block->blockHash;
+            count = (count > manager->cfHead) ? 1 : 0;
+            count += _BRPeerManagerBlockLocators(manager, &locators[count], sizeof(locators)/sizeof(*locators) - count);
+            BRPeerSendGetheaders(peer, locators, count, UINT256_ZERO);
+        }
+
+        r = 1;
+    }
+    // while syncing, merkleblocks announced to the download peer are fetched from all peers that have the filter
+    else if (peer == manager->downloadPeer && manager->bloomFilter && (peer->flags & PEER_FLAG_NEEDSUPDATE) == 0 &&
+             manager->lastBlock->height < manager->estimatedHeight) {
+        for (size_t i = 0; i < blockCount; i++) {
+            if (BRSetContains(manager->blocks, &blockHashes[i])) continue;
+            array_add(manager->fetches, ((const BRBlockFetch) { blockHashes[i], NULL, 0, NULL }));
+        }
+
+        _BRPeerManagerDispatchFetches(manager);
+        r = 1;
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    return r;
+}
+
+static void _BRPeerManagerPeerRelayedBlock(void *info, BRMerkleBlock *block)
+{
+    if (NULL == info || NULL == block) {
+        _peerRelayedBlockFailed (block, NULL, "missed 'info' or 'block'");
+        return;
+    }
+
+    BRPeer *peer = ((BRPeerCallbackInfo *)info)->peer;
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+
+    if (NULL == peer || NULL == manager) {
+        _peerRelayedBlockFailed (block, peer, "missed 'peer' or 'manager'");
+        return;
+    }
+
+    // headers requested as part of a checkpoint range are validated and added to the chain separately
+    if (block->totalTx == 0) {
+        double lockTime = _BRPeerManagerLockForBlock(manager);
+        BRHeaderRange *range = _BRPeerManagerHeaderRangeForPeer(manager, peer);
+        if (range) _BRPeerManagerHeaderRangeAddBlock(manager, range, peer, block);
+        _BRPeerManagerUnlockForBlock(manager, lockTime);
+        if (range) return;
+    }
+
+    // in compact filter mode, headers after the headers-only part of the chain are held until their filters are checked
+    if (block->totalTx == 0 && manager->compactFilters &&
+        block->timestamp + 7*24*60*60 - 2*60*60 > manager->earliestKeyTime) {
+        _BRPeerManagerAddCFHeader(manager, peer, block);
+        return;
+    }
+
+    // merkleblocks requested by the block fetch scheduler are added to the chain in order
+    if (block->totalTx == 0 || ! _BRPeerManagerFetchedBlock(manager, peer, block)) {
+        _BRPeerManagerRelayedBlock(info, block);
+    }
+
+    _BRPeerManagerDrainFetches(info); // the chain may now connect to buffered merkleblocks
+}
+
+// counts and times each block relayed by a peer, and updates stats once an interval has passed
+static void _peerRelayedBlock(void *info, BRMerkleBlock *block)
+{
+    BRPeerManager *manager = (info) ? ((BRPeerCallbackInfo *)info)->manager : NULL;
+    BRPeerManagerStats stats;
+    double start, now;
+    int update = 0;
+
+    if (NULL == manager || NULL == block) {
+        _BRPeerManagerPeerRelayedBlock(info, block);
+        return;
+    }
+
+    pthread_mutex_lock(&manager->statsLock);
+    if (block->totalTx == 0) manager->stats.headers++;
+    else manager->stats.merkleBlocks++;
+    pthread_mutex_unlock(&manager->statsLock);
+
+    start = _peerManagerTime();
+    _BRPeerManagerPeerRelayedBlock(info, block);
+    now = _BRPeerManagerRecordTime(manager, &manager->stats.relayedBlock, start);
+
+    pthread_mutex_lock(&manager->statsLock);
+
+    if (now >= manager->statsStart + manager->statsInterval) {
+        if (now > manager->statsStart) {
+            manager->stats.headersRate = (manager->stats.headers - manager->statsHeaders)/(now - manager->statsStart);
+            manager->stats.merkleBlocksRate = (manager->stats.merkleBlocks - manager->statsMerkleBlocks)/
+                                              (now - manager->statsStart);
+        }
+
+        manager->statsStart = now;
+        manager->statsHeaders = manager->stats.headers;
+        manager->statsMerkleBlocks = manager->stats.merkleBlocks;
+        update = (manager->statsUpdated != NULL);
+    }
+
+    pthread_mutex_unlock(&manager->statsLock);
+
+    if (update) {
+        stats = BRPeerManagerGetStats(manager);
+        manager->statsUpdated(manager->info, &stats);
     }
-    
-    if (next) _peerRelayedBlock(info, next);
 }
 
 static void _peerDataNotfound(void *info, const UInt256 txHashes[], size_t txCount,
@@ -1424,10 +3214,19 @@ static void _peerDataNotfound(void *info, const UInt256 txHashes[], size_t txCou
     pthread_mutex_lock(&manager->lock);
 
     for (size_t i = 0; i < txCount; i++) {
-        _BRTxPeerListRemovePeer(manager->txRelays, txHashes[i], peer);
-        _BRTxPeerListRemovePeer(manager->txRequests, txHashes[i], peer);
+        _BRPeerManagerTxRemovePeer(manager, manager->txRelays, txHashes[i], peer);
+        _BRPeerManagerTxRemovePeer(manager, manager->txRequests, txHashes[i], peer);
     }
 
+    for (size_t i = 0; i < blockCount; i++) { // request scheduled merkleblocks the peer doesn't have elsewhere
+        for (size_t j = manager->fetchHead; j < manager->fetchEnd; j++) {
+            BRBlockFetch *f = &manager->fetches[j];
+            if (f->peer == peer && ! f->block && UInt256Eq(f->blockHash, blockHashes[i])) f->peer = NULL;
+        }
+    }
+
+    if (blockCount > 0) _BRPeerManagerDispatchFetches(manager);
+
     pthread_mutex_unlock(&manager->lock);
 }
 
@@ -1477,8 +3276,8 @@ static BRTransaction *_peerRequestedTx(void *info, UInt256 txHash)
         BRPeerScheduleDisconnect(peer, -1); // cancel publish tx timeout
     }
 
-    _BRTxPeerListAddPeer(&manager->txRelays, txHash, peer);
-    if (pubTx.tx) BRWalletRegisterTransaction(manager->wallet, pubTx.tx);
+    _BRPeerManagerTxAddPeer(manager, manager->txRelays, txHash, peer);
+    if (pubTx.tx) _BRPeerManagerRegisterTransaction(manager, pubTx.tx);
     if (pubTx.tx && ! BRWalletTransactionIsValid(manager->wallet, pubTx.tx)) error = EINVAL;
     pthread_mutex_unlock(&manager->lock);
     if (pubTx.callback) pubTx.callback(pubTx.info, error);
@@ -1492,7 +3291,8 @@ static int _peerNetworkIsReachable(void *info)
     return (manager->networkIsReachable) ? manager->networkIsReachable(manager->info) : 1;
 }
 
-static void _peerThreadCleanup(void *info)
+// the peer's connection is over, whether it was served by its own thread or a reactor
+static void _peerConnectionCleanup(void *info)
 {
     BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
 
@@ -1500,9 +3300,23 @@ static void _peerThreadCleanup(void *info)
     pthread_mutex_lock(&manager->lock);
     manager->peerThreadCount--;
     pthread_mutex_unlock(&manager->lock);
+}
+
+static void _peerThreadCleanup(void *info)
+{
+    BRPeerManager *manager = ((BRPeerCallbackInfo *)info)->manager;
+
+    _peerConnectionCleanup(info);
     if (manager->threadCleanup) manager->threadCleanup(manager->info);
 }
 
+// a reactor peer's connection is over once it's disconnected, the loop thread outlives it and isn't cleaned up here
+static void _peerReactorDisconnected(void *info, int error)
+{
+    _peerDisconnected(info, error);
+    _peerConnectionCleanup(info);
+}
+
 static void _dummyThreadCleanup(void *info)
 {
 }
@@ -1522,6 +3336,8 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
     assert(peers != NULL || peersCount == 0);
     manager->params = params;
     manager->wallet = wallet;
+    array_new(manager->wallets, 1);
+    array_add(manager->wallets, wallet);
     manager->earliestKeyTime = earliestKeyTime;
     manager->averageTxPerBlock = 1400;
     manager->maxConnectCount = PEER_MAX_CONNECTIONS;
@@ -1568,11 +3384,23 @@ BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, u
 
     _peer_log("BPM: initialized with %u last block height", manager->lastBlock->height);
 
-    array_new(manager->txRelays, 10);
-    array_new(manager->txRequests, 10);
+    manager->txRelays = BRSetNew(_BRTxPeersHash, _BRTxPeersEq, 100);
+    manager->txRequests = BRSetNew(_BRTxPeersHash, _BRTxPeersEq, 100);
+    array_new(manager->headerRanges, 10);
+    array_new(manager->fetches, FETCH_MAX_IN_FLIGHT);
+    array_new(manager->cfEntries, CF_HEADERS_BATCH);
+    array_new(manager->orphanPool, 10);
+    array_new(manager->throughput, PEER_MAX_CONNECTIONS);
     array_new(manager->publishedTx, 10);
     array_new(manager->publishedTxHashes, 10);
+    manager->watchSet = BRSetNew(_BRWatchElementHash, _BRWatchElementEq, 100);
+    manager->filterTweak = BRRand(0); // shared by all peers so hash lanes can be cached
+    manager->watchHashFuncs = (uint32_t)(-log(BLOOM_REDUCED_FALSEPOSITIVE_RATE)/M_LN2);
     pthread_mutex_init(&manager->lock, NULL);
+    pthread_mutex_init(&manager->watchLock, NULL);
+    pthread_mutex_init(&manager->statsLock, NULL);
+    manager->statsInterval = PEER_MANAGER_STATS_INTERVAL;
+    manager->statsStart = _peerManagerTime();
     manager->threadCleanup = _dummyThreadCleanup;
     return manager;
 }
@@ -1623,12 +3451,126 @@ void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t
         BRPeerManagerDisconnect(manager);
         pthread_mutex_lock(&manager->lock);
         manager->maxConnectCount = UInt128IsZero(address) ? PEER_MAX_CONNECTIONS : 1;
-        manager->fixedPeer = ((const BRPeer) { address, port, 0, 0, 0 });
+        manager->fixedPeer = ((const BRPeer) { address, port, 0, 0, 0, 0, 0, 0 });
         array_clear(manager->peers);
         pthread_mutex_unlock(&manager->lock);
     }
 }
 
+// serve peer connections from reactor event loops instead of a thread per peer (NULL uses BRPeerDefaultReactor())
+void BRPeerManagerSetReactor(BRPeerManager *manager, BRPeerReactor *reactor)
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    manager->reactor = reactor;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// sync using BIP157 compact block filters instead of BIP37 bloom filters, call before BRPeerManagerConnect()
+void BRPeerManagerSetCompactFilters(BRPeerManager *manager, int compactFilters)
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    manager->compactFilters = compactFilters;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// adds a wallet to be synced along with the manager's own wallet
+void BRPeerManagerAddWallet(BRPeerManager *manager, BRWallet *wallet)
+{
+    size_t i;
+
+    assert(manager != NULL);
+    assert(wallet != NULL);
+    pthread_mutex_lock(&manager->lock);
+    for (i = 0; i < array_count(manager->wallets) && manager->wallets[i] != wallet; i++);
+
+    if (i == array_count(manager->wallets)) {
+        pthread_mutex_lock(&manager->watchLock);
+        array_add(manager->wallets, wallet);
+        pthread_mutex_unlock(&manager->watchLock);
+
+        if (manager->bloomFilter) { // extend the loaded filter with the new wallet's elements, or replace it
+            if (manager->pendingFilter) BRBloomFilterFree(manager->pendingFilter);
+            manager->pendingFilter = manager->bloomFilter;
+            manager->bloomFilter = NULL;
+            _BRPeerManagerUpdateFilter(manager);
+        }
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// stops syncing a wallet added with BRPeerManagerAddWallet()
+void BRPeerManagerRemoveWallet(BRPeerManager *manager, BRWallet *wallet)
+{
+    BRWatchElement *elem = NULL;
+
+    assert(manager != NULL);
+    assert(wallet != manager->wallet);
+    pthread_mutex_lock(&manager->lock);
+    pthread_mutex_lock(&manager->watchLock);
+
+    for (size_t i = array_count(manager->wallets); i > 1; i--) {
+        if (manager->wallets[i - 1] == wallet) array_rm(manager->wallets, i - 1);
+    }
+
+    while ((elem = BRSetIterate(manager->watchSet, elem)) != NULL) { // its elements are dropped at the next refresh
+        if (elem->wallet == wallet) elem->wallet = NULL; // a shared element still routes to the other wallets
+    }
+
+    pthread_mutex_unlock(&manager->watchLock);
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// number of wallets synced by manager, including its own
+size_t BRPeerManagerWalletCount(BRPeerManager *manager)
+{
+    size_t count;
+
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    count = array_count(manager->wallets);
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
+
+// passes recordMessage to each peer connected from now on
+void BRPeerManagerSetRecorder(BRPeerManager *manager, void *recorderInfo,
+                              void (*recordMessage)(void *info, const BRPeer *peer, int inbound,
+                                                    const uint8_t *frame, size_t frameLen))
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    manager->recorderInfo = recorderInfo;
+    manager->recordMessage = recordMessage;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// opens peer connections with openSocket instead of connecting to peer addresses
+void BRPeerManagerSetTransport(BRPeerManager *manager, void *transportInfo,
+                               int (*openSocket)(void *info, const BRPeer *peer))
+{
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    manager->transportInfo = transportInfo;
+    manager->openSocket = openSocket;
+    pthread_mutex_unlock(&manager->lock);
+}
+
+// void statsUpdated(void *, const BRPeerManagerStats *) - called with the info passed to BRPeerManagerSetCallbacks()
+//   each time interval seconds have passed, as relayed blocks are handled, the rates in stats cover that interval
+void BRPeerManagerSetStatsCallback(BRPeerManager *manager, double interval,
+                                   void (*statsUpdated)(void *info, const BRPeerManagerStats *stats))
+{
+    assert(manager != NULL);
+    assert(interval > 0);
+    pthread_mutex_lock(&manager->statsLock);
+    manager->statsInterval = interval;
+    manager->statsUpdated = statsUpdated;
+    pthread_mutex_unlock(&manager->statsLock);
+}
+
 // current connect status
 BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager)
 {
@@ -1680,12 +3622,14 @@ void BRPeerManagerConnect(BRPeerManager *manager)
         array_new(peers, 100);
         array_add_array(peers, manager->peers,
                         (array_count(manager->peers) < 100) ? array_count(manager->peers) : 100);
+        qsort(peers, array_count(peers), sizeof(*peers), _peerCostCompare);
 
         while (array_count(peers) > 0 && array_count(manager->connectedPeers) < manager->maxConnectCount) {
             size_t i = BRRand((uint32_t)array_count(peers)); // index of random peer
             BRPeerCallbackInfo *info;
             
-            i = i*i/array_count(peers); // bias random peer selection toward peers with more recent timestamp
+            i = i*i/array_count(peers); // bias random peer selection toward peers with lower expected cost
+            if (peers[0].rttMs > 0 && peers[0].failures == 0) i = 0; // reconnect to known good peers first
         
             for (size_t j = array_count(manager->connectedPeers); i != SIZE_MAX && j > 0; j--) {
                 if (! BRPeerEq(&peers[i], manager->connectedPeers[j - 1])) continue;
@@ -1694,6 +3638,8 @@ void BRPeerManagerConnect(BRPeerManager *manager)
             }
             
             if (i != SIZE_MAX) {
+                BRPeerReactor *reactor = _BRPeerManagerReactor(manager);
+                
                 info = calloc(1, sizeof(*info));
                 assert(info != NULL);
                 info->manager = manager;
@@ -1702,10 +3648,21 @@ void BRPeerManagerConnect(BRPeerManager *manager)
                 array_rm(peers, i);
                 array_add(manager->connectedPeers, info->peer);
                 manager->peerThreadCount++;
-                BRPeerSetCallbacks(info->peer, info, _peerConnected, _peerDisconnected, _peerRelayedPeers,
+                BRPeerSetCallbacks(info->peer, info, _peerConnected,
+                                   (reactor) ? _peerReactorDisconnected : _peerDisconnected, _peerRelayedPeers,
                                    _peerRelayedTx, _peerHasTx, _peerRejectedTx, _peerRelayedBlock, _peerDataNotfound,
                                    _peerSetFeePerKb, _peerRequestedTx, _peerNetworkIsReachable, _peerThreadCleanup);
+                BRPeerSetRelayedBlockHashesCallback(info->peer, _peerRelayedBlockHashes);
+
+                if (manager->compactFilters) {
+                    BRPeerSetCompactFilterCallbacks(info->peer, _peerRelayedCFHeaders, _peerRelayedCFilter,
+                                                    _peerRelayedFullBlock);
+                }
+
                 BRPeerSetEarliestKeyTime(info->peer, manager->earliestKeyTime);
+                if (reactor) BRPeerSetReactor(info->peer, reactor);
+                BRPeerSetRecorder(info->peer, manager->recorderInfo, manager->recordMessage);
+                BRPeerSetTransport(info->peer, manager->transportInfo, manager->openSocket);
                 BRPeerConnect(info->peer);
 
                 if (BRPeerConnectStatus(info->peer) == BRPeerStatusDisconnected) {
@@ -1720,7 +3677,9 @@ void BRPeerManagerConnect(BRPeerManager *manager)
         array_free(peers);
     }
     
-    if (array_count(manager->connectedPeers) == 0) {
+    // with a reactor, DNS lookups still under way connect to the peers they find, or stop the sync if there are none
+    if (array_count(manager->connectedPeers) == 0 &&
+        (manager->dnsThreadCount == 0 || ! _BRPeerManagerReactor(manager))) {
         _BRPeerManagerSyncStopped(manager);
         pthread_mutex_unlock(&manager->lock);
         if (manager->syncStopped) manager->syncStopped(manager->info, ENETUNREACH);
@@ -1771,6 +3730,9 @@ static int _BRPeerManagerRescan(BRPeerManager *manager, BRMerkleBlock *newLastBl
     if (NULL == newLastBlock) return 0;
 
     manager->lastBlock = newLastBlock;
+    _BRPeerManagerClearHeaderRanges(manager);
+    _BRPeerManagerResetFetches(manager);
+    _BRPeerManagerResetCFEntries(manager);
     _peer_log("BPM: rescanning with %u last block height", manager->lastBlock->height);
 
     if (manager->downloadPeer) { // disconnect the current download peer so a new random one will be selected
@@ -1878,6 +3840,192 @@ void BRPeerManagerRescanFromBlockNumber(BRPeerManager *manager, uint32_t blockNu
     if (needConnect) BRPeerManagerConnect(manager);
 }
 
+// drops the headers imported from a snapshot that failed verification, and everything synced on top of them, then
+// restarts the chain download from the checkpoint the snapshot extended
+static void _BRPeerManagerRollbackSnapshot(BRPeerManager *manager, UInt256 anchorHash)
+{
+    BRMerkleBlock *anchor = BRSetGet(manager->blocks, &anchorHash);
+    size_t count = BRSetCount(manager->blocks);
+    BRMerkleBlock **all = malloc(count*sizeof(*all) + 1);
+
+    assert(all != NULL);
+
+    if (anchor) {
+        _BRPeerManagerRescan(manager, anchor);
+        count = BRSetAll(manager->blocks, (void **)all, count);
+
+        for (size_t i = 0; i < count; i++) {
+            if (all[i]->height == BLOCK_UNKNOWN_HEIGHT || all[i]->height <= anchor->height ||
+                BRSetGet(manager->checkpoints, all[i]) == all[i]) continue;
+            BRSetRemove(manager->blocks, all[i]);
+            BRMerkleBlockFree(all[i]);
+        }
+
+        _BRPeerManagerClearOrphans(manager);
+        if (manager->saveBlocks) manager->saveBlocks(manager->info, 1, &anchor, 1);
+    }
+
+    free(all);
+}
+
+// verifies proof of work, difficulty and checkpoints of an imported header snapshot, the way header ranges are verified
+static void *_snapshotVerifyThreadRoutine(void *arg)
+{
+    BRSnapshotVerifyInfo *info = arg;
+    BRPeerManager *manager = info->manager;
+    BRSet *blocks = BRSetNew(BRMerkleBlockHash, BRMerkleBlockEq, BLOCK_DIFFICULTY_INTERVAL + 1);
+    BRMerkleBlock *prev = info->anchor, *block;
+    UInt256 anchorHash = info->anchor->blockHash;
+    uint32_t anchorHeight = info->anchor->height;
+    int r = 1, cancel = 0;
+    size_t i;
+
+    pthread_cleanup_push(manager->threadCleanup, manager->info);
+    BRSetAdd(blocks, prev);
+
+    for (i = 0; r && ! cancel && i < info->count; i++) {
+        block = BRMerkleBlockParse(&info->headers[i*SNAPSHOT_HEADER_SIZE], SNAPSHOT_HEADER_SIZE);
+        block->height = prev->height + 1;
+        if (! UInt256Eq(block->prevBlock, prev->blockHash) || ! BRMerkleBlockIsValid(block, (uint32_t)time(NULL))) r = 0;
+        if (r && (block->height % BLOCK_DIFFICULTY_INTERVAL) == 0) _BRBlockSetPrune(blocks, block);
+        if (r && ! manager->params->verifyDifficulty(block, blocks)) r = 0;
+
+        for (size_t j = 0; r && j < manager->params->checkpointsCount; j++) {
+            if (manager->params->checkpoints[j].height != block->height) continue;
+            if (! UInt256Eq(UInt256Reverse(manager->params->checkpoints[j].hash), block->blockHash)) r = 0;
+        }
+
+        if (r) BRSetAdd(blocks, block), prev = block;
+        else BRMerkleBlockFree(block);
+
+        if ((i % BLOCK_DIFFICULTY_INTERVAL) == 0) {
+            pthread_mutex_lock(&manager->lock);
+            cancel = manager->snapshotCancel;
+            pthread_mutex_unlock(&manager->lock);
+        }
+    }
+
+    pthread_mutex_lock(&manager->lock);
+
+    if (! r) {
+        _peer_log("BPM: header snapshot failed verification at #%"PRIu32", rolling back to #%"PRIu32,
+                  anchorHeight + (uint32_t)i, anchorHeight);
+        _BRPeerManagerRollbackSnapshot(manager, anchorHash);
+    }
+    else if (! cancel) _peer_log("BPM: verified %zu snapshot headers", info->count);
+
+    manager->snapshotVerifying = 0;
+    pthread_mutex_unlock(&manager->lock);
+    BRSetApply(blocks, NULL, _setApplyFreeBlock); // the anchor copy is freed here, or when it was pruned
+    BRSetFree(blocks);
+    free(info->headers);
+    free(info);
+    pthread_cleanup_pop(1);
+    return NULL;
+}
+
+// imports a header snapshot, see BRPeerManager.h for the format and how it is verified
+size_t BRPeerManagerImportHeaderSnapshot(BRPeerManager *manager, const uint8_t *headers, size_t headersLen,
+                                         UInt256 lastBlockHash)
+{
+    size_t count = headersLen/SNAPSHOT_HEADER_SIZE, n = 0, start = 0, i;
+    BRMerkleBlock *anchor = NULL, *prev, *checkpoint, *b;
+    BRSnapshotVerifyInfo *info;
+    pthread_t thread;
+    pthread_attr_t attr;
+    uint32_t height;
+    UInt256 hash;
+    int r = 1;
+
+    assert(manager != NULL);
+    assert(headers != NULL || headersLen == 0);
+    if (count == 0 || (headersLen % SNAPSHOT_HEADER_SIZE) != 0) return 0;
+    BRSHA256_2(&hash, &headers[(count - 1)*SNAPSHOT_HEADER_SIZE], SNAPSHOT_HEADER_SIZE);
+
+    if (! UInt256Eq(hash, lastBlockHash)) {
+        _peer_log("BPM: header snapshot doesn't end at pinned block: %s", u256hex(lastBlockHash));
+        return 0;
+    }
+
+    pthread_mutex_lock(&manager->lock);
+    hash = UInt256Get(&headers[sizeof(uint32_t)]); // prevBlock of the first header
+    anchor = BRSetGet(manager->blocks, &hash);
+
+    if (! anchor || BRSetGet(manager->checkpoints, anchor) != anchor) {
+        _peer_log("BPM: header snapshot doesn't start after a checkpoint");
+    }
+    else if (array_count(manager->connectedPeers) > 0 || manager->snapshotVerifying) {
+        _peer_log("BPM: header snapshot must be imported before connecting");
+    }
+    else { // headers from a week before earliestKeyTime on are downloaded as merkleblocks
+        while (n < count && UInt32GetLE(&headers[n*SNAPSHOT_HEADER_SIZE + 68]) + 7*24*60*60 < manager->earliestKeyTime) n++;
+        if (anchor->height + n <= manager->lastBlock->height) n = 0; // chain is already past the snapshot
+    }
+
+    if (n > 0) { // only headers since the last difficulty transition are needed to extend the chain
+        height = anchor->height + (uint32_t)n;
+        height -= height % BLOCK_DIFFICULTY_INTERVAL;
+        start = (height > anchor->height) ? height - anchor->height - 1 : 0;
+    }
+
+    BRMerkleBlock *save[(n > start) ? n - start : 1];
+
+    for (i = start, prev = (start == 0) ? anchor : NULL; r && i < n; i++) {
+        b = BRMerkleBlockParse(&headers[i*SNAPSHOT_HEADER_SIZE], SNAPSHOT_HEADER_SIZE);
+        b->height = anchor->height + 1 + (uint32_t)i;
+        save[n - 1 - i] = b;
+        checkpoint = BRSetGet(manager->checkpoints, b);
+        if (prev && ! UInt256Eq(b->prevBlock, prev->blockHash)) r = 0;
+        if (checkpoint && ! UInt256Eq(checkpoint->blockHash, b->blockHash)) r = 0;
+        prev = b;
+    }
+
+    if (! r) {
+        _peer_log("BPM: header snapshot doesn't link up at #%"PRIu32, anchor->height + (uint32_t)i);
+        while (i > start) BRMerkleBlockFree(save[n - i--]);
+        n = 0;
+    }
+    else if (n > 0) {
+        for (i = 0; i < n - start; i++) {
+            b = BRSetGet(manager->blocks, save[i]);
+
+            if (b) BRMerkleBlockFree(save[i]), save[i] = b; // don't replace checkpoints
+            else BRSetAdd(manager->blocks, save[i]);
+        }
+
+        manager->lastBlock = save[0];
+        if (manager->lastBlock->height > manager->estimatedHeight) manager->estimatedHeight = manager->lastBlock->height;
+        if (manager->saveBlocks) manager->saveBlocks(manager->info, 1, save, n - start);
+        _peer_log("BPM: imported snapshot headers #%"PRIu32" to #%"PRIu32", verifying in the background",
+                  anchor->height + 1, manager->lastBlock->height);
+
+        info = calloc(1, sizeof(*info));
+        assert(info != NULL);
+        info->manager = manager;
+        info->headers = malloc(n*SNAPSHOT_HEADER_SIZE);
+        assert(info->headers != NULL);
+        memcpy(info->headers, headers, n*SNAPSHOT_HEADER_SIZE);
+        info->count = n;
+        info->anchor = BRMerkleBlockCopy(anchor);
+        manager->snapshotVerifying = 1;
+        manager->snapshotCancel = 0;
+
+        if (pthread_attr_init(&attr) != 0 || pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+            pthread_create(&thread, &attr, _snapshotVerifyThreadRoutine, info) != 0) {
+            _peer_log("BPM: couldn't start header snapshot verification, rolling back");
+            _BRPeerManagerRollbackSnapshot(manager, anchor->blockHash);
+            manager->snapshotVerifying = 0;
+            BRMerkleBlockFree(info->anchor);
+            free(info->headers);
+            free(info);
+            n = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&manager->lock);
+    return n;
+}
+
 // the (unverified) best block height reported by connected peers
 uint32_t BRPeerManagerEstimatedBlockHeight(BRPeerManager *manager)
 {
@@ -2049,16 +4197,45 @@ size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash)
     assert(! UInt256IsZero(txHash));
     pthread_mutex_lock(&manager->lock);
     
-    for (size_t i = array_count(manager->txRelays); i > 0; i--) {
-        if (! UInt256Eq(manager->txRelays[i - 1].txHash, txHash)) continue;
-        count = array_count(manager->txRelays[i - 1].peers);
-        break;
-    }
-    
+    count = _BRPeerManagerTxPeerCount(manager->txRelays, txHash);
     pthread_mutex_unlock(&manager->lock);
     return count;
 }
 
+// counters for blocks held while waiting for the blocks before them, useful to watch for orphan churn
+BRPeerManagerOrphanStats BRPeerManagerGetOrphanStats(BRPeerManager *manager)
+{
+    BRPeerManagerOrphanStats stats;
+
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    stats = manager->orphanStats;
+    pthread_mutex_unlock(&manager->lock);
+    return stats;
+}
+
+// sync counters, rates and timings, totals are since the manager was created
+BRPeerManagerStats BRPeerManagerGetStats(BRPeerManager *manager)
+{
+    BRPeerManagerStats stats;
+
+    assert(manager != NULL);
+    pthread_mutex_lock(&manager->lock);
+    pthread_mutex_lock(&manager->statsLock);
+    stats = manager->stats;
+    pthread_mutex_unlock(&manager->statsLock);
+
+    for (size_t i = array_count(manager->connectedPeers); i > 0; i--) {
+        BRPeerMsgCounts(manager->connectedPeers[i - 1], stats.received, stats.sent);
+    }
+
+    stats.time = _peerManagerTime();
+    stats.fpRate = manager->fpRate;
+    stats.orphans = manager->orphanStats;
+    pthread_mutex_unlock(&manager->lock);
+    return stats;
+}
+
 const BRChainParams *BRPeerManagerChainParams (BRPeerManager *manager) {
     return manager->params;
 }
@@ -2070,18 +4247,36 @@ void BRPeerManagerFree(BRPeerManager *manager)
     
     assert(manager != NULL);
     pthread_mutex_lock(&manager->lock);
+
+    while (manager->snapshotVerifying) { // wait for header snapshot verification to stop
+        struct timespec ts = { 0, 1000000 };
+
+        manager->snapshotCancel = 1;
+        pthread_mutex_unlock(&manager->lock);
+        nanosleep(&ts, NULL);
+        pthread_mutex_lock(&manager->lock);
+    }
+
+    _BRPeerManagerResetFetches(manager);
+    array_free(manager->fetches);
+    _BRPeerManagerResetCFEntries(manager);
+    array_free(manager->cfEntries);
     array_free(manager->peers);
     for (size_t i = array_count(manager->connectedPeers); i > 0; i--) BRPeerFree(manager->connectedPeers[i - 1]);
     array_free(manager->connectedPeers);
+    _BRPeerManagerClearHeaderRanges(manager);
+    array_free(manager->headerRanges);
     BRSetApply(manager->blocks, NULL, _setApplyFreeBlock);
     BRSetFree(manager->blocks);
-    BRSetApply(manager->orphans, NULL, _setApplyFreeBlock);
+    _BRPeerManagerClearOrphans(manager);
     BRSetFree(manager->orphans);
+    array_free(manager->orphanPool);
+    array_free(manager->throughput);
     BRSetFree(manager->checkpoints);
-    for (size_t i = array_count(manager->txRelays); i > 0; i--) array_free(manager->txRelays[i - 1].peers);
-    array_free(manager->txRelays);
-    for (size_t i = array_count(manager->txRequests); i > 0; i--) array_free(manager->txRequests[i - 1].peers);
-    array_free(manager->txRequests);
+    BRSetApply(manager->txRelays, NULL, _setApplyFree);
+    BRSetFree(manager->txRelays);
+    BRSetApply(manager->txRequests, NULL, _setApplyFree);
+    BRSetFree(manager->txRequests);
 
     for (size_t i = array_count(manager->publishedTx); i > 0; i--) {
         tx = manager->publishedTx[i - 1].tx;
@@ -2089,10 +4284,123 @@ void BRPeerManagerFree(BRPeerManager *manager)
     }
 
     if (manager->bloomFilter) BRBloomFilterFree(manager->bloomFilter);
+    if (manager->pendingFilter) BRBloomFilterFree(manager->pendingFilter);
+    BRSetApply(manager->watchSet, NULL, _setApplyFree);
+    BRSetFree(manager->watchSet);
 
     array_free(manager->publishedTx);
     array_free(manager->publishedTxHashes);
+    array_free(manager->wallets);
     pthread_mutex_unlock(&manager->lock);
     pthread_mutex_destroy(&manager->lock);
+    pthread_mutex_destroy(&manager->watchLock);
+    pthread_mutex_destroy(&manager->statsLock);
     free(manager);
 }
+
+// restarts the chain download from the checkpoint with blockHash and splits the headers up to a week before
+// earliestKeyTime into checkpoint ranges, returns the number of ranges
+size_t BRPeerManagerBuildHeaderRangesTest(BRPeerManager *manager, UInt256 blockHash)
+{
+    size_t count;
+
+    pthread_mutex_lock(&manager->lock);
+    _BRPeerManagerRescan(manager, BRSetGet(manager->blocks, &blockHash));
+    count = _BRPeerManagerBuildHeaderRanges(manager);
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
+
+// adds a header peer relayed for the header range at index, handing the range over to peer first if it was assigned
+// to another peer, returns the number of ranges not yet added to the chain
+size_t BRPeerManagerHeaderRangeAddBlockTest(BRPeerManager *manager, size_t index, BRPeer *peer, BRMerkleBlock *block)
+{
+    BRHeaderRange *range;
+    size_t count;
+
+    pthread_mutex_lock(&manager->lock);
+    range = &manager->headerRanges[index];
+    if (range->peer != peer) _BRHeaderRangeReset(range), range->peer = peer;
+    _BRPeerManagerHeaderRangeAddBlock(manager, range, peer, block);
+    count = array_count(manager->headerRanges);
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
+
+// makes peer the download peer, with an empty bloom filter loaded, and schedules merkleblock downloads for blockHashes
+// as if they had been requested from it
+void BRPeerManagerFetchBlocksTest(BRPeerManager *manager, BRPeer *peer, const UInt256 blockHashes[], size_t count)
+{
+    pthread_mutex_lock(&manager->lock);
+    manager->downloadPeer = peer;
+
+    if (! manager->bloomFilter) {
+        manager->bloomFilter = BRBloomFilterNew(BLOOM_REDUCED_FALSEPOSITIVE_RATE, 1, manager->filterTweak,
+                                                BLOOM_UPDATE_ALL);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        array_add(manager->fetches, ((const BRBlockFetch) { blockHashes[i], peer, time(NULL), NULL }));
+    }
+
+    manager->fetchEnd = array_count(manager->fetches);
+    pthread_mutex_unlock(&manager->lock);
+}
+
+void BRPeerManagerPeerRelayedBlockTest(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block)
+{
+    BRPeerCallbackInfo info = { peer, manager, UINT256_ZERO };
+
+    _BRPeerManagerPeerRelayedBlock(&info, block);
+}
+
+// adds peer to the peers that relayed txHash, returns the number of peers that have
+size_t BRPeerManagerTxAddRelayTest(BRPeerManager *manager, UInt256 txHash, const BRPeer *peer)
+{
+    size_t count;
+
+    pthread_mutex_lock(&manager->lock);
+    count = _BRPeerManagerTxAddPeer(manager, manager->txRelays, txHash, peer);
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
+
+// removes peer from the peers that relayed txHash, returns true if it was one of them
+int BRPeerManagerTxRemoveRelayTest(BRPeerManager *manager, UInt256 txHash, const BRPeer *peer)
+{
+    int r;
+
+    pthread_mutex_lock(&manager->lock);
+    r = _BRPeerManagerTxRemovePeer(manager, manager->txRelays, txHash, peer);
+    pthread_mutex_unlock(&manager->lock);
+    return r;
+}
+
+// refreshes the watch set from the manager's wallets, then registers tx with each added wallet it belongs to, returns
+// the number of wallets it was registered with
+size_t BRPeerManagerRouteTransactionTest(BRPeerManager *manager, const BRTransaction *tx)
+{
+    uint32_t blockHeight;
+    size_t count;
+
+    pthread_mutex_lock(&manager->lock);
+    blockHeight = manager->lastBlock->height;
+    pthread_mutex_unlock(&manager->lock);
+    _BRPeerManagerRefreshWatchSet(manager, blockHeight);
+    pthread_mutex_lock(&manager->lock);
+    count = _BRPeerManagerRouteTransaction(manager, tx);
+    pthread_mutex_unlock(&manager->lock);
+    return count;
+}
+
+// returns the number of merkleblocks the block fetch scheduler keeps in flight to peer
+size_t BRPeerManagerFetchLimitTest(BRPeer *peer)
+{
+    return _BRPeerManagerFetchLimit(peer);
+}
+
+// sorts peers the way connection candidates are, by expected connection cost, lowest first
+void BRPeerManagerSortPeersTest(BRPeer peers[], size_t peersCount)
+{
+    qsort(peers, peersCount, sizeof(*peers), _peerCostCompare);
+}
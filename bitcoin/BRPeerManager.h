@@ -41,6 +41,35 @@ extern "C" {
 
 typedef struct BRPeerManagerStruct BRPeerManager;
 
+typedef struct {
+    size_t count, bytes; // orphan blocks currently held, and the memory they use
+    uint64_t added, connected, evicted, replaced; // totals since the manager was created
+} BRPeerManagerOrphanStats;
+
+#define PEER_MANAGER_HISTOGRAM_BUCKETS 24 // bucket i > 0 counts durations of 2^(i - 1) up to 2^i microseconds
+#define PEER_MANAGER_STATS_INTERVAL    10.0 // default seconds between stats updates
+
+typedef struct {
+    uint64_t count; // durations recorded
+    double total; // sum of the durations in seconds
+    uint64_t buckets[PEER_MANAGER_HISTOGRAM_BUCKETS]; // the first bucket counts durations under a microsecond, and the
+                                                      // last everything longer than the bucket before it
+} BRPeerManagerHistogram;
+
+typedef struct {
+    double time; // unix time the stats were taken
+    uint64_t headers, merkleBlocks; // relayed by peers since the manager was created
+    double headersRate, merkleBlocksRate; // per second over the most recent stats interval
+    double fpRate; // current estimate of the bloom filter false positive rate
+    uint64_t matchedTx, falsePositiveTx; // tx hashes in relayed merkleblocks that were/weren't wallet tx
+    BRPeerMsgCount received[PEER_MSG_TYPES], sent[PEER_MSG_TYPES]; // by message type, see BRPeerMsgType()
+    BRPeerManagerHistogram relayedBlock; // handling each block relayed by a peer, start to finish
+    BRPeerManagerHistogram wallet; // wallet calls registering and updating tx
+    BRPeerManagerHistogram callbacks; // saveBlocks and txStatusUpdate callbacks made while handling relayed blocks
+    BRPeerManagerHistogram lockWait, lockHold; // waiting for and holding the manager lock to handle relayed blocks
+    BRPeerManagerOrphanStats orphans;
+} BRPeerManagerStats;
+
 // returns a newly allocated BRPeerManager struct that must be freed by calling BRPeerManagerFree()
 BRPeerManager *BRPeerManagerNew(const BRChainParams *params, BRWallet *wallet, uint32_t earliestKeyTime,
                                 BRMerkleBlock *blocks[], size_t blocksCount, const BRPeer peers[], size_t peersCount);
@@ -69,6 +98,30 @@ void BRPeerManagerSetCallbacks(BRPeerManager *manager, void *info,
 // set address to UINT128_ZERO to revert to default behavior
 void BRPeerManagerSetFixedPeer(BRPeerManager *manager, UInt128 address, uint16_t port);
 
+// serve peer connections from reactor event loops instead of a thread per peer (NULL uses BRPeerDefaultReactor()),
+// DNS seeds are then resolved by detached lookup threads that connect to the peers they find, so that no loop thread
+// waits on DNS
+void BRPeerManagerSetReactor(BRPeerManager *manager, BRPeerReactor *reactor);
+
+// sync using BIP157 compact block filters instead of BIP37 bloom filters, call before BRPeerManagerConnect()
+// only peers serving compact filters are used, and wallet tx aren't seen until they're in a block
+void BRPeerManagerSetCompactFilters(BRPeerManager *manager, int compactFilters);
+
+// passes recordMessage to each peer connected from now on, see BRPeerSetRecorder() and BRPeerRecorderNew()
+void BRPeerManagerSetRecorder(BRPeerManager *manager, void *recorderInfo,
+                              void (*recordMessage)(void *info, const BRPeer *peer, int inbound,
+                                                    const uint8_t *frame, size_t frameLen));
+
+// opens peer connections with openSocket instead of connecting to peer addresses, e.g. to replay a recorded session
+// with BRPeerReplayOpenSocket(), see BRPeerSetTransport()
+void BRPeerManagerSetTransport(BRPeerManager *manager, void *transportInfo,
+                               int (*openSocket)(void *info, const BRPeer *peer));
+
+// void statsUpdated(void *, const BRPeerManagerStats *) - called with the info passed to BRPeerManagerSetCallbacks()
+//   each time interval seconds have passed, as relayed blocks are handled, the rates in stats cover that interval
+void BRPeerManagerSetStatsCallback(BRPeerManager *manager, double interval,
+                                   void (*statsUpdated)(void *info, const BRPeerManagerStats *stats));
+
 // current connect status
 BRPeerStatus BRPeerManagerConnectStatus(BRPeerManager *manager);
 
@@ -89,6 +142,28 @@ void BRPeerManagerRescanFromLastHardcodedCheckpoint(BRPeerManager *manager);
 // rescan from the just prior checkpoint (uses a new random download peer, see above comment).
 void BRPeerManagerRescanFromBlockNumber(BRPeerManager *manager, uint32_t blockNumber);
 
+// adds a wallet, typically watch-only, to be synced over the same chain, peers and bloom filter as the manager's own
+// wallet, tx matched by the filter are registered with the wallets they belong to, as found by their outpoints and
+// output pubkey hashes, only blocks synced after the wallet is added are searched, call BRPeerManagerRescan() to find
+// earlier tx, and tx can only be published from the manager's own wallet
+void BRPeerManagerAddWallet(BRPeerManager *manager, BRWallet *wallet);
+
+// stops syncing a wallet added with BRPeerManagerAddWallet(), which can be freed once this returns
+void BRPeerManagerRemoveWallet(BRPeerManager *manager, BRWallet *wallet);
+
+// number of wallets synced by manager, including its own
+size_t BRPeerManagerWalletCount(BRPeerManager *manager);
+
+// imports a header snapshot, serialized 80 byte block headers in chain order starting with the header after a checkpoint
+// in the chain params, so a new wallet doesn't have to download the headers between that checkpoint and earliestKeyTime
+// - lastBlockHash pins the hash of the snapshot's final header, which must be known to the app ahead of time
+// - only headers more than a week older than earliestKeyTime are imported, later blocks are synced as merkleblocks
+// - must be called before connecting, proof of work, difficulty and checkpoints are verified in the background, and
+//   if verification fails the imported headers are dropped and the chain is downloaded from the checkpoint instead
+// returns the number of headers imported, or 0 if the snapshot was rejected or the chain is already past it
+size_t BRPeerManagerImportHeaderSnapshot(BRPeerManager *manager, const uint8_t *headers, size_t headersLen,
+                                         UInt256 lastBlockHash);
+
 // the (unverified) best block height reported by connected peers
 uint32_t BRPeerManagerEstimatedBlockHeight(BRPeerManager *manager);
 
@@ -115,6 +190,12 @@ void BRPeerManagerPublishTx(BRPeerManager *manager, BRTransaction *tx, void *inf
 // number of connected peers that have relayed the given unconfirmed transaction
 size_t BRPeerManagerRelayCount(BRPeerManager *manager, UInt256 txHash);
 
+// counters for blocks held while waiting for the blocks before them, useful to watch for orphan churn
+BRPeerManagerOrphanStats BRPeerManagerGetOrphanStats(BRPeerManager *manager);
+
+// sync counters, rates and timings, totals are since the manager was created
+BRPeerManagerStats BRPeerManagerGetStats(BRPeerManager *manager);
+
 // return the BRChainParams used to create this peer manager
 const BRChainParams *BRPeerManagerChainParams(BRPeerManager *manager);
 
@@ -0,0 +1,478 @@
+//
+//  BRPeerReplay.c
+//
+//  Copyright © 2026 Breadwallet AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#include "BRPeerReplay.h"
+#include "BRArray.h"
+#include "BRInt.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#define REPLAY_FILE_MAGIC    0x52505242 // "BRPR"
+#define REPLAY_FILE_VERSION  1
+#define REPLAY_FILE_HEADER   16 // magic, version, network magic number, earliestKeyTime
+#define REPLAY_RECORD_HEADER 31 // microseconds, address, port, inbound, frame length
+#define REPLAY_FRAME_HEADER  24 // network magic number, type, payload length, checksum
+#define REPLAY_STALL_TIMEOUT 1.0 // seconds to wait for the peer to send the messages expected before a frame
+#define REPLAY_POLL_TIMEOUT  100 // milliseconds between checks for the replay being freed
+
+#ifndef MSG_NOSIGNAL   // linux based systems have a MSG_NOSIGNAL send flag, useful for supressing SIGPIPE signals
+#define MSG_NOSIGNAL 0 // set to 0 if undefined (BSD has the SO_NOSIGPIPE sockopt, and windows has no signals at all)
+#endif
+
+static double _replayTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + (double)tv.tv_usec/1000000;
+}
+
+struct BRPeerRecorderStruct {
+    FILE *file;
+    double startTime;
+    pthread_mutex_t lock;
+};
+
+// returns a newly allocated recorder writing to a new file at path, or NULL with errno set, that must be freed by
+// calling BRPeerRecorderFree()
+BRPeerRecorder *BRPeerRecorderNew(const char *path, uint32_t magicNumber, uint32_t earliestKeyTime)
+{
+    BRPeerRecorder *recorder = calloc(1, sizeof(*recorder));
+    uint8_t buf[REPLAY_FILE_HEADER];
+
+    assert(recorder != NULL);
+    assert(path != NULL);
+    recorder->file = fopen(path, "wb");
+    recorder->startTime = _replayTime();
+    UInt32SetLE(&buf[0], REPLAY_FILE_MAGIC);
+    UInt32SetLE(&buf[4], REPLAY_FILE_VERSION);
+    UInt32SetLE(&buf[8], magicNumber);
+    UInt32SetLE(&buf[12], earliestKeyTime);
+
+    if (! recorder->file || fwrite(buf, sizeof(buf), 1, recorder->file) != 1) {
+        int error = errno;
+
+        if (recorder->file) fclose(recorder->file);
+        free(recorder);
+        errno = error;
+        return NULL;
+    }
+
+    pthread_mutex_init(&recorder->lock, NULL);
+    return recorder;
+}
+
+// appends a frame to the recording, only the header of outbound frames is kept
+void BRPeerRecorderRecordMessage(void *info, const BRPeer *peer, int inbound, const uint8_t *frame, size_t frameLen)
+{
+    BRPeerRecorder *recorder = info;
+    uint8_t buf[REPLAY_RECORD_HEADER];
+
+    assert(recorder != NULL);
+    assert(peer != NULL);
+    assert(frame != NULL && frameLen >= REPLAY_FRAME_HEADER);
+    if (! inbound) frameLen = REPLAY_FRAME_HEADER;
+    UInt128Set(&buf[8], peer->address);
+    UInt16SetLE(&buf[24], peer->port);
+    buf[26] = (inbound) ? 1 : 0;
+    UInt32SetLE(&buf[27], (uint32_t)frameLen);
+    pthread_mutex_lock(&recorder->lock);
+    UInt64SetLE(&buf[0], (uint64_t)((_replayTime() - recorder->startTime)*1000000));
+    fwrite(buf, sizeof(buf), 1, recorder->file);
+    fwrite(frame, frameLen, 1, recorder->file);
+    pthread_mutex_unlock(&recorder->lock);
+}
+
+// closes the recording, all peers using the recorder must be disconnected first
+void BRPeerRecorderFree(BRPeerRecorder *recorder)
+{
+    assert(recorder != NULL);
+    fclose(recorder->file);
+    pthread_mutex_destroy(&recorder->lock);
+    free(recorder);
+}
+
+typedef struct {
+    uint64_t time; // microseconds since the recording started
+    int inbound;
+    const uint8_t *frame;
+    size_t frameLen;
+} BRReplayRecord;
+
+typedef struct {
+    BRPeer peer;
+    BRReplayRecord *records;
+    size_t next; // first record of the next session
+    int opened;
+} BRReplayPeer;
+
+typedef struct {
+    BRPeerReplay *replay;
+    const BRReplayRecord *records; // records of the session, the first being the peer's version message
+    size_t count;
+    int socket;
+    uint8_t header[REPLAY_FRAME_HEADER]; // outbound frame being parsed
+    size_t headerLen, payloadLeft, sent; // number of outbound frames the peer has sent
+    int closed;
+} BRReplaySession;
+
+struct BRPeerReplayStruct {
+    uint8_t *data;
+    uint32_t magicNumber, earliestKeyTime;
+    double speed;
+    BRReplayPeer *peers;
+    pthread_t *threads;
+    size_t active;
+    volatile int closing;
+    BRPeerReplayStats stats;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static int _replayPeerCompare(const void *a, const void *b)
+{
+    size_t x = array_count(((const BRReplayPeer *)a)->records), y = array_count(((const BRReplayPeer *)b)->records);
+
+    return (x > y) ? -1 : (x < y) ? 1 : 0;
+}
+
+// returns a newly allocated replay of the recording at path, or NULL with errno set, that must be freed by calling
+// BRPeerReplayFree()
+BRPeerReplay *BRPeerReplayNew(const char *path, double speed)
+{
+    BRPeerReplay *replay = calloc(1, sizeof(*replay));
+    FILE *file;
+    long len = 0;
+    size_t off, i, count;
+    BRReplayRecord record;
+    BRPeer peer = BR_PEER_NONE;
+
+    assert(replay != NULL);
+    assert(path != NULL);
+    assert(speed >= 0);
+    file = fopen(path, "rb");
+
+    if (! file) {
+        free(replay);
+        return NULL;
+    }
+
+    if (fseek(file, 0, SEEK_END) == 0) len = ftell(file);
+    replay->data = (len > 0) ? malloc(len) : NULL;
+
+    if (! replay->data || fseek(file, 0, SEEK_SET) != 0 || fread(replay->data, len, 1, file) != 1 ||
+        len < REPLAY_FILE_HEADER || UInt32GetLE(&replay->data[0]) != REPLAY_FILE_MAGIC ||
+        UInt32GetLE(&replay->data[4]) != REPLAY_FILE_VERSION) { // not a recording, or one in a later format
+        fclose(file);
+        if (replay->data) free(replay->data);
+        free(replay);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fclose(file);
+    replay->magicNumber = UInt32GetLE(&replay->data[8]);
+    replay->earliestKeyTime = UInt32GetLE(&replay->data[12]);
+    replay->speed = speed;
+    array_new(replay->peers, 8);
+    array_new(replay->threads, 8);
+
+    for (off = REPLAY_FILE_HEADER; off + REPLAY_RECORD_HEADER <= (size_t)len;
+         off += REPLAY_RECORD_HEADER + record.frameLen) {
+        record.time = UInt64GetLE(&replay->data[off]);
+        peer.address = UInt128Get(&replay->data[off + 8]);
+        peer.port = UInt16GetLE(&replay->data[off + 24]);
+        record.inbound = replay->data[off + 26];
+        record.frameLen = UInt32GetLE(&replay->data[off + 27]);
+        record.frame = &replay->data[off + REPLAY_RECORD_HEADER];
+        if (record.frameLen < REPLAY_FRAME_HEADER || (size_t)len - off - REPLAY_RECORD_HEADER < record.frameLen) break;
+
+        for (i = 0, count = array_count(replay->peers); i < count; i++) {
+            if (BRPeerEq(&replay->peers[i].peer, &peer)) break;
+        }
+
+        if (i == count) {
+            array_add(replay->peers, ((const BRReplayPeer) { peer, NULL, 0, 0 }));
+            array_new(replay->peers[i].records, 1000);
+        }
+
+        array_add(replay->peers[i].records, record);
+    }
+
+    qsort(replay->peers, array_count(replay->peers), sizeof(*replay->peers), _replayPeerCompare);
+    pthread_mutex_init(&replay->lock, NULL);
+    pthread_cond_init(&replay->cond, NULL);
+    return replay;
+}
+
+// network magic number of the recording
+uint32_t BRPeerReplayMagicNumber(BRPeerReplay *replay)
+{
+    assert(replay != NULL);
+    return replay->magicNumber;
+}
+
+// earliestKeyTime of the recorded sync
+uint32_t BRPeerReplayEarliestKeyTime(BRPeerReplay *replay)
+{
+    assert(replay != NULL);
+    return replay->earliestKeyTime;
+}
+
+// writes up to peersCount recorded peers to peers, busiest first, returns the number of recorded peers
+size_t BRPeerReplayPeers(BRPeerReplay *replay, BRPeer peers[], size_t peersCount)
+{
+    size_t i, count;
+
+    assert(replay != NULL);
+    assert(peers != NULL || peersCount == 0);
+    count = array_count(replay->peers);
+    for (i = 0; i < count && i < peersCount; i++) peers[i] = replay->peers[i].peer;
+    return count;
+}
+
+// true if frame has the given message type
+static int _replayFrameIsType(const uint8_t *frame, const char *type)
+{
+    return (strncmp((const char *)&frame[4], type, 12) == 0);
+}
+
+// reads whatever the peer has sent within timeout seconds and counts its complete frames, returns false once the
+// peer has closed its socket
+static int _replayDrain(BRReplaySession *session, double timeout)
+{
+    struct pollfd pfd = { session->socket, POLLIN, 0 };
+    uint8_t buf[0x4000];
+    ssize_t r;
+    size_t i, n, len;
+
+    if (poll(&pfd, 1, (int)(timeout*1000)) <= 0) return ! session->closed;
+    r = read(session->socket, buf, sizeof(buf));
+    if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR)) session->closed = 1;
+    n = (r > 0) ? (size_t)r : 0;
+
+    for (i = 0; i < n; i += len) {
+        if (session->payloadLeft > 0) { // skip the payload of the current frame
+            len = (session->payloadLeft < n - i) ? session->payloadLeft : n - i;
+            session->payloadLeft -= len;
+        }
+        else { // collect the next frame header
+            len = REPLAY_FRAME_HEADER - session->headerLen;
+            if (len > n - i) len = n - i;
+            memcpy(&session->header[session->headerLen], &buf[i], len);
+            session->headerLen += len;
+
+            if (session->headerLen == REPLAY_FRAME_HEADER) {
+                session->payloadLeft = UInt32GetLE(&session->header[16]);
+                session->headerLen = 0;
+                session->sent++;
+            }
+        }
+    }
+
+    return ! session->closed;
+}
+
+// drains the peer's socket until it can take more of frame, returns false if the peer has closed its socket
+static int _replayWrite(BRReplaySession *session, const uint8_t *frame, size_t frameLen)
+{
+    struct pollfd pfd = { session->socket, POLLIN | POLLOUT, 0 };
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < frameLen && ! session->closed && ! session->replay->closing) {
+        pfd.revents = 0;
+        if (poll(&pfd, 1, REPLAY_POLL_TIMEOUT) < 0 && errno != EINTR) session->closed = 1;
+        if (pfd.revents & (POLLIN | POLLHUP)) _replayDrain(session, 0);
+        if (! (pfd.revents & POLLOUT) || session->closed) continue;
+        n = send(session->socket, &frame[off], frameLen - off, MSG_NOSIGNAL);
+        if (n > 0) off += n;
+        if (n < 0 && errno != EAGAIN && errno != EINTR) session->closed = 1;
+    }
+
+    return (off == frameLen);
+}
+
+static void *_replaySessionRoutine(void *arg)
+{
+    BRReplaySession *session = arg;
+    BRPeerReplay *replay = session->replay;
+    double start = _replayTime(), now, due, stallTime;
+    size_t i, expected = 0, skew = 0, messages = 0, bytes = 0, stalls = 0;
+    const BRReplayRecord *record;
+
+    for (i = 0; i < session->count && ! session->closed && ! replay->closing; i++) {
+        record = &session->records[i];
+
+        if (! record->inbound) { // the peer is expected to send this before any later inbound frame
+            expected++;
+            continue;
+        }
+
+        stallTime = _replayTime() + REPLAY_STALL_TIMEOUT;
+
+        while (session->sent + skew < expected && ! session->closed && ! replay->closing) {
+            now = _replayTime();
+
+            if (now >= stallTime) { // the peer took a different path than recorded, stop waiting on the difference
+                skew = expected - session->sent;
+                stalls++;
+            }
+            else _replayDrain(session, (stallTime - now < 0.1) ? stallTime - now : 0.1);
+        }
+
+        if (replay->speed > 0) { // virtual time, the recorded arrival time scaled by speed
+            due = start + (record->time - session->records[0].time)/replay->speed/1000000;
+            while ((now = _replayTime()) < due && ! session->closed && ! replay->closing) {
+                _replayDrain(session, (due - now < 0.1) ? due - now : 0.1);
+            }
+        }
+
+        if (_replayWrite(session, record->frame, record->frameLen)) messages++, bytes += record->frameLen;
+    }
+
+    shutdown(session->socket, SHUT_WR); // the peer disconnects once it has handled everything sent so far
+    while (! replay->closing && _replayDrain(session, 0.1));
+    close(session->socket);
+
+    pthread_mutex_lock(&replay->lock);
+    replay->stats.messages += messages;
+    replay->stats.bytes += bytes;
+    replay->stats.stalls += stalls;
+    replay->active--;
+    pthread_cond_broadcast(&replay->cond);
+    pthread_mutex_unlock(&replay->lock);
+    free(session);
+    return NULL;
+}
+
+// returns a socket that is fed the next recorded session with peer, or -1 with errno set to ECONNREFUSED once there are
+// no more sessions
+int BRPeerReplayOpenSocket(void *info, const BRPeer *peer)
+{
+    BRPeerReplay *replay = info;
+    BRReplayPeer *p = NULL;
+    BRReplaySession *session;
+    pthread_t thread;
+    size_t i, end, count;
+    int fds[2], error = 0;
+
+    assert(replay != NULL);
+    assert(peer != NULL);
+    pthread_mutex_lock(&replay->lock);
+
+    for (i = 0; i < array_count(replay->peers); i++) {
+        if (BRPeerEq(&replay->peers[i].peer, peer)) p = &replay->peers[i];
+    }
+
+    count = (p) ? array_count(p->records) : 0;
+
+    for (end = (p) ? p->next + 1 : 0; end < count; end++) { // each session starts with an outbound version message
+        if (! p->records[end].inbound && _replayFrameIsType(p->records[end].frame, "version")) break;
+    }
+
+    if (! p || p->next >= count || replay->closing) error = ECONNREFUSED;
+    else if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) error = errno;
+    else {
+#ifdef SO_NOSIGPIPE // BSD based systems have a SO_NOSIGPIPE socket option to supress SIGPIPE signals
+        setsockopt(fds[1], SOL_SOCKET, SO_NOSIGPIPE, &(int) { 1 }, sizeof(int));
+#endif
+        session = calloc(1, sizeof(*session));
+        assert(session != NULL);
+        session->replay = replay;
+        session->records = &p->records[p->next];
+        session->count = end - p->next;
+        session->socket = fds[1];
+
+        if (pthread_create(&thread, NULL, _replaySessionRoutine, session) != 0) {
+            error = EAGAIN;
+            close(fds[0]);
+            close(fds[1]);
+            free(session);
+        }
+        else {
+            array_add(replay->threads, thread);
+            replay->active++;
+            replay->stats.connections++;
+            p->next = end;
+            p->opened = 1;
+        }
+    }
+
+    pthread_mutex_unlock(&replay->lock);
+    if (error) errno = error;
+    return (error) ? -1 : fds[0];
+}
+
+// true when every opened peer has played all its sessions and no session is still playing
+static int _BRPeerReplayIsDone(BRPeerReplay *replay)
+{
+    int done = (replay->stats.connections > 0 && replay->active == 0);
+
+    for (size_t i = 0; done && i < array_count(replay->peers); i++) {
+        if (replay->peers[i].opened && replay->peers[i].next < array_count(replay->peers[i].records)) done = 0;
+    }
+
+    return done;
+}
+
+// waits until each peer that has been connected to has played all its sessions and closed its last socket, returns
+// true on success, or false if timeout seconds pass first
+int BRPeerReplayWait(BRPeerReplay *replay, double timeout)
+{
+    double end = _replayTime() + timeout;
+    struct timespec ts = { (time_t)end, (long)((end - (time_t)end)*1000000000) };
+    int done;
+
+    assert(replay != NULL);
+    pthread_mutex_lock(&replay->lock);
+
+    while (! (done = _BRPeerReplayIsDone(replay))) {
+        if (pthread_cond_timedwait(&replay->cond, &replay->lock, &ts) == ETIMEDOUT) break;
+    }
+
+    pthread_mutex_unlock(&replay->lock);
+    return done;
+}
+
+BRPeerReplayStats BRPeerReplayGetStats(BRPeerReplay *replay)
+{
+    BRPeerReplayStats stats;
+
+    assert(replay != NULL);
+    pthread_mutex_lock(&replay->lock);
+    stats = replay->stats;
+    pthread_mutex_unlock(&replay->lock);
+    return stats;
+}
+
+// stops any sessions still playing and frees the replay, all peers using it must be disconnected first
+void BRPeerReplayFree(BRPeerReplay *replay)
+{
+    assert(replay != NULL);
+    pthread_mutex_lock(&replay->lock);
+    replay->closing = 1;
+    pthread_mutex_unlock(&replay->lock);
+    for (size_t i = 0; i < array_count(replay->threads); i++) pthread_join(replay->threads[i], NULL);
+    for (size_t i = 0; i < array_count(replay->peers); i++) array_free(replay->peers[i].records);
+    array_free(replay->peers);
+    array_free(replay->threads);
+    pthread_cond_destroy(&replay->cond);
+    pthread_mutex_destroy(&replay->lock);
+    free(replay->data);
+    free(replay);
+}
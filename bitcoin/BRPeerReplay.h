@@ -0,0 +1,78 @@
+//
+//  BRPeerReplay.h
+//
+//  Copyright © 2026 Breadwallet AG. All rights reserved.
+//
+//  See the LICENSE file at the project root for license information.
+//  See the CONTRIBUTORS file at the project root for a list of contributors.
+//
+
+#ifndef BRPeerReplay_h
+#define BRPeerReplay_h
+
+#include "BRPeer.h"
+#include <stddef.h>
+#include <inttypes.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A recorder captures the raw message frames exchanged with each peer to a file, and a replay feeds the inbound frames
+// of that file back to peers over a local socketpair, so a sync can be repeated offline. Inbound frames are held back
+// until the peer has sent as many messages as it had when the frame was first received, which keeps responses behind
+// the requests they answer, and are paced by the recorded arrival times scaled by speed (virtual time).
+
+typedef struct BRPeerRecorderStruct BRPeerRecorder;
+
+// returns a newly allocated recorder writing to a new file at path, or NULL with errno set, that must be freed by
+// calling BRPeerRecorderFree(), magicNumber and earliestKeyTime are stored so a replay can recreate the sync
+BRPeerRecorder *BRPeerRecorderNew(const char *path, uint32_t magicNumber, uint32_t earliestKeyTime);
+
+// appends a frame to the recording, pass as recordMessage to BRPeerSetRecorder() or BRPeerManagerSetRecorder() along
+// with the recorder as info, only the header of outbound frames is kept
+void BRPeerRecorderRecordMessage(void *info, const BRPeer *peer, int inbound, const uint8_t *frame, size_t frameLen);
+
+// closes the recording, all peers using the recorder must be disconnected first
+void BRPeerRecorderFree(BRPeerRecorder *recorder);
+
+typedef struct BRPeerReplayStruct BRPeerReplay;
+
+typedef struct {
+    size_t connections; // sockets opened
+    size_t messages; // inbound messages delivered
+    size_t bytes; // inbound bytes delivered
+    size_t stalls; // times a frame was delivered after giving up on the peer sending the messages expected first
+} BRPeerReplayStats;
+
+// returns a newly allocated replay of the recording at path, or NULL with errno set, that must be freed by calling
+// BRPeerReplayFree(), recorded time runs speed times faster than real time, or as fast as possible if speed is zero
+BRPeerReplay *BRPeerReplayNew(const char *path, double speed);
+
+// network magic number of the recording
+uint32_t BRPeerReplayMagicNumber(BRPeerReplay *replay);
+
+// earliestKeyTime of the recorded sync
+uint32_t BRPeerReplayEarliestKeyTime(BRPeerReplay *replay);
+
+// writes up to peersCount recorded peers to peers, busiest first, returns the number of recorded peers
+size_t BRPeerReplayPeers(BRPeerReplay *replay, BRPeer peers[], size_t peersCount);
+
+// returns a socket that is fed the next recorded session with peer, or -1 with errno set to ECONNREFUSED once there are
+// no more sessions, pass as openSocket to BRPeerSetTransport() or BRPeerManagerSetTransport() along with the replay
+int BRPeerReplayOpenSocket(void *info, const BRPeer *peer);
+
+// waits until each peer that has been connected to has played all its sessions and closed its last socket, returns
+// true on success, or false if timeout seconds pass first
+int BRPeerReplayWait(BRPeerReplay *replay, double timeout);
+
+BRPeerReplayStats BRPeerReplayGetStats(BRPeerReplay *replay);
+
+// stops any sessions still playing and frees the replay, all peers using it must be disconnected first
+void BRPeerReplayFree(BRPeerReplay *replay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BRPeerReplay_h
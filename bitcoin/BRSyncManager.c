@@ -83,14 +83,42 @@ struct BRSyncManagerStruct {
 
 /// MARK: - Sync Manager Decls & Defs
 
+typedef struct {
+    int rid;                        // zero until issued
+    uint8_t isDone;
+    size_t range;
+    uint64_t begBlockNumber;
+    uint64_t endBlockNumber;
+    BRArrayOf(char *) addresses;    // given to the client when issued
+} BRClientSyncManagerScanRequest;
+
+typedef struct {
+    size_t range;
+    size_t sequence;
+    BRTransaction *transaction;
+    uint64_t timestamp;
+    uint64_t blockHeight;
+} BRClientSyncManagerScanItem;
+
 struct BRClientSyncManagerScanStateRecord {
-    int requestId;
+    uint8_t isInProgress;
     BRAddress lastExternalAddress;
     BRAddress lastInternalAddress;
-    BRSetOf(BRAddress *) knownAddresses;
+    size_t addressEpoch;
     uint64_t begBlockNumber;
     uint64_t endBlockNumber;
     uint8_t isFullScan;
+
+    // The block range is split into `rangeCount` ranges and queried in rounds: first for all the
+    // addresses, then for those discovered in the prior round.  Each round is a set of requests,
+    // one per range and address shard.  Results for a range are held in `items` until all the
+    // earlier ranges of the round are done, so that they reach the wallet in block order.
+    uint64_t blocksPerRange;
+    size_t rangeCount;
+    size_t headRange;
+    BRArrayOf(BRClientSyncManagerScanRequest) requests;
+    BRArrayOf(BRClientSyncManagerScanItem) items;
+    size_t itemSequence;
 };
 
 typedef struct BRClientSyncManagerScanStateRecord *BRClientSyncManagerScanState;
@@ -169,6 +197,15 @@ struct BRClientSyncManagerStruct {
      */
     int requestIdGenerator;
 
+    /**
+     * How a scan is split into getTransactions() requests: at most `blocksPerRequest` blocks, for a
+     * full scan, and `addressesPerRequest` addresses each, zero for no limit, with up to
+     * `requestsInFlight` outstanding.
+     */
+    uint64_t blocksPerRequest;
+    size_t addressesPerRequest;
+    size_t requestsInFlight;
+
     /**
      * If we are syncing with BRD, instead of as P2P with PeerManager, then we'll keep a record to
      * ensure we've successfully completed the getTransactions() callbacks to the client.
@@ -217,6 +254,12 @@ static void
 BRClientSyncManagerSetNetworkReachable(BRClientSyncManager manager,
                                        int isNetworkReachable);
 
+static void
+BRClientSyncManagerSetSharding(BRClientSyncManager manager,
+                               uint64_t blocksPerRequest,
+                               size_t addressesPerRequest,
+                               size_t requestsInFlight);
+
 static void
 BRClientSyncManagerConnect(BRClientSyncManager manager);
 
@@ -268,13 +311,42 @@ BRClientSyncManagerUpdateTransactions (BRClientSyncManager manager);
 static int
 BRClientSyncManagerGenerateRid (BRClientSyncManager manager);
 
+static BRArrayOf(BRClientSyncManagerScanRequest)
+BRClientSyncManagerIssueRequests (BRClientSyncManager manager);
+
+static void
+BRClientSyncManagerGetTransactions (BRClientSyncManager manager,
+                                    OwnershipGiven BRArrayOf(BRClientSyncManagerScanRequest) requests);
+
+static void
+BRClientSyncManagerRegisterTransaction (BRClientSyncManager manager,
+                                        OwnershipGiven BRTransaction *transaction,
+                                        uint64_t timestamp,
+                                        uint64_t blockHeight,
+                                        uint8_t needRegistration);
+
+static void
+BRClientSyncManagerRegisterTransactions (BRClientSyncManager manager,
+                                         OwnershipGiven BRArrayOf(BRClientSyncManagerScanItem) items);
+
+static BRArrayOf(BRClientSyncManagerScanItem)
+BRClientSyncManagerAdvanceHeadRange (BRClientSyncManager manager);
+
+static BRArrayOf(BRClientSyncManagerScanRequest)
+BRClientSyncManagerFinishRound (BRClientSyncManager manager);
+
 static void
 BRClientSyncManagerScanStateInit (BRClientSyncManagerScanState scanState,
                                   BRWallet *wallet,
                                   int isBTC,
                                   uint64_t syncedBlockHeight,
                                   uint64_t networkBlockHeight,
-                                  int rid);
+                                  uint64_t blocksPerRequest);
+
+static void
+BRClientSyncManagerScanStateAddRound (BRClientSyncManagerScanState scanState,
+                                      OwnershipGiven BRArrayOf(char *) addresses,
+                                      size_t addressesPerRequest);
 
 static void
 BRClientSyncManagerScanStateWipe (BRClientSyncManagerScanState scanState);
@@ -285,8 +357,27 @@ BRClientSyncManagerScanStateIsInProgress(BRClientSyncManagerScanState scanState)
 static uint8_t
 BRClientSyncManagerScanStateIsFullScan (BRClientSyncManagerScanState scanState);
 
+static BRClientSyncManagerScanRequest *
+BRClientSyncManagerScanStateGetRequest(BRClientSyncManagerScanState scanState,
+                                       int rid);
+
 static int
-BRClientSyncManagerScanStateGetRequestId(BRClientSyncManagerScanState scanState);
+BRClientSyncManagerScanStateIsRangeDone(BRClientSyncManagerScanState scanState,
+                                        size_t range);
+
+static int
+BRClientSyncManagerScanStateIsRoundDone(BRClientSyncManagerScanState scanState);
+
+static void
+BRClientSyncManagerScanStateAddItem(BRClientSyncManagerScanState scanState,
+                                    size_t range,
+                                    OwnershipGiven BRTransaction *transaction,
+                                    uint64_t timestamp,
+                                    uint64_t blockHeight);
+
+static BRArrayOf(BRClientSyncManagerScanItem)
+BRClientSyncManagerScanStateTakeItems(BRClientSyncManagerScanState scanState,
+                                      size_t range);
 
 static uint64_t
 BRClientSyncManagerScanStateGetStartBlockNumber(BRClientSyncManagerScanState scanState);
@@ -298,7 +389,9 @@ static uint64_t
 BRClientSyncManagerScanStateGetSyncedBlockNumber(BRClientSyncManagerScanState scanState);
 
 static BRArrayOf(BRAddress *)
-BRClientSyncManagerScanStateGetAddresses(BRClientSyncManagerScanState scanState);
+BRClientSyncManagerScanStateGetAddresses(BRClientSyncManagerScanState scanState,
+                                         BRWallet *wallet,
+                                         int isBTC);
 
 static BRArrayOf(BRAddress *)
 BRClientSyncManagerScanStateAdvanceAndGetNewAddresses (BRClientSyncManagerScanState scanState,
@@ -418,6 +511,16 @@ BRPeerSyncManagerSetFixedPeer (BRPeerSyncManager manager,
                                UInt128 address,
                                uint16_t port);
 
+static void
+BRPeerSyncManagerSetCompactFilters (BRPeerSyncManager manager,
+                                    int compactFilters);
+
+static size_t
+BRPeerSyncManagerImportHeaderSnapshot (BRPeerSyncManager manager,
+                                       OwnershipKept const uint8_t *headers,
+                                       size_t headersLen,
+                                       UInt256 lastBlockHash);
+
 static void
 BRPeerSyncManagerConnect(BRPeerSyncManager manager);
 
@@ -451,21 +554,12 @@ static void _BRPeerSyncManagerTxPublished (void *info, int error);
 
 /// MARK: - Misc. Helper Declarations
 
-static BRAddress *
+static BRArrayOf(BRAddress *)
 _getWalletAddresses (BRWallet *wallet,
-                     size_t *addressCount,
+                     size_t begEpoch,
+                     size_t endEpoch,
                      int isBTC);
 
-static void
-_fillWalletAddressSet(BRSetOf(BRAddress *) addresses,
-                      BRWallet *wallet,
-                      int isBTC);
-
-static BRArrayOf(BRAddress *)
-_updateWalletAddressSet(BRSetOf(BRAddress *) addresses,
-                        BRWallet *wallet,
-                        int isBTC);
-
 static uint32_t
 _calculateSyncDepthHeight(BRCryptoSyncDepth depth,
                           const BRChainParams *chainParams,
@@ -625,6 +719,59 @@ BRSyncManagerSetFixedPeer (BRSyncManager manager,
     }
 }
 
+extern void
+BRSyncManagerSetCompactFilters (BRSyncManager manager,
+                                int compactFilters) {
+    switch (manager->mode) {
+        case CRYPTO_SYNC_MODE_API_ONLY:
+        break;
+        case CRYPTO_SYNC_MODE_P2P_ONLY:
+        BRPeerSyncManagerSetCompactFilters (BRSyncManagerAsPeerSyncManager(manager), compactFilters);
+        break;
+        default:
+        assert (0);
+        break;
+    }
+}
+
+extern void
+BRSyncManagerSetClientSyncSharding (BRSyncManager manager,
+                                    uint64_t blocksPerRequest,
+                                    size_t addressesPerRequest,
+                                    size_t requestsInFlight) {
+    switch (manager->mode) {
+        case CRYPTO_SYNC_MODE_API_ONLY:
+        BRClientSyncManagerSetSharding (BRSyncManagerAsClientSyncManager (manager),
+                                        blocksPerRequest, addressesPerRequest, requestsInFlight);
+        break;
+        case CRYPTO_SYNC_MODE_P2P_ONLY:
+        break;
+        default:
+        assert (0);
+        break;
+    }
+}
+
+extern size_t
+BRSyncManagerImportHeaderSnapshot (BRSyncManager manager,
+                                   OwnershipKept const uint8_t *headers,
+                                   size_t headersLen,
+                                   UInt256 lastBlockHash) {
+    size_t count = 0;
+    switch (manager->mode) {
+        case CRYPTO_SYNC_MODE_API_ONLY:
+        break;
+        case CRYPTO_SYNC_MODE_P2P_ONLY:
+        count = BRPeerSyncManagerImportHeaderSnapshot (BRSyncManagerAsPeerSyncManager(manager),
+                                                       headers, headersLen, lastBlockHash);
+        break;
+        default:
+        assert (0);
+        break;
+    }
+    return count;
+}
+
 extern void
 BRSyncManagerConnect(BRSyncManager manager) {
     switch (manager->mode) {
@@ -856,6 +1003,11 @@ BRClientSyncManagerNew(BRSyncManagerEventContext eventContext,
     manager->isConnected             = 0;
     manager->isNetworkReachable      = isNetworkReachable;
 
+    // a scan is a single request until sharding is set
+    manager->blocksPerRequest        = 0;
+    manager->addressesPerRequest     = 0;
+    manager->requestsInFlight        = 1;
+
     // the calloc will have taken care of this, but, better safe than sorry in case future dev
     // doesn't take that into account
     BRClientSyncManagerScanStateWipe (&manager->scanState);
@@ -925,6 +1077,22 @@ BRClientSyncManagerSetNetworkReachable(BRClientSyncManager manager,
     }
 }
 
+static void
+BRClientSyncManagerSetSharding(BRClientSyncManager manager,
+                               uint64_t blocksPerRequest,
+                               size_t addressesPerRequest,
+                               size_t requestsInFlight) {
+    if (0 == pthread_mutex_lock (&manager->lock)) {
+        // applies from the next scan; the one in progress keeps its requests
+        manager->blocksPerRequest    = blocksPerRequest;
+        manager->addressesPerRequest = addressesPerRequest;
+        manager->requestsInFlight    = MAX (1, requestsInFlight);
+        pthread_mutex_unlock (&manager->lock);
+    } else {
+        assert (0);
+    }
+}
+
 static void
 BRClientSyncManagerConnect(BRClientSyncManager manager) {
     uint8_t needEvent = 0;
@@ -1183,18 +1351,41 @@ BRClientSyncManagerAnnounceGetTransactionsItem (BRClientSyncManager manager,
                                                 uint64_t blockHeight) {
     BRTransaction *transaction = BRTransactionParse (txn, txnLength);
     uint8_t needRegistration = NULL != transaction && BRTransactionIsSigned (transaction);
-    uint8_t needFree = 1;
+    uint8_t isHeld = 0;
 
-    if (needRegistration) {
-        if (0 == pthread_mutex_lock (&manager->lock)) {
-            // confirm completion is for in-progress sync
-            needRegistration &= (rid == BRClientSyncManagerScanStateGetRequestId (&manager->scanState) && manager->isConnected);
-            pthread_mutex_unlock (&manager->lock);
-        } else {
-            assert (0);
+    if (0 == pthread_mutex_lock (&manager->lock)) {
+        // confirm the item is for an in-progress request
+        BRClientSyncManagerScanRequest *request = (manager->isConnected
+                                                   ? BRClientSyncManagerScanStateGetRequest (&manager->scanState, rid)
+                                                   : NULL);
+        needRegistration &= (NULL != request);
+
+        if (needRegistration && request->range != manager->scanState.headRange) {
+            // an earlier range is still outstanding; hold the transaction until it is done
+            BRClientSyncManagerScanStateAddItem (&manager->scanState, request->range, transaction, timestamp, blockHeight);
+            isHeld = 1;
         }
+
+        pthread_mutex_unlock (&manager->lock);
+    } else {
+        assert (0);
     }
 
+    // The wallet is updated outside of the state lock; it takes the wallet lock and makes
+    // wallet callbacks.
+    if (!isHeld) {
+        BRClientSyncManagerRegisterTransaction (manager, transaction, timestamp, blockHeight, needRegistration);
+    }
+}
+
+static void
+BRClientSyncManagerRegisterTransaction (BRClientSyncManager manager,
+                                        OwnershipGiven BRTransaction *transaction,
+                                        uint64_t timestamp,
+                                        uint64_t blockHeight,
+                                        uint8_t needRegistration) {
+    uint8_t needFree = 1;
+
     if (needRegistration) {
         if (NULL == BRWalletTransactionForHash (manager->wallet, transaction->txHash)) {
             // BRWalletRegisterTransaction doesn't reliably report if the txn was added to the wallet.
@@ -1219,6 +1410,21 @@ BRClientSyncManagerAnnounceGetTransactionsItem (BRClientSyncManager manager,
     }
 }
 
+static void
+BRClientSyncManagerRegisterTransactions (BRClientSyncManager manager,
+                                         OwnershipGiven BRArrayOf(BRClientSyncManagerScanItem) items) {
+    if (NULL == items) return;
+
+    for (size_t index = 0; index < array_count (items); index++) {
+        BRClientSyncManagerRegisterTransaction (manager,
+                                                items[index].transaction,
+                                                items[index].timestamp,
+                                                items[index].blockHeight,
+                                                1);
+    }
+    array_free (items);
+}
+
 static BRArrayOf(char *)
 BRClientSyncManagerConvertAddressToString (BRClientSyncManager manager,
                                            OwnershipGiven BRArrayOf(BRAddress *) addresses) {
@@ -1263,52 +1469,32 @@ BRClientSyncManagerAnnounceGetTransactionsDone (BRClientSyncManager manager,
                                                 int success) {
     uint8_t needSyncEvent        = 0;
     uint8_t needDiscEvent        = 0;
-    uint8_t needClientCall       = 0;
-    uint64_t begBlockNumber      = 0;
-    uint64_t endBlockNumber      = 0;
-    size_t addressCount          = 0;
-    BRArrayOf(char *) addresses  = NULL;
+    uint8_t needFinishRound      = 0;
     BRSyncManagerEvent syncEvent = {0};
     BRSyncManagerEvent discEvent = {0};
+    BRArrayOf(BRClientSyncManagerScanItem) items = NULL;
+    BRArrayOf(BRClientSyncManagerScanRequest) requests = NULL;
 
     if (0 == pthread_mutex_lock (&manager->lock)) {
-        // confirm completion is for in-progress sync
-        if (rid == BRClientSyncManagerScanStateGetRequestId (&manager->scanState) &&
-            manager->isConnected) {
+        // confirm completion is for an in-progress request
+        BRClientSyncManagerScanRequest *request = (manager->isConnected
+                                                   ? BRClientSyncManagerScanStateGetRequest (&manager->scanState, rid)
+                                                   : NULL);
+        if (NULL != request) {
             // check for a successful completion
             if (success) {
+                request->isDone = 1;
 
-                // check if the first unused addresses have changed since last completion
-                addresses = BRClientSyncManagerConvertAddressToString
-                (manager,
-                 BRClientSyncManagerScanStateAdvanceAndGetNewAddresses (&manager->scanState,
-                                                                        manager->wallet,
-                                                                        BRChainParamsIsBitcoin (manager->chainParams)));
-
-                addressCount = NULL != addresses ? array_count(addresses) : 0;
-                if (0 != addressCount) {
-                    // ... we've discovered a new address (i.e. there were transactions announce)
-
-                    // store sync data for callback outside of lock
-                    begBlockNumber = BRClientSyncManagerScanStateGetStartBlockNumber (&manager->scanState);
-                    endBlockNumber = BRClientSyncManagerScanStateGetEndBlockNumber (&manager->scanState);
-
-                    // store control flow flags
-                    needClientCall = 1;
-
-                } else {
-                    // .. we haven't discovered any new addresses and we just finished the range
-
-                    // store synced block height
-                    manager->syncedBlockHeight = BRClientSyncManagerScanStateGetSyncedBlockNumber (&manager->scanState);;
+                // collect the transactions held for the ranges that are now next in order
+                items = BRClientSyncManagerAdvanceHeadRange (manager);
 
-                    // store control flow flags
-                    needSyncEvent = BRClientSyncManagerScanStateIsFullScan (&manager->scanState);
-                    syncEvent = (BRSyncManagerEvent) {SYNC_MANAGER_SYNC_STOPPED, { .syncStopped = { cryptoSyncStoppedReasonComplete() } }};
-
-                    // reset sync state
-                    BRClientSyncManagerScanStateWipe (&manager->scanState);
+                // whether the round found new addresses depends on the transactions registered
+                // with the wallet, so a finished round is handled once `items` are registered
+                needFinishRound = BRClientSyncManagerScanStateIsRoundDone (&manager->scanState);
 
+                // otherwise keep the scan's requests in flight; collected for the client call outside of lock
+                if (!needFinishRound) {
+                    requests = BRClientSyncManagerIssueRequests (manager);
                 }
             } else {
                 // transition to the disconnected state
@@ -1346,36 +1532,85 @@ BRClientSyncManagerAnnounceGetTransactionsDone (BRClientSyncManager manager,
         assert (0);
     }
 
-    if (needClientCall) {
-        // Callback to 'client' to get all transactions (for all wallet addresses) between
-        // a {beg,end}BlockNumber.  The client will gather the transactions and then call
-        // bwmAnnounceTransaction()  (for each one or with all of them).
-        manager->clientCallbacks.funcGetTransactions (manager->clientContext,
-                                                      BRClientSyncManagerAsSyncManager (manager),
-                                                      (const char **) addresses,
-                                                      addressCount,
-                                                      begBlockNumber,
-                                                      endBlockNumber,
-                                                      rid);
+    // The wallet is updated outside of the state lock, in range order; it takes the wallet lock
+    // and makes wallet callbacks.
+    BRClientSyncManagerRegisterTransactions (manager, items);
+
+    if (needFinishRound) {
+        requests = BRClientSyncManagerFinishRound (manager);
     }
 
-    if (NULL != addresses) {
-        for (size_t index = 0; index < addressCount; index++) {
-            free (addresses[index]);
+    BRClientSyncManagerGetTransactions (manager, requests);
+}
+
+/**
+ * Start another round of the scan for the addresses discovered by the round just done, or end the
+ * scan if there are none.  Returns the requests to pass to BRClientSyncManagerGetTransactions().
+ */
+static BRArrayOf(BRClientSyncManagerScanRequest)
+BRClientSyncManagerFinishRound (BRClientSyncManager manager) {
+    uint8_t needSyncEvent        = 0;
+    BRSyncManagerEvent syncEvent = {0};
+    BRArrayOf(BRClientSyncManagerScanRequest) requests = NULL;
+
+    if (0 == pthread_mutex_lock (&manager->lock)) {
+        // confirm the scan wasn't stopped while the lock was released
+        if (manager->isConnected &&
+            BRClientSyncManagerScanStateIsInProgress (&manager->scanState) &&
+            BRClientSyncManagerScanStateIsRoundDone (&manager->scanState)) {
+            // check if the first unused addresses have changed since last completion
+            BRArrayOf(char *) addresses = BRClientSyncManagerConvertAddressToString
+            (manager,
+             BRClientSyncManagerScanStateAdvanceAndGetNewAddresses (&manager->scanState,
+                                                                    manager->wallet,
+                                                                    BRChainParamsIsBitcoin (manager->chainParams)));
+
+            if (NULL != addresses) {
+                // ... we've discovered a new address (i.e. there were transactions announce)
+                // so start another round over the same range for the new addresses
+                BRClientSyncManagerScanStateAddRound (&manager->scanState,
+                                                      addresses,
+                                                      manager->addressesPerRequest);
+
+                // collected for the client call outside of lock
+                requests = BRClientSyncManagerIssueRequests (manager);
+
+            } else {
+                // .. we haven't discovered any new addresses and we just finished the range
+
+                // store synced block height
+                manager->syncedBlockHeight = BRClientSyncManagerScanStateGetSyncedBlockNumber (&manager->scanState);;
+
+                // store control flow flags
+                needSyncEvent = BRClientSyncManagerScanStateIsFullScan (&manager->scanState);
+                syncEvent = (BRSyncManagerEvent) {SYNC_MANAGER_SYNC_STOPPED, { .syncStopped = { cryptoSyncStoppedReasonComplete() } }};
+
+                // reset sync state
+                BRClientSyncManagerScanStateWipe (&manager->scanState);
+            }
+        }
+
+        // Send event while holding the state lock so that event
+        // callbacks are ordered to reflect state transitions.
+
+        if (needSyncEvent) {
+            manager->eventCallback (manager->eventContext,
+                                    BRClientSyncManagerAsSyncManager (manager),
+                                    syncEvent);
         }
-        array_free (addresses);
+
+        pthread_mutex_unlock (&manager->lock);
+    } else {
+        assert (0);
     }
+
+    return requests;
 }
 
 static void
 BRClientSyncManagerUpdateTransactions (BRClientSyncManager manager) {
-    int rid                      = 0;
     uint8_t needSyncEvent        = 0;
-    uint8_t needClientCall       = 0;
-    uint64_t begBlockNumber      = 0;
-    uint64_t endBlockNumber      = 0;
-    size_t addressCount          = 0;
-    BRArrayOf(char *) addresses  = NULL;
+    BRArrayOf(BRClientSyncManagerScanRequest) requests = NULL;
 
     if (0 == pthread_mutex_lock (&manager->lock)) {
         // check if we are connect and the prior sync has completed.
@@ -1387,24 +1622,24 @@ BRClientSyncManagerUpdateTransactions (BRClientSyncManager manager) {
                                               BRChainParamsIsBitcoin (manager->chainParams),
                                               manager->syncedBlockHeight,
                                               manager->networkBlockHeight,
-                                              BRClientSyncManagerGenerateRid (manager));
+                                              manager->blocksPerRequest);
 
             // get the addresses to query the BDB with
-            addresses = BRClientSyncManagerConvertAddressToString
-            (manager, BRClientSyncManagerScanStateGetAddresses (&manager->scanState));
+            BRArrayOf(char *) addresses = BRClientSyncManagerConvertAddressToString
+            (manager, BRClientSyncManagerScanStateGetAddresses (&manager->scanState,
+                                                                manager->wallet,
+                                                                BRChainParamsIsBitcoin (manager->chainParams)));
 
             assert (NULL != addresses);
-            addressCount = array_count (addresses);
-            assert (0 != addressCount);
 
-            // store sync data for callback outside of lock
-            rid = BRClientSyncManagerScanStateGetRequestId (&manager->scanState);
-            begBlockNumber = BRClientSyncManagerScanStateGetStartBlockNumber (&manager->scanState);
-            endBlockNumber = BRClientSyncManagerScanStateGetEndBlockNumber (&manager->scanState);
+            // split the scan into requests; collected for the client call outside of lock
+            BRClientSyncManagerScanStateAddRound (&manager->scanState,
+                                                  addresses,
+                                                  manager->addressesPerRequest);
+            requests = BRClientSyncManagerIssueRequests (manager);
 
             // store control flow flags
             needSyncEvent = BRClientSyncManagerScanStateIsFullScan (&manager->scanState);
-            needClientCall = 1;
         }
 
         // Send event while holding the state lock so that event
@@ -1423,25 +1658,7 @@ BRClientSyncManagerUpdateTransactions (BRClientSyncManager manager) {
         assert (0);
     }
 
-    if (needClientCall) {
-        // Callback to 'client' to get all transactions (for all wallet addresses) between
-        // a {beg,end}BlockNumber.  The client will gather the transactions and then call
-        // bwmAnnounceTransaction()  (for each one or with all of them).
-        manager->clientCallbacks.funcGetTransactions (manager->clientContext,
-                                                      BRClientSyncManagerAsSyncManager (manager),
-                                                      (const char **) addresses,
-                                                      addressCount,
-                                                      begBlockNumber,
-                                                      endBlockNumber,
-                                                      rid);
-    }
-
-    if (NULL != addresses) {
-        for (size_t index = 0; index < addressCount; index++) {
-            free (addresses[index]);
-        }
-        array_free (addresses);
-    }
+    BRClientSyncManagerGetTransactions (manager, requests);
 }
 
 static void
@@ -1470,13 +1687,100 @@ BRClientSyncManagerGenerateRid (BRClientSyncManager manager) {
     return ++manager->requestIdGenerator;
 }
 
+/**
+ * Issue the scan's next requests, in range order, up to `requestsInFlight` outstanding.  The
+ * returned requests own their addresses and are to be passed to
+ * BRClientSyncManagerGetTransactions() once the state lock is released.
+ */
+static BRArrayOf(BRClientSyncManagerScanRequest)
+BRClientSyncManagerIssueRequests (BRClientSyncManager manager) {
+    BRClientSyncManagerScanState scanState = &manager->scanState;
+    BRArrayOf(BRClientSyncManagerScanRequest) issued = NULL;
+    size_t inFlight = 0;
+
+    for (size_t index = 0; index < array_count (scanState->requests); index++) {
+        if (0 != scanState->requests[index].rid && !scanState->requests[index].isDone) inFlight++;
+    }
+
+    for (size_t index = 0; index < array_count (scanState->requests) && inFlight < manager->requestsInFlight; index++) {
+        BRClientSyncManagerScanRequest *request = &scanState->requests[index];
+        if (0 == request->rid) {
+            request->rid = BRClientSyncManagerGenerateRid (manager);
+
+            if (NULL == issued) array_new (issued, manager->requestsInFlight);
+            array_add (issued, *request);
+
+            // the addresses are now owned by `issued`
+            request->addresses = NULL;
+            inFlight++;
+        }
+    }
+
+    return issued;
+}
+
+static void
+BRClientSyncManagerGetTransactions (BRClientSyncManager manager,
+                                    OwnershipGiven BRArrayOf(BRClientSyncManagerScanRequest) requests) {
+    if (NULL == requests) return;
+
+    for (size_t index = 0; index < array_count (requests); index++) {
+        BRClientSyncManagerScanRequest *request = &requests[index];
+
+        // Callback to 'client' to get all transactions (for the request's addresses) between
+        // a {beg,end}BlockNumber.  The client will gather the transactions and then call
+        // bwmAnnounceTransaction()  (for each one or with all of them).
+        manager->clientCallbacks.funcGetTransactions (manager->clientContext,
+                                                      BRClientSyncManagerAsSyncManager (manager),
+                                                      (const char **) request->addresses,
+                                                      array_count (request->addresses),
+                                                      request->begBlockNumber,
+                                                      request->endBlockNumber,
+                                                      request->rid);
+
+        for (size_t addressIndex = 0; addressIndex < array_count (request->addresses); addressIndex++) {
+            free (request->addresses[addressIndex]);
+        }
+        array_free (request->addresses);
+    }
+
+    array_free (requests);
+}
+
+/**
+ * Move the head range past each range whose requests are all done, and return the transactions
+ * held for the new head ranges, in range order, to pass to BRClientSyncManagerRegisterTransactions()
+ * once the state lock is released.  Called with the state lock held.
+ */
+static BRArrayOf(BRClientSyncManagerScanItem)
+BRClientSyncManagerAdvanceHeadRange (BRClientSyncManager manager) {
+    BRClientSyncManagerScanState scanState = &manager->scanState;
+    BRArrayOf(BRClientSyncManagerScanItem) items = NULL;
+
+    while (scanState->headRange < scanState->rangeCount &&
+           BRClientSyncManagerScanStateIsRangeDone (scanState, scanState->headRange)) {
+        scanState->headRange++;
+
+        BRArrayOf(BRClientSyncManagerScanItem) rangeItems = BRClientSyncManagerScanStateTakeItems (scanState,
+                                                                                                  scanState->headRange);
+        if (NULL == items) {
+            items = rangeItems;
+        } else {
+            array_add_array (items, rangeItems, array_count (rangeItems));
+            array_free (rangeItems);
+        }
+    }
+
+    return items;
+}
+
 static void
 BRClientSyncManagerScanStateInit (BRClientSyncManagerScanState scanState,
                                   BRWallet *wallet,
                                   int isBTC,
                                   uint64_t syncedBlockHeight,
                                   uint64_t networkBlockHeight,
-                                  int rid) {
+                                  uint64_t blocksPerRequest) {
     // update the `endBlockNumber` to the current block height;
     // since this is exclusive on the end height, we need to increment by
     // one to make sure we get the last block
@@ -1499,29 +1803,99 @@ BRClientSyncManagerScanStateInit (BRClientSyncManagerScanState scanState,
     BRWalletUnusedAddrs(wallet, &scanState->lastExternalAddress, 1, SEQUENCE_EXTERNAL_CHAIN);
     BRWalletUnusedAddrs(wallet, &scanState->lastInternalAddress, 1, SEQUENCE_INTERNAL_CHAIN);
 
-    // save the current requestId
-    scanState->requestId = rid;
+    // mark as in progress
+    scanState->isInProgress = 1;
 
     // mark as sync or not
     scanState->isFullScan = ((scanState->endBlockNumber - scanState->begBlockNumber) > BWM_BRD_SYNC_START_BLOCK_OFFSET);
 
-    // build the set of initial wallet addresses
-    assert (NULL == scanState->knownAddresses);
-    scanState->knownAddresses = BRSetNew (BRAddressHash, BRAddressEq, SEQUENCE_GAP_LIMIT_INTERNAL + SEQUENCE_GAP_LIMIT_EXTERNAL);
-    _fillWalletAddressSet (scanState->knownAddresses, wallet, isBTC);
+    // the addresses generated so far are the ones to scan with
+    scanState->addressEpoch = BRWalletAddrEpoch (wallet);
+
+    // split a full sync into ranges of `blocksPerRequest`; an incremental sync is unbounded so it
+    // remains a single range
+    uint64_t blockCount = scanState->endBlockNumber - scanState->begBlockNumber;
+    scanState->blocksPerRange = ((scanState->isFullScan && 0 != blocksPerRequest && blocksPerRequest < blockCount)
+                                 ? blocksPerRequest
+                                 : blockCount);
+    scanState->rangeCount = (size_t) ((blockCount + scanState->blocksPerRange - 1) / scanState->blocksPerRange);
+    scanState->headRange  = 0;
+
+    array_new (scanState->requests, scanState->rangeCount);
+    array_new (scanState->items, 10);
+    scanState->itemSequence = 0;
+}
+
+static void
+BRClientSyncManagerScanStateAddRound (BRClientSyncManagerScanState scanState,
+                                      OwnershipGiven BRArrayOf(char *) addresses,
+                                      size_t addressesPerRequest) {
+    size_t addressCount = array_count (addresses);
+    assert (0 != addressCount);
+
+    size_t addressesPerShard = ((0 != addressesPerRequest && addressesPerRequest < addressCount)
+                                ? addressesPerRequest
+                                : addressCount);
+
+    // every request of a prior round has been issued and is done
+    assert (BRClientSyncManagerScanStateIsRoundDone (scanState));
+    array_clear (scanState->requests);
+    scanState->headRange = 0;
+
+    for (size_t range = 0; range < scanState->rangeCount; range++) {
+        uint64_t begBlockNumber = (BRClientSyncManagerScanStateGetStartBlockNumber (scanState) +
+                                  range * scanState->blocksPerRange);
+        uint64_t endBlockNumber = (range + 1 == scanState->rangeCount
+                                   ? BRClientSyncManagerScanStateGetEndBlockNumber (scanState)
+                                   : begBlockNumber + scanState->blocksPerRange);
+
+        for (size_t index = 0; index < addressCount; index += addressesPerShard) {
+            size_t shardCount = MIN (addressesPerShard, addressCount - index);
+
+            BRClientSyncManagerScanRequest request = { 0, 0, range, begBlockNumber, endBlockNumber, NULL };
+            array_new (request.addresses, shardCount);
+            for (size_t shardIndex = 0; shardIndex < shardCount; shardIndex++) {
+                array_add (request.addresses, strdup (addresses[index + shardIndex]));
+            }
+
+            array_add (scanState->requests, request);
+        }
+    }
+
+    for (size_t index = 0; index < addressCount; index++) {
+        free (addresses[index]);
+    }
+    array_free (addresses);
 }
 
 static void
 BRClientSyncManagerScanStateWipe (BRClientSyncManagerScanState scanState) {
-    if (NULL != scanState->knownAddresses) {
-        BRSetFreeAll (scanState->knownAddresses, free);
+    if (NULL != scanState->requests) {
+        for (size_t index = 0; index < array_count (scanState->requests); index++) {
+            BRArrayOf(char *) addresses = scanState->requests[index].addresses;
+            if (NULL == addresses) continue;
+
+            for (size_t addressIndex = 0; addressIndex < array_count (addresses); addressIndex++) {
+                free (addresses[addressIndex]);
+            }
+            array_free (addresses);
+        }
+        array_free (scanState->requests);
+    }
+
+    if (NULL != scanState->items) {
+        for (size_t index = 0; index < array_count (scanState->items); index++) {
+            BRTransactionFree (scanState->items[index].transaction);
+        }
+        array_free (scanState->items);
     }
+
     memset (scanState, 0, sizeof(*scanState));
 }
 
 static int
 BRClientSyncManagerScanStateIsInProgress(BRClientSyncManagerScanState scanState) {
-    return 0 != scanState->requestId;
+    return scanState->isInProgress;
 }
 
 static uint8_t
@@ -1529,9 +1903,76 @@ BRClientSyncManagerScanStateIsFullScan (BRClientSyncManagerScanState scanState)
     return scanState->isFullScan;
 }
 
+static BRClientSyncManagerScanRequest *
+BRClientSyncManagerScanStateGetRequest(BRClientSyncManagerScanState scanState,
+                                       int rid) {
+    for (size_t index = 0; 0 != rid && NULL != scanState->requests && index < array_count (scanState->requests); index++) {
+        BRClientSyncManagerScanRequest *request = &scanState->requests[index];
+        if (rid == request->rid && !request->isDone) return request;
+    }
+    return NULL;
+}
+
 static int
-BRClientSyncManagerScanStateGetRequestId(BRClientSyncManagerScanState scanState) {
-    return scanState->requestId;
+BRClientSyncManagerScanStateIsRangeDone(BRClientSyncManagerScanState scanState,
+                                        size_t range) {
+    for (size_t index = 0; index < array_count (scanState->requests); index++) {
+        if (range == scanState->requests[index].range && !scanState->requests[index].isDone) return 0;
+    }
+    return 1;
+}
+
+static int
+BRClientSyncManagerScanStateIsRoundDone(BRClientSyncManagerScanState scanState) {
+    for (size_t index = 0; index < array_count (scanState->requests); index++) {
+        if (!scanState->requests[index].isDone) return 0;
+    }
+    return 1;
+}
+
+static void
+BRClientSyncManagerScanStateAddItem(BRClientSyncManagerScanState scanState,
+                                    size_t range,
+                                    OwnershipGiven BRTransaction *transaction,
+                                    uint64_t timestamp,
+                                    uint64_t blockHeight) {
+    array_add (scanState->items, ((BRClientSyncManagerScanItem) {
+        range,
+        scanState->itemSequence++,
+        transaction,
+        timestamp,
+        blockHeight
+    }));
+}
+
+static int
+_compareScanItems (const void *item1, const void *item2) {
+    const BRClientSyncManagerScanItem *i1 = item1;
+    const BRClientSyncManagerScanItem *i2 = item2;
+
+    if (i1->blockHeight != i2->blockHeight) return i1->blockHeight < i2->blockHeight ? -1 : 1;
+    return i1->sequence < i2->sequence ? -1 : (i1->sequence > i2->sequence ? 1 : 0);
+}
+
+/**
+ * Remove the items held for `range` and return them in block order, keeping the order they
+ * arrived in within a block.
+ */
+static BRArrayOf(BRClientSyncManagerScanItem)
+BRClientSyncManagerScanStateTakeItems(BRClientSyncManagerScanState scanState,
+                                      size_t range) {
+    BRArrayOf(BRClientSyncManagerScanItem) items;
+    array_new (items, 10);
+
+    size_t kept = 0;
+    for (size_t index = 0; index < array_count (scanState->items); index++) {
+        if (range == scanState->items[index].range) array_add (items, scanState->items[index]);
+        else scanState->items[kept++] = scanState->items[index];
+    }
+    array_set_count (scanState->items, kept);
+
+    qsort (items, array_count (items), sizeof (BRClientSyncManagerScanItem), _compareScanItems);
+    return items;
 }
 
 static uint64_t
@@ -1552,21 +1993,10 @@ BRClientSyncManagerScanStateGetSyncedBlockNumber(BRClientSyncManagerScanState sc
 }
 
 static BRArrayOf(BRAddress *)
-BRClientSyncManagerScanStateGetAddresses(BRClientSyncManagerScanState scanState) {
-    size_t addressCount = BRSetCount(scanState->knownAddresses);
-
-    BRArrayOf(BRAddress *) addresses;
-    array_new (addresses, addressCount);
-    array_set_count (addresses, addressCount);
-
-    size_t index = 0;
-    FOR_SET (BRAddress *, knownAddress, scanState->knownAddresses) {
-        addresses[index] = malloc (sizeof(BRAddress));
-        *addresses[index] = *knownAddress;
-        index++;
-    }
-
-    return addresses;
+BRClientSyncManagerScanStateGetAddresses(BRClientSyncManagerScanState scanState,
+                                         BRWallet *wallet,
+                                         int isBTC) {
+    return _getWalletAddresses (wallet, 0, scanState->addressEpoch, isBTC);
 }
 
 static BRArrayOf(BRAddress *)
@@ -1595,8 +2025,10 @@ BRClientSyncManagerScanStateAdvanceAndGetNewAddresses (BRClientSyncManagerScanSt
         scanState->lastExternalAddress = externalAddress;
         scanState->lastInternalAddress = internalAddress;
 
-        // get the list of newly discovered addresses
-        newAddresses = _updateWalletAddressSet (scanState->knownAddresses, wallet, isBTC);
+        // get the list of newly discovered addresses, those generated since the last epoch
+        size_t addressEpoch = BRWalletAddrEpoch (wallet);
+        newAddresses = _getWalletAddresses (wallet, scanState->addressEpoch, addressEpoch, isBTC);
+        scanState->addressEpoch = addressEpoch;
     }
 
     return newAddresses;
@@ -1720,6 +2152,20 @@ BRPeerSyncManagerSetFixedPeer (BRPeerSyncManager manager,
     BRPeerManagerSetFixedPeer (manager->peerManager, address, port);
 }
 
+static void
+BRPeerSyncManagerSetCompactFilters (BRPeerSyncManager manager,
+                                    int compactFilters) {
+    BRPeerManagerSetCompactFilters (manager->peerManager, compactFilters);
+}
+
+static size_t
+BRPeerSyncManagerImportHeaderSnapshot (BRPeerSyncManager manager,
+                                       OwnershipKept const uint8_t *headers,
+                                       size_t headersLen,
+                                       UInt256 lastBlockHash) {
+    return BRPeerManagerImportHeaderSnapshot (manager->peerManager, headers, headersLen, lastBlockHash);
+}
+
 static void
 BRPeerSyncManagerConnect(BRPeerSyncManager manager) {
     BRPeerManagerConnect (manager->peerManager);
@@ -2092,72 +2538,35 @@ _BRPeerSyncManagerTxPublished (void *info,
 
 /// MARK: - Misc. Helper Implementations
 
-static BRAddress *
-_getWalletAddresses (BRWallet *wallet,size_t *addressCount, int isBTC) {
-    assert (addressCount);
+static BRArrayOf(BRAddress *)
+_getWalletAddresses (BRWallet *wallet, size_t begEpoch, size_t endEpoch, int isBTC) {
+    assert (begEpoch <= endEpoch);
 
-    size_t addrCount = BRWalletAllAddrs (wallet, NULL, 0);
+    // Get the wallet's default addresses generated between the two epochs...
+    size_t addrCount = endEpoch - begEpoch;
+    BRAddress *addrs = (BRAddress *) calloc (addrCount ? addrCount : 1, sizeof (BRAddress));
+    addrCount = BRWalletAddrsSinceEpoch (wallet, begEpoch, addrs, addrCount);
 
     // For BTC we'll create two types of addresses: SEGWIT and LEGACY.  For BCH, we'll create one
     // type of address: LEGACY.  Double up the size if BTC.
-    *addressCount = (isBTC ? 2 * addrCount : addrCount);
-
-    // Allocate enough addresses...
-    BRAddress *addrs = (BRAddress *) calloc (*addressCount, sizeof (BRAddress));
-
-    // ... and then fill in `addrs` with the wallet's default addresses
-     BRWalletAllAddrs (wallet, addrs, addrCount);
-
-    // If this is BTC, add in the LEGACY type
-    if (isBTC) {
-        memcpy (addrs + addrCount, addrs, addrCount * sizeof(BRAddress)); // ??
-        for (size_t index = 0; index < addrCount; index++)
-            addrs[addrCount + index] = BRWalletAddressToLegacy (wallet, &addrs[index]);
-    }
-
-   return addrs;
-}
-
-static void
-_fillWalletAddressSet(BRSetOf(BRAddress *) addresses, BRWallet *wallet, int isBTC) {
-    size_t addressCount = 0;
-    BRAddress *addressArray = _getWalletAddresses (wallet, &addressCount, isBTC);
+    BRArrayOf(BRAddress *) addresses;
+    array_new (addresses, isBTC ? 2 * addrCount : addrCount);
 
-    for (size_t index = 0; index < addressCount; index++) {
-        if (!BRSetContains (addresses, &addressArray[index])) {
-            BRAddress *address = malloc (sizeof(BRAddress));
-            *address = addressArray[index];
-            BRSetAdd (addresses, address);
-        }
+    for (size_t index = 0; index < addrCount; index++) {
+        BRAddress *address = malloc (sizeof(BRAddress));
+        *address = addrs[index];
+        array_add (addresses, address);
     }
 
-    free (addressArray);
-}
-
-static BRArrayOf(BRAddress *)
-_updateWalletAddressSet(BRSetOf(BRAddress *) addresses, BRWallet *wallet, int isBTC) {
-    size_t addressCount = 0;
-    BRAddress *addressArray = _getWalletAddresses (wallet, &addressCount, isBTC);
-
-    BRArrayOf(BRAddress *) newAddresses;
-    array_new (newAddresses, addressCount);
-
-    for (size_t index = 0; index < addressCount; index++) {
-        if (!BRSetContains (addresses, &addressArray[index])) {
-            // one copy remains owned by the address set
-            BRAddress *address = malloc (sizeof(BRAddress));
-            *address = addressArray[index];
-            BRSetAdd (addresses, address);
-
-            // one copy owned by the returned array
-            address = malloc (sizeof(BRAddress));
-            *address = addressArray[index];
-            array_add (newAddresses, address);
-        }
+    // ... and if this is BTC, add in the LEGACY type
+    for (size_t index = 0; isBTC && index < addrCount; index++) {
+        BRAddress *address = malloc (sizeof(BRAddress));
+        *address = BRWalletAddressToLegacy (wallet, &addrs[index]);
+        array_add (addresses, address);
     }
 
-    free (addressArray);
-    return newAddresses;
+    free (addrs);
+    return addresses;
 }
 
 static uint32_t
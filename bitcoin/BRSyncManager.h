@@ -171,6 +171,38 @@ BRSyncManagerSetFixedPeer (BRSyncManager manager,
                            UInt128 address,
                            uint16_t port);
 
+/**
+ * Sync with BIP157 compact block filters instead of bloom filters; only applies to P2P mode and must
+ * be set before connecting.
+ */
+extern void
+BRSyncManagerSetCompactFilters (BRSyncManager manager,
+                                int compactFilters);
+
+/**
+ * Split each API mode transaction scan into getTransactions requests of at most `blocksPerRequest`
+ * blocks, for a full scan, and `addressesPerRequest` addresses, zero for no limit, and keep up to
+ * `requestsInFlight` of them outstanding.  Results are still given to the wallet in block order and
+ * addresses found in a scan are queried over the same range.  Only applies to API mode and takes
+ * effect from the next scan.
+ */
+extern void
+BRSyncManagerSetClientSyncSharding (BRSyncManager manager,
+                                    uint64_t blocksPerRequest,
+                                    size_t addressesPerRequest,
+                                    size_t requestsInFlight);
+
+/**
+ * Import a pinned header snapshot so a new wallet doesn't download the headers before its earliest
+ * key time; only applies to P2P mode and must be called before connecting.  See
+ * BRPeerManagerImportHeaderSnapshot() for the format.  Returns the number of headers imported.
+ */
+extern size_t
+BRSyncManagerImportHeaderSnapshot (BRSyncManager manager,
+                                   OwnershipKept const uint8_t *headers,
+                                   size_t headersLen,
+                                   UInt256 lastBlockHash);
+
 extern void
 BRSyncManagerConnect(BRSyncManager manager);
 
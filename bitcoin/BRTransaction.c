@@ -494,6 +494,79 @@ BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen)
     return tx;
 }
 
+// buf must contain a serialized tx
+// returns the txHash that BRTransactionParse() would give the tx, or UINT256_ZERO if the tx is not signed or not valid,
+// without allocating a transaction (for a segwit tx larger than 4k, a buffer is still allocated to hash it)
+UInt256 BRTransactionParseTxHash(const uint8_t *buf, size_t bufLen)
+{
+    assert(buf != NULL || bufLen == 0);
+    if (! buf) return UINT256_ZERO;
+
+    UInt256 txHash = UINT256_ZERO;
+    uint8_t stackBuf[0x1000], *sBuf;
+    int witnessFlag = 0;
+    size_t i, j, off = 0, witnessOff = 0, sLen = 0, len = 0, inCount, outCount, count;
+
+    // walk the same fields as BRTransactionParse(), only keeping the offsets
+    off += sizeof(uint32_t);
+    inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+    off += len;
+    if (inCount == 0 && off + 1 <= bufLen) witnessFlag = buf[off++];
+
+    if (witnessFlag) {
+        inCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+    }
+
+    for (i = 0; off <= bufLen && i < inCount; i++) {
+        off += sizeof(UInt256) + sizeof(uint32_t);
+        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        if (sLen > bufLen) return UINT256_ZERO;
+        if (off + sLen <= bufLen && BRScriptPubKeyIsValid(&buf[off], sLen)) return UINT256_ZERO; // unsigned input
+        off += sLen + sizeof(uint32_t);
+    }
+
+    outCount = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+    off += len;
+
+    for (i = 0; off <= bufLen && i < outCount; i++) {
+        off += sizeof(uint64_t);
+        sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+        if (sLen > bufLen) return UINT256_ZERO;
+        off += sLen;
+    }
+
+    for (i = 0, witnessOff = off; witnessFlag && off <= bufLen && i < inCount; i++) {
+        count = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+        off += len;
+
+        for (j = 0; off <= bufLen && j < count; j++) {
+            sLen = (size_t)BRVarInt(&buf[off], (off <= bufLen ? bufLen - off : 0), &len);
+            if (sLen > bufLen) return UINT256_ZERO;
+            off += len + sLen;
+        }
+    }
+
+    off += sizeof(uint32_t);
+    if (inCount == 0 || off > bufLen) return UINT256_ZERO;
+
+    if (witnessFlag) { // the txHash leaves out the marker, flag and witnesses
+        sLen = (witnessOff - 2) + sizeof(uint32_t);
+        sBuf = (sLen <= sizeof(stackBuf)) ? stackBuf : malloc(sLen);
+        assert(sBuf != NULL);
+        memcpy(sBuf, buf, sizeof(uint32_t));
+        memcpy(&sBuf[sizeof(uint32_t)], &buf[sizeof(uint32_t) + 2], witnessOff - (sizeof(uint32_t) + 2));
+        memcpy(&sBuf[witnessOff - 2], &buf[off - sizeof(uint32_t)], sizeof(uint32_t));
+        BRSHA256_2(&txHash, sBuf, sLen);
+        if (sBuf != stackBuf) free(sBuf);
+    }
+    else BRSHA256_2(&txHash, buf, off);
+
+    return txHash;
+}
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
 // (tx->blockHeight and tx->timestamp are not serialized)
 size_t BRTransactionSerialize(const BRTransaction *tx, uint8_t *buf, size_t bufLen)
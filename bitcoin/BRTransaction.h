@@ -103,6 +103,11 @@ BRTransaction *BRTransactionCopy(const BRTransaction *tx);
 // retruns a transaction that must be freed by calling BRTransactionFree()
 BRTransaction *BRTransactionParse(const uint8_t *buf, size_t bufLen);
 
+// buf must contain a serialized tx
+// returns the txHash that BRTransactionParse() would give the tx, or UINT256_ZERO if the tx is not signed or not valid,
+// without allocating a transaction (for a segwit tx larger than 4k, a buffer is still allocated to hash it)
+UInt256 BRTransactionParseTxHash(const uint8_t *buf, size_t bufLen);
+
 // returns number of bytes written to buf, or total bufLen needed if buf is NULL
 // (tx->blockHeight and tx->timestamp are not serialized)
 size_t BRTransactionSerialize(const BRTransaction *tx, uint8_t *buf, size_t bufLen);
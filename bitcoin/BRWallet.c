@@ -66,6 +66,8 @@ inline static size_t _txChainIndex(const BRTransaction *tx, const UInt160 *chain
     return -1;
 }
 
+#define ADDR_ORDER_INTERNAL 0x80000000u
+
 struct BRWalletStruct {
     uint64_t balance, totalSent, totalReceived, feePerKb, *balanceHist;
     uint32_t blockHeight;
@@ -74,6 +76,8 @@ struct BRWalletStruct {
     BRMasterPubKey masterPubKey;
     BRAddressParams addrParams;
     UInt160 *internalChain, *externalChain;
+    uint32_t *addrOrder; // chain index of each generated address, in the order generated, with ADDR_ORDER_INTERNAL set
+                         // for the internal chain
     BRSet *allTx, *invalidTx, *pendingTx, *spentOutputs, *usedPKH, *allPKH;
     void *callbackInfo;
     void (*balanceChanged)(void *info, uint64_t balance);
@@ -266,6 +270,7 @@ BRWallet *BRWalletNew(BRAddressParams addrParams, BRTransaction *transactions[],
     wallet->addrParams = addrParams;
     array_new(wallet->internalChain, 100);
     array_new(wallet->externalChain, 100);
+    array_new(wallet->addrOrder, 200);
     array_new(wallet->balanceHist, txCount + 100);
     wallet->allTx = BRSetNew(BRTransactionHash, BRTransactionEq, txCount + 100);
     wallet->invalidTx = BRSetNew(BRTransactionHash, BRTransactionEq, 10);
@@ -353,6 +358,7 @@ size_t BRWalletUnusedAddrs(BRWallet *wallet, BRAddress addrs[], uint32_t gapLimi
         
         if (! BRKeySetPubKey(&key, pubKey, len)) break;
         array_add(chain, BRKeyHash160(&key));
+        array_add(wallet->addrOrder, (internal == SEQUENCE_INTERNAL_CHAIN ? ADDR_ORDER_INTERNAL : 0) | (uint32_t)count);
         count++;
         if (BRSetContains(wallet->usedPKH, &chain[array_count(chain) - 1])) i = count;
     }
@@ -562,6 +568,60 @@ size_t BRWalletAllAddrs(BRWallet *wallet, BRAddress addrs[], size_t addrsCount)
     return internalCount + externalCount;
 }
 
+// writes the hash160 of all addresses previously genereated with BRWalletUnusedAddrs() to pkhs, without the round trip
+// through address strings
+// returns the number hashes written, or total number available if pkhs is NULL
+size_t BRWalletAllPKHs(BRWallet *wallet, UInt160 pkhs[], size_t pkhsCount)
+{
+    size_t internalCount = 0, externalCount = 0;
+    
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    internalCount = (! pkhs || array_count(wallet->internalChain) < pkhsCount) ?
+                    array_count(wallet->internalChain) : pkhsCount;
+    if (pkhs) memcpy(pkhs, wallet->internalChain, internalCount*sizeof(*pkhs));
+    externalCount = (! pkhs || array_count(wallet->externalChain) < pkhsCount - internalCount) ?
+                    array_count(wallet->externalChain) : pkhsCount - internalCount;
+    if (pkhs) memcpy(&pkhs[internalCount], wallet->externalChain, externalCount*sizeof(*pkhs));
+    pthread_mutex_unlock(&wallet->lock);
+    return internalCount + externalCount;
+}
+
+// returns the number of addresses generated with BRWalletUnusedAddrs() so far, an epoch to later pass to
+// BRWalletAddrsSinceEpoch()
+size_t BRWalletAddrEpoch(BRWallet *wallet)
+{
+    size_t epoch;
+    
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    epoch = array_count(wallet->addrOrder);
+    pthread_mutex_unlock(&wallet->lock);
+    return epoch;
+}
+
+// writes the addresses generated with BRWalletUnusedAddrs() since epoch to addrs, in the order they were generated
+// returns the number addresses written, or total number available if addrs is NULL
+size_t BRWalletAddrsSinceEpoch(BRWallet *wallet, size_t epoch, BRAddress addrs[], size_t addrsCount)
+{
+    size_t i, count = 0;
+    uint32_t order;
+    
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    if (epoch < array_count(wallet->addrOrder)) count = array_count(wallet->addrOrder) - epoch;
+    if (addrs && count > addrsCount) count = addrsCount;
+
+    for (i = 0; addrs && i < count; i++) {
+        order = wallet->addrOrder[epoch + i];
+        BRAddressFromHash160(addrs[i].s, sizeof(*addrs), wallet->addrParams, (order & ADDR_ORDER_INTERNAL) ?
+                             &wallet->internalChain[order & ~ADDR_ORDER_INTERNAL] : &wallet->externalChain[order]);
+    }
+
+    pthread_mutex_unlock(&wallet->lock);
+    return count;
+}
+
 // true if the address was previously generated by BRWalletUnusedAddrs() (even if it's now used)
 int BRWalletContainsAddress(BRWallet *wallet, const char *addr)
 {
@@ -897,6 +957,21 @@ BRTransaction *BRWalletTransactionForHash(BRWallet *wallet, UInt256 txHash)
     return tx;
 }
 
+// true if the transaction with the given hash has been registered in the wallet with blockHeight and timestamp, such
+// that BRWalletUpdateTransactions() would leave the wallet unchanged for it
+int BRWalletHasTransactionAt(BRWallet *wallet, UInt256 txHash, uint32_t blockHeight, uint32_t timestamp)
+{
+    BRTransaction *tx;
+    int r = 0;
+    
+    assert(wallet != NULL);
+    pthread_mutex_lock(&wallet->lock);
+    tx = BRSetGet(wallet->allTx, &txHash);
+    r = (tx && tx->blockHeight == blockHeight && tx->timestamp == timestamp && blockHeight <= wallet->blockHeight);
+    pthread_mutex_unlock(&wallet->lock);
+    return r;
+}
+
 // returns a copy of the transaction with the given hash if it's been registered in the wallet
 BRTransaction *BRWalletTransactionCopyForHash(BRWallet *wallet, UInt256 txHash) {
     BRTransaction *tx;
@@ -1283,6 +1358,7 @@ void BRWalletFree(BRWallet *wallet)
     BRSetFree(wallet->spentOutputs);
     array_free(wallet->internalChain);
     array_free(wallet->externalChain);
+    array_free(wallet->addrOrder);
     array_free(wallet->balanceHist);
     array_free(wallet->transactions);
     array_free(wallet->utxos);
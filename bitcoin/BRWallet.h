@@ -98,6 +98,19 @@ BRAddress BRWalletAddressToLegacy (BRWallet *wallet, BRAddress *addr);
 // returns the number addresses written, or total number available if addrs is NULL
 size_t BRWalletAllAddrs(BRWallet *wallet, BRAddress addrs[], size_t addrsCount);
 
+// writes the hash160 of all addresses previously genereated with BRWalletUnusedAddrs() to pkhs, without the round trip
+// through address strings
+// returns the number hashes written, or total number available if pkhs is NULL
+size_t BRWalletAllPKHs(BRWallet *wallet, UInt160 pkhs[], size_t pkhsCount);
+
+// returns the number of addresses generated with BRWalletUnusedAddrs() so far, an epoch to later pass to
+// BRWalletAddrsSinceEpoch(), addresses are only ever added so a later epoch is never smaller
+size_t BRWalletAddrEpoch(BRWallet *wallet);
+
+// writes the addresses generated with BRWalletUnusedAddrs() since epoch to addrs, in the order they were generated
+// returns the number addresses written, or total number available if addrs is NULL
+size_t BRWalletAddrsSinceEpoch(BRWallet *wallet, size_t epoch, BRAddress addrs[], size_t addrsCount);
+
 // true if the address was previously generated by BRWalletUnusedAddrs() (even if it's now used)
 int BRWalletContainsAddress(BRWallet *wallet, const char *addr);
 
@@ -174,6 +187,10 @@ BRTransaction *BRWalletTransactionForHash(BRWallet *wallet, UInt256 txHash);
 // returns a copy of the transaction with the given hash if it's been registered in the wallet
 BRTransaction *BRWalletTransactionCopyForHash(BRWallet *wallet, UInt256 txHash);
 
+// true if the transaction with the given hash has been registered in the wallet with blockHeight and timestamp, such
+// that BRWalletUpdateTransactions() would leave the wallet unchanged for it
+int BRWalletHasTransactionAt(BRWallet *wallet, UInt256 txHash, uint32_t blockHeight, uint32_t timestamp);
+
 // true if no previous wallet transaction spends any of the given transaction's inputs, and no inputs are invalid
 int BRWalletTransactionIsValid(BRWallet *wallet, const BRTransaction *tx);
 
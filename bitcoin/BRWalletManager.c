@@ -493,33 +493,167 @@ static void BRTransactionWithStateFree(BRTransactionWithState txn) {
     free (txn);
 }
 
+static size_t BRTransactionWithStateHashByOwned(const void *txn) {
+    // drop the low bits, which are always zero for an allocated pointer
+    return (size_t) (((uintptr_t) ((BRTransactionWithState) txn)->ownedTransaction) >> 4);
+}
+
+static int BRTransactionWithStateEqByOwned(const void *txn1, const void *txn2) {
+    return ((BRTransactionWithState) txn1)->ownedTransaction == ((BRTransactionWithState) txn2)->ownedTransaction;
+}
+
+static size_t BRTransactionWithStateHashByHash(const void *txn) {
+    return (size_t) ((BRTransactionWithState) txn)->ownedTransaction->txHash.u32[0];
+}
+
+static int BRTransactionWithStateEqByHash(const void *txn1, const void *txn2) {
+    return txn1 == txn2 || UInt256Eq (((BRTransactionWithState) txn1)->ownedTransaction->txHash,
+                                      ((BRTransactionWithState) txn2)->ownedTransaction->txHash);
+}
+
+/**
+ * The index of the first confirmed transaction at or above `blockHeight`.
+ */
+static size_t
+BRWalletManagerConfirmedTransactionsLowerBound (BRWalletManager manager,
+                                                uint32_t blockHeight) {
+    size_t lo = 0, hi = array_count (manager->transactionsConfirmed);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (manager->transactionsConfirmed[mid]->ownedTransaction->blockHeight < blockHeight) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+static void
+BRWalletManagerIndexConfirmedTransaction (BRWalletManager manager,
+                                          BRTransactionWithState txnWithState) {
+    uint32_t blockHeight = txnWithState->ownedTransaction->blockHeight;
+    if (TX_UNCONFIRMED == blockHeight) return;
+
+    // insert after any others at the same height
+    size_t index = BRWalletManagerConfirmedTransactionsLowerBound (manager, blockHeight + 1);
+    array_insert (manager->transactionsConfirmed, index, txnWithState);
+}
+
+static void
+BRWalletManagerUnindexConfirmedTransaction (BRWalletManager manager,
+                                            BRTransactionWithState txnWithState) {
+    uint32_t blockHeight = txnWithState->ownedTransaction->blockHeight;
+    if (TX_UNCONFIRMED == blockHeight) return;
+
+    for (size_t index = BRWalletManagerConfirmedTransactionsLowerBound (manager, blockHeight);
+         index < array_count (manager->transactionsConfirmed) &&
+         manager->transactionsConfirmed[index]->ownedTransaction->blockHeight == blockHeight;
+         index++) {
+        if (manager->transactionsConfirmed[index] == txnWithState) {
+            array_rm (manager->transactionsConfirmed, index);
+            break;
+        }
+    }
+}
+
+/**
+ * Index a signed transaction by hash. If another transaction has the same hash, the first one
+ * added is the one found; this one waits with the unsigned transactions until that one is
+ * deleted. Returns true if indexed.
+ */
+static int
+BRWalletManagerIndexSignedTransaction (BRWalletManager manager,
+                                       BRTransactionWithState txnWithState) {
+    if (NULL == BRSetGet (manager->transactionsByHash, txnWithState)) {
+        BRSetAdd (manager->transactionsByHash, txnWithState);
+        return 1;
+    }
+
+    array_add (manager->transactionsUnsigned, txnWithState);
+    return 0;
+}
+
+/**
+ * Move the transactions that have been signed since they were added into the hash index.
+ * Returns the number moved.
+ */
+static size_t
+BRWalletManagerIndexNewlySignedTransactions (BRWalletManager manager) {
+    size_t signedCount = 0;
+
+    for (size_t index = array_count (manager->transactionsUnsigned); index > 0; index--) {
+        BRTransactionWithState txnWithState = manager->transactionsUnsigned[index - 1];
+        if (BRTransactionIsSigned (txnWithState->ownedTransaction)) {
+            array_rm (manager->transactionsUnsigned, index - 1);
+            signedCount += BRWalletManagerIndexSignedTransaction (manager, txnWithState);
+        }
+    }
+
+    return signedCount;
+}
+
 static BRTransactionWithState
 BRWalletManagerAddTransaction(BRWalletManager manager,
                               BRTransaction *ownedTransaction,
                               BRTransaction *refedTransaction) {
     BRTransactionWithState txnWithState = BRTransactionWithStateNew (ownedTransaction, refedTransaction);
     array_add (manager->transactions, txnWithState);
+
+    BRSetAdd (manager->transactionsByOwned, txnWithState);
+    if (BRTransactionIsSigned (ownedTransaction)) BRWalletManagerIndexSignedTransaction (manager, txnWithState);
+    else array_add (manager->transactionsUnsigned, txnWithState);
+    BRWalletManagerIndexConfirmedTransaction (manager, txnWithState);
+
     return txnWithState;
 }
 
 /**
- * Find the tracked transaction using the `owned` transaction pointer. Deleted transactions
- * are not checked (i.e. they are skipped).
+ * Set the block of a tracked transaction, keeping the confirmed transactions ordered.
  */
 static BRTransactionWithState
-BRWalletManagerFindTransactionByOwned (BRWalletManager manager,
-                                       BRTransaction *transaction) {
-    BRTransactionWithState txnWithState = NULL;
+BRWalletManagerUpdateTransaction (BRWalletManager manager,
+                                  BRTransactionWithState txnWithState,
+                                  uint32_t height,
+                                  uint32_t timestamp) {
+    BRWalletManagerUnindexConfirmedTransaction (manager, txnWithState);
+    BRTransactionWithStateSetBlock (txnWithState, height, timestamp);
+    if (!txnWithState->isDeleted) BRWalletManagerIndexConfirmedTransaction (manager, txnWithState);
+    return txnWithState;
+}
 
-    for (size_t index = 0; index < array_count(manager->transactions); index++) {
-        if (!manager->transactions[index]->isDeleted &&
-            manager->transactions[index]->ownedTransaction == transaction) {
-            txnWithState = manager->transactions[index];
-            break;
+/**
+ * Mark a tracked transaction as deleted, removing it from the indexes. It stays in
+ * `transactions` as its owned transaction may still be referenced.
+ */
+static BRTransactionWithState
+BRWalletManagerDeleteTransaction (BRWalletManager manager,
+                                  BRTransactionWithState txnWithState) {
+    BRSetRemove (manager->transactionsByOwned, txnWithState);
+
+    if (txnWithState == BRSetGet (manager->transactionsByHash, txnWithState)) {
+        BRSetRemove (manager->transactionsByHash, txnWithState);
+    } else {
+        for (size_t index = 0; index < array_count (manager->transactionsUnsigned); index++) {
+            if (manager->transactionsUnsigned[index] == txnWithState) {
+                array_rm (manager->transactionsUnsigned, index);
+                break;
+            }
         }
     }
 
-    return txnWithState;
+    BRWalletManagerUnindexConfirmedTransaction (manager, txnWithState);
+    return BRTransactionWithStateSetDeleted (txnWithState);
+}
+
+/**
+ * Find the tracked transaction using the `owned` transaction pointer. Deleted transactions
+ * are not checked (i.e. they are skipped).
+ */
+static BRTransactionWithState
+BRWalletManagerFindTransactionByOwned (BRWalletManager manager,
+                                       BRTransaction *transaction) {
+    struct BRTransactionWithStateStruct key = { .ownedTransaction = transaction };
+    return BRSetGet (manager->transactionsByOwned, &key);
 }
 
 /**
@@ -533,23 +667,18 @@ BRWalletManagerFindTransactionWithLastConfirmedSend(BRWalletManager manager,
     BRTransactionWithState txnWithState = NULL;
 
     if (lastBlockHeight >= confirmationsUntilFinal) {
-        for (size_t index = 0; index < array_count (manager->transactions); index++) {
-            // ensure:
-            // - tx is not deleted
-            // - tx is valid (i.e. no previous transaction spend any of utxos, and no inputs are invalid)
-            // - AND the transaction was a SEND
-            // - AND the transaction has been confirmed
-            if (!manager->transactions[index]->isDeleted &&
-                BRTransactionIsSigned (manager->transactions[index]->ownedTransaction) &&
-                BRWalletTransactionIsValid (manager->wallet, manager->transactions[index]->ownedTransaction) &&
-                0 != BRWalletAmountSentByTx (manager->wallet, manager->transactions[index]->ownedTransaction) &&
-                TX_UNCONFIRMED != manager->transactions[index]->ownedTransaction->blockHeight &&
-                manager->transactions[index]->ownedTransaction->blockHeight < (lastBlockHeight - confirmationsUntilFinal)) {
-
-                if (NULL == txnWithState ||
-                    txnWithState->ownedTransaction->blockHeight < manager->transactions[index]->ownedTransaction->blockHeight) {
-                    txnWithState =  manager->transactions[index];
-                }
+        // walk down from the highest confirmed transaction, stopping at the first that:
+        // - is below the final depth
+        // - AND is valid (i.e. no previous transaction spend any of utxos, and no inputs are invalid)
+        // - AND was a SEND
+        for (size_t index = array_count (manager->transactionsConfirmed); NULL == txnWithState && index > 0; index--) {
+            BRTransactionWithState candidate = manager->transactionsConfirmed[index - 1];
+
+            if (candidate->ownedTransaction->blockHeight < (lastBlockHeight - confirmationsUntilFinal) &&
+                BRTransactionIsSigned (candidate->ownedTransaction) &&
+                BRWalletTransactionIsValid (manager->wallet, candidate->ownedTransaction) &&
+                0 != BRWalletAmountSentByTx (manager->wallet, candidate->ownedTransaction)) {
+                txnWithState = candidate;
             }
         }
     }
@@ -564,21 +693,35 @@ BRWalletManagerFindTransactionWithLastConfirmedSend(BRWalletManager manager,
 static BRTransactionWithState
 BRWalletManagerFindTransactionByHash (BRWalletManager manager,
                                       UInt256 hash) {
-    BRTransactionWithState txnWithState = NULL;
+    BRTransaction transaction = { .txHash = hash };
+    struct BRTransactionWithStateStruct key = { .ownedTransaction = &transaction };
 
-    for (size_t index = 0; index < array_count(manager->transactions); index++) {
-        if (!manager->transactions[index]->isDeleted &&
-            UInt256Eq (manager->transactions[index]->ownedTransaction->txHash, hash)) {
-            txnWithState = manager->transactions[index];
-            break;
-        }
+    BRTransactionWithState txnWithState = BRSetGet (manager->transactionsByHash, &key);
+
+    // a transaction signed after being added is only indexed by hash once looked for
+    if (NULL == txnWithState && 0 != BRWalletManagerIndexNewlySignedTransactions (manager)) {
+        txnWithState = BRSetGet (manager->transactionsByHash, &key);
     }
 
     return txnWithState;
 }
 
+static void
+BRWalletManagerNewTransactions(BRWalletManager manager, size_t capacity) {
+    array_new (manager->transactions, capacity);
+    array_new (manager->transactionsUnsigned, 10);
+    array_new (manager->transactionsConfirmed, capacity);
+    manager->transactionsByOwned = BRSetNew (BRTransactionWithStateHashByOwned, BRTransactionWithStateEqByOwned, capacity);
+    manager->transactionsByHash  = BRSetNew (BRTransactionWithStateHashByHash,  BRTransactionWithStateEqByHash,  capacity);
+}
+
 static void
 BRWalletManagerFreeTransactions(BRWalletManager manager) {
+    BRSetFree (manager->transactionsByHash);
+    BRSetFree (manager->transactionsByOwned);
+    array_free (manager->transactionsConfirmed);
+    array_free (manager->transactionsUnsigned);
+
     for (size_t index = 0; index < array_count(manager->transactions); index++) {
         BRTransactionWithStateFree (manager->transactions[index]);
     }
@@ -601,6 +744,23 @@ fileServiceTypeTransactionV1Identifier (BRFileServiceContext context,
     return transaction->txHash;
 }
 
+// Unconfirmed transactions, at TX_UNCONFIRMED, are the highest.
+static int64_t
+fileServiceTypeTransactionHeightKey (BRFileServiceContext context,
+                                     BRFileService fs,
+                                     const void *entity) {
+    const BRTransaction *transaction = entity;
+    return transaction->blockHeight;
+}
+
+static int64_t
+fileServiceTypeTransactionTimestampKey (BRFileServiceContext context,
+                                        BRFileService fs,
+                                        const void *entity) {
+    const BRTransaction *transaction = entity;
+    return transaction->timestamp;
+}
+
 static uint8_t *
 fileServiceTypeTransactionV1Writer (BRFileServiceContext context,
                                     BRFileService fs,
@@ -687,6 +847,14 @@ fileServiceTypeBlockV1Identifier (BRFileServiceContext context,
     return block->blockHash;
 }
 
+static int64_t
+fileServiceTypeBlockHeightKey (BRFileServiceContext context,
+                               BRFileService fs,
+                               const void *entity) {
+    const BRMerkleBlock *block = entity;
+    return block->height;
+}
+
 static uint8_t *
 fileServiceTypeBlockV1Writer (BRFileServiceContext context,
                               BRFileService fs,
@@ -761,9 +929,14 @@ initialBlocksLoad (BRWalletManager manager) {
 
 #define fileServiceTypePeers        "peers"
 enum {
-    WALLET_MANAGER_PEER_VERSION_1
+    WALLET_MANAGER_PEER_VERSION_1,
+    WALLET_MANAGER_PEER_VERSION_2
 };
 
+// V1 entries were written as sizeof(BRPeer) before the connection quality fields were added, only the leading
+// address, port, services, timestamp and flags bytes are meaningful
+#define WALLET_MANAGER_PEER_V1_BYTES (sizeof (UInt128) + sizeof (uint16_t) + 2 * sizeof (uint64_t) + sizeof (uint8_t))
+
 static UInt256
 fileServiceTypePeerV1Identifier (BRFileServiceContext context,
                                  BRFileService fs,
@@ -810,11 +983,11 @@ fileServiceTypePeerV1Reader (BRFileServiceContext context,
                              BRFileService fs,
                              uint8_t *bytes,
                              uint32_t bytesCount) {
-    assert (bytesCount == sizeof (BRPeer));
+    assert (bytesCount >= WALLET_MANAGER_PEER_V1_BYTES);
 
     size_t offset = 0;
 
-    BRPeer *peer = malloc (bytesCount);
+    BRPeer *peer = calloc (1, sizeof (BRPeer));
 
     memcpy (peer->address.u8, &bytes[offset], sizeof (UInt128));
     offset += sizeof (UInt128);
@@ -834,6 +1007,99 @@ fileServiceTypePeerV1Reader (BRFileServiceContext context,
     return peer;
 }
 
+static UInt256
+fileServiceTypePeerV2Identifier (BRFileServiceContext context,
+                                 BRFileService fs,
+                                 const void *entity) {
+    const BRPeer *peer = entity;
+    uint8_t bytes[sizeof (UInt128) + sizeof (uint16_t)];
+
+    // identify by address and port only, so updated connection stats replace the saved peer
+    memcpy (bytes, peer->address.u8, sizeof (UInt128));
+    UInt16SetBE (&bytes[sizeof (UInt128)], peer->port);
+
+    UInt256 hash;
+    BRSHA256 (&hash, bytes, sizeof (bytes));
+
+    return hash;
+}
+
+static uint8_t *
+fileServiceTypePeerV2Writer (BRFileServiceContext context,
+                             BRFileService fs,
+                             const void* entity,
+                             uint32_t *bytesCount) {
+    const BRPeer *peer = entity;
+    size_t offset = 0;
+
+    *bytesCount = WALLET_MANAGER_PEER_V1_BYTES + sizeof (uint16_t) + 2 * sizeof (uint32_t);
+    uint8_t *bytes = malloc (*bytesCount);
+
+    memcpy (&bytes[offset], peer->address.u8, sizeof (UInt128));
+    offset += sizeof (UInt128);
+
+    UInt16SetBE (&bytes[offset], peer->port);
+    offset += sizeof (uint16_t);
+
+    UInt64SetBE (&bytes[offset], peer->services);
+    offset += sizeof (uint64_t);
+
+    UInt64SetBE (&bytes[offset], peer->timestamp);
+    offset += sizeof (uint64_t);
+
+    bytes[offset] = peer->flags;
+    offset += sizeof(uint8_t);
+
+    UInt16SetBE (&bytes[offset], peer->failures);
+    offset += sizeof (uint16_t);
+
+    UInt32SetBE (&bytes[offset], peer->rttMs);
+    offset += sizeof (uint32_t);
+
+    UInt32SetBE (&bytes[offset], peer->blockRate);
+    offset += sizeof (uint32_t); (void) offset;
+
+    return bytes;
+}
+
+static void *
+fileServiceTypePeerV2Reader (BRFileServiceContext context,
+                             BRFileService fs,
+                             uint8_t *bytes,
+                             uint32_t bytesCount) {
+    assert (bytesCount == WALLET_MANAGER_PEER_V1_BYTES + sizeof (uint16_t) + 2 * sizeof (uint32_t));
+
+    size_t offset = 0;
+
+    BRPeer *peer = calloc (1, sizeof (BRPeer));
+
+    memcpy (peer->address.u8, &bytes[offset], sizeof (UInt128));
+    offset += sizeof (UInt128);
+
+    peer->port = UInt16GetBE (&bytes[offset]);
+    offset += sizeof (uint16_t);
+
+    peer->services = UInt64GetBE(&bytes[offset]);
+    offset += sizeof (uint64_t);
+
+    peer->timestamp = UInt64GetBE(&bytes[offset]);
+    offset += sizeof (uint64_t);
+
+    peer->flags = bytes[offset];
+    offset += sizeof(uint8_t);
+
+    peer->failures = UInt16GetBE (&bytes[offset]);
+    offset += sizeof (uint16_t);
+
+    peer->rttMs = UInt32GetBE (&bytes[offset]);
+    offset += sizeof (uint32_t);
+
+    peer->blockRate = UInt32GetBE (&bytes[offset]);
+    offset += sizeof (uint32_t); (void) offset;
+
+    return peer;
+}
+
 static BRArrayOf(BRPeer)
 initialPeersLoad (BRWalletManager manager) {
     /// Load peers for the wallet manager.
@@ -900,6 +1166,11 @@ static_on_release BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeTransactionV1Reader,
                 fileServiceTypeTransactionV1Writer
             }
+        },
+        2,
+        {
+            { "height",    FILE_SERVICE_KEY_INTEGER, { .integer = fileServiceTypeTransactionHeightKey } },
+            { "timestamp", FILE_SERVICE_KEY_INTEGER, { .integer = fileServiceTypeTransactionTimestampKey } }
         }
     },
 
@@ -914,21 +1185,34 @@ static_on_release BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeBlockV1Reader,
                 fileServiceTypeBlockV1Writer
             }
+        },
+        1,
+        {
+            { "height", FILE_SERVICE_KEY_INTEGER, { .integer = fileServiceTypeBlockHeightKey } }
         }
     },
 
     {
         fileServiceTypePeers,
-        WALLET_MANAGER_PEER_VERSION_1,
-        1,
+        WALLET_MANAGER_PEER_VERSION_2,
+        2,
         {
             {
                 WALLET_MANAGER_PEER_VERSION_1,
                 fileServiceTypePeerV1Identifier,
                 fileServiceTypePeerV1Reader,
                 fileServiceTypePeerV1Writer
+            },
+
+            {
+                WALLET_MANAGER_PEER_VERSION_2,
+                fileServiceTypePeerV2Identifier,
+                fileServiceTypePeerV2Reader,
+                fileServiceTypePeerV2Writer
             }
-        }
+        },
+        0,
+        { }
     }
 };
 static_on_release size_t fileServiceSpecificationsCount = (sizeof (fileServiceSpecifications) / sizeof (BRFileServiceTypeSpecification));
@@ -1055,8 +1339,14 @@ BRWalletManagerNew (BRWalletManagerClient client,
         array_new (peers, 1);
     }
 
-    // Create the transaction array with enough initial capacity to hold all the loaded transactions
-    array_new(bwm->transactions, array_count(transactions));
+    // From here on, batch the saves: confirming a block can save hundreds of transactions.
+    fileServiceSetWriteBehind (bwm->fileService,
+                               FILE_SERVICE_WRITE_BEHIND_PENDING_LIMIT,
+                               FILE_SERVICE_WRITE_BEHIND_PENDING_DELAY);
+
+    // Create the transaction array, and its indexes, with enough initial capacity to hold all
+    // the loaded transactions
+    BRWalletManagerNewTransactions (bwm, array_count(transactions));
 
     // Create the Wallet being managed and populate with the loaded transactions
     _peer_log ("BWM: initializing wallet with %zu transactions", array_count(transactions));
@@ -1691,7 +1981,7 @@ bwmHandleTxAdded (BRWalletManager manager,
     } else {
         // this is a transaction we've submitted; set the reference transaction from the wallet
         BRTransactionWithStateSetReferenced (txnWithState, refedTransaction);
-        BRTransactionWithStateSetBlock (txnWithState, ownedTransaction->blockHeight, ownedTransaction->timestamp);
+        BRWalletManagerUpdateTransaction (manager, txnWithState, ownedTransaction->blockHeight, ownedTransaction->timestamp);
 
         // we already have an owned copy of this transaction; free up the passed one
         BRTransactionFree (ownedTransaction);
@@ -1726,7 +2016,7 @@ bwmHandleTxUpdated (BRWalletManager manager,
     BRTransactionWithState txnWithState = BRWalletManagerFindTransactionByHash (manager, hash);
     assert (NULL != txnWithState && BRTransactionIsSigned (BRTransactionWithStateGetOwned (txnWithState)));
 
-    BRTransactionWithStateSetBlock (txnWithState, blockHeight, timestamp);
+    BRWalletManagerUpdateTransaction (manager, txnWithState, blockHeight, timestamp);
     pthread_mutex_unlock (&manager->lock);
 
     bwmSignalTransactionEvent(manager,
@@ -1746,7 +2036,7 @@ bwmHandleTxDeleted (BRWalletManager manager,
     BRTransactionWithState txnWithState = BRWalletManagerFindTransactionByHash (manager, hash);
     assert (NULL != txnWithState && BRTransactionIsSigned (BRTransactionWithStateGetOwned (txnWithState)));
 
-    BRTransactionWithStateSetDeleted (txnWithState);
+    BRWalletManagerDeleteTransaction (manager, txnWithState);
     pthread_mutex_unlock (&manager->lock);
 
     bwmSignalTransactionEvent(manager,
@@ -2009,6 +2299,14 @@ bwmAnnounceTransaction (BRWalletManager manager,
                         size_t transactionLength,
                         uint64_t timestamp,
                         uint64_t blockHeight) {
+    // A re-sync announces every transaction again; skip those the wallet already has as announced,
+    // before copying and parsing them, as registering them would change nothing.
+    UInt256 txHash = BRTransactionParseTxHash (transaction, transactionLength);
+    if (!UInt256IsZero (txHash) &&
+        BRWalletHasTransactionAt (manager->wallet, txHash, (uint32_t) blockHeight, (uint32_t) timestamp)) {
+        return 1;
+    }
+
     bwmSignalAnnounceTransaction (manager,
                                   id,
                                   transaction,
@@ -2535,3 +2833,107 @@ BRTransactionEventTypeString (BRTransactionEventType t) {
     }
     return "<BITCOIN_TRANSACTION_EVENT_TYPE_UNKNOWN>";
 }
+
+/// MARK: - Transaction Index Tests
+
+/**
+ * A manager holding only the transaction indexes, to test them without a wallet, peer manager
+ * or file service.
+ */
+extern BRWalletManager
+BRWalletManagerTransactionIndexesNewTest (void) {
+    BRWalletManager manager = calloc (1, sizeof (struct BRWalletManagerStruct));
+    BRWalletManagerNewTransactions (manager, 10);
+    return manager;
+}
+
+extern void
+BRWalletManagerTransactionIndexesFreeTest (BRWalletManager manager) {
+    BRWalletManagerFreeTransactions (manager);
+    free (manager);
+}
+
+extern void
+BRWalletManagerAddTransactionTest (BRWalletManager manager,
+                                   OwnershipGiven BRTransaction *transaction) {
+    BRWalletManagerAddTransaction (manager, transaction, NULL);
+}
+
+/**
+ * Returns false if `transaction` isn't tracked, or was deleted.
+ */
+extern int
+BRWalletManagerUpdateTransactionTest (BRWalletManager manager,
+                                      BRTransaction *transaction,
+                                      uint32_t height,
+                                      uint32_t timestamp) {
+    BRTransactionWithState txnWithState = BRWalletManagerFindTransactionByOwned (manager, transaction);
+    if (NULL != txnWithState) BRWalletManagerUpdateTransaction (manager, txnWithState, height, timestamp);
+    return NULL != txnWithState;
+}
+
+/**
+ * Returns false if `transaction` isn't tracked, or was already deleted.
+ */
+extern int
+BRWalletManagerDeleteTransactionTest (BRWalletManager manager,
+                                      BRTransaction *transaction) {
+    BRTransactionWithState txnWithState = BRWalletManagerFindTransactionByOwned (manager, transaction);
+    if (NULL != txnWithState) BRWalletManagerDeleteTransaction (manager, txnWithState);
+    return NULL != txnWithState;
+}
+
+extern BRTransaction *
+BRWalletManagerFindTransactionTest (BRWalletManager manager,
+                                    UInt256 hash) {
+    BRTransactionWithState txnWithState = BRWalletManagerFindTransactionByHash (manager, hash);
+    return (NULL != txnWithState) ? BRTransactionWithStateGetOwned (txnWithState) : NULL;
+}
+
+/**
+ * Check that the indexes hold exactly the non-deleted transactions: each by owned pointer;
+ * each either by hash or, if not yet signed or sharing its hash, in the unsigned list; and the
+ * confirmed ones ordered by block height.
+ */
+extern int
+BRWalletManagerTransactionIndexesConsistentTest (BRWalletManager manager) {
+    size_t liveCount = 0, hashedCount = 0, waitingCount = 0, confirmedCount = 0;
+
+    for (size_t index = 0; index < array_count (manager->transactions); index++) {
+        BRTransactionWithState txnWithState = manager->transactions[index];
+        int isByOwned = txnWithState == BRSetGet (manager->transactionsByOwned, txnWithState);
+        int isByHash  = txnWithState == BRSetGet (manager->transactionsByHash,  txnWithState);
+        int isWaiting = 0, isConfirmed = 0;
+
+        for (size_t i = 0; i < array_count (manager->transactionsUnsigned); i++) {
+            if (manager->transactionsUnsigned[i] == txnWithState) isWaiting++;
+        }
+
+        for (size_t i = 0; i < array_count (manager->transactionsConfirmed); i++) {
+            if (manager->transactionsConfirmed[i] == txnWithState) isConfirmed++;
+        }
+
+        if (txnWithState->isDeleted) {
+            if (isByOwned || isByHash || isWaiting || isConfirmed) return 0;
+            continue;
+        }
+
+        if (!isByOwned || isByHash + isWaiting != 1) return 0;
+        if (isConfirmed != (TX_UNCONFIRMED != txnWithState->ownedTransaction->blockHeight)) return 0;
+
+        liveCount++;
+        hashedCount    += isByHash;
+        waitingCount   += isWaiting;
+        confirmedCount += isConfirmed;
+    }
+
+    for (size_t index = 1; index < array_count (manager->transactionsConfirmed); index++) {
+        if (manager->transactionsConfirmed[index - 1]->ownedTransaction->blockHeight >
+            manager->transactionsConfirmed[index]->ownedTransaction->blockHeight) return 0;
+    }
+
+    return (liveCount      == BRSetCount (manager->transactionsByOwned) &&
+            hashedCount    == BRSetCount (manager->transactionsByHash) &&
+            waitingCount   == array_count (manager->transactionsUnsigned) &&
+            confirmedCount == array_count (manager->transactionsConfirmed));
+}
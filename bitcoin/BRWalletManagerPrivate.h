@@ -16,6 +16,7 @@
 #include "ethereum/event/BREvent.h"
 #include "support/BRBase.h"
 #include "support/BRArray.h"
+#include "support/BRSet.h"
 #include "support/BRFileService.h"
 
 #ifdef __cplusplus
@@ -72,6 +73,21 @@ struct BRWalletManagerStruct {
      * associated with the `wallet`.
      */
     BRArrayOf(BRTransactionWithState) transactions;
+
+    /*
+     * Indexes over the non-deleted `transactions`: by `owned` transaction pointer and by
+     * `owned` transaction hash.  A transaction is only indexed by hash once signed, and once
+     * no other transaction with its hash is; until then it is held in `transactionsUnsigned`.
+     */
+    BRSetOf(BRTransactionWithState) transactionsByOwned;
+    BRSetOf(BRTransactionWithState) transactionsByHash;
+    BRArrayOf(BRTransactionWithState) transactionsUnsigned;
+
+    /*
+     * The non-deleted, confirmed `transactions`, ordered by block height; the last confirmed
+     * send is found by walking down from the top.
+     */
+    BRArrayOf(BRTransactionWithState) transactionsConfirmed;
 };
 
 /// Mark: - Wallet Callbacks
@@ -38,15 +38,18 @@
 #include "bcash/BRBCashAddr.h"
 
 #include "bitcoin/BRBloomFilter.h"
+#include "bitcoin/BRGCSFilter.h"
 #include "bitcoin/BRMerkleBlock.h"
 #include "bitcoin/BRWallet.h"
 #include "bitcoin/BRBIP38Key.h"
 #include "bitcoin/BRPeer.h"
 #include "bitcoin/BRPeerManager.h"
+#include "bitcoin/BRPeerReplay.h"
 #include "bitcoin/BRChainParams.h"
 #include "bitcoin/BRPaymentProtocol.h"
 #include "bitcoin/BRTransaction.h"
 #include "bitcoin/BRWalletManager.h"
+#include "bitcoin/BRSyncManager.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -55,7 +58,11 @@
 #include <errno.h>
 #include <time.h>
 #include <unistd.h>
+#include <poll.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include <pthread.h>
 
 #define SKIP_BIP38 1
@@ -2319,6 +2326,9 @@ int BRTransactionTests()
     "\x0e\x1c\x1a\x9d\x08\xaa\xb5\x41\xa4\xf3\x31\x53\xae\x00\x00\x00\x00";
     
     tx = BRTransactionParse((uint8_t *)buf0, sizeof(buf0) - 1);
+    if (! tx || ! UInt256Eq(BRTransactionParseTxHash((uint8_t *)buf0, sizeof(buf0) - 1), tx->txHash) ||
+        ! UInt256IsZero(BRTransactionParseTxHash((uint8_t *)buf0, sizeof(buf0) - 2)))
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionParseTxHash() test 1", __func__);
     
     uint8_t buf1[BRTransactionSerialize(tx, NULL, 0)];
     size_t len0 = BRTransactionSerialize(tx, buf1, sizeof(buf1));
@@ -2346,6 +2356,9 @@ int BRTransactionTests()
     BRTransactionFree(src);
 
     src = BRTransactionParse(buf4, len4);
+    if (! UInt256Eq(BRTransactionParseTxHash(buf4, len4), src->txHash))
+        r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionParseTxHash() test 2", __func__);
+
     tgt = BRTransactionCopy(src);
     if (! BRTransactionEqual(tgt, src))
         r = 0, fprintf(stderr, "\n***FAILED*** %s: BRTransactionCopy() test 3", __func__);
@@ -2469,6 +2482,18 @@ int BRWalletTests()
 
     if (BRWalletAllAddrs(w, NULL, 0) != SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED + SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED + 1)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletAllAddrs() test\n", __func__);
+
+    size_t epoch = BRWalletAddrEpoch(w);
+    BRAddress epochAddrs[6];
+
+    if (epoch != BRWalletAllAddrs(w, NULL, 0) || BRWalletAddrsSinceEpoch(w, epoch, NULL, 0) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletAddrEpoch() test 1\n", __func__);
+
+    BRWalletUnusedAddrs(w, NULL, SEQUENCE_GAP_LIMIT_INTERNAL_EXTENDED + 5, SEQUENCE_INTERNAL_CHAIN);
+    if (BRWalletAddrEpoch(w) != epoch + 5 || BRWalletAddrsSinceEpoch(w, epoch, epochAddrs, 6) != 5 ||
+        ! BRWalletContainsAddress(w, epochAddrs[0].s) || ! BRWalletContainsAddress(w, epochAddrs[4].s) ||
+        BRWalletAddrsSinceEpoch(w, epoch + 4, epochAddrs, 6) != 1 || ! BRWalletContainsAddress(w, epochAddrs[0].s))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletAddrEpoch() test 2\n", __func__);
     
     UInt256 hash = tx->txHash;
 
@@ -2633,6 +2658,28 @@ int BRBloomFilterTests()
     if (len2 != sizeof(d2) - 1 || memcmp(buf2, d2, len2) != 0)
         r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterSerialize() test 2\n", __func__);
     
+    BRBloomFilterFree(f);
+    f = BRBloomFilterNew(0.01, 3, 2147483649, BLOOM_UPDATE_P2PUBKEY_ONLY);
+
+    // same filter built from cached hash lanes
+    uint32_t hashes[3][BLOOM_MAX_HASH_FUNCS];
+    
+    BRBloomFilterDataHashes(2147483649, (uint8_t *)data5, sizeof(data5) - 1, hashes[0], 0, f->hashFuncs);
+    BRBloomFilterDataHashes(2147483649, (uint8_t *)data7, sizeof(data7) - 1, hashes[1], 0, 1);
+    BRBloomFilterDataHashes(2147483649, (uint8_t *)data7, sizeof(data7) - 1, &hashes[1][1], 1, f->hashFuncs - 1);
+    BRBloomFilterDataHashes(2147483649, (uint8_t *)data8, sizeof(data8) - 1, hashes[2], 0, f->hashFuncs);
+
+    for (size_t i = 0; i < 3; i++) BRBloomFilterInsertHashes(f, hashes[i], f->hashFuncs);
+    if (! BRBloomFilterContainsHashes(f, hashes[1], f->hashFuncs) ||
+        ! BRBloomFilterContainsData(f, (uint8_t *)data7, sizeof(data7) - 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterContainsHashes() test\n", __func__);
+
+    uint8_t buf3[BRBloomFilterSerialize(f, NULL, 0)];
+    size_t len3 = BRBloomFilterSerialize(f, buf3, sizeof(buf3));
+    
+    if (len3 != sizeof(d2) - 1 || memcmp(buf3, d2, len3) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRBloomFilterInsertHashes() test\n", __func__);
+    
     BRBloomFilterFree(f);
     return r;
 }
@@ -2654,6 +2701,81 @@ static int BRMerkleBlockEqual (const BRMerkleBlock *block1, const BRMerkleBlock
            && block1->height == block2->height;
 }
 
+// matches a walletCount script wallet against a blockCount element filter holding only one of the wallet's scripts,
+// returns the number of matches in ten tries (10), or 0 if the first half of the wallet matches too
+static size_t _GCSFilterMatchTest(size_t walletCount, size_t blockCount, double *msPerMatch)
+{
+    size_t i, matches = 0;
+    uint8_t (*scripts)[22] = malloc((walletCount + blockCount)*sizeof(*scripts));
+    const uint8_t **walletItems = malloc(walletCount*sizeof(*walletItems)), **blockItems = malloc(blockCount*sizeof(*blockItems));
+    size_t *walletLens = malloc(walletCount*sizeof(*walletLens)), *blockLens = malloc(blockCount*sizeof(*blockLens));
+    UInt256 blockHash = UINT256_ZERO;
+    struct timeval start, end;
+    BRGCSFilter *f;
+
+    for (i = 0; i < walletCount + blockCount; i++) {
+        scripts[i][0] = OP_0, scripts[i][1] = 20;
+        BRSHA256(&blockHash, &i, sizeof(i));
+        memcpy(&scripts[i][2], &blockHash, 20);
+        if (i < walletCount) walletItems[i] = scripts[i], walletLens[i] = sizeof(*scripts);
+        else blockItems[i - walletCount] = scripts[(i == walletCount) ? walletCount/2 : i],
+             blockLens[i - walletCount] = sizeof(*scripts);
+    }
+
+    f = BRGCSFilterNew(blockHash, blockItems, blockLens, blockCount);
+    gettimeofday(&start, NULL);
+    for (i = 0; i < 10; i++) matches += BRGCSFilterMatchAny(f, walletItems, walletLens, walletCount);
+    gettimeofday(&end, NULL);
+    if (BRGCSFilterMatchAny(f, walletItems, walletLens, walletCount/2)) matches = 0;
+    if (msPerMatch) *msPerMatch = ((end.tv_sec - start.tv_sec)*1000.0 + (end.tv_usec - start.tv_usec)/1000.0)/10;
+
+    BRGCSFilterFree(f);
+    free(blockLens);
+    free(walletLens);
+    free(blockItems);
+    free(walletItems);
+    free(scripts);
+    return matches/10;
+}
+
+int BRGCSFilterTests()
+{
+    int r = 1;
+    // testnet genesis block, BIP158 test vector 0
+    UInt256 blockHash = UInt256Reverse(uint256("000000000933ea01ad0ee984209779baaec3ced90fa3f408719526f8d77f4943"));
+    char script[] = "\x41\x04\x67\x8a\xfd\xb0\xfe\x55\x48\x27\x19\x67\xf1\xa6\x71\x30\xb7\x10\x5c\xd6\xa8\x28\xe0\x39"
+    "\x09\xa6\x79\x62\xe0\xea\x1f\x61\xde\xb6\x49\xf6\xbc\x3f\x4c\xef\x38\xc4\xf3\x55\x04\xe5\x1e\xc1\x12\xde\x5c\x38"
+    "\x4d\xf7\xba\x0b\x8d\x57\x8a\x4c\x70\x2b\x6b\xf1\x1d\x5f\xac", other[] = "\x00\x14\x01\x02\x03";
+    const uint8_t *items[] = { (uint8_t *)script, (uint8_t *)other };
+    size_t itemsLen[] = { sizeof(script) - 1, sizeof(other) - 1 };
+    uint8_t buf[4];
+    BRGCSFilter *f = BRGCSFilterNew(blockHash, items, itemsLen, 1), *f2;
+
+    if (BRGCSFilterSerialize(f, buf, sizeof(buf)) != 4 || memcmp(buf, "\x01\x9d\xfc\xa8", 4) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRGCSFilterNew() test\n", __func__);
+
+    if (! UInt256Eq(BRGCSFilterHeader(BRGCSFilterHash(f), UINT256_ZERO),
+                    UInt256Reverse(uint256("21584579b7eb08997773e5aeff3a7f932700042d0ed2a6129012b7d7ae81b750"))))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRGCSFilterHeader() test\n", __func__);
+
+    if (! BRGCSFilterMatchAny(f, items, itemsLen, 1) || BRGCSFilterMatchAny(f, &items[1], &itemsLen[1], 1))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRGCSFilterMatchAny() test\n", __func__);
+
+    f2 = BRGCSFilterParse(blockHash, buf, sizeof(buf));
+
+    if (! f2 || ! BRGCSFilterMatchAny(f2, items, itemsLen, 2) || BRGCSFilterParse(blockHash, buf, 3))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRGCSFilterParse() test\n", __func__);
+
+    if (f2) BRGCSFilterFree(f2);
+    BRGCSFilterFree(f);
+
+    // a wallet matched against a filter holding only one of the wallet's scripts
+    if (_GCSFilterMatchTest(1000, 100, NULL) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRGCSFilterMatchAny() test 2\n", __func__);
+
+    return r;
+}
+
 int BRMerkleBlockTests()
 {
     int r = 1;
@@ -2709,6 +2831,24 @@ int BRMerkleBlockTests()
     if (! UInt256Eq(txHashes[3], uint256("c9ab658448c10b6921b7a4ce3021eb22ed6bb6a7fde1e5bcc4b1db6615c6abc5")))
         r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockTxHashes() test 4\n", __func__);
     
+    // odd number of tx, with the partial tree built from the full list of tx hashes in a block
+    UInt256 allHashes[11], matchedHashes[11];
+    uint8_t matched[11] = { 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1 };
+    BRMerkleBlock *d = BRMerkleBlockNew(), *e = BRMerkleBlockNew();
+
+    for (uint32_t i = 0; i < 11; i++) BRSHA256(&allHashes[i], &i, sizeof(i));
+
+    if (! UInt256Eq(BRMerkleBlockSetMatchedTxHashes(d, allHashes, matched, 11),
+                    BRMerkleBlockSetMatchedTxHashes(e, allHashes, NULL, 11)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSetMatchedTxHashes() test 1\n", __func__);
+
+    if (BRMerkleBlockTxHashes(d, matchedHashes, 11) != 2 || ! UInt256Eq(matchedHashes[0], allHashes[2]) ||
+        ! UInt256Eq(matchedHashes[1], allHashes[10]) || BRMerkleBlockTxHashes(e, NULL, 0) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockSetMatchedTxHashes() test 2\n", __func__);
+
+    BRMerkleBlockFree(d);
+    BRMerkleBlockFree(e);
+
     // TODO: test a block with an odd number of tree rows both at the tx level and merkle node level
 
     // TODO: XXX test BRMerkleBlockVerifyDifficulty()
@@ -3167,15 +3307,1501 @@ int BRPaymentProtocolEncryptionTests()
     return r;
 }
 
-void BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t len, const char *type);
+int BRPeerAcceptMessageTest(BRPeer *peer, const uint8_t *msg, size_t len, const char *type);
+int BRPeerReadMessagesTest(BRPeer *peer, int socket);
+
+// appends a bitcoin protocol message with the given type and payload to buf, returns the number of bytes written
+static size_t _peerTestMessage(uint8_t *buf, uint32_t magicNumber, const char *type, const uint8_t *msg, size_t msgLen)
+{
+    uint8_t hash[32];
+    
+    UInt32SetLE(buf, magicNumber);
+    memset(&buf[4], 0, 12);
+    strncpy((char *)&buf[4], type, 12);
+    UInt32SetLE(&buf[16], (uint32_t)msgLen);
+    BRSHA256_2(hash, msg, msgLen);
+    memcpy(&buf[20], hash, sizeof(uint32_t));
+    if (msgLen > 0) memcpy(&buf[24], msg, msgLen);
+    return 24 + msgLen;
+}
+
+typedef struct {
+    UInt256 filterHeader, blockHash;
+    size_t headersCount;
+    int filterMatch;
+} _peerTestCF;
+
+static void _peerTestCFHeaders(void *info, UInt256 stopHash, UInt256 prevHeader, const UInt256 filterHashes[],
+                               size_t count)
+{
+    _peerTestCF *cf = info;
+
+    for (size_t i = 0; i < count; i++) prevHeader = BRGCSFilterHeader(filterHashes[i], prevHeader);
+    cf->filterHeader = prevHeader;
+    cf->headersCount += count;
+}
+
+static void _peerTestCFilter(void *info, UInt256 blockHash, const uint8_t *buf, size_t bufLen)
+{
+    _peerTestCF *cf = info;
+    BRGCSFilter *f = BRGCSFilterParse(blockHash, buf, bufLen);
+    const uint8_t *item = (const uint8_t *)"script";
+    size_t itemLen = 6;
+
+    cf->blockHash = blockHash;
+    cf->filterMatch = (f && BRGCSFilterMatchAny(f, &item, &itemLen, 1));
+    if (f) BRGCSFilterFree(f);
+}
+
+static void _peerTestReplayConnected(void *info)
+{
+    ((int *)info)[0]++;
+}
+
+static void _peerTestReplayThreadCleanup(void *info)
+{
+    ((int *)info)[1] = 1;
+}
+
+// records a handshake with a stand-in remote node, then replays it to a peer connected over the replay's transport
+static int _peerReplayTests(uint32_t magic)
+{
+    int r = 1, fd, state[2] = { 0, 0 };
+    char path[] = "/tmp/BRPeerReplayXXXXXX";
+    uint8_t buf[24 + 85], version[85];
+    BRPeer remote = BR_PEER_NONE, peers[2];
+    BRPeerRecorder *recorder;
+    BRPeerReplay *replay;
+    BRPeerReplayStats stats;
+    BRPeer *p;
+
+    fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    recorder = (fd >= 0) ? BRPeerRecorderNew(path, magic, 1234) : NULL;
+    
+    if (! recorder) {
+        fprintf(stderr, "***FAILED*** %s: BRPeerRecorderNew() test\n", __func__);
+        return 0;
+    }
+    
+    remote.address = ((UInt128) { .u8 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1 } });
+    remote.port = 8333;
+    memset(version, 0, sizeof(version));
+    UInt32SetLE(version, 70013); // protocol version, all other fields zero and an empty user agent
+    BRPeerRecorderRecordMessage(recorder, &remote, 0, buf, _peerTestMessage(buf, magic, "version", version, 85));
+    BRPeerRecorderRecordMessage(recorder, &remote, 1, buf, _peerTestMessage(buf, magic, "version", version, 85));
+    BRPeerRecorderRecordMessage(recorder, &remote, 0, buf, _peerTestMessage(buf, magic, "verack", NULL, 0));
+    BRPeerRecorderRecordMessage(recorder, &remote, 1, buf, _peerTestMessage(buf, magic, "verack", NULL, 0));
+    BRPeerRecorderFree(recorder);
+
+    replay = BRPeerReplayNew(path, 0);
+    unlink(path);
+    
+    if (! replay) {
+        fprintf(stderr, "***FAILED*** %s: BRPeerReplayNew() test 1\n", __func__);
+        return 0;
+    }
+    
+    if (BRPeerReplayMagicNumber(replay) != magic || BRPeerReplayEarliestKeyTime(replay) != 1234)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReplayNew() test 2\n", __func__);
+    
+    if (BRPeerReplayPeers(replay, peers, 2) != 1 || ! BRPeerEq(&peers[0], &remote))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReplayPeers() test\n", __func__);
+
+    p = BRPeerNew(magic);
+    *p = remote;
+    BRPeerSetCallbacks(p, state, _peerTestReplayConnected, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                       _peerTestReplayThreadCleanup);
+    BRPeerSetTransport(p, replay, BRPeerReplayOpenSocket);
+    BRPeerConnect(p);
+    
+    if (! BRPeerReplayWait(replay, 10))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReplayWait() test\n", __func__);
+    
+    for (int i = 0; i < 1000 && ! state[1]; i++) usleep(10000); // wait for the peer thread to finish
+    stats = BRPeerReplayGetStats(replay);
+    
+    if (state[0] != 1 || stats.connections != 1 || stats.messages != 2 || stats.bytes != 24 + 85 + 24)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReplayOpenSocket() test 1\n", __func__);
+    
+    if (BRPeerReplayOpenSocket(replay, &remote) != -1 || errno != ECONNREFUSED) // the only session has been played
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReplayOpenSocket() test 2\n", __func__);
+
+    if (state[1]) BRPeerFree(p);
+    BRPeerReplayFree(replay);
+    return r;
+}
+
+typedef struct {
+    volatile int disconnected, error, cleanups;
+} _peerTestReactorState;
+
+static void _peerTestReactorDisconnected(void *info, int error)
+{
+    ((_peerTestReactorState *)info)->error = error;
+    ((_peerTestReactorState *)info)->disconnected++;
+}
+
+static void _peerTestReactorThreadCleanup(void *info)
+{
+    ((_peerTestReactorState *)info)->cleanups++;
+}
+
+// returns a socket listening on an ephemeral loopback port, which is written to port
+static int _peerTestListen(uint16_t *port)
+{
+    struct sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    int fd = socket(PF_INET, SOCK_STREAM, 0);
+    
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    
+    if (fd >= 0 && (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 1) != 0 ||
+                    getsockname(fd, (struct sockaddr *)&addr, &addrLen) != 0)) {
+        close(fd);
+        fd = -1;
+    }
+    
+    if (fd >= 0) *port = ntohs(addr.sin_port);
+    return fd;
+}
+
+// reads len bytes from fd, giving up after the connection has been idle for a few seconds
+static size_t _peerTestRead(int fd, uint8_t *buf, size_t len)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    size_t off = 0;
+    ssize_t n = 1;
+    
+    while (off < len && n > 0 && poll(&pfd, 1, 5000) == 1) {
+        n = read(fd, &buf[off], len - off);
+        if (n > 0) off += n;
+    }
+    
+    return off;
+}
+
+// waits up to a few seconds for the peer's disconnected callback
+static int _peerTestReactorWait(_peerTestReactorState *state, int disconnected)
+{
+    for (int i = 0; i < 500 && state->disconnected < disconnected; i++) usleep(10000);
+    usleep(10000); // let the callback return before the peer is freed
+    return (state->disconnected == disconnected);
+}
+
+// connects peers to a loopback listener through an event loop reactor
+static int _peerReactorTests(uint32_t magic)
+{
+    int r = 1, fd, conn = -1;
+    uint16_t port = 0;
+    _peerTestReactorState state = { 0, 0, 0 }, loopState = { 0, 0, 0 };
+    BRPeerReactor *reactor = BRPeerReactorNew(1, &loopState, _peerTestReactorThreadCleanup);
+    struct pollfd pfd;
+    size_t len, msgLen = 0x40000, msgCount = 64;
+    uint8_t header[24], *msg = calloc(1, msgLen), *buf = malloc(msgCount*(24 + msgLen));
+    BRPeer *p;
+    
+    if (! reactor) {
+        fprintf(stderr, "***FAILED*** %s: BRPeerReactorNew() test\n", __func__);
+        free(msg);
+        free(buf);
+        return 0;
+    }
+    
+    // non-blocking connect failure, nothing is listening on the port
+    fd = _peerTestListen(&port);
+    if (fd >= 0) close(fd);
+    p = BRPeerNew(magic);
+    p->address = ((UInt128) { .u8 = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, 127, 0, 0, 1 } });
+    p->port = port;
+    BRPeerSetCallbacks(p, &state, NULL, _peerTestReactorDisconnected, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                       NULL, _peerTestReactorThreadCleanup);
+    BRPeerSetReactor(p, reactor);
+    BRPeerConnect(p);
+    
+    if (! _peerTestReactorWait(&state, 1) || state.error != ECONNREFUSED)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerConnect() test 1\n", __func__);
+    
+    // non-blocking connect success, the listener is sent the version message
+    fd = _peerTestListen(&port);
+    p->port = port;
+    BRPeerConnect(p);
+    pfd.fd = fd, pfd.events = POLLIN, pfd.revents = 0;
+    if (fd >= 0 && poll(&pfd, 1, 5000) == 1) conn = accept(fd, NULL, NULL);
+    
+    if (conn < 0 || _peerTestRead(conn, header, sizeof(header)) != sizeof(header) ||
+        UInt32GetLE(header) != magic || strncmp((const char *)&header[4], "version", 12) != 0 ||
+        _peerTestRead(conn, buf, UInt32GetLE(&header[16])) != UInt32GetLE(&header[16]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerConnect() test 2\n", __func__);
+    
+    if (BRPeerConnectStatus(p) != BRPeerStatusConnecting) // waiting for the version message that never comes
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerConnectStatus() test\n", __func__);
+    
+    // sends don't block while the remote end isn't reading, the reactor drains its send buffer once it is
+    BRPeerScheduleDisconnect(p, 10); // a blocking send would wait for the remote end until timing out
+    for (size_t i = 0; i < msgCount; i++) BRPeerSendMessage(p, msg, msgLen, "test");
+    
+    if (BRPeerConnectStatus(p) != BRPeerStatusConnecting)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerSendMessage() test 1\n", __func__);
+    
+    len = (conn >= 0) ? _peerTestRead(conn, buf, msgCount*(24 + msgLen)) : 0;
+    
+    if (len != msgCount*(24 + msgLen) || UInt32GetLE(&buf[len - 24 - msgLen]) != magic ||
+        strncmp((const char *)&buf[len - 24 - msgLen + 4], "test", 12) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerSendMessage() test 2\n", __func__);
+    
+    // timer wheel expiry, the remote end never completes the handshake
+    BRPeerScheduleDisconnect(p, 1);
+    
+    if (! _peerTestReactorWait(&state, 2) || state.error != ETIMEDOUT)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerScheduleDisconnect() test\n", __func__);
+    
+    if (conn >= 0 && read(conn, header, sizeof(header)) != 0) // the loop closed the socket
+        r = 0, fprintf(stderr, "***FAILED*** %s: socket close test 1\n", __func__);
+    
+    if (conn >= 0) close(conn);
+    conn = -1;
+    
+    // disconnect cleanup, a disconnect requested from another thread is carried out by the loop
+    BRPeerConnect(p);
+    if (fd >= 0 && poll(&pfd, 1, 5000) == 1) conn = accept(fd, NULL, NULL);
+    if (conn >= 0) _peerTestRead(conn, header, sizeof(header));
+    BRPeerDisconnect(p);
+    
+    if (! _peerTestReactorWait(&state, 3) || BRPeerConnectStatus(p) != BRPeerStatusDisconnected)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerDisconnect() test\n", __func__);
+    
+    if (conn >= 0) _peerTestRead(conn, buf, msgCount*(24 + msgLen)); // the rest of the version message, up to the close
+    
+    if (conn < 0 || read(conn, header, sizeof(header)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: socket close test 2\n", __func__);
+    
+    if (state.cleanups != 0) // reactor peers don't have threads to clean up
+        r = 0, fprintf(stderr, "***FAILED*** %s: threadCleanup() test 1\n", __func__);
+    
+    if (conn >= 0) close(conn);
+    if (fd >= 0) close(fd);
+    BRPeerFree(p);
+    BRPeerReactorFree(reactor);
+    
+    if (loopState.cleanups != 1) // the loop thread cleans up as it exits
+        r = 0, fprintf(stderr, "***FAILED*** %s: threadCleanup() test 2\n", __func__);
+    
+    free(msg);
+    free(buf);
+    return r;
+}
+
+// mainnet blocks 0, 1 and 2 as serialized headers with a zero tx count, real proof-of-work that needs no mining
+static const char *_peerTestHeaders[] = {
+    "\x01\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00"
+    "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x3b\xa3\xed\xfd\x7a\x7b\x12\xb2\x7a\xc7\x2c\x3e\x67\x76\x8f\x61\x7f\xc8"
+    "\x1b\xc3\x88\x8a\x51\x32\x3a\x9f\xb8\xaa\x4b\x1e\x5e\x4a\x29\xab\x5f\x49\xff\xff\x00\x1d\x1d\xac\x2b\x7c\x00",
+    "\x01\x00\x00\x00\x6f\xe2\x8c\x0a\xb6\xf1\xb3\x72\xc1\xa6\xa2\x46\xae\x63\xf7\x4f\x93\x1e\x83\x65\xe1\x5a\x08"
+    "\x9c\x68\xd6\x19\x00\x00\x00\x00\x00\x98\x20\x51\xfd\x1e\x4b\xa7\x44\xbb\xbe\x68\x0e\x1f\xee\x14\x67\x7b\xa1"
+    "\xa3\xc3\x54\x0b\xf7\xb1\xcd\xb6\x06\xe8\x57\x23\x3e\x0e\x61\xbc\x66\x49\xff\xff\x00\x1d\x01\xe3\x62\x99\x00",
+    "\x01\x00\x00\x00\x48\x60\xeb\x18\xbf\x1b\x16\x20\xe3\x7e\x94\x90\xfc\x8a\x42\x75\x14\x41\x6f\xd7\x51\x59\xab"
+    "\x86\x68\x8e\x9a\x83\x00\x00\x00\x00\xd5\xfd\xcc\x54\x1e\x25\xde\x1c\x7a\x5a\xdd\xed\xf2\x48\x58\xb8\xbb\x66"
+    "\x5c\x9f\x36\xef\x74\x4e\xe4\x2c\x31\x60\x22\xc9\x0f\x9b\xb0\xbc\x66\x49\xff\xff\x00\x1d\x08\xd2\xbd\x61\x00"
+};
+
+#define PEER_TEST_HEADERS_BAD 1337 // index of the header given a broken nonce
+
+typedef struct {
+    BRPeer *peer;
+    const uint8_t *msg;
+    size_t msgLen;
+    UInt256 *blockHashes; // relayed blocks, in relay order
+    int r;
+} _peerTestHeadersState;
+
+static void _peerTestRelayedBlock(void *info, BRMerkleBlock *block)
+{
+    _peerTestHeadersState *state = info;
+
+    array_add(state->blockHashes, block->blockHash);
+    BRMerkleBlockFree(block);
+}
+
+static void *_peerTestHeadersRoutine(void *info)
+{
+    _peerTestHeadersState *state = info;
+
+    state->r = BRPeerAcceptMessageTest(state->peer, state->msg, state->msgLen, "headers");
+    return NULL;
+}
+
+// reference inline validation, one header at a time: fills hashes and returns how many headers precede the first
+// malformed or invalid one
+static size_t _peerTestHeadersInline(const uint8_t *headers, size_t count, uint32_t now, UInt256 hashes[])
+{
+    BRMerkleBlock *block;
+    size_t i;
+    int valid = 1;
+
+    for (i = 0; valid && i < count; i++) {
+        block = BRMerkleBlockParse(&headers[81*i], 81);
+        valid = (block && BRMerkleBlockIsValid(block, now));
+        if (valid) hashes[i] = block->blockHash;
+        if (block) BRMerkleBlockFree(block);
+    }
+
+    return (valid) ? i : i - 1;
+}
+
+static void _peerTestHeadersPeer(_peerTestHeadersState *state, uint32_t magic, const uint8_t *msg, size_t msgLen)
+{
+    state->peer = BRPeerNew(magic);
+    state->msg = msg;
+    state->msgLen = msgLen;
+    array_new(state->blockHashes, 2000);
+    state->r = 0;
+    BRPeerSetCallbacks(state->peer, state, NULL, NULL, NULL, NULL, NULL, NULL, _peerTestRelayedBlock, NULL, NULL,
+                       NULL, NULL, NULL);
+    BRPeerSetEarliestKeyTime(state->peer, 1231006505); // genesis block time, so short batches are validated too
+}
+
+static int _peerHeadersTests(uint32_t magic)
+{
+    int r = 1, result, started[4];
+    size_t count = 2000, batch = 400, off, msgLen, partLen, relayed;
+    uint8_t *msg = malloc(9 + 81*count), *bad = malloc(9 + 81*count), *part = malloc(9 + 81*batch), *headers;
+    UInt256 *hashes = calloc(count, sizeof(*hashes));
+    _peerTestHeadersState state, states[4];
+    pthread_t threads[4];
+
+    off = BRVarIntSet(msg, 9, count);
+    msgLen = off + 81*count;
+    for (size_t i = 0; i < count; i++) memcpy(&msg[off + 81*i], _peerTestHeaders[i % 3], 81);
+    memcpy(bad, msg, msgLen);
+    bad[off + 81*PEER_TEST_HEADERS_BAD + 76] ^= 0xff; // the header hash no longer meets its proof-of-work target
+    partLen = BRVarIntSet(part, 9, batch) + 81*batch;
+
+    for (int j = 0; j < 2; j++) { // a valid batch, then a corrupt one
+        headers = (j == 0) ? msg : bad;
+        relayed = _peerTestHeadersInline(&headers[off], count, (uint32_t)time(NULL), hashes);
+
+        if (relayed != ((j == 0) ? count : PEER_TEST_HEADERS_BAD))
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRMerkleBlockIsValid() test %d\n", __func__, j + 1);
+
+        // a full batch is validated on the shared header pool
+        _peerTestHeadersPeer(&state, magic, headers, msgLen);
+        result = BRPeerAcceptMessageTest(state.peer, headers, msgLen, "headers");
+
+        if (result != (relayed == count) || array_count(state.blockHashes) != relayed ||
+            memcmp(state.blockHashes, hashes, relayed*sizeof(*hashes)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerAcceptMessageTest() test %d\n", __func__, 2*j + 1);
+
+        // the same headers in batches too small for the pool are validated inline, on the calling thread
+        array_clear(state.blockHashes);
+        result = 1;
+
+        for (size_t i = 0; result && i < count; i += batch) {
+            memcpy(&part[partLen - 81*batch], &headers[off + 81*i], 81*batch);
+            result = BRPeerAcceptMessageTest(state.peer, part, partLen, "headers");
+        }
+
+        if (result != (relayed == count) || array_count(state.blockHashes) != relayed ||
+            memcmp(state.blockHashes, hashes, relayed*sizeof(*hashes)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerAcceptMessageTest() test %d\n", __func__, 2*j + 2);
+
+        array_free(state.blockHashes);
+        BRPeerFree(state.peer);
+    }
+
+    // several peers share the pool at once, then disconnect and are freed while its detached threads live on
+    relayed = _peerTestHeadersInline(&msg[off], count, (uint32_t)time(NULL), hashes);
+
+    for (size_t i = 0; i < 4; i++) {
+        _peerTestHeadersPeer(&states[i], magic, msg, msgLen);
+        started[i] = (pthread_create(&threads[i], NULL, _peerTestHeadersRoutine, &states[i]) == 0);
+        if (! started[i]) _peerTestHeadersRoutine(&states[i]);
+    }
+
+    for (size_t i = 0; i < 4; i++) {
+        if (started[i]) pthread_join(threads[i], NULL);
+
+        if (! states[i].r || array_count(states[i].blockHashes) != relayed ||
+            memcmp(states[i].blockHashes, hashes, relayed*sizeof(*hashes)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerAcceptMessageTest() test 5\n", __func__);
+
+        BRPeerDisconnect(states[i].peer);
+        array_free(states[i].blockHashes);
+        BRPeerFree(states[i].peer);
+    }
+
+    relayed = _peerTestHeadersInline(&bad[off], count, (uint32_t)time(NULL), hashes);
+    _peerTestHeadersPeer(&state, magic, bad, msgLen);
+    result = BRPeerAcceptMessageTest(state.peer, bad, msgLen, "headers");
+
+    if (result || array_count(state.blockHashes) != relayed ||
+        memcmp(state.blockHashes, hashes, relayed*sizeof(*hashes)) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerAcceptMessageTest() test 6\n", __func__);
+
+    array_free(state.blockHashes);
+    BRPeerFree(state.peer);
+    free(hashes);
+    free(part);
+    free(bad);
+    free(msg);
+    return r;
+}
 
 int BRPeerTests()
 {
-    int r = 1;
-    BRPeer *p = BRPeerNew(BRMainNetParams->magicNumber);
+    int r = 1, fds[2];
+    uint32_t magic = BRMainNetParams->magicNumber;
+    BRPeer *p = BRPeerNew(magic);
     const char msg[] = "my message";
+    uint8_t buf[1024], nonce[8] = { 1, 2, 3, 4, 5, 6, 7, 8 }, addr[1 + 30*2] = { 2 };
+    size_t len = 0;
+    ssize_t n;
     
     BRPeerAcceptMessageTest(p, (const uint8_t *)msg, sizeof(msg) - 1, "inv");
+    BRPeerFree(p);
+
+    // stream framing: leading garbage, back to back messages, a ping to answer, then end of stream
+    p = BRPeerNew(magic);
+    memcpy(&buf[len], "junk", 4);
+    len += 4;
+    len += _peerTestMessage(&buf[len], magic, "addr", addr, sizeof(addr));
+    len += _peerTestMessage(&buf[len], magic, "ping", nonce, sizeof(nonce));
+    len += _peerTestMessage(&buf[len], magic, "addr", addr, sizeof(addr));
+    
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: socketpair() test\n", __func__);
+    else {
+        if (write(fds[0], buf, len) != len) r = 0, fprintf(stderr, "***FAILED*** %s: write() test\n", __func__);
+        shutdown(fds[0], SHUT_WR);
+        
+        if (BRPeerReadMessagesTest(p, fds[1]) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReadMessagesTest() test 1\n", __func__);
+        
+        n = read(fds[0], buf, sizeof(buf)); // expect a pong with the ping nonce
+        
+        if (n != 24 + sizeof(nonce) || strncmp((const char *)&buf[4], "pong", 12) != 0 ||
+            memcmp(&buf[24], nonce, sizeof(nonce)) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReadMessagesTest() test 2\n", __func__);
+
+        BRPeerMsgCount received[PEER_MSG_TYPES], sent[PEER_MSG_TYPES];
+        size_t addrIdx = 0, pingIdx = 0, pongIdx = 0;
+
+        memset(received, 0, sizeof(received));
+        memset(sent, 0, sizeof(sent));
+        BRPeerMsgCounts(p, received, sent);
+
+        for (size_t i = 0; i < PEER_MSG_TYPES; i++) {
+            if (strcmp(BRPeerMsgType(i), "addr") == 0) addrIdx = i;
+            if (strcmp(BRPeerMsgType(i), "ping") == 0) pingIdx = i;
+            if (strcmp(BRPeerMsgType(i), "pong") == 0) pongIdx = i;
+        }
+
+        if (received[addrIdx].count != 2 || received[addrIdx].bytes != 2*(24 + sizeof(addr)) ||
+            received[pingIdx].count != 1 || sent[pongIdx].count != 1 || sent[pongIdx].bytes != 24 + sizeof(nonce) ||
+            received[PEER_MSG_TYPES - 1].count != 0 || strcmp(BRPeerMsgType(PEER_MSG_TYPES - 1), "other") != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerMsgCounts() test\n", __func__);
+        
+        close(fds[0]);
+        close(fds[1]);
+    }
+    
+    // stream framing: corrupted checksum
+    len = _peerTestMessage(buf, magic, "addr", addr, sizeof(addr));
+    buf[20] ^= 0xff;
+    
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+        if (write(fds[0], buf, len) != len) r = 0, fprintf(stderr, "***FAILED*** %s: write() test\n", __func__);
+        shutdown(fds[0], SHUT_WR);
+        
+        if (BRPeerReadMessagesTest(p, fds[1]) != EPROTO)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReadMessagesTest() test 3\n", __func__);
+        
+        close(fds[0]);
+        close(fds[1]);
+    }
+    
+    BRPeerFree(p);
+
+    // a stand-in peer serving a compact block filter and its filter header
+    _peerTestCF cf = { UINT256_ZERO, UINT256_ZERO, 0, 0 };
+    UInt256 blockHash = uint256("0000000000000000000000000000000000000000000000000000000000000001"), filterHash;
+    const uint8_t *item = (const uint8_t *)"script";
+    size_t itemLen = 6, off;
+    BRGCSFilter *f = BRGCSFilterNew(blockHash, &item, &itemLen, 1);
+    uint8_t cfmsg[1 + 32 + 32 + 1 + 32 + f->length];
+
+    p = BRPeerNew(magic);
+    BRPeerSetCallbacks(p, &cf, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    BRPeerSetCompactFilterCallbacks(p, _peerTestCFHeaders, _peerTestCFilter, NULL);
+    filterHash = BRGCSFilterHash(f);
+    cfmsg[0] = GCS_FILTER_TYPE_BASIC;
+    UInt256Set(&cfmsg[1], blockHash);
+    UInt256Set(&cfmsg[33], UINT256_ZERO);
+    cfmsg[65] = 1;
+    UInt256Set(&cfmsg[66], filterHash);
+    len = _peerTestMessage(buf, magic, MSG_CFHEADERS, cfmsg, 98);
+    off = 33 + BRVarIntSet(&cfmsg[33], 9, f->length);
+    off += BRGCSFilterSerialize(f, &cfmsg[off], f->length);
+    len += _peerTestMessage(&buf[len], magic, MSG_CFILTER, cfmsg, off);
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0) {
+        if (write(fds[0], buf, len) != len) r = 0, fprintf(stderr, "***FAILED*** %s: write() test\n", __func__);
+        shutdown(fds[0], SHUT_WR);
+
+        if (BRPeerReadMessagesTest(p, fds[1]) != 0)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerReadMessagesTest() test 4\n", __func__);
+
+        close(fds[0]);
+        close(fds[1]);
+    }
+
+    if (cf.headersCount != 1 || ! UInt256Eq(cf.filterHeader, BRGCSFilterHeader(filterHash, UINT256_ZERO)))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerSetCompactFilterCallbacks() test 1\n", __func__);
+
+    if (! UInt256Eq(cf.blockHash, blockHash) || ! cf.filterMatch)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerSetCompactFilterCallbacks() test 2\n", __func__);
+
+    BRGCSFilterFree(f);
+    BRPeerFree(p);
+    if (! _peerReplayTests(magic)) r = 0;
+    if (! _peerReactorTests(magic)) r = 0;
+    if (! _peerHeadersTests(magic)) r = 0;
+    return r;
+}
+
+size_t BRPeerManagerBuildHeaderRangesTest(BRPeerManager *manager, UInt256 blockHash);
+size_t BRPeerManagerHeaderRangeAddBlockTest(BRPeerManager *manager, size_t index, BRPeer *peer, BRMerkleBlock *block);
+void BRPeerManagerFetchBlocksTest(BRPeerManager *manager, BRPeer *peer, const UInt256 blockHashes[], size_t count);
+void BRPeerManagerPeerRelayedBlockTest(BRPeerManager *manager, BRPeer *peer, BRMerkleBlock *block);
+size_t BRPeerManagerFetchLimitTest(BRPeer *peer);
+size_t BRPeerManagerTxAddRelayTest(BRPeerManager *manager, UInt256 txHash, const BRPeer *peer);
+int BRPeerManagerTxRemoveRelayTest(BRPeerManager *manager, UInt256 txHash, const BRPeer *peer);
+size_t BRPeerManagerRouteTransactionTest(BRPeerManager *manager, const BRTransaction *tx);
+void BRPeerManagerSortPeersTest(BRPeer peers[], size_t peersCount);
+
+#define PEER_MANAGER_TEST_CHECKPOINTS 4
+
+static BRChainParams _peerManagerTestParams;
+static BRCheckPoint _peerManagerTestCheckpoints[PEER_MANAGER_TEST_CHECKPOINTS];
+static UInt256 _peerManagerTestHashes[(PEER_MANAGER_TEST_CHECKPOINTS - 1)*BLOCK_DIFFICULTY_INTERVAL + 1];
+static const char *_peerManagerTestDNSSeeds[] = { NULL };
+
+static int _peerManagerTestVerifyDifficulty(const BRMerkleBlock *block, const BRSet *blockSet)
+{
+    return 1;
+}
+
+// returns a header at height that follows prevBlock, with nonce 0 for headers on the test chain
+static BRMerkleBlock *_peerManagerTestBlock(uint32_t height, UInt256 prevBlock, uint32_t nonce)
+{
+    BRMerkleBlock *block = BRMerkleBlockNew();
+    uint8_t buf[80];
+
+    block->version = 1;
+    block->prevBlock = prevBlock;
+    block->timestamp = 1231006505 + height*600;
+    block->target = 0x1d00ffff;
+    block->nonce = nonce;
+    BRMerkleBlockSerialize(block, buf, sizeof(buf));
+    BRSHA256_2(&block->blockHash, buf, sizeof(buf));
+    return block;
+}
+
+// turns header into a merkleblock with hashesCount tx hashes, none of which match the wallet, and timestamp
+static BRMerkleBlock *_peerManagerTestMerkleBlock(BRMerkleBlock *header, uint32_t timestamp, size_t hashesCount)
+{
+    UInt256 *hashes = calloc(hashesCount, sizeof(*hashes));
+    uint8_t buf[80], flags = 0;
+
+    header->timestamp = timestamp;
+    BRMerkleBlockSerialize(header, buf, sizeof(buf));
+    BRSHA256_2(&header->blockHash, buf, sizeof(buf));
+    for (size_t i = 0; i < hashesCount; i++) hashes[i].u32[0] = (uint32_t)i + 1;
+    header->totalTx = (uint32_t)hashesCount;
+    header->hashesCount = hashesCount;
+    header->flagsLen = 1;
+    BRMerkleBlockSetTxHashes(header, hashes, header->hashesCount, &flags, header->flagsLen);
+    free(hashes);
+    return header;
+}
+
+// chain params for a test chain of old headers with a checkpoint every difficulty interval, difficulty isn't verified
+// and the headers have no proof of work
+static const BRChainParams *_peerManagerTestChain(void)
+{
+    BRMerkleBlock *b;
+
+    if (_peerManagerTestParams.checkpointsCount > 0) return &_peerManagerTestParams;
+
+    for (uint32_t i = 0; i < sizeof(_peerManagerTestHashes)/sizeof(*_peerManagerTestHashes); i++) {
+        b = _peerManagerTestBlock(i, (i > 0) ? _peerManagerTestHashes[i - 1] : UINT256_ZERO, 0);
+        _peerManagerTestHashes[i] = b->blockHash;
+
+        if ((i % BLOCK_DIFFICULTY_INTERVAL) == 0) {
+            _peerManagerTestCheckpoints[i/BLOCK_DIFFICULTY_INTERVAL] =
+                (BRCheckPoint) { i, UInt256Reverse(b->blockHash), b->timestamp, b->target };
+        }
+
+        BRMerkleBlockFree(b);
+    }
+
+    _peerManagerTestParams = *BRTestNetParams;
+    _peerManagerTestParams.dnsSeeds = _peerManagerTestDNSSeeds;
+    _peerManagerTestParams.verifyDifficulty = _peerManagerTestVerifyDifficulty;
+    _peerManagerTestParams.checkpoints = _peerManagerTestCheckpoints;
+    _peerManagerTestParams.checkpointsCount = PEER_MANAGER_TEST_CHECKPOINTS;
+    return &_peerManagerTestParams;
+}
+
+// sends the test chain headers from height start to end to the header range at index
+static size_t _peerManagerTestRange(BRPeerManager *manager, size_t index, BRPeer *peer, uint32_t start, uint32_t end)
+{
+    size_t count = 0;
+
+    for (uint32_t h = start; h <= end; h++) {
+        count = BRPeerManagerHeaderRangeAddBlockTest(manager, index, peer,
+                                                     _peerManagerTestBlock(h, _peerManagerTestHashes[h - 1], 0));
+    }
+
+    return count;
+}
+
+// header ranges between the test chain checkpoints, completed out of order, with bad headers and handed over
+static int _peerManagerHeaderRangeTests(void)
+{
+    int r = 1;
+    const BRChainParams *params = _peerManagerTestChain();
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(params->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRPeerManager *manager = BRPeerManagerNew(params, wallet, (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    BRPeer *p1 = BRPeerNew(params->magicNumber), *p2 = BRPeerNew(params->magicNumber),
+           *p3 = BRPeerNew(params->magicNumber);
+    const uint32_t n = BLOCK_DIFFICULTY_INTERVAL;
+    size_t count;
+
+    if (BRPeerManagerLastBlockHeight(manager) != 3*n)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerNew() test\n", __func__);
+
+    count = BRPeerManagerBuildHeaderRangesTest(manager, _peerManagerTestHashes[0]);
+
+    if (count != 3 || BRPeerManagerLastBlockHeight(manager) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerBuildHeaderRangesTest() test\n", __func__);
+
+    // the second range completes first, and waits for the first one
+    count = _peerManagerTestRange(manager, 1, p2, n + 1, 2*n);
+
+    if (count != 3 || BRPeerManagerLastBlockHeight(manager) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerHeaderRangeAddBlockTest() test 1\n", __func__);
+
+    // a header that doesn't extend the range fails it, and the rest of the response is ignored
+    BRPeerManagerHeaderRangeAddBlockTest(manager, 0, p1, _peerManagerTestBlock(2, _peerManagerTestHashes[1], 0));
+    count = _peerManagerTestRange(manager, 0, p1, 1, n);
+
+    if (count != 3 || BRPeerManagerLastBlockHeight(manager) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerHeaderRangeAddBlockTest() test 2\n", __func__);
+
+    // handed over to another peer, the first range completes and both ranges are added to the chain
+    count = _peerManagerTestRange(manager, 0, p3, 1, n);
+
+    if (count != 1 || BRPeerManagerLastBlockHeight(manager) != 2*n)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerHeaderRangeAddBlockTest() test 3\n", __func__);
+
+    // a final header that differs from the checkpoint fails the range
+    _peerManagerTestRange(manager, 0, p1, 2*n + 1, 3*n - 1);
+    count = BRPeerManagerHeaderRangeAddBlockTest(manager, 0, p1,
+                                                 _peerManagerTestBlock(3*n, _peerManagerTestHashes[3*n - 1], 1));
+
+    if (count != 1 || BRPeerManagerLastBlockHeight(manager) != 2*n)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerHeaderRangeAddBlockTest() test 4\n", __func__);
+
+    count = _peerManagerTestRange(manager, 0, p2, 2*n + 1, 3*n);
+
+    if (count != 0 || BRPeerManagerLastBlockHeight(manager) != 3*n)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerHeaderRangeAddBlockTest() test 5\n", __func__);
+
+    BRPeerFree(p1);
+    BRPeerFree(p2);
+    BRPeerFree(p3);
+    BRPeerManagerFree(manager);
+    BRWalletFree(wallet);
+    return r;
+}
+
+// merkleblocks scheduled across peers arriving out of order, and added to the chain in order
+static int _peerManagerFetchTests(void)
+{
+    int r = 1;
+    const BRChainParams *params = _peerManagerTestChain();
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(params->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRPeerManager *manager = BRPeerManagerNew(params, wallet, (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    BRPeer *p1 = BRPeerNew(params->magicNumber), *p2 = BRPeerNew(params->magicNumber);
+    const uint32_t height = BRPeerManagerLastBlockHeight(manager);
+    UInt256 hashes[6], prevBlock = _peerManagerTestHashes[height];
+    BRMerkleBlock *blocks[6];
+
+    for (size_t i = 0; i < 6; i++) {
+        blocks[i] = _peerManagerTestBlock(height + 1 + (uint32_t)i, prevBlock, 0);
+        _peerManagerTestMerkleBlock(blocks[i], blocks[i]->timestamp, 1);
+        prevBlock = hashes[i] = blocks[i]->blockHash;
+    }
+
+    BRPeerManagerFetchBlocksTest(manager, p1, hashes, 5);
+
+    // blocks received ahead of the blocks before them are held
+    BRPeerManagerPeerRelayedBlockTest(manager, p2, blocks[2]);
+    BRPeerManagerPeerRelayedBlockTest(manager, p2, blocks[4]);
+    BRPeerManagerPeerRelayedBlockTest(manager, p1, blocks[1]);
+    BRPeerManagerPeerRelayedBlockTest(manager, p2, BRMerkleBlockCopy(blocks[1])); // also received after a re-request
+
+    if (BRPeerManagerLastBlockHeight(manager) != height)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPeerRelayedBlockTest() test 1\n", __func__);
+
+    // the held blocks are added once the chain connects to them
+    BRPeerManagerPeerRelayedBlockTest(manager, p1, blocks[0]);
+
+    if (BRPeerManagerLastBlockHeight(manager) != height + 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPeerRelayedBlockTest() test 2\n", __func__);
+
+    BRPeerManagerPeerRelayedBlockTest(manager, p1, blocks[3]);
+
+    if (BRPeerManagerLastBlockHeight(manager) != height + 5)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPeerRelayedBlockTest() test 3\n", __func__);
+
+    // a block that wasn't scheduled is added to the chain right away
+    BRPeerManagerPeerRelayedBlockTest(manager, p1, blocks[5]);
+
+    if (BRPeerManagerLastBlockHeight(manager) != height + 6)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerPeerRelayedBlockTest() test 4\n", __func__);
+
+    BRPeerManagerFree(manager);
+    BRPeerFree(p1);
+    BRPeerFree(p2);
+    BRWalletFree(wallet);
+    return r;
+}
+
+// merkleblocks kept in flight to a peer follow its round trip time and measured block rate
+static int _peerManagerFetchLimitTests(void)
+{
+    int r = 1;
+    const BRChainParams *params = _peerManagerTestChain();
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(params->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRPeerManager *manager = BRPeerManagerNew(params, wallet, (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    BRPeer *p = BRPeerNew(params->magicNumber);
+    const uint32_t height = BRPeerManagerLastBlockHeight(manager);
+    const size_t window = 100; // FETCH_WINDOW
+    UInt256 hashes[window], prevBlock = _peerManagerTestHashes[height];
+    BRMerkleBlock *blocks[window];
+    size_t limit;
+
+    // two round trips worth at the assumed 100 blocks per second, until the peer has been measured
+    if (BRPeerManagerFetchLimitTest(p) != 100)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerFetchLimitTest() test 1\n", __func__);
+
+    p->rttMs = 300, p->blockRate = 250;
+    if (BRPeerManagerFetchLimitTest(p) != 150)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerFetchLimitTest() test 2\n", __func__);
+
+    p->rttMs = 50, p->blockRate = 100; // at least 20 are kept in flight
+    if (BRPeerManagerFetchLimitTest(p) != 20)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerFetchLimitTest() test 3\n", __func__);
+
+    p->rttMs = 1000, p->blockRate = 400; // and at most 500
+    if (BRPeerManagerFetchLimitTest(p) != 500)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerFetchLimitTest() test 4\n", __func__);
+
+    // the block rate is measured once a full window of scheduled blocks has arrived from the peer
+    p->blockRate = 0;
+
+    for (size_t i = 0; i < window; i++) {
+        blocks[i] = _peerManagerTestBlock(height + 1 + (uint32_t)i, prevBlock, 0);
+        _peerManagerTestMerkleBlock(blocks[i], blocks[i]->timestamp, 1);
+        prevBlock = hashes[i] = blocks[i]->blockHash;
+    }
+
+    BRPeerManagerFetchBlocksTest(manager, p, hashes, window);
+    for (size_t i = 0; i < window - 1; i++) BRPeerManagerPeerRelayedBlockTest(manager, p, blocks[i]);
+
+    if (p->blockRate != 0 || BRPeerManagerFetchLimitTest(p) != 200)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerFetchLimitTest() test 5\n", __func__);
+
+    usleep(500000); // the window takes at least half a second, so the peer delivers at most about 200 blocks a second
+    BRPeerManagerPeerRelayedBlockTest(manager, p, blocks[window - 1]);
+    limit = p->blockRate*(p->rttMs/1000.0)*2.0;
+    if (limit < 20) limit = 20;
+
+    if (p->blockRate == 0 || p->blockRate > 201 || BRPeerManagerFetchLimitTest(p) != limit ||
+        BRPeerManagerLastBlockHeight(manager) != height + window)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerFetchLimitTest() test 6\n", __func__);
+
+    BRPeerManagerFree(manager);
+    BRPeerFree(p);
+    BRWalletFree(wallet);
+    return r;
+}
+
+// connection candidates rank by round trip time, block rate, recent failures and how long ago they were seen
+static int _peerManagerCostTests(void)
+{
+    int r = 1;
+    const uint64_t now = (uint64_t)time(NULL), day = 24*60*60;
+    BRPeer peers[] = { // address, port, services, timestamp, flags, failures, rttMs, blockRate
+        { UINT128_ZERO, 6, 0, now - 7*day, 0, 0, 50, 500 }, // a week unseen: 35.25s
+        { UINT128_ZERO, 4, 0, now, 0, 2, 50, 500 },         // two failures: 10.25s
+        { UINT128_ZERO, 2, 0, now, 0, 0, 0, 0 },            // never measured: 0.5s + 1s
+        { UINT128_ZERO, 7, 0, now, 0, 0, 50, 10 },          // slow to download a window: 10.05s
+        { UINT128_ZERO, 1, 0, now, 0, 0, 50, 500 },         // measured and fast: 0.25s
+        { UINT128_ZERO, 5, 0, now - day, 0, 0, 50, 500 },   // a day unseen: 5.25s
+        { UINT128_ZERO, 3, 0, now, 0, 0, 2000, 500 }        // slow round trips: 2.2s
+    };
+    const uint16_t ports[] = { 1, 2, 3, 5, 7, 4, 6 };
+
+    BRPeerManagerSortPeersTest(peers, sizeof(peers)/sizeof(*peers));
+
+    for (size_t i = 0; i < sizeof(peers)/sizeof(*peers); i++) {
+        if (peers[i].port != ports[i])
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerSortPeersTest() test %zu\n", __func__, i + 1);
+    }
+
+    return r;
+}
+
+// orphans connected once the blocks before them arrive, and evicted to stay within the pool's limits
+static int _peerManagerOrphanTests(void)
+{
+    int r = 1;
+    const BRChainParams *params = _peerManagerTestChain();
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(params->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRPeerManager *manager = BRPeerManagerNew(params, wallet, (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    BRPeer *p1 = BRPeerNew(params->magicNumber), *p2 = BRPeerNew(params->magicNumber);
+    const uint32_t height = BRPeerManagerLastBlockHeight(manager), now = (uint32_t)time(NULL);
+    const size_t maxPerPeer = 100, maxBytes = 2*1024*1024; // ORPHAN_MAX_PER_PEER and ORPHAN_MAX_BYTES
+    UInt256 prevBlock = UINT256_ZERO;
+    BRMerkleBlock *blocks[3];
+    BRPeerManagerOrphanStats stats;
+
+    p2->port = p1->port + 1;
+    BRPeerManagerFetchBlocksTest(manager, p1, NULL, 0); // makes p1 the download peer
+    blocks[0] = _peerManagerTestMerkleBlock(_peerManagerTestBlock(height + 1, _peerManagerTestHashes[height], 0), now, 1);
+    blocks[1] = _peerManagerTestMerkleBlock(_peerManagerTestBlock(height + 2, blocks[0]->blockHash, 0), now, 1);
+    blocks[2] = _peerManagerTestMerkleBlock(_peerManagerTestBlock(height + 3, blocks[1]->blockHash, 0), now, 1);
+
+    // blocks received before the blocks they follow are held, and added to the chain once those arrive
+    BRPeerManagerPeerRelayedBlockTest(manager, p1, blocks[2]);
+    BRPeerManagerPeerRelayedBlockTest(manager, p1, blocks[1]);
+    stats = BRPeerManagerGetOrphanStats(manager);
+
+    if (stats.count != 2 || stats.added != 2 || stats.bytes == 0 || BRPeerManagerLastBlockHeight(manager) != height)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerGetOrphanStats() test 1\n", __func__);
+
+    BRPeerManagerPeerRelayedBlockTest(manager, p1, blocks[0]);
+    stats = BRPeerManagerGetOrphanStats(manager);
+
+    if (stats.count != 0 || stats.bytes != 0 || stats.connected != 2 || stats.evicted != 0 ||
+        BRPeerManagerLastBlockHeight(manager) != height + 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerGetOrphanStats() test 2\n", __func__);
+
+    // a competing orphan with the same previous block replaces the one held
+    prevBlock.u32[0] = 1;
+    BRPeerManagerPeerRelayedBlockTest(manager, p1,
+                                      _peerManagerTestMerkleBlock(_peerManagerTestBlock(0, prevBlock, 0), now, 1));
+    BRPeerManagerPeerRelayedBlockTest(manager, p1,
+                                      _peerManagerTestMerkleBlock(_peerManagerTestBlock(0, prevBlock, 1), now, 1));
+    stats = BRPeerManagerGetOrphanStats(manager);
+
+    if (stats.count != 1 || stats.replaced != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerGetOrphanStats() test 3\n", __func__);
+
+    // a peer's oldest orphan is evicted once it has relayed its quota
+    for (size_t i = 0; i <= maxPerPeer; i++) {
+        prevBlock.u32[0] = 2 + (uint32_t)i;
+        BRPeerManagerPeerRelayedBlockTest(manager, p2,
+                                          _peerManagerTestMerkleBlock(_peerManagerTestBlock(0, prevBlock, 0), now, 1));
+    }
+
+    stats = BRPeerManagerGetOrphanStats(manager);
+
+    if (stats.count != 1 + maxPerPeer || stats.evicted != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerGetOrphanStats() test 4\n", __func__);
+
+    // the oldest orphans are evicted to keep the pool within its memory budget
+    for (size_t i = 0; i < 4; i++) {
+        prevBlock.u32[0] = 1000 + (uint32_t)i;
+        p1->port++; // from peers that are still within their quota
+        BRPeerManagerPeerRelayedBlockTest(manager, p1,
+                                          _peerManagerTestMerkleBlock(_peerManagerTestBlock(0, prevBlock, 0), now,
+                                                                      maxBytes/4/sizeof(UInt256)));
+    }
+
+    stats = BRPeerManagerGetOrphanStats(manager);
+
+    if (stats.bytes > maxBytes || stats.count != 3 || stats.evicted != maxPerPeer + 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerGetOrphanStats() test 5\n", __func__);
+
+    BRPeerManagerFree(manager);
+    BRPeerFree(p1);
+    BRPeerFree(p2);
+    BRWalletFree(wallet);
+    return r;
+}
+
+// peers that relayed each tx, tracked as bits of per-peer slots that are reused once all the slots have been taken
+static int _peerManagerTxRelayTests(void)
+{
+    int r = 1;
+    const BRChainParams *params = _peerManagerTestChain();
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(params->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRPeerManager *manager = BRPeerManagerNew(params, wallet, (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    const size_t slots = 64; // TX_PEER_SLOTS
+    BRPeer peers[slots + 1];
+    UInt256 txHash[3] = { UINT256_ZERO, UINT256_ZERO, UINT256_ZERO };
+    size_t count = 0;
+
+    for (size_t i = 0; i <= slots; i++) peers[i] = BR_PEER_NONE, peers[i].port = 1000 + (uint16_t)i;
+    for (size_t i = 0; i < 3; i++) txHash[i].u32[0] = txHash[i].u32[7] = (uint32_t)i + 1;
+
+    for (size_t i = 0; i < 3; i++) count = BRPeerManagerTxAddRelayTest(manager, txHash[0], &peers[i]);
+    if (count != 3) r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerTxAddRelayTest() test 1\n", __func__);
+
+    count = BRPeerManagerTxAddRelayTest(manager, txHash[0], &peers[1]); // a peer that already relayed the tx
+    if (count != 3) r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerTxAddRelayTest() test 2\n", __func__);
+
+    if (! BRPeerManagerTxRemoveRelayTest(manager, txHash[0], &peers[1]) ||
+        BRPeerManagerTxRemoveRelayTest(manager, txHash[0], &peers[1]) ||
+        BRPeerManagerTxRemoveRelayTest(manager, txHash[1], &peers[0]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerTxRemoveRelayTest() test 1\n", __func__);
+
+    if (BRPeerManagerRelayCount(manager, txHash[0]) != 2 || BRPeerManagerRelayCount(manager, txHash[1]) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRelayCount() test 1\n", __func__);
+
+    BRPeerManagerTxRemoveRelayTest(manager, txHash[0], &peers[0]);
+    BRPeerManagerTxRemoveRelayTest(manager, txHash[0], &peers[2]);
+
+    if (BRPeerManagerRelayCount(manager, txHash[0]) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRelayCount() test 2\n", __func__);
+
+    // once every slot is taken, the slot of a peer that isn't connected goes to the next peer, and is cleared first
+    for (size_t i = 0; i < slots; i++) count = BRPeerManagerTxAddRelayTest(manager, txHash[1], &peers[i]);
+    if (count != slots) r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerTxAddRelayTest() test 3\n", __func__);
+
+    count = BRPeerManagerTxAddRelayTest(manager, txHash[2], &peers[slots]);
+
+    if (count != 1 || BRPeerManagerRelayCount(manager, txHash[1]) != slots - 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerTxAddRelayTest() test 4\n", __func__);
+
+    if (BRPeerManagerTxRemoveRelayTest(manager, txHash[1], &peers[0]) ||
+        ! BRPeerManagerTxRemoveRelayTest(manager, txHash[1], &peers[1]) ||
+        BRPeerManagerTxRemoveRelayTest(manager, txHash[1], &peers[slots]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerTxRemoveRelayTest() test 2\n", __func__);
+
+    if (BRPeerManagerRelayCount(manager, txHash[1]) != slots - 2 || BRPeerManagerRelayCount(manager, txHash[2]) != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRelayCount() test 3\n", __func__);
+
+    BRPeerManagerFree(manager);
+    BRWalletFree(wallet);
+    return r;
+}
+
+static void _peerManagerTestSaveBlocks(void *info, int replace, BRMerkleBlock *blocks[], size_t blocksCount)
+{
+    uint32_t *saved = info; // replace flag, number of blocks, and height of the first block of the most recent save
+
+    saved[0] = replace;
+    saved[1] = (uint32_t)blocksCount;
+    saved[2] = (blocksCount > 0) ? blocks[0]->height : 0;
+}
+
+// header snapshots rejected up front, and one that fails verification in the background and is rolled back
+static int _peerManagerSnapshotTests(void)
+{
+    int r = 1;
+    const BRChainParams *params = _peerManagerTestChain();
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(params->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRPeerManager *manager = BRPeerManagerNew(params, wallet, (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    const uint32_t height = BRPeerManagerLastBlockHeight(manager), count = BLOCK_DIFFICULTY_INTERVAL + 1000;
+    uint8_t *headers = malloc(count*80);
+    UInt256 prevBlock = _peerManagerTestHashes[height], lastBlockHash = UINT256_ZERO;
+    volatile uint32_t saved[3] = { 0, 0, 0 };
+    BRMerkleBlock *b;
+
+    BRPeerManagerSetCallbacks(manager, (void *)saved, NULL, NULL, NULL, _peerManagerTestSaveBlocks, NULL, NULL, NULL);
+
+    for (uint32_t i = 0; i < count; i++) { // headers following the last checkpoint, without proof of work
+        b = _peerManagerTestBlock(height + 1 + i, prevBlock, 0);
+        BRMerkleBlockSerialize(b, &headers[i*80], 80);
+        prevBlock = lastBlockHash = b->blockHash;
+        BRMerkleBlockFree(b);
+    }
+
+    if (BRPeerManagerImportHeaderSnapshot(manager, headers, count*80, _peerManagerTestHashes[height]) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerImportHeaderSnapshot() test 1\n", __func__);
+
+    // the snapshot has to start right after a checkpoint
+    if (BRPeerManagerImportHeaderSnapshot(manager, &headers[80], (count - 1)*80, lastBlockHash) != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerImportHeaderSnapshot() test 2\n", __func__);
+
+    headers[(count - 10)*80 + 4] ^= 0xff; // break the link to the header before
+
+    if (BRPeerManagerImportHeaderSnapshot(manager, headers, count*80, lastBlockHash) != 0 ||
+        BRPeerManagerLastBlockHeight(manager) != height || saved[1] != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerImportHeaderSnapshot() test 3\n", __func__);
+
+    headers[(count - 10)*80 + 4] ^= 0xff;
+
+    // the headers are added to the chain, then dropped again once they fail proof of work verification
+    if (BRPeerManagerImportHeaderSnapshot(manager, headers, count*80, lastBlockHash) != count)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerImportHeaderSnapshot() test 4\n", __func__);
+
+    for (int i = 0; i < 1000 && BRPeerManagerLastBlockHeight(manager) != height; i++) usleep(10000);
+
+    if (BRPeerManagerLastBlockHeight(manager) != height || saved[0] != 1 || saved[1] != 1 || saved[2] != height)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerImportHeaderSnapshot() test 5\n", __func__);
+
+    BRPeerManagerFree(manager);
+    BRWalletFree(wallet);
+    free(headers);
+    return r;
+}
+
+// a tx paying to the receive addresses of wallets, with its hash set
+static BRTransaction *_peerManagerTestTx(BRWallet *wallets[], size_t count, uint64_t amount)
+{
+    BRTransaction *tx = BRTransactionNew();
+    BRAddress addr;
+
+    for (size_t i = 0; i < count; i++) {
+        addr = BRWalletLegacyAddress(wallets[i]);
+
+        uint8_t script[BRAddressScriptPubKey(NULL, 0, _peerManagerTestParams.addrParams, addr.s)];
+        size_t scriptLen = BRAddressScriptPubKey(script, sizeof(script), _peerManagerTestParams.addrParams, addr.s);
+
+        BRTransactionAddOutput(tx, amount, script, scriptLen);
+    }
+
+    uint8_t buf[BRTransactionSerialize(tx, NULL, 0)];
+    size_t len = BRTransactionSerialize(tx, buf, sizeof(buf));
+
+    BRSHA256_2(&tx->txHash, buf, len);
+    return tx;
+}
+
+// a tx touching wallets added to the manager is routed to each of them, but not to wallets removed again
+static int _peerManagerWalletRoutingTests(void)
+{
+    int r = 1;
+    const BRChainParams *params = _peerManagerTestChain();
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallets[3];
+    BRPeerManager *manager;
+    BRTransaction *tx;
+
+    for (size_t i = 0; i < 3; i++) {
+        seed.u8[0] = (uint8_t)i;
+        wallets[i] = BRWalletNew(params->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    }
+
+    manager = BRPeerManagerNew(params, wallets[0], (uint32_t)time(NULL), NULL, 0, NULL, 0);
+    BRPeerManagerAddWallet(manager, wallets[1]);
+    BRPeerManagerAddWallet(manager, wallets[2]);
+    BRPeerManagerAddWallet(manager, wallets[1]);
+
+    if (BRPeerManagerWalletCount(manager) != 3)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerAddWallet() test 1\n", __func__);
+
+    tx = _peerManagerTestTx(&wallets[1], 2, 1000000);
+
+    // the manager's own wallet registers tx itself, so it's only routed to the two added wallets
+    if (BRPeerManagerRouteTransactionTest(manager, tx) != 2 || BRWalletTransactionForHash(wallets[0], tx->txHash) ||
+        ! BRWalletTransactionForHash(wallets[1], tx->txHash) || ! BRWalletTransactionForHash(wallets[2], tx->txHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRouteTransactionTest() test 1\n", __func__);
+
+    if (BRWalletBalance(wallets[1]) != 1000000 || BRWalletBalance(wallets[2]) != 1000000)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRouteTransactionTest() test 2\n", __func__);
+
+    if (BRPeerManagerRouteTransactionTest(manager, tx) != 0) // already registered with both
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRouteTransactionTest() test 3\n", __func__);
+
+    BRTransactionFree(tx);
+    BRPeerManagerRemoveWallet(manager, wallets[2]);
+
+    if (BRPeerManagerWalletCount(manager) != 2)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRemoveWallet() test 1\n", __func__);
+
+    tx = _peerManagerTestTx(&wallets[1], 2, 2000000);
+
+    if (BRPeerManagerRouteTransactionTest(manager, tx) != 1 || ! BRWalletTransactionForHash(wallets[1], tx->txHash) ||
+        BRWalletTransactionForHash(wallets[2], tx->txHash))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRPeerManagerRouteTransactionTest() test 4\n", __func__);
+
+    BRTransactionFree(tx);
+    BRPeerManagerFree(manager);
+    for (size_t i = 0; i < 3; i++) BRWalletFree(wallets[i]);
+    return r;
+}
+
+int BRPeerManagerTests()
+{
+    int r = 1;
+
+    if (! _peerManagerHeaderRangeTests()) r = 0;
+    if (! _peerManagerFetchTests()) r = 0;
+    if (! _peerManagerFetchLimitTests()) r = 0;
+    if (! _peerManagerCostTests()) r = 0;
+    if (! _peerManagerOrphanTests()) r = 0;
+    if (! _peerManagerTxRelayTests()) r = 0;
+    if (! _peerManagerSnapshotTests()) r = 0;
+    if (! _peerManagerWalletRoutingTests()) r = 0;
+    return r;
+}
+
+BRWalletManager BRWalletManagerTransactionIndexesNewTest(void);
+void BRWalletManagerTransactionIndexesFreeTest(BRWalletManager manager);
+void BRWalletManagerAddTransactionTest(BRWalletManager manager, BRTransaction *transaction);
+int BRWalletManagerUpdateTransactionTest(BRWalletManager manager, BRTransaction *transaction, uint32_t height,
+                                         uint32_t timestamp);
+int BRWalletManagerDeleteTransactionTest(BRWalletManager manager, BRTransaction *transaction);
+BRTransaction *BRWalletManagerFindTransactionTest(BRWalletManager manager, UInt256 hash);
+int BRWalletManagerTransactionIndexesConsistentTest(BRWalletManager manager);
+
+// sets a signature on tx's input, and hash n
+static void _walletManagerTestSign(BRTransaction *tx, uint32_t n)
+{
+    uint8_t sig[] = { 0x01 };
+
+    BRTxInputSetSignature(&tx->inputs[0], sig, sizeof(sig));
+    BRTxInputSetWitness(&tx->inputs[0], sig, 0);
+    tx->txHash = UINT256_ZERO;
+    tx->txHash.u32[0] = n;
+}
+
+// returns a tx at blockHeight spending output n of a made up tx, signed with hash n if n isn't 0
+static BRTransaction *_walletManagerTestTx(uint32_t n, uint32_t blockHeight)
+{
+    BRTransaction *tx = BRTransactionNew();
+    UInt256 inHash = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+
+    BRTransactionAddInput(tx, inHash, n, 0, NULL, 0, NULL, 0, NULL, 0, TXIN_SEQUENCE);
+    if (n != 0) _walletManagerTestSign(tx, n);
+    tx->blockHeight = blockHeight;
+    return tx;
+}
+
+int BRWalletManagerTests()
+{
+    int r = 1;
+    BRWalletManager manager = BRWalletManagerTransactionIndexesNewTest();
+    BRTransaction *tx[6], *t;
+    UInt256 hash[6];
+
+    for (uint32_t i = 0; i < 6; i++) hash[i] = UINT256_ZERO, hash[i].u32[0] = i + 1;
+    tx[0] = _walletManagerTestTx(1, 10);
+    tx[1] = _walletManagerTestTx(2, TX_UNCONFIRMED);
+    tx[2] = _walletManagerTestTx(3, 5);
+    tx[3] = _walletManagerTestTx(0, TX_UNCONFIRMED); // created, not signed yet
+    for (size_t i = 0; i < 4; i++) BRWalletManagerAddTransactionTest(manager, tx[i]);
+
+    if (! BRWalletManagerTransactionIndexesConsistentTest(manager) ||
+        BRWalletManagerFindTransactionTest(manager, hash[0]) != tx[0] ||
+        BRWalletManagerFindTransactionTest(manager, hash[1]) != tx[1] ||
+        BRWalletManagerFindTransactionTest(manager, hash[2]) != tx[2] ||
+        BRWalletManagerFindTransactionTest(manager, hash[3]) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerAddTransactionTest() test 1\n", __func__);
+
+    // confirmed tx are re-indexed as their block changes
+    if (! BRWalletManagerUpdateTransactionTest(manager, tx[1], 7, 1) ||
+        ! BRWalletManagerUpdateTransactionTest(manager, tx[0], TX_UNCONFIRMED, 0) ||
+        ! BRWalletManagerUpdateTransactionTest(manager, tx[2], 12, 1) ||
+        ! BRWalletManagerTransactionIndexesConsistentTest(manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerUpdateTransactionTest() test 1\n", __func__);
+
+    // a tx signed after it was added is found by its hash
+    _walletManagerTestSign(tx[3], 4);
+
+    if (BRWalletManagerFindTransactionTest(manager, hash[3]) != tx[3] ||
+        ! BRWalletManagerTransactionIndexesConsistentTest(manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerFindTransactionTest() test 1\n", __func__);
+
+    // a deleted tx is dropped from each index, and is no longer found
+    if (! BRWalletManagerDeleteTransactionTest(manager, tx[2]) ||
+        BRWalletManagerDeleteTransactionTest(manager, tx[2]) ||
+        BRWalletManagerUpdateTransactionTest(manager, tx[2], 13, 1) ||
+        BRWalletManagerFindTransactionTest(manager, hash[2]) != NULL ||
+        ! BRWalletManagerTransactionIndexesConsistentTest(manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerDeleteTransactionTest() test 1\n", __func__);
+
+    // the same tx added again replaces the deleted one
+    tx[4] = _walletManagerTestTx(3, 12);
+    BRWalletManagerAddTransactionTest(manager, tx[4]);
+
+    if (BRWalletManagerFindTransactionTest(manager, hash[2]) != tx[4] ||
+        ! BRWalletManagerTransactionIndexesConsistentTest(manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerAddTransactionTest() test 2\n", __func__);
+
+    // of two tx with the same hash the first added is found, then the second once the first is deleted
+    tx[5] = _walletManagerTestTx(2, 7);
+    BRWalletManagerAddTransactionTest(manager, tx[5]);
+
+    if (BRWalletManagerFindTransactionTest(manager, hash[1]) != tx[1] ||
+        ! BRWalletManagerTransactionIndexesConsistentTest(manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerAddTransactionTest() test 3\n", __func__);
+
+    if (! BRWalletManagerDeleteTransactionTest(manager, tx[1]) ||
+        BRWalletManagerFindTransactionTest(manager, hash[1]) != tx[5] ||
+        ! BRWalletManagerTransactionIndexesConsistentTest(manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerDeleteTransactionTest() test 2\n", __func__);
+
+    // a tx deleted before it was signed, and one deleted after it was
+    t = _walletManagerTestTx(0, TX_UNCONFIRMED);
+    BRWalletManagerAddTransactionTest(manager, t);
+
+    if (! BRWalletManagerDeleteTransactionTest(manager, t) || ! BRWalletManagerDeleteTransactionTest(manager, tx[3]) ||
+        BRWalletManagerFindTransactionTest(manager, hash[3]) != NULL ||
+        ! BRWalletManagerTransactionIndexesConsistentTest(manager))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRWalletManagerDeleteTransactionTest() test 3\n", __func__);
+
+    BRWalletManagerTransactionIndexesFreeTest(manager);
+    return r;
+}
+
+typedef struct {
+    size_t requestCount, addedCount, eventCount;
+    int rids[8];
+    size_t addrCounts[8];
+    char **addrs[8];
+    UInt256 added[8];
+    BRSyncManagerEventType events[8];
+} _SyncManagerTestContext;
+
+static void _syncManagerTestGetBlockNumber(void *context, BRSyncManager manager, int rid)
+{
+}
+
+// records each getTransactions() request, with a copy of its addresses
+static void _syncManagerTestGetTransactions(void *context, BRSyncManager manager, const char **addresses,
+                                            size_t addressCount, uint64_t begBlockNumber, uint64_t endBlockNumber,
+                                            int rid)
+{
+    _SyncManagerTestContext *ctx = context;
+
+    if (ctx->requestCount < 8) {
+        ctx->rids[ctx->requestCount] = rid;
+        ctx->addrCounts[ctx->requestCount] = addressCount;
+        ctx->addrs[ctx->requestCount] = calloc(addressCount, sizeof(char *));
+        for (size_t i = 0; i < addressCount; i++) ctx->addrs[ctx->requestCount][i] = strdup(addresses[i]);
+    }
+
+    ctx->requestCount++;
+}
+
+static void _syncManagerTestSubmitTransaction(void *context, BRSyncManager manager, uint8_t *transaction,
+                                              size_t transactionLength, UInt256 transactionHash, int rid)
+{
+}
+
+static void _syncManagerTestEvent(void *context, BRSyncManager manager, BRSyncManagerEvent event)
+{
+    _SyncManagerTestContext *ctx = context;
+
+    if (ctx->eventCount < 8) ctx->events[ctx->eventCount] = event.type;
+    ctx->eventCount++;
+}
+
+// records the order tx are registered with the wallet
+static void _syncManagerTestTxAdded(void *info, BRTransaction *tx)
+{
+    _SyncManagerTestContext *ctx = info;
+
+    if (ctx->addedCount < 8) ctx->added[ctx->addedCount] = tx->txHash;
+    ctx->addedCount++;
+}
+
+// returns a signed tx paying addr, serialized into buf, spending output n of a made up tx; sets hash to its hash
+static size_t _syncManagerTestTx(uint8_t *buf, size_t bufLen, const char *addr, uint32_t n, UInt256 *hash)
+{
+    BRTransaction *tx = BRTransactionNew(), *parsed;
+    UInt256 inHash = uint256("0000000000000000000000000000000000000000000000000000000000000001");
+    uint8_t sig[] = { 0x01, 0x01 }; // pushes one byte
+    uint8_t script[BRAddressScriptPubKey(NULL, 0, BRMainNetParams->addrParams, addr)];
+    size_t scriptLen = BRAddressScriptPubKey(script, sizeof(script), BRMainNetParams->addrParams, addr), len;
+
+    BRTransactionAddInput(tx, inHash, n, 0, NULL, 0, sig, sizeof(sig), NULL, 0, TXIN_SEQUENCE);
+    BRTransactionAddOutput(tx, SATOSHIS, script, scriptLen);
+    len = BRTransactionSerialize(tx, buf, bufLen);
+    parsed = BRTransactionParse(buf, len);
+    *hash = parsed->txHash;
+    BRTransactionFree(parsed);
+    BRTransactionFree(tx);
+    return len;
+}
+
+static BRSyncManager _syncManagerTestNew(_SyncManagerTestContext *ctx, BRWallet *wallet)
+{
+    BRSyncManagerClientCallbacks callbacks = {
+        _syncManagerTestGetBlockNumber, _syncManagerTestGetTransactions, _syncManagerTestSubmitTransaction
+    };
+    BRSyncManager manager;
+
+    BRWalletSetCallbacks(wallet, ctx, NULL, _syncManagerTestTxAdded, NULL, NULL);
+
+    // a full scan of blocks 0 to 1000, in ranges of 500 blocks with every range requested at once
+    manager = BRSyncManagerNewForMode(CRYPTO_SYNC_MODE_API_ONLY, ctx, _syncManagerTestEvent, ctx, callbacks,
+                                      BRMainNetParams, wallet, 0, 1000, 6, 1, NULL, 0, NULL, 0);
+    BRSyncManagerSetClientSyncSharding(manager, 500, 0, 3);
+    return manager;
+}
+
+static void _syncManagerTestContextFree(_SyncManagerTestContext *ctx)
+{
+    for (size_t i = 0; i < ctx->requestCount && i < 8; i++) {
+        for (size_t j = 0; j < ctx->addrCounts[i]; j++) free(ctx->addrs[i][j]);
+        free(ctx->addrs[i]);
+    }
+}
+
+static int _syncManagerOrderTests(void)
+{
+    int r = 1;
+    _SyncManagerTestContext ctx = { 0 };
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(BRMainNetParams->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRSyncManager manager = _syncManagerTestNew(&ctx, wallet);
+    BRAddress addrs[SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED], addr;
+    uint8_t buf[4][256];
+    size_t len[4];
+    UInt256 hash[4];
+
+    // the last external address generated, so that using it leaves fewer than the gap limit unused
+    BRWalletUnusedAddrs(wallet, addrs, SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED, SEQUENCE_EXTERNAL_CHAIN);
+    addr = addrs[SEQUENCE_GAP_LIMIT_EXTERNAL_EXTENDED - 1];
+
+    for (uint32_t i = 0; i < 4; i++) len[i] = _syncManagerTestTx(buf[i], sizeof(buf[i]), addr.s, i + 1, &hash[i]);
+    BRSyncManagerConnect(manager);
+
+    // one request for each of the ranges [0, 500), [500, 1000) and [1000, 1001)
+    if (ctx.requestCount != 3 || ctx.addrCounts[0] == 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerConnect() test\n", __func__);
+
+    if (ctx.requestCount != 3) {
+        BRSyncManagerFree(manager);
+        BRWalletFree(wallet);
+        _syncManagerTestContextFree(&ctx);
+        return r;
+    }
+
+    // items for a range after the first are held until the ranges before it are done
+    BRSyncManagerAnnounceGetTransactionsItem(manager, ctx.rids[2], buf[2], len[2], 1, 1000);
+    BRSyncManagerAnnounceGetTransactionsItem(manager, ctx.rids[1], buf[1], len[1], 1, 600);
+
+    if (ctx.addedCount != 0)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerAnnounceGetTransactionsItem() test 1\n", __func__);
+
+    // an item for the first range is registered straight away, and one for an unknown request is dropped
+    BRSyncManagerAnnounceGetTransactionsItem(manager, ctx.rids[0], buf[0], len[0], 1, 100);
+    BRSyncManagerAnnounceGetTransactionsItem(manager, 999, buf[3], len[3], 1, 100);
+    BRSyncManagerAnnounceGetTransactionsDone(manager, 999, 1);
+
+    if (ctx.addedCount != 1 || ! UInt256Eq(ctx.added[0], hash[0]))
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerAnnounceGetTransactionsItem() test 2\n", __func__);
+
+    // the second range finishing first doesn't release its items ...
+    BRSyncManagerAnnounceGetTransactionsDone(manager, ctx.rids[1], 1);
+
+    if (ctx.addedCount != 1)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerAnnounceGetTransactionsDone() test 1\n", __func__);
+
+    // ... until the first range does, then the held items are registered in range order
+    BRSyncManagerAnnounceGetTransactionsDone(manager, ctx.rids[0], 1);
+
+    if (ctx.addedCount != 3 || ! UInt256Eq(ctx.added[1], hash[1]) || ! UInt256Eq(ctx.added[2], hash[2]) ||
+        BRWalletTransactionForHash(wallet, hash[3]) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerAnnounceGetTransactionsDone() test 2\n", __func__);
+
+    // the round used the last external address, so the next round requests only the addresses added after it
+    BRSyncManagerAnnounceGetTransactionsDone(manager, ctx.rids[2], 1);
+
+    if (ctx.requestCount != 6)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerAnnounceGetTransactionsDone() test 3\n", __func__);
+
+    for (size_t i = 3; i < ctx.requestCount && i < 6; i++) {
+        int isNew = (ctx.addrCounts[i] > 0 && ctx.addrCounts[i] < ctx.addrCounts[0]);
+
+        for (size_t j = 0; j < ctx.addrCounts[i]; j++) {
+            for (size_t k = 0; k < ctx.addrCounts[0]; k++) {
+                if (strcmp(ctx.addrs[i][j], ctx.addrs[0][k]) == 0) isNew = 0;
+            }
+        }
+
+        if (! isNew)
+            r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerAnnounceGetTransactionsDone() test 4\n", __func__);
+    }
+
+    // a round that finds no new addresses completes the scan
+    for (size_t i = 3; i < ctx.requestCount && i < 6; i++) {
+        BRSyncManagerAnnounceGetTransactionsDone(manager, ctx.rids[i], 1);
+    }
+
+    if (ctx.requestCount != 6 || ctx.eventCount < 1 || ctx.events[ctx.eventCount - 1] != SYNC_MANAGER_SYNC_STOPPED)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerAnnounceGetTransactionsDone() test 5\n", __func__);
+
+    BRSyncManagerFree(manager);
+    BRWalletFree(wallet);
+    _syncManagerTestContextFree(&ctx);
+    return r;
+}
+
+static int _syncManagerDisconnectTests(void)
+{
+    int r = 1;
+    _SyncManagerTestContext ctx = { 0 };
+    UInt512 seed = UINT512_ZERO;
+    BRWallet *wallet = BRWalletNew(BRMainNetParams->addrParams, NULL, 0, BRBIP32MasterPubKey(&seed, sizeof(seed)));
+    BRSyncManager manager = _syncManagerTestNew(&ctx, wallet);
+    BRAddress addr = BRWalletReceiveAddress(wallet);
+    uint8_t buf[2][256];
+    size_t len[2];
+    UInt256 hash[2];
+
+    for (uint32_t i = 0; i < 2; i++) len[i] = _syncManagerTestTx(buf[i], sizeof(buf[i]), addr.s, i + 1, &hash[i]);
+    BRSyncManagerConnect(manager);
+
+    if (ctx.requestCount != 3) {
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerConnect() test\n", __func__);
+        BRSyncManagerFree(manager);
+        BRWalletFree(wallet);
+        _syncManagerTestContextFree(&ctx);
+        return r;
+    }
+
+    // a disconnect drops the held items, and the items and completions of its requests that arrive after it
+    BRSyncManagerAnnounceGetTransactionsItem(manager, ctx.rids[1], buf[1], len[1], 1, 600);
+    BRSyncManagerDisconnect(manager);
+    BRSyncManagerAnnounceGetTransactionsItem(manager, ctx.rids[0], buf[0], len[0], 1, 100);
+    BRSyncManagerAnnounceGetTransactionsDone(manager, ctx.rids[0], 1);
+    BRSyncManagerAnnounceGetTransactionsDone(manager, ctx.rids[1], 1);
+
+    if (ctx.addedCount != 0 || ctx.requestCount != 3 || BRWalletTransactionForHash(wallet, hash[0]) != NULL ||
+        BRWalletTransactionForHash(wallet, hash[1]) != NULL)
+        r = 0, fprintf(stderr, "***FAILED*** %s: BRSyncManagerDisconnect() test\n", __func__);
+
+    BRSyncManagerFree(manager);
+    BRWalletFree(wallet);
+    _syncManagerTestContextFree(&ctx);
+    return r;
+}
+
+int BRSyncManagerTests()
+{
+    int r = 1;
+
+    if (! _syncManagerOrderTests()) r = 0;
+    if (! _syncManagerDisconnectTests()) r = 0;
     return r;
 }
 
@@ -3229,8 +4855,18 @@ int BRRunTests()
     printf("%s\n", (BRWalletTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRBloomFilterTests...               ");
     printf("%s\n", (BRBloomFilterTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRGCSFilterTests...                 ");
+    printf("%s\n", (BRGCSFilterTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRMerkleBlockTests...               ");
     printf("%s\n", (BRMerkleBlockTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPeerTests...                      ");
+    printf("%s\n", (BRPeerTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRPeerManagerTests...               ");
+    printf("%s\n", (BRPeerManagerTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRWalletManagerTests...             ");
+    printf("%s\n", (BRWalletManagerTests()) ? "success" : (fail++, "***FAIL***"));
+    printf("BRSyncManagerTests...               ");
+    printf("%s\n", (BRSyncManagerTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolTests...           ");
     printf("%s\n", (BRPaymentProtocolTests()) ? "success" : (fail++, "***FAIL***"));
     printf("BRPaymentProtocolEncryptionTests... ");
@@ -3365,6 +5001,232 @@ extern int BRRunTestsSync (const char *paperKey,
     return 1;
 }
 
+//
+// Peer Message Framing Throughput
+//
+typedef struct {
+    int socket;
+    const uint8_t *stream;
+    size_t streamLen, repeat;
+} BRPeerThroughputContext;
+
+static void *_peerThroughputWrite(void *arg) {
+    BRPeerThroughputContext *context = arg;
+    ssize_t n = 0;
+
+    for (size_t i = 0; n >= 0 && i < context->repeat; i++) {
+        for (size_t off = 0; n >= 0 && off < context->streamLen; off += n) {
+            n = write(context->socket, &context->stream[off], context->streamLen - off);
+        }
+    }
+
+    shutdown(context->socket, SHUT_WR);
+    return NULL;
+}
+
+static void *_peerThroughputDrain(void *arg) {
+    BRPeerThroughputContext *context = arg;
+    uint8_t buf[0x10000];
+
+    while (read(context->socket, buf, sizeof(buf)) > 0); // discard whatever the peer sends back
+    return NULL;
+}
+
+// replays a raw capture of the bytes a remote node sent over one connection through a socketpair into BRPeer's message
+// framing repeat times, or a synthesized stream of addr messages if capturePath is NULL, and reports the throughput
+extern int BRRunTestsPeerThroughput (const char *capturePath,
+                                     size_t repeat) {
+    uint32_t magic = BRMainNetParams->magicNumber;
+    BRPeerThroughputContext context = { -1, NULL, 0, (repeat > 0) ? repeat : 1 };
+    uint8_t *stream = NULL, addr[3 + 30*1000], filter[] = { 0x01, 0xff, 0x01, 0, 0, 0, 0, 0, 0, 0, 0 };
+    pthread_t writer, drain;
+    struct timeval start, end;
+    double seconds;
+    int fds[2], error;
+    FILE *file;
+
+    if (capturePath) {
+        file = fopen(capturePath, "rb");
+
+        if (file) {
+            fseek(file, 0, SEEK_END);
+            context.streamLen = (size_t)ftell(file);
+            fseek(file, 0, SEEK_SET);
+            stream = malloc(context.streamLen);
+            if (stream && fread(stream, 1, context.streamLen, file) != context.streamLen) context.streamLen = 0;
+            fclose(file);
+        }
+
+        if (! stream || context.streamLen == 0) {
+            fprintf(stderr, "***FAILED*** %s: can't read capture %s\n", __func__, capturePath);
+            if (stream) free(stream);
+            return 0;
+        }
+    }
+    else { // 2048 unsolicited addr messages of 1 to 1000 entries each, which BRPeer frames and then ignores
+        memset(addr, 0, sizeof(addr));
+        stream = malloc(2048*(24 + 3 + 30*1000));
+        assert(stream != NULL);
+
+        for (size_t i = 0, count; i < 2048; i++) {
+            count = 1 + (i*7919) % 1000;
+            addr[0] = 0xfd;
+            UInt16SetLE(&addr[1], (uint16_t)count);
+            context.streamLen += _peerTestMessage(&stream[context.streamLen], magic, "addr", addr, 3 + 30*count);
+        }
+    }
+
+    context.stream = stream;
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        fprintf(stderr, "***FAILED*** %s: socketpair() %s\n", __func__, strerror(errno));
+        free(stream);
+        return 0;
+    }
+
+    BRPeer *p = BRPeerNew(magic);
+    BRPeerSendFilterload(p, filter, sizeof(filter)); // so a captured sync's tx and merkleblock messages are accepted
+    context.socket = fds[0];
+    gettimeofday(&start, NULL);
+    pthread_create(&writer, NULL, _peerThroughputWrite, &context);
+    pthread_create(&drain, NULL, _peerThroughputDrain, &context);
+    error = BRPeerReadMessagesTest(p, fds[1]);
+    gettimeofday(&end, NULL);
+    shutdown(fds[1], SHUT_RDWR);
+    pthread_join(writer, NULL);
+    pthread_join(drain, NULL);
+    close(fds[0]);
+    close(fds[1]);
+    BRPeerFree(p);
+    free(stream);
+
+    seconds = (end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1000000;
+    printf("***\n*** PeerThroughput: %zu bytes in %.3fs, %.1f MB/s%s%s\n***\n", context.streamLen*context.repeat,
+           seconds, context.streamLen*context.repeat/seconds/1000000, (error) ? ", stopped early: " : "",
+           (error) ? strerror(error) : "");
+    return error == 0;
+}
+
+//
+// GCS Filter Match
+//
+extern int BRRunTestsGCSFilterMatch (size_t walletCount) {
+    double ms = 0;
+    int r = (_GCSFilterMatchTest(walletCount, 5000, &ms) == 1);
+
+    printf("***\n*** GCSFilterMatch: %zu script wallet, %d element filter, %.1fms per match\n***\n", walletCount,
+           5000, ms);
+    return r;
+}
+
+//
+// Sync Replay
+//
+static const BRChainParams *_syncReplayParams(uint32_t magicNumber) {
+    const BRChainParams *params[] = { BRMainNetParams, BRTestNetParams, BRBCashParams, BRBCashTestNetParams };
+
+    for (size_t i = 0; i < sizeof(params)/sizeof(*params); i++) {
+        if (params[i]->magicNumber == magicNumber) return params[i];
+    }
+
+    return NULL;
+}
+
+static void _syncReplayStopped(void *info, int error) {
+    *(volatile int *)info = 1;
+}
+
+// syncs from the network on mainnet, or testnet if isMainnet is false, while recording every message exchanged with
+// peers to capturePath for BRRunTestsSyncReplay()
+extern int BRRunTestsSyncRecord (const char *capturePath,
+                                 int isMainnet) {
+    const BRChainParams *params = (isMainnet) ? BRMainNetParams : BRTestNetParams;
+    uint32_t epoch = (uint32_t)(time(NULL) - 14*24*60*60);
+    BRPeerRecorder *recorder = BRPeerRecorderNew(capturePath, params->magicNumber, epoch);
+    volatile int stopped = 0;
+    UInt512 seed = UINT512_ZERO;
+    BRMasterPubKey mpk;
+    BRWallet *wallet;
+    BRPeerManager *manager;
+
+    if (! recorder) {
+        fprintf(stderr, "***FAILED*** %s: can't create capture %s: %s\n", __func__, capturePath, strerror(errno));
+        return 0;
+    }
+
+    mpk = BRBIP32MasterPubKey(&seed, sizeof(seed));
+    wallet = BRWalletNew(params->addrParams, NULL, 0, mpk);
+    manager = BRPeerManagerNew(params, wallet, epoch, NULL, 0, NULL, 0);
+    BRPeerManagerSetCallbacks(manager, (void *)&stopped, NULL, _syncReplayStopped, NULL, NULL, NULL, NULL, NULL);
+    BRPeerManagerSetRecorder(manager, recorder, BRPeerRecorderRecordMessage);
+    BRPeerManagerConnect(manager);
+    while (! stopped && BRPeerManagerSyncProgress(manager, 0) < 1.0) usleep(100000);
+
+    printf("***\n*** SyncRecord: %s, blocks to %"PRIu32"\n***\n", capturePath, BRPeerManagerLastBlockHeight(manager));
+    BRPeerManagerDisconnect(manager);
+    BRPeerManagerFree(manager);
+    BRWalletFree(wallet);
+    BRPeerRecorderFree(recorder);
+    return 1;
+}
+
+// replays a capture made by BRRunTestsSyncRecord() through a peer manager syncing from the busiest recorded peer, speed
+// times faster than recorded or as fast as possible if speed is zero, and reports the sync throughput
+extern int BRRunTestsSyncReplay (const char *capturePath,
+                                 double speed) {
+    BRPeerReplay *replay = BRPeerReplayNew(capturePath, speed);
+    const BRChainParams *params = (replay) ? _syncReplayParams(BRPeerReplayMagicNumber(replay)) : NULL;
+    volatile int stopped = 0;
+    UInt512 seed = UINT512_ZERO;
+    BRMasterPubKey mpk;
+    BRWallet *wallet;
+    BRPeerManager *manager;
+    BRPeerReplayStats stats;
+    BRPeerManagerStats pmStats;
+    BRPeer peer;
+    struct timeval start, end;
+    uint32_t startHeight, endHeight;
+    double seconds;
+    int done;
+
+    if (! params || BRPeerReplayPeers(replay, &peer, 1) == 0) {
+        fprintf(stderr, "***FAILED*** %s: can't replay capture %s\n", __func__, capturePath);
+        if (replay) BRPeerReplayFree(replay);
+        return 0;
+    }
+
+    mpk = BRBIP32MasterPubKey(&seed, sizeof(seed));
+    wallet = BRWalletNew(params->addrParams, NULL, 0, mpk);
+    manager = BRPeerManagerNew(params, wallet, BRPeerReplayEarliestKeyTime(replay), NULL, 0, NULL, 0);
+    BRPeerManagerSetCallbacks(manager, (void *)&stopped, NULL, _syncReplayStopped, NULL, NULL, NULL, NULL, NULL);
+    BRPeerManagerSetTransport(manager, replay, BRPeerReplayOpenSocket);
+    BRPeerManagerSetFixedPeer(manager, peer.address, peer.port);
+    startHeight = BRPeerManagerLastBlockHeight(manager);
+    gettimeofday(&start, NULL);
+    BRPeerManagerConnect(manager);
+    done = BRPeerReplayWait(replay, 60*60);
+    gettimeofday(&end, NULL);
+    endHeight = BRPeerManagerLastBlockHeight(manager);
+    pmStats = BRPeerManagerGetStats(manager);
+    for (int i = 0; i < 600 && ! stopped; i++) usleep(100000); // let reconnects to the played out peer give up first
+    BRPeerManagerDisconnect(manager);
+    stats = BRPeerReplayGetStats(replay);
+
+    seconds = (end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec)/1000000;
+    printf("***\n*** SyncReplay: %zu messages, %zu bytes, blocks %"PRIu32" to %"PRIu32" in %.3fs, %.1f blocks/s, "
+           "%.1f MB/s\n", stats.messages, stats.bytes, startHeight, endHeight, seconds,
+           (endHeight - startHeight)/seconds, stats.bytes/seconds/1000000);
+    printf("*** %zu connections, %zu stalls, %"PRIu64" orphans evicted%s\n", stats.connections, stats.stalls,
+           pmStats.orphans.evicted, (done) ? "" : ", timed out");
+    printf("*** relayed blocks %.1fus, wallet %.1fus, lock wait %.1fus on average, false positive rate %f\n***\n",
+           pmStats.relayedBlock.total*1000000/(pmStats.relayedBlock.count ? pmStats.relayedBlock.count : 1),
+           pmStats.wallet.total*1000000/(pmStats.wallet.count ? pmStats.wallet.count : 1),
+           pmStats.lockWait.total*1000000/(pmStats.lockWait.count ? pmStats.lockWait.count : 1), pmStats.fpRate);
+    BRPeerManagerFree(manager);
+    BRWalletFree(wallet);
+    BRPeerReplayFree(replay);
+    return done;
+}
+
 #ifndef BITCOIN_TEST_NO_MAIN
 void syncStarted(void *info)
 {
@@ -3381,8 +5243,31 @@ void txStatusUpdate(void *info)
     printf("transaction status updated\n");
 }
 
+extern int BRRunSupFileServiceBenchmark(const char *basePath, size_t count); // support/testSup.c
+
 int main(int argc, const char *argv[])
 {
+    if (argc > 2 && strcmp(argv[1], "record-sync") == 0) {
+        return (BRRunTestsSyncRecord(argv[2], (argc > 3) ? strcmp(argv[3], "testnet") != 0 : 1)) ? 0 : 1;
+    }
+    
+    if (argc > 2 && strcmp(argv[1], "bench-sync") == 0) {
+        return (BRRunTestsSyncReplay(argv[2], (argc > 3) ? atof(argv[3]) : 0)) ? 0 : 1;
+    }
+    
+    if (argc > 1 && strcmp(argv[1], "bench-peer") == 0) { // a capture of "-" frames synthesized addr messages
+        return (BRRunTestsPeerThroughput((argc > 2 && strcmp(argv[2], "-") != 0) ? argv[2] : NULL,
+                                         (argc > 3) ? (size_t)atol(argv[3]) : 1)) ? 0 : 1;
+    }
+    
+    if (argc > 2 && strcmp(argv[1], "bench-fileservice") == 0) {
+        return (BRRunSupFileServiceBenchmark(argv[2], (argc > 3) ? (size_t)atol(argv[3]) : 100000)) ? 0 : 1;
+    }
+    
+    if (argc > 1 && strcmp(argv[1], "bench-gcs") == 0) {
+        return (BRRunTestsGCSFilterMatch((argc > 2) ? (size_t)atol(argv[2]) : 100000)) ? 0 : 1;
+    }
+    
     int r = BRRunTests();
     
 //    int err = 0;
@@ -1300,6 +1300,8 @@ extern size_t fileServiceSpecificationsCount;
 #define fileServiceTypeTransactions "transactions"
 #define fileServiceTypeBlocks       "blocks"
 #define fileServiceTypePeers        "peers"
+#define WALLET_MANAGER_PEER_VERSION_1   0
+#define WALLET_MANAGER_PEER_VERSION_2   1
 
 static int
 BRMerkleBlockEqual (const BRMerkleBlock *block1, const BRMerkleBlock *block2);
@@ -1310,6 +1312,9 @@ BRTransactionEqual (BRTransaction *tx1, BRTransaction *tx2);
 static int
 BRPeerEqual (const BRPeer *p1, const BRPeer *p2);
 
+static ssize_t
+BRPeerRowsLoad (BRFileService fs, BRPeer *peers, size_t peersCount);
+
 static int
 BRRunTestWalletManagerFileService (const char *storagePath) {
     BRFileServiceTester fst = calloc (1, sizeof (struct BRFileServiceTesterRecord));
@@ -1407,10 +1412,11 @@ BRRunTestWalletManagerFileService (const char *storagePath) {
 
     time_t now = time(NULL);
 
-    BRPeer pFull = ((const BRPeer) { UINT128_ZERO, 1111, 0xdeadbeef, now, 3 });
+    BRPeer pFull = ((const BRPeer) { UINT128_ZERO, 1111, 0xdeadbeef, now, 3, 2, 180, 450 });
     BRPeer *p = &pFull;
     if (NULL == p) return 0;
 
+    if (1 != fileServiceClear (fs, fileServiceTypePeers)) return 0;
     if (1 != fileServiceSave (fs, fileServiceTypePeers, p)) return 0;
 
     BRSetClear (peerSet);
@@ -1425,7 +1431,41 @@ BRRunTestWalletManagerFileService (const char *storagePath) {
 
     free(p2);
     BRSetFree(peerSet);
-    
+
+    ///
+    /// Peer, connection stats and V1
+    ///
+    BRPeer rows[3];
+
+    // Updated connection stats replace the saved peer, which V2 identifies by address and port
+    BRPeer pUpdated = ((const BRPeer) { UINT128_ZERO, 1111, 0xdeadbeef, now, 3, 0, 90, 900 });
+
+    if (1 != fileServiceSave (fs, fileServiceTypePeers, &pUpdated)) return 0;
+
+    if (1 != BRPeerRowsLoad (fs, rows, 3)) return 0;
+    if (1 != BRPeerEqual (&pUpdated, &rows[0])) return 0;
+
+    // A V1 record loads without connection stats...
+    BRPeer pV1 = ((const BRPeer) { UINT128_ZERO, 2222, 0xdeadbeef, now - 60, 3, 1, 250, 300 });
+
+    if (1 != fileServiceDefineCurrentVersion (fs, fileServiceTypePeers, WALLET_MANAGER_PEER_VERSION_1)) return 0;
+    if (1 != fileServiceSave (fs, fileServiceTypePeers, &pV1)) return 0;
+    if (1 != fileServiceDefineCurrentVersion (fs, fileServiceTypePeers, WALLET_MANAGER_PEER_VERSION_2)) return 0;
+
+    pV1.failures  = 0;
+    pV1.rttMs     = 0;
+    pV1.blockRate = 0;
+
+    // ... and is saved again as V2, in place of the V1 record, so each load finds it once
+    for (size_t load = 0; load < 2; load++) {
+        if (2 != BRPeerRowsLoad (fs, rows, 3)) return 0;
+
+        BRPeer *r1111 = (1111 == rows[0].port ? &rows[0] : &rows[1]);
+        BRPeer *r2222 = (1111 == rows[0].port ? &rows[1] : &rows[0]);
+        if (1 != BRPeerEqual (&pUpdated, r1111)) return 0;
+        if (1 != BRPeerEqual (&pV1, r2222)) return 0;
+    }
+
     fileServiceClose(fs);
     fileServiceRelease(fs);
 
@@ -1497,7 +1537,39 @@ static int BRPeerEqual (const BRPeer *p1, const BRPeer *p2) {
             p1->port == p2->port &&
             p1->services == p2->services &&
             p1->timestamp == p2->timestamp &&
-            p1->flags == p2->flags);
+            p1->flags == p2->flags &&
+            p1->failures == p2->failures &&
+            p1->rttMs == p2->rttMs &&
+            p1->blockRate == p2->blockRate);
+}
+
+static size_t
+BRPeerRowHash (const void *peer) {
+    return (size_t) peer;
+}
+
+static int
+BRPeerRowEq (const void *peer1, const void *peer2) {
+    return peer1 == peer2;
+}
+
+// Load every saved peer, without merging those with the same address and port, and copy up to
+// `peersCount` of them to `peers`.  Returns the number loaded, or -1 on failure.
+static ssize_t
+BRPeerRowsLoad (BRFileService fs, BRPeer *peers, size_t peersCount) {
+    BRSetOf(BRPeer*) peerSet = BRSetNew (BRPeerRowHash, BRPeerRowEq, 10);
+    ssize_t count = -1;
+
+    if (1 == fileServiceLoad (fs, peerSet, fileServiceTypePeers, 1)) {
+        count = 0;
+        FOR_SET (BRPeer*, peer, peerSet) {
+            if ((size_t) count < peersCount) peers[count] = *peer;
+            count++;
+        }
+    }
+
+    BRSetFreeAll (peerSet, free);
+    return count;
 }
 
 extern int BRRunTestsBWM (const char *paperKey,
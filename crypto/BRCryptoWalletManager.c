@@ -9,6 +9,7 @@
 //  See the CONTRIBUTORS file at the project root for a list of contributors.
 
 #include <assert.h>
+#include <sys/time.h>
 #include <arpa/inet.h>      // struct in_addr
 
 #include "BRCryptoBase.h"
@@ -262,27 +263,24 @@ cryptoWalletManagerCreate (BRCryptoCWMListener listener,
             pthread_mutex_unlock (&cwm->lock);
 
             // Announce the new wallet manager;
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_CREATED
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_CREATED
+                                                     });
 
             // ... and announce the created wallet.
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (cwm->wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_CREATED
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (cwm->wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_CREATED
+                                                    });
 
             // ... and announce the manager's new wallet.
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
-                                                          { .wallet = { cryptoWalletTake (cwm->wallet) }}
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
+                                                         { .wallet = { cryptoWalletTake (cwm->wallet) }}
+                                                     });
             pthread_mutex_lock (&cwm->lock);
 
             // Load transfers from persistent storage
@@ -298,13 +296,12 @@ cryptoWalletManagerCreate (BRCryptoCWMListener listener,
             pthread_mutex_unlock (&cwm->lock);
 
             // ... and announce the balance
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (cwm->wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
-                                                   { .balanceUpdated = { balance }}
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (cwm->wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
+                                                        { .balanceUpdated = { balance }}
+                                                    });
 
             break;
         }
@@ -323,6 +320,9 @@ cryptoWalletManagerCreate (BRCryptoCWMListener listener,
     return cwm;
 }
 
+static void
+cryptoWalletManagerPendingEventRelease (BRCryptoWalletManagerPendingEvent *pending);
+
 static void
 cryptoWalletManagerRelease (BRCryptoWalletManager cwm) {
     // Ensure CWM is stopped...
@@ -337,6 +337,13 @@ cryptoWalletManagerRelease (BRCryptoWalletManager cwm) {
         cryptoWalletGive (cwm->wallets[index]);
     array_free (cwm->wallets);
 
+    // Events still held by event batching have no listener to go to now.
+    if (NULL != cwm->events) {
+        for (size_t index = 0; index < array_count(cwm->events); index++)
+            cryptoWalletManagerPendingEventRelease (&cwm->events[index]);
+        array_free (cwm->events);
+    }
+
     // Release the specific cwm type, if it exists.
     switch (cwm->type) {
         case BLOCK_CHAIN_TYPE_BTC:
@@ -436,8 +443,13 @@ private_extern void
 cryptoWalletManagerSetState (BRCryptoWalletManager cwm,
                              BRCryptoWalletManagerState state) {
     pthread_mutex_lock (&cwm->lock);
+    int flush = (CRYPTO_WALLET_MANAGER_STATE_SYNCING == cwm->state.type &&
+                 CRYPTO_WALLET_MANAGER_STATE_SYNCING != state.type);
     cwm->state = state;
     pthread_mutex_unlock (&cwm->lock);
+
+    // Events are only held while syncing; deliver whatever the sync left held.
+    if (flush) cryptoWalletManagerFlushEvents (cwm);
 }
 
 extern BRCryptoAddressScheme
@@ -642,6 +654,278 @@ cryptoWalletManagerInstallETHTokensForCurrencies (BRCryptoWalletManager cwm) {
     cryptoNetworkGive(network);
 }
 
+/// MARK: - Events
+
+static uint64_t
+cryptoWalletManagerEventsTime (void) {
+    struct timeval now;
+    gettimeofday (&now, NULL);
+    return 1000 * (uint64_t) now.tv_sec + (uint64_t) now.tv_usec / 1000;
+}
+
+static void
+cryptoWalletManagerPendingEventRelease (BRCryptoWalletManagerPendingEvent *pending) {
+    switch (pending->type) {
+        case CWM_PENDING_EVENT_WALLET:
+            switch (pending->u.wallet.type) {
+                case CRYPTO_WALLET_EVENT_TRANSFER_ADDED:
+                case CRYPTO_WALLET_EVENT_TRANSFER_CHANGED:
+                case CRYPTO_WALLET_EVENT_TRANSFER_SUBMITTED:
+                case CRYPTO_WALLET_EVENT_TRANSFER_DELETED:
+                    cryptoTransferGive (pending->u.wallet.u.transfer.value);
+                    break;
+                case CRYPTO_WALLET_EVENT_BALANCE_UPDATED:
+                    cryptoAmountGive (pending->u.wallet.u.balanceUpdated.amount);
+                    break;
+                default:
+                    assert (0);
+                    break;
+            }
+            break;
+
+        case CWM_PENDING_EVENT_TRANSFER:
+            if (CRYPTO_TRANSFER_EVENT_CHANGED == pending->u.transfer.type) {
+                cryptoTransferStateRelease (&pending->u.transfer.u.state.old);
+                cryptoTransferStateRelease (&pending->u.transfer.u.state.new);
+            }
+            cryptoTransferGive (pending->transfer);
+            break;
+    }
+    cryptoWalletGive (pending->wallet);
+}
+
+static int
+cryptoWalletManagerPendingEventIsBatched (BRCryptoWalletManagerPendingEvent *pending) {
+    switch (pending->type) {
+        case CWM_PENDING_EVENT_WALLET:
+            switch (pending->u.wallet.type) {
+                case CRYPTO_WALLET_EVENT_TRANSFER_ADDED:
+                case CRYPTO_WALLET_EVENT_TRANSFER_CHANGED:
+                case CRYPTO_WALLET_EVENT_TRANSFER_SUBMITTED:
+                case CRYPTO_WALLET_EVENT_TRANSFER_DELETED:
+                case CRYPTO_WALLET_EVENT_BALANCE_UPDATED:
+                    return 1;
+                default:
+                    return 0;
+            }
+
+        case CWM_PENDING_EVENT_TRANSFER:
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * Merge `pending` into an event already held in `events`, if possible.  Returns true if merged,
+ * in which case `pending` has been released; otherwise `pending` must be added.
+ */
+static int
+cryptoWalletManagerPendingEventCoalesce (BRArrayOf(BRCryptoWalletManagerPendingEvent) events,
+                                         BRCryptoWalletManagerPendingEvent *pending) {
+    switch (pending->type) {
+        case CWM_PENDING_EVENT_WALLET:
+            for (size_t index = 0; index < array_count (events); index++) {
+                BRCryptoWalletManagerPendingEvent *held = &events[index];
+                if (CWM_PENDING_EVENT_WALLET != held->type    ||
+                    pending->wallet != held->wallet           ||
+                    pending->u.wallet.type != held->u.wallet.type) continue;
+
+                switch (pending->u.wallet.type) {
+                    case CRYPTO_WALLET_EVENT_BALANCE_UPDATED:
+                        // Only the latest balance matters; it replaces the held one but goes
+                        // after the events (from the same update) that were held since.
+                        cryptoWalletManagerPendingEventRelease (held);
+                        array_rm (events, index);
+                        return 0;
+
+                    case CRYPTO_WALLET_EVENT_TRANSFER_CHANGED:
+                        if (pending->u.wallet.u.transfer.value != held->u.wallet.u.transfer.value) break;
+                        cryptoWalletManagerPendingEventRelease (pending);
+                        return 1;
+
+                    default:
+                        return 0;
+                }
+            }
+            return 0;
+
+        case CWM_PENDING_EVENT_TRANSFER:
+            if (CRYPTO_TRANSFER_EVENT_CHANGED != pending->u.transfer.type) return 0;
+
+            // Extend the transfer's most recent event, if it is a held CHANGED, to the new state.
+            for (size_t index = array_count (events); index > 0; index--) {
+                BRCryptoWalletManagerPendingEvent *held = &events[index - 1];
+                if (CWM_PENDING_EVENT_TRANSFER != held->type || pending->transfer != held->transfer) continue;
+                if (CRYPTO_TRANSFER_EVENT_CHANGED != held->u.transfer.type) return 0;
+
+                cryptoTransferStateRelease (&held->u.transfer.u.state.new);
+                held->u.transfer.u.state.new = pending->u.transfer.u.state.new;
+
+                cryptoTransferStateRelease (&pending->u.transfer.u.state.old);
+                cryptoTransferGive (pending->transfer);
+                cryptoWalletGive (pending->wallet);
+                return 1;
+            }
+            return 0;
+    }
+    return 0;
+}
+
+static void
+cryptoWalletManagerDeliverEvent (BRCryptoWalletManager cwm,
+                                 BRCryptoWalletManagerPendingEvent *pending) {
+    switch (pending->type) {
+        case CWM_PENDING_EVENT_WALLET:
+            cwm->listener.walletEventCallback (cwm->listener.context,
+                                               cryptoWalletManagerTake (cwm),
+                                               pending->wallet,
+                                               pending->u.wallet);
+            break;
+
+        case CWM_PENDING_EVENT_TRANSFER:
+            cwm->listener.transferEventCallback (cwm->listener.context,
+                                                 cryptoWalletManagerTake (cwm),
+                                                 pending->wallet,
+                                                 pending->transfer,
+                                                 pending->u.transfer);
+            break;
+    }
+}
+
+static void
+cryptoWalletManagerDeliverEvents (BRCryptoWalletManager cwm,
+                                  OwnershipGiven BRArrayOf(BRCryptoWalletManagerPendingEvent) events) {
+    for (size_t index = 0; index < array_count (events); index++)
+        cryptoWalletManagerDeliverEvent (cwm, &events[index]);
+    array_free (events);
+}
+
+/**
+ * Deliver the held events if the batch's time limit has passed or, absent a time limit, on any
+ * call; a batch that never fills is then delivered on the next idle tick.
+ */
+static void
+cryptoWalletManagerFlushEventsIfExpired (BRCryptoWalletManager cwm) {
+    BRArrayOf(BRCryptoWalletManagerPendingEvent) events = NULL;
+
+    pthread_mutex_lock (&cwm->lock);
+    if (NULL != cwm->events &&
+        (0 == cwm->millisecondsPerBatch ||
+         cryptoWalletManagerEventsTime () - cwm->eventsBatchStart >= cwm->millisecondsPerBatch)) {
+        events = cwm->events;
+        cwm->events = NULL;
+    }
+    pthread_mutex_unlock (&cwm->lock);
+
+    if (NULL != events) cryptoWalletManagerDeliverEvents (cwm, events);
+}
+
+/**
+ * Hold `pending` if batching applies to it; otherwise deliver it, after any held events.
+ */
+static void
+cryptoWalletManagerGenerateEvent (BRCryptoWalletManager cwm,
+                                  BRCryptoWalletManagerPendingEvent pending) {
+    BRArrayOf(BRCryptoWalletManagerPendingEvent) events = NULL;
+
+    pthread_mutex_lock (&cwm->lock);
+    int isBatched = ((0 != cwm->eventsPerBatch || 0 != cwm->millisecondsPerBatch) &&
+                     CRYPTO_WALLET_MANAGER_STATE_SYNCING == cwm->state.type &&
+                     cryptoWalletManagerPendingEventIsBatched (&pending));
+
+    if (isBatched) {
+        uint64_t now = cryptoWalletManagerEventsTime ();
+
+        if (NULL == cwm->events) {
+            array_new (cwm->events, 100);
+            cwm->eventsBatchStart = now;
+        }
+
+        if (!cryptoWalletManagerPendingEventCoalesce (cwm->events, &pending))
+            array_add (cwm->events, pending);
+
+        // Deliver the batch once either limit is reached.
+        if ((0 != cwm->eventsPerBatch       && array_count (cwm->events) >= cwm->eventsPerBatch) ||
+            (0 != cwm->millisecondsPerBatch && now - cwm->eventsBatchStart >= cwm->millisecondsPerBatch)) {
+            events = cwm->events;
+            cwm->events = NULL;
+        }
+    }
+    else {
+        events = cwm->events;
+        cwm->events = NULL;
+    }
+    pthread_mutex_unlock (&cwm->lock);
+
+    if (NULL != events) cryptoWalletManagerDeliverEvents (cwm, events);
+    if (!isBatched) cryptoWalletManagerDeliverEvent (cwm, &pending);
+}
+
+private_extern void
+cryptoWalletManagerGenerateManagerEvent (BRCryptoWalletManager cwm,
+                                         BRCryptoWalletManagerEvent event) {
+    // Held events precede any manager event, notably SYNC_STOPPED, but for the frequent ones
+    // that the held events are not ordered against.  Those still bound how long events are
+    // held when no further wallet or transfer events arrive to complete the batch.
+    if (CRYPTO_WALLET_MANAGER_EVENT_SYNC_CONTINUES      != event.type &&
+        CRYPTO_WALLET_MANAGER_EVENT_BLOCK_HEIGHT_UPDATED != event.type)
+        cryptoWalletManagerFlushEvents (cwm);
+    else
+        cryptoWalletManagerFlushEventsIfExpired (cwm);
+
+    cwm->listener.walletManagerEventCallback (cwm->listener.context,
+                                              cryptoWalletManagerTake (cwm),
+                                              event);
+}
+
+private_extern void
+cryptoWalletManagerGenerateWalletEvent (BRCryptoWalletManager cwm,
+                                        OwnershipGiven BRCryptoWallet wallet,
+                                        BRCryptoWalletEvent event) {
+    cryptoWalletManagerGenerateEvent (cwm, (BRCryptoWalletManagerPendingEvent) {
+        CWM_PENDING_EVENT_WALLET,
+        wallet,
+        NULL,
+        { .wallet = event }
+    });
+}
+
+private_extern void
+cryptoWalletManagerGenerateTransferEvent (BRCryptoWalletManager cwm,
+                                          OwnershipGiven BRCryptoWallet wallet,
+                                          OwnershipGiven BRCryptoTransfer transfer,
+                                          BRCryptoTransferEvent event) {
+    cryptoWalletManagerGenerateEvent (cwm, (BRCryptoWalletManagerPendingEvent) {
+        CWM_PENDING_EVENT_TRANSFER,
+        wallet,
+        transfer,
+        { .transfer = event }
+    });
+}
+
+extern void
+cryptoWalletManagerSetEventBatching (BRCryptoWalletManager cwm,
+                                     size_t eventsPerBatch,
+                                     uint64_t millisecondsPerBatch) {
+    pthread_mutex_lock (&cwm->lock);
+    cwm->eventsPerBatch       = eventsPerBatch;
+    cwm->millisecondsPerBatch = millisecondsPerBatch;
+    pthread_mutex_unlock (&cwm->lock);
+
+    if (0 == eventsPerBatch && 0 == millisecondsPerBatch)
+        cryptoWalletManagerFlushEvents (cwm);
+}
+
+extern void
+cryptoWalletManagerFlushEvents (BRCryptoWalletManager cwm) {
+    pthread_mutex_lock (&cwm->lock);
+    BRArrayOf(BRCryptoWalletManagerPendingEvent) events = cwm->events;
+    cwm->events = NULL;
+    pthread_mutex_unlock (&cwm->lock);
+
+    if (NULL != events) cryptoWalletManagerDeliverEvents (cwm, events);
+}
+
 /// MARK: - Connect/Disconnect/Sync
 
 extern void
@@ -763,11 +1047,10 @@ cryptoWalletManagerSetTransferStateGEN (BRCryptoWalletManager cwm,
                                                                        cryptoTransferGetUnitForFee(transfer));
 
         pthread_mutex_unlock (&cwm->lock);
-        cwm->listener.transferEventCallback (cwm->listener.context,
-                                             cryptoWalletManagerTake (cwm),
-                                             cryptoWalletTake (wallet),
-                                             cryptoTransferTake(transfer),
-                                             (BRCryptoTransferEvent) {
+        cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                  cryptoWalletTake (wallet),
+                                                  cryptoTransferTake(transfer),
+                                                  (BRCryptoTransferEvent) {
             CRYPTO_TRANSFER_EVENT_CHANGED,
             { .state = {
                 cryptoTransferStateCopy (&oldState),
@@ -792,13 +1075,12 @@ cryptoWalletManagerSetTransferStateGEN (BRCryptoWalletManager cwm,
         genWalletRemTransfer(cryptoWalletAsGEN(wallet), genericTransfer);
 
         BRCryptoAmount balance = cryptoWalletGetBalance(wallet);
-        cwm->listener.walletEventCallback (cwm->listener.context,
-                                           cryptoWalletManagerTake (cwm),
-                                           cryptoWalletTake (cwm->wallet),
-                                           (BRCryptoWalletEvent) {
-                                               CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
-                                               { .balanceUpdated = { balance }}
-                                           });
+        cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                cryptoWalletTake (cwm->wallet),
+                                                (BRCryptoWalletEvent) {
+                                                    CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
+                                                    { .balanceUpdated = { balance }}
+                                                });
     }
 
     pthread_mutex_unlock (&cwm->lock);
@@ -823,11 +1105,10 @@ cryptoWalletManagerCreateTransfer (BRCryptoWalletManager cwm,
             break;
         case BLOCK_CHAIN_TYPE_GEN:
             if (NULL != transfer) {
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake(transfer),
-                                                     (BRCryptoTransferEvent) {
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake(transfer),
+                                                          (BRCryptoTransferEvent) {
                     CRYPTO_TRANSFER_EVENT_CREATED
                 });
             }
@@ -1003,10 +1284,9 @@ cryptoWalletManagerSubmitSigned (BRCryptoWalletManager cwm,
             genWalletAddTransfer (cryptoWalletAsGEN(wallet), cryptoTransferAsGEN(transfer));
 
             // ... and announce the wallet's newly added transfer
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
                 CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
                 { .transfer = { cryptoTransferTake (transfer) }}
             });
@@ -1017,10 +1297,9 @@ cryptoWalletManagerSubmitSigned (BRCryptoWalletManager cwm,
                                       cryptoTransferAsGEN (transfer));
 
             // ... and then announce the submission.
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
                 CRYPTO_WALLET_EVENT_TRANSFER_SUBMITTED,
                 { .transfer = { cryptoTransferTake (transfer) }}
             });
@@ -1218,10 +1497,9 @@ cryptoWalletManagerEstimateFeeBasis (BRCryptoWalletManager cwm,
             BRCryptoUnit unitForFee = cryptoWalletGetUnitForFee (wallet);
             BRCryptoFeeBasis feeBasis = cryptoFeeBasisCreateAsGEN (unitForFee, genFeeBasis);
             
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
                 CRYPTO_WALLET_EVENT_FEE_BASIS_ESTIMATED,
                 { .feeBasisEstimated = {
                     CRYPTO_SUCCESS,
@@ -1437,11 +1715,10 @@ cryptoWalletManagerHandleTransferGEN (BRCryptoWalletManager cwm,
     // If we created the transfer...
     if (transferWasCreated) {
         // ... announce the newly created transfer.
-        cwm->listener.transferEventCallback (cwm->listener.context,
-                                             cryptoWalletManagerTake (cwm),
-                                             cryptoWalletTake (wallet),
-                                             cryptoTransferTake(transfer),
-                                             (BRCryptoTransferEvent) {
+        cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                  cryptoWalletTake (wallet),
+                                                  cryptoTransferTake(transfer),
+                                                  (BRCryptoTransferEvent) {
             CRYPTO_TRANSFER_EVENT_CREATED
         });
 
@@ -1452,10 +1729,9 @@ cryptoWalletManagerHandleTransferGEN (BRCryptoWalletManager cwm,
         genWalletAddTransfer (cryptoWalletAsGEN(wallet), cryptoTransferAsGEN(transfer));
 
         // ... and announce the wallet's newly added transfer
-        cwm->listener.walletEventCallback (cwm->listener.context,
-                                           cryptoWalletManagerTake (cwm),
-                                           cryptoWalletTake (wallet),
-                                           (BRCryptoWalletEvent) {
+        cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                cryptoWalletTake (wallet),
+                                                (BRCryptoWalletEvent) {
             CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
             { .transfer = { cryptoTransferTake (transfer) }}
         });
@@ -1463,11 +1739,10 @@ cryptoWalletManagerHandleTransferGEN (BRCryptoWalletManager cwm,
 
     // If the state is not created and changed, announce a transfer state change.
     if (CRYPTO_TRANSFER_STATE_CREATED != newState.type && oldState.type != newState.type) {
-        cwm->listener.transferEventCallback (cwm->listener.context,
-                                             cryptoWalletManagerTake (cwm),
-                                             cryptoWalletTake (wallet),
-                                             cryptoTransferTake(transfer),
-                                             (BRCryptoTransferEvent) {
+        cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                  cryptoWalletTake (wallet),
+                                                  cryptoTransferTake(transfer),
+                                                  (BRCryptoTransferEvent) {
             CRYPTO_TRANSFER_EVENT_CHANGED,
             { .state = {
                 cryptoTransferStateCopy (&oldState),
@@ -1687,7 +1962,7 @@ cryptoWalletMigratorHandlePeerAsBTC (BRCryptoWalletMigrator migrator,
                                      uint16_t port,
                                      uint64_t services,
                                      uint32_t timestamp) {
-    BRPeer peer;
+    BRPeer peer = BR_PEER_NONE;
 
     peer.address = (UInt128) { .u32 = { 0, 0, 0xffff, address }};
     peer.port = port;
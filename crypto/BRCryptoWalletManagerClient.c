@@ -198,27 +198,24 @@ cwmWalletManagerEventAsBTC (BRWalletManagerClientContext context,
             needEvent = 0;
 
             // Generate a CRYPTO wallet manager event for CREATED...
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_CREATED
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_CREATED
+                                                     });
 
             // Generate a CRYPTO wallet event for CREATED...
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (cwm->wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_CREATED
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (cwm->wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_CREATED
+                                                    });
 
             // ... and then a CRYPTO wallet manager event for WALLET_ADDED
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
-                                                          { .wallet = { cryptoWalletTake (cwm->wallet) }}
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
+                                                         { .wallet = { cryptoWalletTake (cwm->wallet) }}
+                                                     });
             break;
         }
 
@@ -244,9 +241,8 @@ cwmWalletManagerEventAsBTC (BRWalletManagerClientContext context,
             cwmEvent = (BRCryptoWalletManagerEvent) {
                 CRYPTO_WALLET_MANAGER_EVENT_SYNC_STARTED
             };
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      cwmEvent);
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     cwmEvent);
 
             BRCryptoWalletManagerState state = cryptoWalletManagerStateInit (CRYPTO_WALLET_MANAGER_STATE_SYNCING);
             cwmEvent = (BRCryptoWalletManagerEvent) {
@@ -273,9 +269,8 @@ cwmWalletManagerEventAsBTC (BRWalletManagerClientContext context,
                     event.u.syncStopped.reason,
                 }}
             };
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      cwmEvent);
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     cwmEvent);
 
             BRCryptoWalletManagerState state = cryptoWalletManagerStateInit (CRYPTO_WALLET_MANAGER_STATE_CONNECTED);
             cwmEvent = (BRCryptoWalletManagerEvent) {
@@ -307,9 +302,8 @@ cwmWalletManagerEventAsBTC (BRWalletManagerClientContext context,
     }
 
     if (needEvent)
-        cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                  cryptoWalletManagerTake (cwm),
-                                                  cwmEvent);
+        cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                 cwmEvent);
 
     cryptoWalletManagerGive (cwm);
 }
@@ -353,21 +347,19 @@ cwmWalletEventAsBTC (BRWalletManagerClientContext context,
             BRCryptoAmount amount = cryptoAmountCreateInteger (event.u.balance.satoshi, unit); // taken
 
             // Generate BALANCE_UPDATED with 'amount' (taken)
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
-                                                   { .balanceUpdated = { cryptoAmountTake (amount) }}
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
+                                                        { .balanceUpdated = { cryptoAmountTake (amount) }}
+                                                    });
 
             // ... and then a CRYPTO wallet manager event for WALLET_CHANGED
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
-                                                          { .wallet = { cryptoWalletTake (wallet) }}
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
+                                                         { .wallet = { cryptoWalletTake (wallet) }}
+                                                     });
 
             cryptoAmountGive (amount);
             cryptoWalletGive (wallet);
@@ -390,21 +382,19 @@ cwmWalletEventAsBTC (BRWalletManagerClientContext context,
                                                                    1000);
 
             // Generate FEE_BASIS_UPDATED for default fee basis change
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_FEE_BASIS_UPDATED,
-                                                   { .feeBasisUpdated = { cryptoFeeBasisTake (feeBasis) }}
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_FEE_BASIS_UPDATED,
+                                                        { .feeBasisUpdated = { cryptoFeeBasisTake (feeBasis) }}
+                                                    });
 
             // ... and then a CRYPTO wallet manager event for WALLET_CHANGED
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
-                                                          { .wallet = { cryptoWalletTake (wallet) }}
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
+                                                         { .wallet = { cryptoWalletTake (wallet) }}
+                                                     });
 
             cryptoFeeBasisGive (feeBasis);
             cryptoUnitGive (feeUnit);
@@ -428,14 +418,13 @@ cwmWalletEventAsBTC (BRWalletManagerClientContext context,
             BRCryptoTransferState newState = cryptoTransferStateInit (CRYPTO_TRANSFER_STATE_SUBMITTED);
             cryptoTransferSetState (transfer, newState);
 
-            cwm->listener.transferEventCallback (cwm->listener.context,
-                                                 cryptoWalletManagerTake (cwm),
-                                                 cryptoWalletTake (wallet),
-                                                 cryptoTransferTake (transfer),
-                                                 (BRCryptoTransferEvent) {
-                                                     CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                     { .state = { oldState, newState }}
-                                                 });
+            cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                      cryptoWalletTake (wallet),
+                                                      cryptoTransferTake (transfer),
+                                                      (BRCryptoTransferEvent) {
+                                                          CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                          { .state = { oldState, newState }}
+                                                      });
 
             cryptoTransferGive (transfer);
             cryptoWalletGive (wallet);
@@ -458,14 +447,13 @@ cwmWalletEventAsBTC (BRWalletManagerClientContext context,
             BRCryptoTransferState newState = cryptoTransferStateErroredInit (event.u.submitFailed.error);
             cryptoTransferSetState (transfer, newState);
 
-            cwm->listener.transferEventCallback (cwm->listener.context,
-                                                 cryptoWalletManagerTake (cwm),
-                                                 cryptoWalletTake (wallet),
-                                                 cryptoTransferTake (transfer),
-                                                 (BRCryptoTransferEvent) {
-                                                     CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                     { .state = { oldState, newState }}
-                                                 });
+            cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                      cryptoWalletTake (wallet),
+                                                      cryptoTransferTake (transfer),
+                                                      (BRCryptoTransferEvent) {
+                                                          CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                          { .state = { oldState, newState }}
+                                                      });
 
             cryptoTransferGive (transfer);
             cryptoWalletGive (wallet);
@@ -486,17 +474,16 @@ cwmWalletEventAsBTC (BRWalletManagerClientContext context,
                                                                    event.u.feeEstimated.sizeInByte);
 
             // Generate FEE_BASIS_ESTIMATED
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_FEE_BASIS_ESTIMATED,
-                                                   { .feeBasisEstimated = {
-                                                       CRYPTO_SUCCESS,
-                                                       event.u.feeEstimated.cookie,
-                                                       cryptoFeeBasisTake(feeBasis)
-                                                   }}
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_FEE_BASIS_ESTIMATED,
+                                                        { .feeBasisEstimated = {
+                                                            CRYPTO_SUCCESS,
+                                                            event.u.feeEstimated.cookie,
+                                                            cryptoFeeBasisTake(feeBasis)
+                                                        }}
+                                                    });
 
             cryptoFeeBasisGive (feeBasis);
             cryptoUnitGive (feeUnit);
@@ -516,20 +503,18 @@ cwmWalletEventAsBTC (BRWalletManagerClientContext context,
             cryptoWalletManagerRemWallet (cwm, wallet);
 
             // Generate a CRYPTO wallet manager event for WALLET_DELETED...
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_WALLET_DELETED,
-                                                          { .wallet = { cryptoWalletTake (wallet) }}
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_WALLET_DELETED,
+                                                         { .wallet = { cryptoWalletTake (wallet) }}
+                                                     });
 
             // ... and then a CRYPTO wallet event for DELETED.
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_DELETED
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_DELETED
+                                                    });
 
             cryptoWalletGive (wallet);
             break;
@@ -581,25 +566,23 @@ cwmTransactionEventAsBTC (BRWalletManagerClientContext context,
                                                   isBTC);
 
             // Generate a CRYPTO transfer event for CREATED'...
-            cwm->listener.transferEventCallback (cwm->listener.context,
-                                                 cryptoWalletManagerTake (cwm),
-                                                 cryptoWalletTake (wallet),
-                                                 cryptoTransferTake (transfer),
-                                                 (BRCryptoTransferEvent) {
-                                                     CRYPTO_TRANSFER_EVENT_CREATED
-                                                 });
+            cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                      cryptoWalletTake (wallet),
+                                                      cryptoTransferTake (transfer),
+                                                      (BRCryptoTransferEvent) {
+                                                          CRYPTO_TRANSFER_EVENT_CREATED
+                                                      });
 
             // ... add 'transfer' to 'wallet' (argubaly late... but to prove a point)...
             cryptoWalletAddTransfer (wallet, transfer);
 
             // ... and then generate a CRYPTO wallet event for 'TRANSFER_ADDED'
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
-                                                   { .transfer = { cryptoTransferTake (transfer) }}
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
+                                                        { .transfer = { cryptoTransferTake (transfer) }}
+                                                    });
 
             cryptoTransferGive (transfer);
             cryptoUnitGive (unitForFee);
@@ -620,14 +603,13 @@ cwmTransactionEventAsBTC (BRWalletManagerClientContext context,
             BRCryptoTransferState newState = cryptoTransferStateInit (CRYPTO_TRANSFER_STATE_SIGNED);
             cryptoTransferSetState (transfer, newState);
 
-            cwm->listener.transferEventCallback (cwm->listener.context,
-                                                 cryptoWalletManagerTake (cwm),
-                                                 cryptoWalletTake (wallet),
-                                                 cryptoTransferTake (transfer ),
-                                                 (BRCryptoTransferEvent) {
-                                                     CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                     { .state = { oldState, newState }}
-                                                 });
+            cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                      cryptoWalletTake (wallet),
+                                                      cryptoTransferTake (transfer ),
+                                                      (BRCryptoTransferEvent) {
+                                                          CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                          { .state = { oldState, newState }}
+                                                      });
 
             cryptoTransferGive (transfer);
             break;
@@ -656,25 +638,23 @@ cwmTransactionEventAsBTC (BRWalletManagerClientContext context,
                                                       isBTC);
 
                 // Generate a CRYPTO transfer event for CREATED'...
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CREATED
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CREATED
+                                                          });
 
                 // ... add 'transfer' to 'wallet' (argubaly late... but to prove a point)...
                 cryptoWalletAddTransfer (wallet, transfer);
 
                 // ... and then generate a CRYPTO wallet event for 'TRANSFER_ADDED'
-                cwm->listener.walletEventCallback (cwm->listener.context,
-                                                   cryptoWalletManagerTake (cwm),
-                                                   cryptoWalletTake (wallet),
-                                                   (BRCryptoWalletEvent) {
-                                                       CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
-                                                       { .transfer = { cryptoTransferTake (transfer) }}
-                                                   });
+                cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                        cryptoWalletTake (wallet),
+                                                        (BRCryptoWalletEvent) {
+                                                            CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
+                                                            { .transfer = { cryptoTransferTake (transfer) }}
+                                                        });
 
                 cryptoUnitGive (unitForFee);
                 cryptoUnitGive (unit);
@@ -713,14 +693,13 @@ cwmTransactionEventAsBTC (BRWalletManagerClientContext context,
 
                 cryptoTransferSetState (transfer, newState);
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                         { .state = { oldState, newState }}
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                              { .state = { oldState, newState }}
+                                                          });
 
             } else if (CRYPTO_TRANSFER_STATE_INCLUDED != oldState.type &&
                        0 != event.u.updated.timestamp && TX_UNCONFIRMED != event.u.updated.blockHeight) {
@@ -737,14 +716,13 @@ cwmTransactionEventAsBTC (BRWalletManagerClientContext context,
 
                 cryptoTransferSetState (transfer, newState);
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                         { .state = { oldState, newState }}
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                              { .state = { oldState, newState }}
+                                                          });
             } else {
                 // no change; just release the old state and carry on
                 cryptoTransferStateRelease (&oldState);
@@ -764,25 +742,23 @@ cwmTransactionEventAsBTC (BRWalletManagerClientContext context,
             assert (NULL != transfer);
 
             // Generate a CRYPTO wallet event for 'TRANSFER_DELETED'...
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_TRANSFER_DELETED,
-                                                   { .transfer = { cryptoTransferTake (transfer) }}
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_TRANSFER_DELETED,
+                                                        { .transfer = { cryptoTransferTake (transfer) }}
+                                                    });
 
             // ... Remove 'transfer' from 'wallet'
             cryptoWalletRemTransfer (wallet, transfer);
 
             // ... and then follow up with a CRYPTO transfer event for 'DELETED'
-            cwm->listener.transferEventCallback (cwm->listener.context,
-                                                 cryptoWalletManagerTake (cwm),
-                                                 cryptoWalletTake (wallet),
-                                                 cryptoTransferTake (transfer),
-                                                 (BRCryptoTransferEvent) {
-                                                     CRYPTO_TRANSFER_EVENT_DELETED
-                                                 });
+            cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                      cryptoWalletTake (wallet),
+                                                      cryptoTransferTake (transfer),
+                                                      (BRCryptoTransferEvent) {
+                                                          CRYPTO_TRANSFER_EVENT_DELETED
+                                                      });
 
             cryptoTransferGive (transfer);
             break;
@@ -831,27 +807,24 @@ cwmWalletManagerEventAsETH (BREthereumClientContext context,
             needEvent = 0;
 
             // Generate a CRYPTO wallet manager event for CREATED...
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_CREATED
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_CREATED
+                                                     });
 
             // Generate a CRYPTO wallet event for CREATED...
-            cwm->listener.walletEventCallback (cwm->listener.context,
-                                               cryptoWalletManagerTake (cwm),
-                                               cryptoWalletTake (cwm->wallet),
-                                               (BRCryptoWalletEvent) {
-                                                   CRYPTO_WALLET_EVENT_CREATED
-                                               });
+            cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                    cryptoWalletTake (cwm->wallet),
+                                                    (BRCryptoWalletEvent) {
+                                                        CRYPTO_WALLET_EVENT_CREATED
+                                                    });
 
             // ... and then a CRYPTO wallet manager event for WALLET_ADDED
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake (cwm),
-                                                      (BRCryptoWalletManagerEvent) {
-                                                          CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
-                                                          { .wallet = { cryptoWalletTake (cwm->wallet) }}
-                                                      });
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     (BRCryptoWalletManagerEvent) {
+                                                         CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
+                                                         { .wallet = { cryptoWalletTake (cwm->wallet) }}
+                                                     });
 
             break;
         }
@@ -860,22 +833,20 @@ cwmWalletManagerEventAsETH (BREthereumClientContext context,
             // If the newState is `syncing` we want a syncStarted event
             if (EWM_STATE_SYNCING == event.u.changed.newState) {
                 assert (EWM_STATE_CONNECTED == event.u.changed.oldState);
-                cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                          cryptoWalletManagerTake(cwm),
-                                                          (BRCryptoWalletManagerEvent) {
-                                                              CRYPTO_WALLET_MANAGER_EVENT_SYNC_STARTED
-                                                          });
+                cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                         (BRCryptoWalletManagerEvent) {
+                                                             CRYPTO_WALLET_MANAGER_EVENT_SYNC_STARTED
+                                                         });
             }
 
             // If the oldState is `syncing` we want a syncEnded event
             if (EWM_STATE_SYNCING == event.u.changed.oldState) {
                 assert (EWM_STATE_CONNECTED == event.u.changed.newState);
-                cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                          cryptoWalletManagerTake(cwm),
-                                                          (BRCryptoWalletManagerEvent) {
-                                                              CRYPTO_WALLET_MANAGER_EVENT_SYNC_STOPPED,
-                                                              { .syncStopped = { cryptoSyncStoppedReasonComplete() } }
-                                                          });
+                cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                         (BRCryptoWalletManagerEvent) {
+                                                             CRYPTO_WALLET_MANAGER_EVENT_SYNC_STOPPED,
+                                                             { .syncStopped = { cryptoSyncStoppedReasonComplete() } }
+                                                         });
             }
 
             cwmEvent = (BRCryptoWalletManagerEvent) {
@@ -922,9 +893,8 @@ cwmWalletManagerEventAsETH (BREthereumClientContext context,
     }
 
     if (needEvent)
-        cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                  cryptoWalletManagerTake (cwm),
-                                                  cwmEvent);
+        cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                 cwmEvent);
 
     cryptoWalletManagerGive (cwm);
 }
@@ -1007,19 +977,17 @@ cwmWalletEventAsETH (BREthereumClientContext context,
                 cryptoCurrencyGive (currency);
 
                 // This is invoked directly on an EWM thread. (as is all this function's code).
-                cwm->listener.walletEventCallback (cwm->listener.context,
-                                                   cryptoWalletManagerTake (cwm),
-                                                   cryptoWalletTake (wallet),
-                                                   (BRCryptoWalletEvent) {
-                                                       CRYPTO_WALLET_EVENT_CREATED
-                                                   });
-
-                cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                          cryptoWalletManagerTake (cwm),
-                                                          (BRCryptoWalletManagerEvent) {
-                                                              CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
-                                                              { .wallet = { wallet }}
-                                                          });
+                cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                        cryptoWalletTake (wallet),
+                                                        (BRCryptoWalletEvent) {
+                                                            CRYPTO_WALLET_EVENT_CREATED
+                                                        });
+
+                cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                         (BRCryptoWalletManagerEvent) {
+                                                             CRYPTO_WALLET_MANAGER_EVENT_WALLET_ADDED,
+                                                             { .wallet = { wallet }}
+                                                         });
             }
             break;
         }
@@ -1042,21 +1010,19 @@ cwmWalletEventAsETH (BREthereumClientContext context,
                 cryptoUnitGive(unit);
 
                 // Generate a BALANCE_UPDATED for the wallet
-                cwm->listener.walletEventCallback(cwm->listener.context,
-                                                  cryptoWalletManagerTake(cwm),
-                                                  cryptoWalletTake (wallet),
-                                                  (BRCryptoWalletEvent) {
-                                                      CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
-                                                      {.balanceUpdated = {cryptoAmount}}
-                                                  });
+                cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                        cryptoWalletTake (wallet),
+                                                        (BRCryptoWalletEvent) {
+                                                            CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
+                                                            {.balanceUpdated = {cryptoAmount}}
+                                                        });
 
                 // ... and then a CRYPTO wallet manager event for WALLET_CHANGED
-                cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                          cryptoWalletManagerTake (cwm),
-                                                          (BRCryptoWalletManagerEvent) {
-                                                              CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
-                                                              { .wallet = { wallet }}
-                                                          });
+                cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                         (BRCryptoWalletManagerEvent) {
+                                                             CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
+                                                             { .wallet = { wallet }}
+                                                         });
             }
             break;
         }
@@ -1070,21 +1036,19 @@ cwmWalletEventAsETH (BREthereumClientContext context,
                                                                        ewmWalletGetDefaultGasLimit(cwm->u.eth, wid),
                                                                        ewmWalletGetDefaultGasPrice(cwm->u.eth,wid));
                 // Generate a FEE_BASIS_UPDATED for the wallet
-                cwm->listener.walletEventCallback(cwm->listener.context,
-                                                  cryptoWalletManagerTake(cwm),
-                                                  cryptoWalletTake (wallet),
-                                                  (BRCryptoWalletEvent) {
-                                                      CRYPTO_WALLET_EVENT_FEE_BASIS_UPDATED,
-                                                      {.feeBasisUpdated = {feeBasis}}
-                                                  });
+                cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                        cryptoWalletTake (wallet),
+                                                        (BRCryptoWalletEvent) {
+                                                            CRYPTO_WALLET_EVENT_FEE_BASIS_UPDATED,
+                                                            {.feeBasisUpdated = {feeBasis}}
+                                                        });
 
                 // ... and then a CRYPTO wallet manager event for WALLET_CHANGED
-                cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                          cryptoWalletManagerTake (cwm),
-                                                          (BRCryptoWalletManagerEvent) {
-                                                              CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
-                                                              { .wallet = { wallet }}
-                                                          });
+                cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                         (BRCryptoWalletManagerEvent) {
+                                                             CRYPTO_WALLET_MANAGER_EVENT_WALLET_CHANGED,
+                                                             { .wallet = { wallet }}
+                                                         });
                 cryptoUnitGive (feeUnit);
             }
             break;
@@ -1096,30 +1060,28 @@ cwmWalletEventAsETH (BREthereumClientContext context,
 
                     BRCryptoFeeBasis feeBasis = cryptoFeeBasisCreateAsETH (feeUnit, event.u.feeEstimate.gasEstimate, event.u.feeEstimate.gasPrice);
 
-                    cwm->listener.walletEventCallback(cwm->listener.context,
-                                                      cryptoWalletManagerTake(cwm),
-                                                      wallet,
-                                                      (BRCryptoWalletEvent) {
-                                                           CRYPTO_WALLET_EVENT_FEE_BASIS_ESTIMATED,
-                                                           { .feeBasisEstimated = {
-                                                               CRYPTO_SUCCESS,
-                                                               event.u.feeEstimate.cookie,
-                                                               feeBasis
-                                                           }}
-                                                       });
+                    cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                            wallet,
+                                                            (BRCryptoWalletEvent) {
+                                                                 CRYPTO_WALLET_EVENT_FEE_BASIS_ESTIMATED,
+                                                                 { .feeBasisEstimated = {
+                                                                     CRYPTO_SUCCESS,
+                                                                     event.u.feeEstimate.cookie,
+                                                                     feeBasis
+                                                                 }}
+                                                             });
 
                     cryptoUnitGive (feeUnit);
                 } else {
-                    cwm->listener.walletEventCallback(cwm->listener.context,
-                                                      cryptoWalletManagerTake(cwm),
-                                                      wallet,
-                                                      (BRCryptoWalletEvent) {
-                                                           CRYPTO_WALLET_EVENT_FEE_BASIS_ESTIMATED,
-                                                           { .feeBasisEstimated = {
-                                                               cryptoStatusFromETH (event.status),
-                                                               event.u.feeEstimate.cookie,
-                                                           }}
-                                                       });
+                    cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                            wallet,
+                                                            (BRCryptoWalletEvent) {
+                                                                 CRYPTO_WALLET_EVENT_FEE_BASIS_ESTIMATED,
+                                                                 { .feeBasisEstimated = {
+                                                                     cryptoStatusFromETH (event.status),
+                                                                     event.u.feeEstimate.cookie,
+                                                                 }}
+                                                             });
                 }
             }
             break;
@@ -1127,20 +1089,18 @@ cwmWalletEventAsETH (BREthereumClientContext context,
         case WALLET_EVENT_DELETED:
             if (NULL != wallet) {
                 // Generate a CRYPTO wallet manager event for WALLET_DELETED...
-                cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                          cryptoWalletManagerTake (cwm),
-                                                          (BRCryptoWalletManagerEvent) {
-                                                              CRYPTO_WALLET_MANAGER_EVENT_WALLET_DELETED,
-                                                              { .wallet = { cryptoWalletTake (wallet) }}
-                                                          });
+                cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                         (BRCryptoWalletManagerEvent) {
+                                                             CRYPTO_WALLET_MANAGER_EVENT_WALLET_DELETED,
+                                                             { .wallet = { cryptoWalletTake (wallet) }}
+                                                         });
 
                 // ... and then a CRYPTO wallet event for DELETED.
-                cwm->listener.walletEventCallback (cwm->listener.context,
-                                                   cryptoWalletManagerTake (cwm),
-                                                   wallet,
-                                                   (BRCryptoWalletEvent) {
-                                                       CRYPTO_WALLET_EVENT_DELETED
-                                                   });
+                cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                        wallet,
+                                                        (BRCryptoWalletEvent) {
+                                                            CRYPTO_WALLET_EVENT_DELETED
+                                                        });
             }
             break;
     }
@@ -1224,23 +1184,21 @@ cwmTransactionEventAsETH (BREthereumClientContext context,
                                                       tid,
                                                       NULL); // taken
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CREATED
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CREATED
+                                                          });
 
                 cryptoWalletAddTransfer (wallet, transfer);
 
-                cwm->listener.walletEventCallback (cwm->listener.context,
-                                                   cryptoWalletManagerTake (cwm),
-                                                   cryptoWalletTake (wallet),
-                                                   (BRCryptoWalletEvent) {
-                                                       CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
-                                                       { .transfer = { cryptoTransferTake (transfer) }}
-                                                   });
+                cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                        cryptoWalletTake (wallet),
+                                                        (BRCryptoWalletEvent) {
+                                                            CRYPTO_WALLET_EVENT_TRANSFER_ADDED,
+                                                            { .transfer = { cryptoTransferTake (transfer) }}
+                                                        });
 
                 cryptoUnitGive (unitForFee);
                 cryptoUnitGive (unit);
@@ -1256,14 +1214,13 @@ cwmTransactionEventAsETH (BREthereumClientContext context,
 
                 cryptoTransferSetState (transfer, newState);
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                         { .state = { oldState, newState }}
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                              { .state = { oldState, newState }}
+                                                          });
             }
             break;
         }
@@ -1276,14 +1233,13 @@ cwmTransactionEventAsETH (BREthereumClientContext context,
 
                 cryptoTransferSetState (transfer, newState);
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                         { .state = { oldState, newState }}
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                              { .state = { oldState, newState }}
+                                                          });
             }
             break;
         }
@@ -1314,14 +1270,13 @@ cwmTransactionEventAsETH (BREthereumClientContext context,
 
                 cryptoTransferSetState (transfer, newState);
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                         { .state = { oldState, newState }}
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                              { .state = { oldState, newState }}
+                                                          });
             }
             break;
         }
@@ -1334,14 +1289,13 @@ cwmTransactionEventAsETH (BREthereumClientContext context,
 
                 cryptoTransferSetState (transfer, newState);
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                         { .state = { oldState, newState }}
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                              { .state = { oldState, newState }}
+                                                          });
             }
             break;
         }
@@ -1357,13 +1311,12 @@ cwmTransactionEventAsETH (BREthereumClientContext context,
                 cryptoWalletRemTransfer (wallet, transfer);
 
                 // Deleted from wallet
-                cwm->listener.walletEventCallback (cwm->listener.context,
-                                                   cryptoWalletManagerTake (cwm),
-                                                   cryptoWalletTake (wallet),
-                                                   (BRCryptoWalletEvent) {
-                                                       CRYPTO_WALLET_EVENT_TRANSFER_DELETED,
-                                                       { .transfer = { cryptoTransferTake (transfer) }}
-                                                   });
+                cryptoWalletManagerGenerateWalletEvent (cwm,
+                                                        cryptoWalletTake (wallet),
+                                                        (BRCryptoWalletEvent) {
+                                                            CRYPTO_WALLET_EVENT_TRANSFER_DELETED,
+                                                            { .transfer = { cryptoTransferTake (transfer) }}
+                                                        });
 
                 // State changed
                 BRCryptoTransferState oldState = cryptoTransferGetState (transfer);
@@ -1371,22 +1324,20 @@ cwmTransactionEventAsETH (BREthereumClientContext context,
 
                 cryptoTransferSetState (transfer, newState);
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_CHANGED,
-                                                         { .state = { oldState, newState }}
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_CHANGED,
+                                                              { .state = { oldState, newState }}
+                                                          });
 
-                cwm->listener.transferEventCallback (cwm->listener.context,
-                                                     cryptoWalletManagerTake (cwm),
-                                                     cryptoWalletTake (wallet),
-                                                     cryptoTransferTake (transfer),
-                                                     (BRCryptoTransferEvent) {
-                                                         CRYPTO_TRANSFER_EVENT_DELETED
-                                                     });
+                cryptoWalletManagerGenerateTransferEvent (cwm,
+                                                          cryptoWalletTake (wallet),
+                                                          cryptoTransferTake (transfer),
+                                                          (BRCryptoTransferEvent) {
+                                                              CRYPTO_TRANSFER_EVENT_DELETED
+                                                          });
             }
             break;
         }
@@ -1874,9 +1825,8 @@ cwmAnnounceGetBlockNumberSuccessAsInteger (OwnershipKept BRCryptoWalletManager c
             BRCryptoNetwork network = cryptoWalletManagerGetNetwork(cwm);
             cryptoNetworkSetHeight (network, blockNumber);
 
-            cwm->listener.walletManagerEventCallback (cwm->listener.context,
-                                                      cryptoWalletManagerTake(cwm),
-                                                      ((BRCryptoWalletManagerEvent) {
+            cryptoWalletManagerGenerateManagerEvent (cwm,
+                                                     ((BRCryptoWalletManagerEvent) {
                 CRYPTO_WALLET_MANAGER_EVENT_BLOCK_HEIGHT_UPDATED,
                 { .blockHeight = { blockNumber } }
             }));
@@ -2231,13 +2181,12 @@ cwmAnnounceGetTransfersComplete (OwnershipKept BRCryptoWalletManager cwm,
     // Synchronizing of transfers is complete - calculate the new balance
     BRCryptoAmount balance = cryptoWalletGetBalance(cwm->wallet);
     // ... and announce the balance
-    cwm->listener.walletEventCallback (cwm->listener.context,
-                                       cryptoWalletManagerTake (cwm),
-                                       cryptoWalletTake (cwm->wallet),
-                                       (BRCryptoWalletEvent) {
-                                           CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
-                                           { .balanceUpdated = { cryptoAmountTake(balance) }}
-                                       });
+    cryptoWalletManagerGenerateWalletEvent (cwm,
+                                            cryptoWalletTake (cwm->wallet),
+                                            (BRCryptoWalletEvent) {
+                                                CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
+                                                { .balanceUpdated = { cryptoAmountTake(balance) }}
+                                            });
 
     cryptoAmountGive(balance);
     cryptoWalletManagerGive (cwm);
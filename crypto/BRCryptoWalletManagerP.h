@@ -27,6 +27,21 @@
 extern "C" {
 #endif
 
+/// A wallet or transfer event held back, while syncing, for delivery in a batch.  The event owns
+/// its wallet and transfer references (but not the manager's).
+typedef struct {
+    enum {
+        CWM_PENDING_EVENT_WALLET,
+        CWM_PENDING_EVENT_TRANSFER
+    } type;
+    BRCryptoWallet wallet;
+    BRCryptoTransfer transfer;          // NULL for CWM_PENDING_EVENT_WALLET
+    union {
+        BRCryptoWalletEvent wallet;
+        BRCryptoTransferEvent transfer;
+    } u;
+} BRCryptoWalletManagerPendingEvent;
+
 struct BRCryptoWalletManagerRecord {
     pthread_mutex_t lock;
 
@@ -52,6 +67,13 @@ struct BRCryptoWalletManagerRecord {
     BRArrayOf(BRCryptoWallet) wallets;
     char *path;
 
+    /// Event batching; disabled when both limits are zero.  While syncing, wallet and transfer
+    /// events are coalesced into `events` and delivered once either limit is reached.
+    size_t eventsPerBatch;
+    uint64_t millisecondsPerBatch;
+    uint64_t eventsBatchStart;
+    BRArrayOf(BRCryptoWalletManagerPendingEvent) events;
+
     BRCryptoRef ref;
 };
 
@@ -81,6 +103,23 @@ cryptoWalletManagerSetState (BRCryptoWalletManager cwm,
 private_extern void
 cryptoWalletManagerStop (BRCryptoWalletManager cwm);
 
+/// MARK: - Events
+
+private_extern void
+cryptoWalletManagerGenerateManagerEvent (BRCryptoWalletManager cwm,
+                                         BRCryptoWalletManagerEvent event);
+
+private_extern void
+cryptoWalletManagerGenerateWalletEvent (BRCryptoWalletManager cwm,
+                                        OwnershipGiven BRCryptoWallet wallet,
+                                        BRCryptoWalletEvent event);
+
+private_extern void
+cryptoWalletManagerGenerateTransferEvent (BRCryptoWalletManager cwm,
+                                          OwnershipGiven BRCryptoWallet wallet,
+                                          OwnershipGiven BRCryptoTransfer transfer,
+                                          BRCryptoTransferEvent event);
+
 private_extern BRWalletManager
 cryptoWalletManagerAsBTC (BRCryptoWalletManager manager);
 
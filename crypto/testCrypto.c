@@ -14,11 +14,12 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "BRCryptoAmount.h"
 #include "BRCryptoNetworkP.h"
-#include "BRCryptoWallet.h"
+#include "BRCryptoWalletP.h"
 #include "BRCryptoTransferP.h"
 #include "BRCryptoWalletManagerP.h"
 
@@ -301,6 +302,284 @@ runCryptoTransferTests (void) {
     transferTestsAddress();
 }
 
+///
+/// Mark: BRCryptoWalletManager Event Batching Tests
+///
+
+typedef enum {
+    BATCHING_EVENT_MANAGER,
+    BATCHING_EVENT_WALLET,
+    BATCHING_EVENT_TRANSFER
+} BatchingEventKind;
+
+typedef struct {
+    size_t count;
+    struct {
+        BatchingEventKind kind;
+        int type;
+        BRCryptoTransfer transfer;
+        uint64_t balance;
+        BRCryptoTransferStateType oldType;
+        BRCryptoTransferStateType newType;
+    } events[16];
+} BatchingRecorder;
+
+static void
+batchingTestsManagerEvent (BRCryptoCWMListenerContext context,
+                           BRCryptoWalletManager manager,
+                           BRCryptoWalletManagerEvent event) {
+    BatchingRecorder *recorder = context;
+    assert (recorder->count < 16);
+    recorder->events[recorder->count].kind = BATCHING_EVENT_MANAGER;
+    recorder->events[recorder->count].type = event.type;
+    recorder->count++;
+    cryptoWalletManagerGive (manager);
+}
+
+static void
+batchingTestsWalletEvent (BRCryptoCWMListenerContext context,
+                          BRCryptoWalletManager manager,
+                          BRCryptoWallet wallet,
+                          BRCryptoWalletEvent event) {
+    BatchingRecorder *recorder = context;
+    assert (recorder->count < 16);
+    recorder->events[recorder->count].kind     = BATCHING_EVENT_WALLET;
+    recorder->events[recorder->count].type     = event.type;
+    recorder->events[recorder->count].transfer = NULL;
+    recorder->events[recorder->count].balance  = 0;
+
+    switch (event.type) {
+        case CRYPTO_WALLET_EVENT_TRANSFER_ADDED:
+        case CRYPTO_WALLET_EVENT_TRANSFER_CHANGED:
+        case CRYPTO_WALLET_EVENT_TRANSFER_SUBMITTED:
+        case CRYPTO_WALLET_EVENT_TRANSFER_DELETED:
+            recorder->events[recorder->count].transfer = event.u.transfer.value;
+            cryptoTransferGive (event.u.transfer.value);
+            break;
+        case CRYPTO_WALLET_EVENT_BALANCE_UPDATED: {
+            BRCryptoBoolean overflow;
+            recorder->events[recorder->count].balance = cryptoAmountGetIntegerRaw (event.u.balanceUpdated.amount, &overflow);
+            cryptoAmountGive (event.u.balanceUpdated.amount);
+            break;
+        }
+        default:
+            break;
+    }
+    recorder->count++;
+    cryptoWalletGive (wallet);
+    cryptoWalletManagerGive (manager);
+}
+
+static void
+batchingTestsTransferEvent (BRCryptoCWMListenerContext context,
+                            BRCryptoWalletManager manager,
+                            BRCryptoWallet wallet,
+                            BRCryptoTransfer transfer,
+                            BRCryptoTransferEvent event) {
+    BatchingRecorder *recorder = context;
+    assert (recorder->count < 16);
+    recorder->events[recorder->count].kind     = BATCHING_EVENT_TRANSFER;
+    recorder->events[recorder->count].type     = event.type;
+    recorder->events[recorder->count].transfer = transfer;
+
+    if (CRYPTO_TRANSFER_EVENT_CHANGED == event.type) {
+        recorder->events[recorder->count].oldType = event.u.state.old.type;
+        recorder->events[recorder->count].newType = event.u.state.new.type;
+        cryptoTransferStateRelease (&event.u.state.old);
+        cryptoTransferStateRelease (&event.u.state.new);
+    }
+    recorder->count++;
+    cryptoTransferGive (transfer);
+    cryptoWalletGive (wallet);
+    cryptoWalletManagerGive (manager);
+}
+
+static void
+batchingTestsRelease (BRCryptoWalletManager cwm) {
+    // The manager is on the stack; it never reaches a zero count.
+    assert (0);
+}
+
+static void
+batchingTestsGenerateBalance (BRCryptoWalletManager cwm,
+                              BRCryptoWallet wallet,
+                              BRCryptoUnit unit,
+                              int64_t value) {
+    cryptoWalletManagerGenerateWalletEvent (cwm, cryptoWalletTake (wallet), (BRCryptoWalletEvent) {
+        CRYPTO_WALLET_EVENT_BALANCE_UPDATED,
+        { .balanceUpdated = { cryptoAmountCreateInteger (value, unit) }}
+    });
+}
+
+static void
+batchingTestsGenerateWalletTransferChanged (BRCryptoWalletManager cwm,
+                                            BRCryptoWallet wallet,
+                                            BRCryptoTransfer transfer) {
+    cryptoWalletManagerGenerateWalletEvent (cwm, cryptoWalletTake (wallet), (BRCryptoWalletEvent) {
+        CRYPTO_WALLET_EVENT_TRANSFER_CHANGED,
+        { .transfer = { cryptoTransferTake (transfer) }}
+    });
+}
+
+static void
+batchingTestsGenerateTransferChanged (BRCryptoWalletManager cwm,
+                                      BRCryptoWallet wallet,
+                                      BRCryptoTransfer transfer,
+                                      BRCryptoTransferStateType oldType,
+                                      BRCryptoTransferStateType newType) {
+    cryptoWalletManagerGenerateTransferEvent (cwm, cryptoWalletTake (wallet), cryptoTransferTake (transfer), (BRCryptoTransferEvent) {
+        CRYPTO_TRANSFER_EVENT_CHANGED,
+        { .state = { cryptoTransferStateInit (oldType), cryptoTransferStateInit (newType) }}
+    });
+}
+
+static void
+batchingTestsGenerateBlockHeight (BRCryptoWalletManager cwm) {
+    cryptoWalletManagerGenerateManagerEvent (cwm, (BRCryptoWalletManagerEvent) {
+        CRYPTO_WALLET_MANAGER_EVENT_BLOCK_HEIGHT_UPDATED,
+        { .blockHeight = { 1 }}
+    });
+}
+
+static void
+runCryptoWalletManagerEventBatchingTests (void) {
+    BRCryptoCurrency btc = cryptoCurrencyCreate ("BitcoinUIDS", "Bitcoin", "BTC", "native", NULL);
+    BRCryptoUnit     sat = cryptoUnitCreateAsBase (btc, "SatoshiUIDS", "Satoshi", "SAT");
+
+    BRMasterPubKey mpk = transferTestsGetMPK();
+    BRWallet *wid = BRWalletNew (BRTestNetParams->addrParams, NULL, 0, mpk);
+    BRWalletSetCallbacks (wid, NULL, NULL, NULL, NULL, NULL);
+
+    BRCryptoWallet wallet = cryptoWalletCreateAsBTC (sat, sat, NULL, wid);
+
+    // Two distinct transfers; coalescing only compares the transfer references
+    BRTransaction *tids[2];
+    BRCryptoTransfer transfers[2];
+    for (size_t index = 0; index < 2; index++) {
+        size_t   testRawSize;
+        uint8_t *testRawBytes = hexDecodeCreate (&testRawSize, transferTests[0].rawChars, strlen (transferTests[0].rawChars));
+        tids[index]      = BRTransactionParse (testRawBytes, testRawSize);
+        transfers[index] = cryptoTransferCreateAsBTC (sat, sat, wid, tids[index], CRYPTO_TRUE);
+        free (testRawBytes);
+    }
+
+    BatchingRecorder recorder = { 0 };
+
+    struct BRCryptoWalletManagerRecord manager;
+    memset (&manager, 0, sizeof (manager));
+    manager.listener = (BRCryptoCWMListener) {
+        &recorder,
+        batchingTestsManagerEvent,
+        batchingTestsWalletEvent,
+        batchingTestsTransferEvent
+    };
+    manager.state = cryptoWalletManagerStateInit (CRYPTO_WALLET_MANAGER_STATE_SYNCING);
+    manager.ref   = CRYPTO_REF_ASSIGN (batchingTestsRelease);
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+        pthread_mutex_init(&manager.lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    BRCryptoWalletManager cwm = &manager;
+
+    cryptoWalletManagerSetEventBatching (cwm, 100, 0);
+
+    // Only the last BALANCE_UPDATED is kept
+    batchingTestsGenerateBalance (cwm, wallet, sat, 1);
+    batchingTestsGenerateBalance (cwm, wallet, sat, 2);
+    batchingTestsGenerateBalance (cwm, wallet, sat, 3);
+    assert (0 == recorder.count);
+    cryptoWalletManagerFlushEvents (cwm);
+    assert (1 == recorder.count);
+    assert (CRYPTO_WALLET_EVENT_BALANCE_UPDATED == recorder.events[0].type);
+    assert (3 == recorder.events[0].balance);
+    recorder.count = 0;
+
+    // A transfer's CHANGED events merge into one, from the first old state to the last new state
+    batchingTestsGenerateTransferChanged (cwm, wallet, transfers[0], CRYPTO_TRANSFER_STATE_CREATED,   CRYPTO_TRANSFER_STATE_SIGNED);
+    batchingTestsGenerateTransferChanged (cwm, wallet, transfers[0], CRYPTO_TRANSFER_STATE_SIGNED,    CRYPTO_TRANSFER_STATE_SUBMITTED);
+    batchingTestsGenerateTransferChanged (cwm, wallet, transfers[1], CRYPTO_TRANSFER_STATE_CREATED,   CRYPTO_TRANSFER_STATE_SIGNED);
+    cryptoWalletManagerFlushEvents (cwm);
+    assert (2 == recorder.count);
+    assert (BATCHING_EVENT_TRANSFER == recorder.events[0].kind);
+    assert (transfers[0] == recorder.events[0].transfer);
+    assert (CRYPTO_TRANSFER_STATE_CREATED   == recorder.events[0].oldType);
+    assert (CRYPTO_TRANSFER_STATE_SUBMITTED == recorder.events[0].newType);
+    assert (transfers[1] == recorder.events[1].transfer);
+    assert (CRYPTO_TRANSFER_STATE_SIGNED    == recorder.events[1].newType);
+    recorder.count = 0;
+
+    // A duplicate wallet TRANSFER_CHANGED, for the same transfer, is dropped
+    batchingTestsGenerateWalletTransferChanged (cwm, wallet, transfers[0]);
+    batchingTestsGenerateWalletTransferChanged (cwm, wallet, transfers[1]);
+    batchingTestsGenerateWalletTransferChanged (cwm, wallet, transfers[0]);
+    cryptoWalletManagerFlushEvents (cwm);
+    assert (2 == recorder.count);
+    assert (transfers[0] == recorder.events[0].transfer);
+    assert (transfers[1] == recorder.events[1].transfer);
+    recorder.count = 0;
+
+    // A non-batched event delivers the held events first
+    batchingTestsGenerateBalance (cwm, wallet, sat, 4);
+    cryptoWalletManagerGenerateWalletEvent (cwm, cryptoWalletTake (wallet), (BRCryptoWalletEvent) {
+        CRYPTO_WALLET_EVENT_CREATED
+    });
+    assert (2 == recorder.count);
+    assert (CRYPTO_WALLET_EVENT_BALANCE_UPDATED == recorder.events[0].type);
+    assert (CRYPTO_WALLET_EVENT_CREATED         == recorder.events[1].type);
+    recorder.count = 0;
+
+    // ... as does a manager event, which it then follows
+    batchingTestsGenerateBalance (cwm, wallet, sat, 5);
+    cryptoWalletManagerGenerateManagerEvent (cwm, (BRCryptoWalletManagerEvent) {
+        CRYPTO_WALLET_MANAGER_EVENT_SYNC_STOPPED,
+        { .syncStopped = { cryptoSyncStoppedReasonComplete() }}
+    });
+    assert (2 == recorder.count);
+    assert (BATCHING_EVENT_WALLET  == recorder.events[0].kind);
+    assert (BATCHING_EVENT_MANAGER == recorder.events[1].kind);
+    recorder.count = 0;
+
+    // Absent a time limit, an idle tick delivers a batch that never fills
+    batchingTestsGenerateBalance (cwm, wallet, sat, 6);
+    batchingTestsGenerateBlockHeight (cwm);
+    assert (2 == recorder.count);
+    assert (BATCHING_EVENT_WALLET  == recorder.events[0].kind);
+    assert (BATCHING_EVENT_MANAGER == recorder.events[1].kind);
+    recorder.count = 0;
+
+    // With a time limit, an idle tick within it does not; ending the sync does
+    cryptoWalletManagerSetEventBatching (cwm, 100, 60 * 1000);
+    batchingTestsGenerateBalance (cwm, wallet, sat, 7);
+    batchingTestsGenerateBlockHeight (cwm);
+    assert (1 == recorder.count);
+    assert (BATCHING_EVENT_MANAGER == recorder.events[0].kind);
+    cryptoWalletManagerSetState (cwm, cryptoWalletManagerStateInit (CRYPTO_WALLET_MANAGER_STATE_CONNECTED));
+    assert (2 == recorder.count);
+    assert (7 == recorder.events[1].balance);
+    recorder.count = 0;
+
+    // Not syncing, events are delivered as generated
+    batchingTestsGenerateBalance (cwm, wallet, sat, 8);
+    assert (1 == recorder.count);
+    recorder.count = 0;
+
+    assert (NULL == manager.events);
+    pthread_mutex_destroy (&manager.lock);
+
+    for (size_t index = 0; index < 2; index++) {
+        cryptoTransferGive (transfers[index]);
+        BRTransactionFree (tids[index]);
+    }
+    cryptoWalletGive (wallet);
+    BRWalletFree (wid);
+    cryptoUnitGive (sat);
+    cryptoCurrencyGive (btc);
+}
+
 ///
 /// Mark: BRCryptoWalletManager Tests
 ///
@@ -1677,5 +1956,6 @@ extern void
 runCryptoTests (void) {
     runCryptoAmountTests ();
     runCryptoTransferTests();
+    runCryptoWalletManagerEventBatchingTests();
     return;
 }
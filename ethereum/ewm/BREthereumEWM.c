@@ -311,6 +311,11 @@ ewmCreate (BREthereumNetwork network,
     // Save the recovered tokens
     ewm->tokens = tokens;
 
+    // From here on, batch the saves of transactions and logs.
+    fileServiceSetWriteBehind (ewm->fs,
+                               FILE_SERVICE_WRITE_BEHIND_PENDING_LIMIT,
+                               FILE_SERVICE_WRITE_BEHIND_PENDING_DELAY);
+
     // Create the alarm clock, but don't start it.
     alarmClockCreateIfNecessary(0);
 
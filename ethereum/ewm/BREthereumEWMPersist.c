@@ -335,7 +335,9 @@ static BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeTransactionV1Reader,
                 fileServiceTypeTransactionV1Writer
             }
-        }
+        },
+        0,
+        { }
     },
 
     {
@@ -349,7 +351,9 @@ static BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeLogV1Reader,
                 fileServiceTypeLogV1Writer
             }
-        }
+        },
+        0,
+        { }
     },
 
     {
@@ -363,7 +367,9 @@ static BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeBlockV1Reader,
                 fileServiceTypeBlockV1Writer
             }
-        }
+        },
+        0,
+        { }
     },
 
     {
@@ -377,7 +383,9 @@ static BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeNodeV1Reader,
                 fileServiceTypeNodeV1Writer
             }
-        }
+        },
+        0,
+        { }
     },
 
     {
@@ -391,7 +399,9 @@ static BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeTokenV1Reader,
                 fileServiceTypeTokenV1Writer
             }
-        }
+        },
+        0,
+        { }
     },
 
     {
@@ -405,7 +415,9 @@ static BRFileServiceTypeSpecification fileServiceSpecifications[] = {
                 fileServiceTypeWalletV1Reader,
                 fileServiceTypeWalletV1Writer
             }
-        }
+        },
+        0,
+        { }
     }
 };
 
@@ -246,7 +246,8 @@ genManagerInitializeFileService (BRGenericManager gwm) {
                                     gwm,
                                     fileServiceTypeTransferV1Identifier,
                                     fileServiceTypeTransferV1Reader,
-                                    fileServiceTypeTransferV1Writer) ||
+                                    fileServiceTypeTransferV1Writer,
+                                    0, NULL) ||
 
         1 != fileServiceDefineCurrentVersion (gwm->fileService, fileServiceTypeTransactions,
                                               GENERIC_TRANSFER_VERSION_1))
@@ -205,6 +205,33 @@ extern "C" {
     cryptoWalletManagerSetNetworkReachable (BRCryptoWalletManager cwm,
                                             BRCryptoBoolean isNetworkReachable);
 
+    /**
+     * Batch the wallet and transfer events generated while syncing.  Rather than one listener
+     * callback per change, the events are held and then delivered together once
+     * `eventsPerBatch` events are held or, as further events are generated, once
+     * `millisecondsPerBatch` has elapsed since the first was held (a zero limit is not applied).  While held, a wallet's BALANCE_UPDATED events coalesce
+     * into the latest one and a transfer's CHANGED events coalesce into one spanning the oldest
+     * to the newest state.  Held events are always delivered before any wallet manager event,
+     * other than SYNC_CONTINUES and BLOCK_HEIGHT_UPDATED, and thus before SYNC_STOPPED.
+     *
+     * Batching is disabled by default; zero for both limits disables it again (delivering any
+     * held events).
+     *
+     * @param cwm the wallet manager
+     * @param eventsPerBatch the maximum number of events held
+     * @param millisecondsPerBatch the maximum time an event is held
+     */
+    extern void
+    cryptoWalletManagerSetEventBatching (BRCryptoWalletManager cwm,
+                                         size_t eventsPerBatch,
+                                         uint64_t millisecondsPerBatch);
+
+    /**
+     * Deliver any events held by event batching.
+     */
+    extern void
+    cryptoWalletManagerFlushEvents (BRCryptoWalletManager cwm);
+
     extern BRCryptoBoolean
     cryptoWalletManagerHasWallet (BRCryptoWalletManager cwm,
                                   BRCryptoWallet wallet);
@@ -31,6 +31,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <pthread.h>
+#include <sys/time.h>
 #include "../vendor/sqlite3/sqlite3.h"
 typedef int sqlite3_status_code;
 
@@ -39,35 +40,116 @@ typedef int sqlite3_status_code;
 
 #define FILE_SERVICE_SDB_FILENAME      "entities.db"
 
-#define FILE_SERVICE_SDB_ENTITY_TABLE     \
+// Version 1 stored `Hash` and `Data` hex-encoded, as TEXT; version 2 stores their bytes as BLOBs.
+// Both kept all types in the one `Entity` table; version 3 has a table per type, with columns for
+// the type's keys (by which cursors are ordered).
+#define FILE_SERVICE_SDB_SCHEMA_VERSION   (3)
+
+#define FILE_SERVICE_SDB_QUERY_SCHEMA_VERSION     \
+"PRAGMA user_version;"
+
+#define FILE_SERVICE_SDB_UPDATE_SCHEMA_VERSION     \
+"PRAGMA user_version = 3;"
+
+// The table for all types, from before version 3.  A type's rows move to its own table once the
+// type is defined; the table is dropped once empty.
+#define FILE_SERVICE_SDB_LEGACY_ENTITY_TABLE     \
 "CREATE TABLE IF NOT EXISTS Entity(     \n\
   Type      CHAR(64)    NOT NULL,       \n\
-  Hash      CHAR(64)    NOT NULL,       \n\
-  Data      TEXT        NOT NULL,       \n\
+  Hash      BLOB        NOT NULL,       \n\
+  Data      BLOB        NOT NULL,       \n\
   PRIMARY KEY (Type, Hash));"
 
-typedef char FileServiceSQL[1024];
+#define FILE_SERVICE_SDB_QUERY_LEGACY_ENTITY_TABLE_EXISTS     \
+"SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'Entity';"
 
-#define FILE_SERVICE_SDB_INSERT_ENTITY    \
+#define FILE_SERVICE_SDB_QUERY_ALL_V1_ENTITY     \
+"SELECT Type, Hash, Data FROM EntityV1;"
+
+#define FILE_SERVICE_SDB_INSERT_LEGACY_ENTITY    \
 "INSERT OR REPLACE INTO Entity (Type, Hash, Data) VALUES (?, ?, ?);"
 
-#define FILE_SERVICE_SDB_QUERY_ENTITY     \
-"SELECT Data FROM Entity WHERE Type = ? AND Hash = ?;"
+#define FILE_SERVICE_SDB_MOVE_LEGACY_ENTITY     \
+"INSERT OR REPLACE INTO \"%s\" (Hash, Data) SELECT Hash, Data FROM Entity WHERE Type = '%s';\n\
+DELETE FROM Entity WHERE Type = '%s';"
+
+#define FILE_SERVICE_SDB_QUERY_LEGACY_ENTITY_EMPTY     \
+"SELECT COUNT(*) FROM (SELECT 1 FROM Entity LIMIT 1);"
+
+typedef char FileServiceSQL[1024];
+
+// The per-type SQL, on the type's table: `Entity_<type>` or, in a shared store, `Entity_<namespace
+// id>_<type>`.  The type's key columns are appended to `Hash` and `Data` in the column lists; keys
+// are unique within a type and are neither `Hash` nor `Data`.
+
+#define FILE_SERVICE_SDB_TYPE_TABLE     \
+"CREATE TABLE IF NOT EXISTS \"%s\"(  \n\
+  Hash      BLOB        PRIMARY KEY NOT NULL, \n\
+  Data      BLOB        NOT NULL);"
+
+#define FILE_SERVICE_SDB_QUERY_TYPE_COLUMNS     \
+"PRAGMA table_info(\"%s\");"
+
+#define FILE_SERVICE_SDB_TYPE_ADD_INTEGER_KEY     \
+"ALTER TABLE \"%s\" ADD COLUMN \"%s\" INTEGER NOT NULL DEFAULT 0;"
+
+#define FILE_SERVICE_SDB_TYPE_ADD_TEXT_KEY     \
+"ALTER TABLE \"%s\" ADD COLUMN \"%s\" TEXT NOT NULL DEFAULT '';"
+
+#define FILE_SERVICE_SDB_TYPE_KEY_INDEX     \
+"CREATE INDEX IF NOT EXISTS \"%s_%s\" ON \"%s\" (\"%s\", Hash);"
+
+#define FILE_SERVICE_SDB_INSERT_ENTITY    \
+"INSERT OR REPLACE INTO \"%s\" (Hash, Data%s) VALUES (?, ?%s);"
 
 #define FILE_SERVICE_SDB_QUERY_ALL_ENTITY     \
-"SELECT Hash, Data FROM Entity WHERE Type = ?;"
+"SELECT Hash, Data%s FROM \"%s\";"
 
-#define FILE_SERVICE_SDB_UPDATE_ENTITY     \
-"UPDATE Entity SET Data = ? WHERE Type = ? AND Hash = ?;"
+// A page of entities for a cursor: those in the key's range (?1, ?2) following the last entity of
+// the previous page (?3, ?4), if any, up to a limit (?5).  The conditions and the order are filled
+// in per the cursor's key and `BRFileServiceOrder`.
+#define FILE_SERVICE_SDB_QUERY_PAGE_ENTITY     \
+"SELECT Hash, Data%s FROM \"%s\" WHERE %s%s ORDER BY %s LIMIT ?5;"
 
 #define FILE_SERVICE_SDB_DELETE_ENTITY     \
-"DELETE FROM Entity WHERE Type = ? AND Hash = ?;"
+"DELETE FROM \"%s\" WHERE Hash = ?;"
 
 #define FILE_SERVICE_SDB_DELETE_ALL_TYPE_ENTITY     \
-"DELETE FROM Entity WHERE Type = ?;"
-
-#define FILE_SERVICE_SDB_DELETE_ALL_ENTITY     \
-"DELETE FROM Entity;"
+"DELETE FROM \"%s\";"
+
+// Limits on the length of type and key names, which must also be SQL identifiers, so that the
+// per-type SQL fits in FileServiceSQL.
+#define FILE_SERVICE_TYPE_NAME_LIMIT      (64)
+#define FILE_SERVICE_KEY_NAME_LIMIT       (32)
+#define FILE_SERVICE_TABLE_NAME_LIMIT     (FILE_SERVICE_TYPE_NAME_LIMIT + 32)
+
+// A shared store keeps its services apart by namespace: {path, currency, network}, as given to
+// `fileServiceCreate()`.  A namespace's id names its tables.
+#define FILE_SERVICE_SDB_NAMESPACE_TABLE     \
+"CREATE TABLE IF NOT EXISTS Namespace(  \n\
+  Id        INTEGER     PRIMARY KEY,    \n\
+  Path      TEXT        NOT NULL,       \n\
+  Currency  TEXT        NOT NULL,       \n\
+  Network   TEXT        NOT NULL,       \n\
+  UNIQUE (Path, Currency, Network));"
+
+#define FILE_SERVICE_SDB_INSERT_NAMESPACE     \
+"INSERT OR IGNORE INTO Namespace (Path, Currency, Network) VALUES (?1, ?2, ?3);"
+
+#define FILE_SERVICE_SDB_QUERY_NAMESPACE     \
+"SELECT Id FROM Namespace WHERE Path = ?1 AND Currency = ?2 AND Network = ?3;"
+
+#define FILE_SERVICE_SDB_DELETE_NAMESPACE     \
+"DELETE FROM Namespace WHERE Id = ?;"
+
+#define FILE_SERVICE_SDB_QUERY_NAMESPACE_TABLES     \
+"SELECT name FROM sqlite_master WHERE type = 'table' AND name LIKE 'Entity!_%lld!_%%' ESCAPE '!';"
+
+// A shared store is written often, by many services; with WAL a commit appends to the log, rather
+// than also writing a rollback journal, and syncs only at checkpoints.
+#define FILE_SERVICE_SDB_SHARED_PRAGMAS     \
+"PRAGMA journal_mode = WAL;             \n\
+PRAGMA synchronous = NORMAL;"
 
 #if defined(DEBUG)
 static int needSQLiteCompileOptions = 1;
@@ -91,23 +173,18 @@ hexDecode (uint8_t *target, size_t targetLen, const char *source, size_t sourceL
     }
 }
 
-static void
-hexEncode (char *target, size_t targetLen, const uint8_t *source, size_t sourceLen) {
-    assert (targetLen == 2 * sourceLen  + 1);
-
-    for (int i = 0; i < sourceLen; i++) {
-        target[2*i + 0] = encodeChar (source[i] >> 4);
-        target[2*i + 1] = encodeChar (source[i]);
-    }
-    target[2*sourceLen] = '\0';
-}
-
 /** Forward Declarations */
 static int
 fileServiceFailedSDB (BRFileService fs,
                       int releaseLock,
                       sqlite3_status_code code);
 
+static int
+_fileServiceFlushPending (BRFileServiceStore store);
+
+static void
+fileServiceStopWriter (BRFileServiceStore store);
+
 /// Return 0 on success, -1 otherwise
 static int directoryMake (const char *path) {
     struct stat dirStat;
@@ -135,20 +212,167 @@ typedef struct {
     BRFileServiceWriter writer;
 } BRFileServiceEntityHandler;
 
+///
+/// A secondary key of a particular entity, stored in its own (indexed) column.
+///
+typedef struct {
+    char *name;
+    BRFileServiceKeyType type;
+    BRFileServiceContext context;
+    union {
+        BRFileServiceIntegerKey integer;
+        BRFileServiceTextKey text;
+    } u;
+} BRFileServiceEntityKey;
+
+/// The value of a key, per the key's type
+typedef struct {
+    int64_t integer;
+    char *text;
+} BRFileServiceKeyValue;
+
 ///
 /// The set of handlers, by version, for a particular entity.
 ///
 typedef struct {
     char *type;
+    char *table;
     BRFileServiceVersion currentVersion;
     BRArrayOf(BRFileServiceEntityHandler) handlers;
+    BRArrayOf(BRFileServiceEntityKey) keys;
+
+    // Statements on the type's table, with its keys; NULL until the table is prepared.
+    sqlite3_stmt *sdbInsertStmt;
+    sqlite3_stmt *sdbSelectAllStmt;
+    sqlite3_stmt *sdbDeleteStmt;
+    sqlite3_stmt *sdbDeleteAllStmt;
 } BRFileServiceEntityType;
 
 static void
-fileServiceEntityTypeRelease (const BRFileServiceEntityType *entityType) {
+fileServiceEntityTypeReleaseKeys (BRFileServiceEntityType *entityType) {
+    for (size_t index = 0; index < array_count (entityType->keys); index++)
+        free (entityType->keys[index].name);
+    array_clear (entityType->keys);
+}
+
+static void
+fileServiceEntityTypeRelease (BRFileServiceEntityType *entityType) {
     free (entityType->type);
+    free (entityType->table);
     if (NULL != entityType->handlers)
         array_free(entityType->handlers);
+    if (NULL != entityType->keys) {
+        fileServiceEntityTypeReleaseKeys (entityType);
+        array_free (entityType->keys);
+    }
+    free (entityType);
+}
+
+// Return the values of the keys of `entity`, or NULL if the type has no keys.  You own the values;
+// release them with `fileServiceKeyValuesRelease()`.
+static BRFileServiceKeyValue *
+fileServiceEntityTypeKeyValues (BRFileService fs,
+                                const BRFileServiceEntityType *entityType,
+                                const void *entity) {
+    size_t keysCount = array_count (entityType->keys);
+    if (0 == keysCount) return NULL;
+
+    BRFileServiceKeyValue *values = calloc (keysCount, sizeof (BRFileServiceKeyValue));
+    for (size_t index = 0; index < keysCount; index++) {
+        const BRFileServiceEntityKey *key = &entityType->keys[index];
+        switch (key->type) {
+            case FILE_SERVICE_KEY_INTEGER:
+                values[index].integer = key->u.integer (key->context, fs, entity);
+                break;
+            case FILE_SERVICE_KEY_TEXT:
+                values[index].text = key->u.text (key->context, fs, entity);
+                if (NULL == values[index].text) values[index].text = strdup ("");
+                break;
+        }
+    }
+    return values;
+}
+
+// Return the values of the keys in the columns of `stmt`'s current row, from `column` on.
+static BRFileServiceKeyValue *
+fileServiceEntityTypeColumnKeyValues (const BRFileServiceEntityType *entityType,
+                                      sqlite3_stmt *stmt,
+                                      int column) {
+    size_t keysCount = array_count (entityType->keys);
+    if (0 == keysCount) return NULL;
+
+    BRFileServiceKeyValue *values = calloc (keysCount, sizeof (BRFileServiceKeyValue));
+    for (size_t index = 0; index < keysCount; index++) {
+        switch (entityType->keys[index].type) {
+            case FILE_SERVICE_KEY_INTEGER:
+                values[index].integer = sqlite3_column_int64 (stmt, column + (int) index);
+                break;
+            case FILE_SERVICE_KEY_TEXT: {
+                const char *text = (const char *) sqlite3_column_text (stmt, column + (int) index);
+                values[index].text = strdup (NULL == text ? "" : text);
+                break;
+            }
+        }
+    }
+    return values;
+}
+
+static sqlite3_status_code
+fileServiceEntityTypeBindKeyValues (const BRFileServiceEntityType *entityType,
+                                    sqlite3_stmt *stmt,
+                                    int index,
+                                    const BRFileServiceKeyValue *values) {
+    sqlite3_status_code status = SQLITE_OK;
+    for (size_t kindex = 0; SQLITE_OK == status && kindex < array_count (entityType->keys); kindex++)
+        switch (entityType->keys[kindex].type) {
+            case FILE_SERVICE_KEY_INTEGER:
+                status = sqlite3_bind_int64 (stmt, index + (int) kindex, values[kindex].integer);
+                break;
+            case FILE_SERVICE_KEY_TEXT:
+                status = sqlite3_bind_text (stmt, index + (int) kindex, values[kindex].text, -1, SQLITE_TRANSIENT);
+                break;
+        }
+    return status;
+}
+
+static int
+fileServiceKeyValuesEqual (const BRFileServiceEntityType *entityType,
+                           const BRFileServiceKeyValue *values1,
+                           const BRFileServiceKeyValue *values2) {
+    for (size_t index = 0; index < array_count (entityType->keys); index++)
+        switch (entityType->keys[index].type) {
+            case FILE_SERVICE_KEY_INTEGER:
+                if (values1[index].integer != values2[index].integer) return 0;
+                break;
+            case FILE_SERVICE_KEY_TEXT:
+                if (0 != strcmp (values1[index].text, values2[index].text)) return 0;
+                break;
+        }
+    return 1;
+}
+
+static void
+fileServiceKeyValuesRelease (size_t keysCount,
+                             BRFileServiceKeyValue *values) {
+    if (NULL == values) return;
+    for (size_t index = 0; index < keysCount; index++)
+        if (NULL != values[index].text) free (values[index].text);
+    free (values);
+}
+
+// Fill `columns` with the key columns, as `, "name", ...`, and `placeholders`, if not NULL, with
+// a parameter for each, as `, ?, ...`.
+static void
+fileServiceEntityTypeColumns (const BRFileServiceEntityType *entityType,
+                              char *columns,
+                              char *placeholders) {
+    columns[0] = '\0';
+    if (NULL != placeholders) placeholders[0] = '\0';
+
+    for (size_t index = 0; index < array_count (entityType->keys); index++) {
+        columns += sprintf (columns, ", \"%s\"", entityType->keys[index].name);
+        if (NULL != placeholders) placeholders += sprintf (placeholders, ", ?");
+    }
 }
 
 static BRFileServiceEntityHandler *
@@ -176,24 +400,85 @@ fileServiceEntityTypeAddHandler (BRFileServiceEntityType *entityType,
 ///
 ///
 ///
-struct BRFileServiceRecord {
+/// A save or remove queued in write-behind mode; the latest one for an entity replaces any earlier.
+typedef struct {
+    BRFileService fs;
+    BRFileServiceEntityType *entityType;
+    UInt256 identifier;
+    uint8_t *data;          // the encoded entity to save, or NULL to remove it
+    size_t dataCount;
+    BRFileServiceKeyValue *keyValues;
+} BRFileServicePendingWrite;
+
+static void
+fileServicePendingWriteRelease (BRFileServicePendingWrite *write) {
+    if (NULL != write->data) free (write->data);
+    fileServiceKeyValuesRelease (array_count (write->entityType->keys), write->keyValues);
+    free (write);
+}
+
+static size_t
+fileServicePendingWriteHash (const void *write) {
+    return (size_t) ((const BRFileServicePendingWrite *) write)->identifier.u64[0];
+}
+
+static int
+fileServicePendingWriteEq (const void *write1, const void *write2) {
+    const BRFileServicePendingWrite *w1 = write1, *w2 = write2;
+    return w1->entityType == w2->entityType && UInt256Eq (w1->identifier, w2->identifier);
+}
+
+static sqlite3_status_code
+_fileServiceWrite (BRFileServiceStore store,
+                   BRFileServicePendingWrite **writes,
+                   size_t writesCount);
+
+static double
+fileServiceTime (void) {
+    struct timeval tv;
+    gettimeofday (&tv, NULL);
+    return tv.tv_sec + (double) tv.tv_usec / 1000000;
+}
+
+///
+/// The DB, and the writer for write-behind mode, used by one or more BRFileServices.  A service
+/// has a store of its own unless created while a shared store is installed.
+///
+struct BRFileServiceStoreRecord {
     char    *sdbPath;
     sqlite3 *sdb;
-    sqlite3_stmt *sdbInsertStmt;
-    sqlite3_stmt *sdbSelectStmt;
-    sqlite3_stmt *sdbSelectAllStmt;
-    sqlite3_stmt *sdbUpdateStmt;
-    sqlite3_stmt *sdbDeleteStmt;
-    sqlite3_stmt *sdbDeleteAllTypeStmt;
-    sqlite3_stmt *sdbDeleteAllStmt;
+    uint8_t  sdbLegacy;     // the `Entity` table, from before version 3, exists
+    uint8_t  shared;        // created by `fileServiceStoreCreate()`; services use namespaces
+
+    // Protects `sdb` and its statements, including those of the store's services.
+    pthread_mutex_t lock;
+    size_t refCount;        // the creator, if shared, plus each service; protected by `lock`
+
+    // Write-behind.  The `pending` set is protected by `pendingLock`, which may be taken while
+    // holding `lock` but not the other way around.
+    pthread_mutex_t pendingLock;
+    pthread_cond_t  pendingCond;
+    BRSetOf(BRFileServicePendingWrite*) pending;
+    size_t   pendingLimit;      // write once this many are pending; 0 if not in write-behind mode
+    double   pendingDelay;      // ... or once the oldest has been pending this many seconds
+    double   pendingTime;       // when the oldest pending write was queued
+    pthread_t writer;
+    uint8_t  writerRunning;
+    uint8_t  writerQuit;
+};
+
+///
+///
+///
+struct BRFileServiceRecord {
+    BRFileServiceStore store;
+    int64_t  namespaceId;    // the namespace id in a shared store; otherwise 0
     uint8_t  sdbClosed;
 
     char *currency;
     char *network;
 
-    pthread_mutex_t lock;
-    
-    BRArrayOf(BRFileServiceEntityType) entityTypes;
+    BRArrayOf(BRFileServiceEntityType*) entityTypes;
     BRFileServiceContext context;
     BRFileServiceErrorHandler handler;
 };
@@ -203,7 +488,7 @@ fileServiceCreateReturnError (BRFileService fs,
                               int releaseLock,
                               BRFileServiceError error) {
     // Nothing with 'error' at this point; a placeholder for now.
-    if (releaseLock) pthread_mutex_unlock (&fs->lock);
+    if (releaseLock) pthread_mutex_unlock (&fs->store->lock);
     fileServiceRelease (fs);
     return NULL;
 }
@@ -219,6 +504,336 @@ fileServiceCreateFilePath (const char *basePath,
     return sdbPath;
 }
 
+// Bring the DB up to the current schema version, in one DB transaction.  A version 1 DB is
+// converted by decoding each row into a new `Entity` table; from there, rows move to per-type
+// tables as types are defined.
+static sqlite3_status_code
+fileServiceMigrate (BRFileServiceStore store) {
+    sqlite3_stmt *stmt;
+    sqlite3_status_code status;
+    int schemaVersion = 0, tableExists = 0;
+
+    status = sqlite3_prepare_v2 (store->sdb, FILE_SERVICE_SDB_QUERY_SCHEMA_VERSION, -1, &stmt, NULL);
+    if (SQLITE_OK != status) return status;
+    if (SQLITE_ROW == sqlite3_step (stmt)) schemaVersion = sqlite3_column_int (stmt, 0);
+    sqlite3_finalize (stmt);
+
+    status = sqlite3_prepare_v2 (store->sdb, FILE_SERVICE_SDB_QUERY_LEGACY_ENTITY_TABLE_EXISTS, -1, &stmt, NULL);
+    if (SQLITE_OK != status) return status;
+    if (SQLITE_ROW == sqlite3_step (stmt)) tableExists = sqlite3_column_int (stmt, 0);
+    sqlite3_finalize (stmt);
+
+    store->sdbLegacy = tableExists;
+
+    if (schemaVersion >= FILE_SERVICE_SDB_SCHEMA_VERSION) return SQLITE_OK;
+
+    // A DB without a version predates versioning; that is, it is version 1.
+    int convertV1 = tableExists && schemaVersion < 2;
+
+    status = sqlite3_exec (store->sdb, "BEGIN", NULL, NULL, NULL);
+    if (SQLITE_OK != status) return status;
+
+    if (convertV1)
+        status = sqlite3_exec (store->sdb, "ALTER TABLE Entity RENAME TO EntityV1;", NULL, NULL, NULL);
+
+    if (SQLITE_OK == status && convertV1)
+        status = sqlite3_exec (store->sdb, FILE_SERVICE_SDB_LEGACY_ENTITY_TABLE, NULL, NULL, NULL);
+
+    if (SQLITE_OK == status && convertV1) {
+        sqlite3_stmt *selectStmt = NULL, *insertStmt = NULL;
+
+        status = sqlite3_prepare_v2 (store->sdb, FILE_SERVICE_SDB_QUERY_ALL_V1_ENTITY, -1, &selectStmt, NULL);
+        if (SQLITE_OK == status)
+            status = sqlite3_prepare_v2 (store->sdb, FILE_SERVICE_SDB_INSERT_LEGACY_ENTITY, -1, &insertStmt, NULL);
+
+        while (SQLITE_OK == status) {
+            sqlite3_status_code step = sqlite3_step (selectStmt);
+            if (SQLITE_DONE == step) break;
+            if (SQLITE_ROW  != step) { status = step; break; }
+
+            const char *type = (const char *) sqlite3_column_text (selectStmt, 0);
+            const char *hash = (const char *) sqlite3_column_text (selectStmt, 1);
+            const char *data = (const char *) sqlite3_column_text (selectStmt, 2);
+            size_t hashCount = (size_t) sqlite3_column_bytes (selectStmt, 1);
+            size_t dataCount = (size_t) sqlite3_column_bytes (selectStmt, 2);
+
+            // Skip malformed rows; they could not have been loaded anyway.
+            if (NULL == type || NULL == hash || NULL == data ||
+                2 * sizeof (UInt256) != hashCount || 0 != dataCount % 2)
+                continue;
+
+            UInt256 identifier;
+            hexDecode (identifier.u8, sizeof (UInt256), hash, hashCount);
+
+            uint8_t *bytes = malloc (dataCount / 2 + 1);
+            hexDecode (bytes, dataCount / 2, data, dataCount);
+
+            sqlite3_reset (insertStmt);
+            sqlite3_clear_bindings (insertStmt);
+
+            status = sqlite3_bind_text (insertStmt, 1, type, -1, SQLITE_STATIC);
+            if (SQLITE_OK == status)
+                status = sqlite3_bind_blob (insertStmt, 2, identifier.u8, sizeof (UInt256), SQLITE_STATIC);
+            if (SQLITE_OK == status)
+                status = sqlite3_bind_blob (insertStmt, 3, bytes, (int) (dataCount / 2), SQLITE_STATIC);
+            if (SQLITE_OK == status)
+                status = sqlite3_step (insertStmt);
+            if (SQLITE_DONE == status)
+                status = SQLITE_OK;
+
+            free (bytes);
+        }
+
+        if (NULL != insertStmt) sqlite3_finalize (insertStmt);
+        if (NULL != selectStmt) sqlite3_finalize (selectStmt);
+
+        if (SQLITE_OK == status)
+            status = sqlite3_exec (store->sdb, "DROP TABLE EntityV1;", NULL, NULL, NULL);
+    }
+
+    if (SQLITE_OK == status)
+        status = sqlite3_exec (store->sdb, FILE_SERVICE_SDB_UPDATE_SCHEMA_VERSION, NULL, NULL, NULL);
+
+    if (SQLITE_OK == status)
+        status = sqlite3_exec (store->sdb, "COMMIT", NULL, NULL, NULL);
+    else
+        sqlite3_exec (store->sdb, "ROLLBACK", NULL, NULL, NULL);
+
+    // Return the space freed by the version 1 table to the file system.
+    if (SQLITE_OK == status && convertV1)
+        sqlite3_exec (store->sdb, "VACUUM;", NULL, NULL, NULL);
+
+    return status;
+}
+
+/// MARK: - Store
+
+static pthread_once_t  _store_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _store_lock;
+static BRFileServiceStore _store_installed = NULL;
+
+static void _store_init (void) {
+    pthread_mutex_init (&_store_lock, NULL);
+}
+
+static void
+fileServiceStoreFree (BRFileServiceStore store) {
+    if (NULL != store->sdb) sqlite3_close (store->sdb);
+    if (NULL != store->sdbPath) free (store->sdbPath);
+    if (NULL != store->pending) BRSetFree (store->pending);
+
+    pthread_mutex_destroy (&store->lock);
+    pthread_mutex_destroy (&store->pendingLock);
+    pthread_cond_destroy  (&store->pendingCond);
+
+    free (store);
+}
+
+// Open, and migrate, the DB at `sdbPath`.  Returns NULL on an error.
+static BRFileServiceStore
+fileServiceStoreOpen (const char *sdbPath,
+                      int shared) {
+    BRFileServiceStore store = calloc (1, sizeof (struct BRFileServiceStoreRecord));
+
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_NORMAL);
+
+        pthread_mutex_init(&store->lock, &attr);
+        pthread_mutex_init(&store->pendingLock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+
+    pthread_cond_init (&store->pendingCond, NULL);
+    store->pending  = BRSetNew (fileServicePendingWriteHash, fileServicePendingWriteEq, 100);
+    store->sdbPath  = strdup (sdbPath);
+    store->shared   = shared;
+    store->refCount = 1;
+
+    // Create/Open the SQLITE Database
+    sqlite3_status_code status = sqlite3_open (store->sdbPath, &store->sdb);
+
+    if (SQLITE_OK == status && shared)
+        status = sqlite3_exec (store->sdb, FILE_SERVICE_SDB_SHARED_PRAGMAS, NULL, NULL, NULL);
+
+    // Migrate an older DB; the tables are created as types are defined.
+    if (SQLITE_OK == status)
+        status = fileServiceMigrate (store);
+
+    if (SQLITE_OK == status && shared)
+        status = sqlite3_exec (store->sdb, FILE_SERVICE_SDB_NAMESPACE_TABLE, NULL, NULL, NULL);
+
+    if (SQLITE_OK != status) {
+        fileServiceStoreFree (store);
+        return NULL;
+    }
+
+    return store;
+}
+
+extern BRFileServiceStore
+fileServiceStoreCreate (const char *basePath) {
+    if (NULL == basePath || 0 == strlen(basePath)) return NULL;
+
+    // Make directory if needed.
+    if (-1 == directoryMake(basePath)) return NULL;
+
+    if (0 == sqlite3_threadsafe()) return NULL;
+
+    char *sdbPath = malloc (strlen (basePath) + 1 + strlen (FILE_SERVICE_SDB_FILENAME) + 1);
+    sprintf (sdbPath, "%s/%s", basePath, FILE_SERVICE_SDB_FILENAME);
+
+    BRFileServiceStore store = fileServiceStoreOpen (sdbPath, 1);
+    free (sdbPath);
+    return store;
+}
+
+static BRFileServiceStore
+fileServiceStoreTake (BRFileServiceStore store) {
+    pthread_mutex_lock (&store->lock);
+    store->refCount += 1;
+    pthread_mutex_unlock (&store->lock);
+    return store;
+}
+
+extern void
+fileServiceStoreRelease (BRFileServiceStore store) {
+    pthread_mutex_lock (&store->lock);
+    int last = (0 == --store->refCount);
+    pthread_mutex_unlock (&store->lock);
+
+    if (!last) return;
+
+    // Every service has flushed its writes; the writer has nothing left to do.
+    fileServiceStopWriter (store);
+    fileServiceStoreFree (store);
+}
+
+extern void
+fileServiceStoreInstall (BRFileServiceStore store) {
+    pthread_once (&_store_once, _store_init);
+
+    if (NULL != store) fileServiceStoreTake (store);
+
+    pthread_mutex_lock (&_store_lock);
+    BRFileServiceStore installed = _store_installed;
+    _store_installed = store;
+    pthread_mutex_unlock (&_store_lock);
+
+    if (NULL != installed) fileServiceStoreRelease (installed);
+}
+
+// Return the installed store, if any, with a reference taken for the caller.
+static BRFileServiceStore
+fileServiceStoreTakeInstalled (void) {
+    pthread_once (&_store_once, _store_init);
+
+    pthread_mutex_lock (&_store_lock);
+    BRFileServiceStore store = _store_installed;
+    if (NULL != store) fileServiceStoreTake (store);
+    pthread_mutex_unlock (&_store_lock);
+
+    return store;
+}
+
+// Find the id of the namespace {path, currency, network} in `store`, adding it if `create`.  The id
+// is 0 if there is no such namespace.  The lock must be held.
+static sqlite3_status_code
+_fileServiceStoreNamespace (BRFileServiceStore store,
+                            const char *path,
+                            const char *currency,
+                            const char *network,
+                            int create,
+                            int64_t *namespaceId) {
+    const char *sql[2] = { FILE_SERVICE_SDB_INSERT_NAMESPACE, FILE_SERVICE_SDB_QUERY_NAMESPACE };
+    sqlite3_status_code status = SQLITE_OK;
+
+    *namespaceId = 0;
+
+    for (size_t index = (create ? 0 : 1); SQLITE_OK == status && index < 2; index++) {
+        sqlite3_stmt *stmt;
+
+        status = sqlite3_prepare_v2 (store->sdb, sql[index], -1, &stmt, NULL);
+        if (SQLITE_OK != status) break;
+
+        sqlite3_bind_text (stmt, 1, path,     -1, SQLITE_STATIC);
+        sqlite3_bind_text (stmt, 2, currency, -1, SQLITE_STATIC);
+        sqlite3_bind_text (stmt, 3, network,  -1, SQLITE_STATIC);
+
+        status = sqlite3_step (stmt);
+        if (SQLITE_ROW == status) *namespaceId = sqlite3_column_int64 (stmt, 0);
+        if (SQLITE_ROW == status || SQLITE_DONE == status) status = SQLITE_OK;
+
+        sqlite3_finalize (stmt);
+    }
+
+    return status;
+}
+
+// Drop the tables of a namespace and forget it.  Returns true (1) if success.
+static int
+fileServiceStoreWipe (BRFileServiceStore store,
+                      const char *path,
+                      const char *currency,
+                      const char *network) {
+    BRArrayOf(char*) tables;
+    FileServiceSQL sql;
+    sqlite3_stmt *stmt;
+    int64_t namespaceId;
+
+    pthread_mutex_lock (&store->lock);
+
+    // The namespace's service, if any, has been released; nothing of it is pending.
+    sqlite3_status_code status = _fileServiceStoreNamespace (store, path, currency, network, 0, &namespaceId);
+    if (SQLITE_OK != status || 0 == namespaceId) {
+        pthread_mutex_unlock (&store->lock);
+        return SQLITE_OK == status;
+    }
+
+    array_new (tables, 5);
+
+    sprintf (sql, FILE_SERVICE_SDB_QUERY_NAMESPACE_TABLES, (long long) namespaceId);
+    status = sqlite3_prepare_v2 (store->sdb, sql, -1, &stmt, NULL);
+    if (SQLITE_OK == status) {
+        while (SQLITE_ROW == sqlite3_step (stmt))
+            array_add (tables, strdup ((const char *) sqlite3_column_text (stmt, 0)));
+        sqlite3_finalize (stmt);
+    }
+
+    if (SQLITE_OK == status)
+        status = sqlite3_exec (store->sdb, "BEGIN", NULL, NULL, NULL);
+
+    for (size_t index = 0; SQLITE_OK == status && index < array_count (tables); index++) {
+        sprintf (sql, "DROP TABLE \"%s\";", tables[index]);
+        status = sqlite3_exec (store->sdb, sql, NULL, NULL, NULL);
+    }
+
+    if (SQLITE_OK == status)
+        status = sqlite3_prepare_v2 (store->sdb, FILE_SERVICE_SDB_DELETE_NAMESPACE, -1, &stmt, NULL);
+    if (SQLITE_OK == status) {
+        sqlite3_bind_int64 (stmt, 1, namespaceId);
+        status = sqlite3_step (stmt);
+        if (SQLITE_DONE == status) status = SQLITE_OK;
+        sqlite3_finalize (stmt);
+    }
+
+    if (SQLITE_OK == status)
+        status = sqlite3_exec (store->sdb, "COMMIT", NULL, NULL, NULL);
+    else if (!sqlite3_get_autocommit (store->sdb))
+        sqlite3_exec (store->sdb, "ROLLBACK", NULL, NULL, NULL);
+
+    pthread_mutex_unlock (&store->lock);
+
+    for (size_t index = 0; index < array_count (tables); index++)
+        free (tables[index]);
+    array_free (tables);
+
+    return SQLITE_OK == status;
+}
+
+/// MARK: - Create, Close, Release
+
 extern BRFileService
 fileServiceCreate (const char *basePath,
                    const char *currency,
@@ -233,115 +848,58 @@ fileServiceCreate (const char *basePath,
     if (strlen(network) > FILENAME_MAX || strlen(currency) > FILENAME_MAX)
         return NULL;
 
-    // Make directory if needed.
-    if (-1 == directoryMake(basePath)) return NULL;
+    // Use the installed store, if any; its DB is elsewhere.
+    BRFileServiceStore store = fileServiceStoreTakeInstalled ();
 
-    // Require `basePath` to be an existing directory.
-    DIR *dir = opendir(basePath);
-    if (NULL == dir) return NULL;
-    closedir(dir);
+    if (NULL == store) {
+        // Make directory if needed.
+        if (-1 == directoryMake(basePath)) return NULL;
 
-    // Require SQLite to support 'MULTI_THREADED' or 'SERIALIZED'.  We'll lock our connection.
-    // and thus 'MULTI_THREADED' is appropriate.
-    if (0 == sqlite3_threadsafe()) return NULL;
+        // Require `basePath` to be an existing directory.
+        DIR *dir = opendir(basePath);
+        if (NULL == dir) return NULL;
+        closedir(dir);
 
-    // Create the file service itself
-    BRFileService fs = calloc (1, sizeof (struct BRFileServiceRecord));
+        // Require SQLite to support 'MULTI_THREADED' or 'SERIALIZED'.  We'll lock our connection.
+        // and thus 'MULTI_THREADED' is appropriate.
+        if (0 == sqlite3_threadsafe()) return NULL;
 
-    {
-        pthread_mutexattr_t attr;
-        pthread_mutexattr_init(&attr);
-        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_NORMAL);
+        // Create/Open the SQLITE Database, in a store of our own
+        char *sdbPath = fileServiceCreateFilePath (basePath, currency, network, FILE_SERVICE_SDB_FILENAME);
+        store = fileServiceStoreOpen (sdbPath, 0);
+        free (sdbPath);
 
-        pthread_mutex_init(&fs->lock, &attr);
-        pthread_mutexattr_destroy(&attr);
+        if (NULL == store) return NULL;
     }
 
+    // Create the file service itself
+    BRFileService fs = calloc (1, sizeof (struct BRFileServiceRecord));
+    fs->store = store;
+
     // Set the error handler - early
     fileServiceSetErrorHandler (fs, context, handler);
 
-    fs->sdb = NULL;
-    fs->sdbPath = NULL;
     fs->sdbClosed = 0;
 
     // Save currency and network
     fs->currency = strdup (currency);
     fs->network  = strdup (network);
 
-    // Locate the SQLITE Database
-    fs->sdbPath = fileServiceCreateFilePath (basePath, currency, network, FILE_SERVICE_SDB_FILENAME);
-
-    // Create/Open the SQLITE Database
-    sqlite3_status_code status = sqlite3_open(fs->sdbPath, &fs->sdb);
-    if (SQLITE_OK != status) {
-        fileServiceRelease (fs);
-        return NULL;
-    }
-
-    // Create the SQLite 'Entity' Table
-    sqlite3_stmt *sdbCreateTableStmt;
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_ENTITY_TABLE, -1, &sdbCreateTableStmt, NULL);
-    if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
-    if (SQLITE_DONE != sqlite3_step(sdbCreateTableStmt))
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-    sqlite3_finalize(sdbCreateTableStmt);
-
-    // Create the SQLITE 'Insert into Entity' Statement
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_INSERT_ENTITY, -1, &fs->sdbInsertStmt, NULL);
-    if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
-    // Create the SQLITE "Select Entity By Hash' Statement
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_QUERY_ENTITY, -1, &fs->sdbSelectStmt, NULL);
-    if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
-    // Create the SQLITE "Select Entity ' Statement
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_QUERY_ALL_ENTITY, -1, &fs->sdbSelectAllStmt, NULL);
-    if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_UPDATE_ENTITY, -1, &fs->sdbUpdateStmt, NULL);
-    if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_DELETE_ENTITY, -1, &fs->sdbDeleteStmt, NULL);
-    if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
-    status = sqlite3_prepare_v2 (fs->sdb, FILE_SERVICE_SDB_DELETE_ALL_TYPE_ENTITY, -1, &fs->sdbDeleteAllTypeStmt, NULL);
-    if (SQLITE_OK != status)
-        return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
-            FILE_SERVICE_SDB,
-            { .sdb = { status }}
-        });
-
     // Allocate the `entityTypes` array
     array_new (fs->entityTypes, FILE_SERVICE_INITIAL_TYPE_COUNT);
 
+    // In a shared store, find our namespace
+    if (store->shared) {
+        pthread_mutex_lock (&store->lock);
+        sqlite3_status_code status = _fileServiceStoreNamespace (store, basePath, currency, network, 1, &fs->namespaceId);
+        if (SQLITE_OK != status || 0 == fs->namespaceId)
+            return fileServiceCreateReturnError (fs, 1, (BRFileServiceError) {
+                FILE_SERVICE_SDB,
+                { .sdb = { status }}
+            });
+        pthread_mutex_unlock (&store->lock);
+    }
+
 #if defined(DEBUG)
     if (needSQLiteCompileOptions) {
         needSQLiteCompileOptions = 0;
@@ -366,51 +924,65 @@ _fileServiceFinalizeStmt (BRFileService fs, sqlite3_stmt **stmt) {
     }
 }
 
+// Finalize the statements of `fs`; if the store is its own, close the DB.  The lock must be held.
 static void
 _fileServiceCloseInternal (BRFileService fs) {
     if (fs->sdbClosed) return;
 
+    // Under the pending lock too, as `_fileServiceQueue()` checks it there
+    pthread_mutex_lock (&fs->store->pendingLock);
     fs->sdbClosed = 1;
-    _fileServiceFinalizeStmt (fs, &fs->sdbInsertStmt);
-    _fileServiceFinalizeStmt (fs, &fs->sdbSelectStmt);
-    _fileServiceFinalizeStmt (fs, &fs->sdbSelectAllStmt);
-    _fileServiceFinalizeStmt (fs, &fs->sdbUpdateStmt);
-    _fileServiceFinalizeStmt (fs, &fs->sdbDeleteStmt);
-    _fileServiceFinalizeStmt (fs, &fs->sdbDeleteAllTypeStmt);
-    _fileServiceFinalizeStmt (fs, &fs->sdbDeleteAllStmt);
+    pthread_mutex_unlock (&fs->store->pendingLock);
+    for (size_t index = 0; NULL != fs->entityTypes && index < array_count (fs->entityTypes); index++) {
+        BRFileServiceEntityType *entityType = fs->entityTypes[index];
+        _fileServiceFinalizeStmt (fs, &entityType->sdbInsertStmt);
+        _fileServiceFinalizeStmt (fs, &entityType->sdbSelectAllStmt);
+        _fileServiceFinalizeStmt (fs, &entityType->sdbDeleteStmt);
+        _fileServiceFinalizeStmt (fs, &entityType->sdbDeleteAllStmt);
+    }
 
-    if (NULL != fs->sdb) sqlite3_close (fs->sdb);
-    fs->sdb = NULL;
+    if (!fs->store->shared) {
+        if (NULL != fs->store->sdb) sqlite3_close (fs->store->sdb);
+        fs->store->sdb = NULL;
+    }
 }
 
 extern void
 fileServiceClose (BRFileService fs) {
-    pthread_mutex_lock (&fs->lock);
+    if (!fs->store->shared) fileServiceStopWriter (fs->store);
+
+    pthread_mutex_lock (&fs->store->lock);
+    _fileServiceFlushPending (fs->store);
     _fileServiceCloseInternal(fs);
-    pthread_mutex_unlock (&fs->lock);
+    pthread_mutex_unlock (&fs->store->lock);
 }
 
 // This is callable with a partially allocated BRFileService.  So, be
 // careful with fields that might not yet exist.
 extern void
 fileServiceRelease (BRFileService fs) {
-    pthread_mutex_lock (&fs->lock);
+    BRFileServiceStore store = fs->store;
 
+    if (!store->shared) fileServiceStopWriter (store);
+
+    pthread_mutex_lock (&store->lock);
+
+    // Pending writes, for any service of the store, refer to their service's types
+    _fileServiceFlushPending (store);
     _fileServiceCloseInternal(fs);
 
     if (NULL != fs->entityTypes) {
         size_t typesCount = array_count(fs->entityTypes);
         for (size_t index = 0; index < typesCount; index++)
-            fileServiceEntityTypeRelease (&fs->entityTypes[index]);
+            fileServiceEntityTypeRelease (fs->entityTypes[index]);
         array_free(fs->entityTypes);
     }
 
     if (NULL != fs->network)  free (fs->network);
     if (NULL != fs->currency) free (fs->currency);
-    if (NULL != fs->sdbPath)  free (fs->sdbPath);
 
-    pthread_mutex_unlock (&fs->lock);
-    pthread_mutex_destroy(&fs->lock);
+    pthread_mutex_unlock (&store->lock);
+    fileServiceStoreRelease (store);
 
     free (fs);
 }
@@ -428,8 +1000,8 @@ fileServiceLookupType (const BRFileService fs,
                        const char *type) {
     size_t typeCount = array_count(fs->entityTypes);
     for (size_t index = 0; index < typeCount; index++)
-        if (0 == strcmp (type, fs->entityTypes[index].type))
-            return &fs->entityTypes[index];
+        if (0 == strcmp (type, fs->entityTypes[index]->type))
+            return fs->entityTypes[index];
     return NULL;
 }
 
@@ -437,15 +1009,20 @@ static BRFileServiceEntityType *
 fileServiceAddType (const BRFileService fs,
                     const char *type,
                     BRFileServiceVersion version) {
-    BRFileServiceEntityType entityType = {
-        strdup (type),
-        version,
-        NULL
-    };
-    array_new (entityType.handlers, FILE_SERVICE_INITIAL_HANDLER_COUNT);
+    BRFileServiceEntityType *entityType = calloc (1, sizeof (BRFileServiceEntityType));
+    entityType->type = strdup (type);
+    entityType->currentVersion = version;
+
+    // The type's table, in the service's namespaceId, if any
+    entityType->table = malloc (FILE_SERVICE_TABLE_NAME_LIMIT + 1);
+    if (0 == fs->namespaceId) sprintf (entityType->table, "Entity_%s", type);
+    else sprintf (entityType->table, "Entity_%lld_%s", (long long) fs->namespaceId, type);
+
+    array_new (entityType->handlers, FILE_SERVICE_INITIAL_HANDLER_COUNT);
+    array_new (entityType->keys, 1);
 
     array_add (fs->entityTypes, entityType);
-    return &fs->entityTypes[array_count(fs->entityTypes) - 1];
+    return entityType;
 }
 
 static BRFileServiceEntityHandler *
@@ -466,7 +1043,7 @@ fileServiceFailedInternal (BRFileService fs,
                            BRFileServiceError error) {
     if (NULL != bufferToFree) free (bufferToFree);
     if (NULL != fileToClose)  fclose (fileToClose);
-    if (releaseLock) pthread_mutex_unlock (&fs->lock);
+    if (releaseLock) pthread_mutex_unlock (&fs->store->lock);
 
     // Handler invoked w/o the lock.  Avoid a possible recursive use of FS.
     if (NULL != fs->handler)
@@ -534,22 +1111,13 @@ fileServiceFailedEntity(BRFileService fs,
 
 /// MARK: - Save
 
-static int
-_fileServiceSave (BRFileService fs,
-                  const char *type,  /* block, peers, transactions, logs, ... */
-                  const void *entity,
-                  int needLock) {     /* BRMerkleBlock*, BRTransaction, BREthereumTransaction, ... */
-
-    BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
-    if (NULL == entityType) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type"); return 0; };
-
-    BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, entityType->currentVersion);
-    if (NULL == handler) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type handler"); return 0; };
-
-    // Get then hex-encode the identifer
-    UInt256 identifier = handler->identifier (handler->context, fs, entity);
-    const char *hash = u256hex(identifier);
-
+// Serialize `entity` as the {header, entity bytes} stored in the DB.  You own the result.
+static uint8_t *
+_fileServiceEncode (BRFileService fs,
+                    BRFileServiceEntityType *entityType,
+                    BRFileServiceEntityHandler *handler,
+                    const void *entity,
+                    size_t *bytesCount) {
     // Get the entity bytes
     uint32_t entityBytesCount;
     uint8_t *entityBytes = handler->writer (handler->context, fs, entity, &entityBytesCount);
@@ -559,8 +1127,7 @@ _fileServiceSave (BRFileService fs,
     // Extend the entity bytes with the current header format, which is:
     //   {HeaderFormatVersion, Current(Type)Version, EntityBytesCount, EntityBytes}
     size_t  offset = 0;
-    size_t  bytesCount = 1 + 1 + sizeof(uint32_t) + entityBytesCount;
-    uint8_t *bytes = malloc (bytesCount);
+    uint8_t *bytes = malloc (1 + 1 + sizeof(uint32_t) + entityBytesCount);
 
     bytes[offset] = (uint8_t) currentHeaderFormatVersion;
     offset += 1;
@@ -572,68 +1139,298 @@ _fileServiceSave (BRFileService fs,
     offset += sizeof (uint32_t);
 
     memcpy (&bytes[offset], entityBytes, entityBytesCount);
+    offset += entityBytesCount;
     free (entityBytes);
 
-    // Nex encode bytes
-    size_t dataCount = 2 * bytesCount + 1;
-    char *data = malloc (dataCount);
-    hexEncode (data, dataCount, bytes, bytesCount);
-    free (bytes);
+    *bytesCount = offset;
+    return bytes;
+}
+
+// Insert or replace the entity's row.  The lock must be held.
+static sqlite3_status_code
+_fileServiceInsert (BRFileService fs,
+                    BRFileServiceEntityType *entityType,
+                    UInt256 identifier,
+                    const uint8_t *data,
+                    size_t dataCount,
+                    const BRFileServiceKeyValue *keyValues) {
+    sqlite3_stmt *stmt = entityType->sdbInsertStmt;
+    sqlite3_status_code status;
+
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings(stmt);
+
+    status = sqlite3_bind_blob (stmt, 1, identifier.u8, sizeof (UInt256), SQLITE_TRANSIENT);
+    if (SQLITE_OK != status) return status;
+
+    status = sqlite3_bind_blob (stmt, 2, data, (int) dataCount, SQLITE_STATIC);
+    if (SQLITE_OK != status) return status;
+
+    status = fileServiceEntityTypeBindKeyValues (entityType, stmt, 3, keyValues);
+    if (SQLITE_OK != status) return status;
+
+    status = sqlite3_step (stmt);
+
+    // Ensure the 'implicit DB transaction' is committed.
+    sqlite3_reset (stmt);
+
+    return status;
+}
+
+// Delete the entity's row, if any.  The lock must be held.
+static sqlite3_status_code
+_fileServiceDelete (BRFileService fs,
+                    BRFileServiceEntityType *entityType,
+                    UInt256 identifier) {
+    sqlite3_stmt *stmt = entityType->sdbDeleteStmt;
+    sqlite3_status_code status;
+
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+
+    status = sqlite3_bind_blob (stmt, 1, identifier.u8, sizeof (UInt256), SQLITE_TRANSIENT);
+    if (SQLITE_OK != status) return status;
+
+    status = sqlite3_step (stmt);
+
+    // Ensure the 'implicit DB transaction' is committed.
+    sqlite3_reset (stmt);
+
+    return status;
+}
+
+// Queue a save (or, with `data` NULL, a remove) in write-behind mode, replacing any queued for the
+// same entity.  Return 0, without taking `data` and `keyValues`, if not in write-behind mode or if
+// `fs` is closed (whereupon the caller fails as 'closed').
+static int
+_fileServiceQueue (BRFileService fs,
+                   BRFileServiceEntityType *entityType,
+                   UInt256 identifier,
+                   uint8_t *data,
+                   size_t dataCount,
+                   BRFileServiceKeyValue *keyValues) {
+    BRFileServicePendingWrite key = { fs, entityType, identifier, NULL, 0, NULL };
+
+    pthread_mutex_lock (&fs->store->pendingLock);
+    if (0 == fs->store->pendingLimit || fs->sdbClosed) {
+        pthread_mutex_unlock (&fs->store->pendingLock);
+        return 0;
+    }
+
+    BRFileServicePendingWrite *write = BRSetGet (fs->store->pending, &key);
+    if (NULL == write) {
+        write = malloc (sizeof (BRFileServicePendingWrite));
+        *write = key;
+        BRSetAdd (fs->store->pending, write);
+
+        // Start the clock on the first pending write
+        if (1 == BRSetCount (fs->store->pending)) {
+            fs->store->pendingTime = fileServiceTime();
+            pthread_cond_signal (&fs->store->pendingCond);
+        }
+    }
+    else {
+        if (NULL != write->data) free (write->data);
+        fileServiceKeyValuesRelease (array_count (entityType->keys), write->keyValues);
+    }
+    write->data = data;
+    write->dataCount = dataCount;
+    write->keyValues = keyValues;
+
+    if (BRSetCount (fs->store->pending) == fs->store->pendingLimit)
+        pthread_cond_signal (&fs->store->pendingCond);
+
+    pthread_mutex_unlock (&fs->store->pendingLock);
+    return 1;
+}
+
+static int
+_fileServiceSave (BRFileService fs,
+                  const char *type,  /* block, peers, transactions, logs, ... */
+                  const void *entity,
+                  int needLock) {     /* BRMerkleBlock*, BRTransaction, BREthereumTransaction, ... */
+
+    BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
+    if (NULL == entityType) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type"); return 0; };
+
+    BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, entityType->currentVersion);
+    if (NULL == handler) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type handler"); return 0; };
+
+    // Get the identifer, the keys and the encoded entity
+    UInt256 identifier = handler->identifier (handler->context, fs, entity);
+    BRFileServiceKeyValue *keyValues = fileServiceEntityTypeKeyValues (fs, entityType, entity);
+    size_t dataCount;
+    uint8_t *data = _fileServiceEncode (fs, entityType, handler, entity, &dataCount);
+
+    // In write-behind mode, the writer thread will save it.
+    if (needLock && _fileServiceQueue (fs, entityType, identifier, data, dataCount, keyValues))
+        return 1;
 
     // Fill out the SQL statement
     sqlite3_status_code status;
 
     if (needLock)
-        pthread_mutex_lock (&fs->lock);
+        pthread_mutex_lock (&fs->store->lock);
 
-    if (fs->sdbClosed)
+    if (fs->sdbClosed) {
+        free (data);
+        fileServiceKeyValuesRelease (array_count (entityType->keys), keyValues);
         return fileServiceFailedImpl (fs, needLock, NULL, NULL, "closed");
+    }
 
-    sqlite3_reset (fs->sdbInsertStmt);
-    sqlite3_clear_bindings(fs->sdbInsertStmt);
+    status = _fileServiceInsert (fs, entityType, identifier, data, dataCount, keyValues);
+    free (data);
+    fileServiceKeyValuesRelease (array_count (entityType->keys), keyValues);
 
-    status = sqlite3_bind_text (fs->sdbInsertStmt, 1, type, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status) {
-        free (data);
+    if (SQLITE_DONE != status)
         return fileServiceFailedSDB (fs, needLock, status);
+
+    if (needLock)
+        pthread_mutex_unlock (&fs->store->lock);
+
+    return 1;
+}
+
+extern int
+fileServiceSave (BRFileService fs,
+                 const char *type,  /* block, peers, transactions, logs, ... */
+                 const void *entity) {     /* BRMerkleBlock*, BRTransaction, BREthereumTransaction, ... */
+    return _fileServiceSave (fs, type, entity, 1);
+}
+
+/// MARK: - Load
+
+// Read an entity from `bytes`, the {header, entity bytes} stored in the DB, with the handler for
+// its version; readers may modify `bytes`.  Set `current` if `bytes` are in the current versions.
+// On failure, report it, with `releaseLock` and `bufferToFree`, and return NULL.
+static void *
+_fileServiceDecode (BRFileService fs,
+                    int releaseLock,
+                    void *bufferToFree,
+                    BRFileServiceEntityType *entityType,
+                    uint8_t *bytes,
+                    size_t bytesCount,
+                    int *current) {
+    size_t offset = 0;
+    BRFileServiceVersion version;
+    uint32_t  entityBytesCount;
+    uint8_t  *entityBytes;
+
+    if (bytesCount < 1 + 1 + sizeof (uint32_t)) {
+        fileServiceFailedImpl (fs, releaseLock, bufferToFree, NULL, "missed query `hash` or `data`");
+        return NULL;
     }
 
-    status = sqlite3_bind_text (fs->sdbInsertStmt, 2, hash, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status) {
-        free (data);
-        return fileServiceFailedSDB (fs, needLock, status);
+    BRFileServiceHeaderFormatVersion headerVersion = bytes[offset];
+    offset += 1;
+
+    switch (headerVersion) {
+        case HEADER_FORMAT_1:
+            version = bytes[offset];
+            offset += 1;
+
+            entityBytesCount = UInt32GetBE (&bytes[offset]);
+            offset += sizeof (uint32_t);
+
+            break;
     }
 
-    status = sqlite3_bind_text (fs->sdbInsertStmt, 3, data, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status) {
-        free (data);
-        return fileServiceFailedSDB (fs, needLock, status);
+    // Assert entityBytesCount remain in bytes
+    if (offset + entityBytesCount > bytesCount) {
+        assert (0); // In DEBUG builds.
+        fileServiceFailedImpl (fs, releaseLock, bufferToFree, NULL, "missed bytes count");
+        return NULL;
+    }
+
+    entityBytes = &bytes[offset];
+
+    switch (headerVersion) {
+        case HEADER_FORMAT_1:
+            // compute then compare checksum
+            break;
+    }
+
+    // Look up the entity handler
+    BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, version);
+    if (NULL == handler) {
+        fileServiceFailedImpl (fs, releaseLock, bufferToFree, NULL, "missed type handler");
+        return NULL;
     }
 
-    status = sqlite3_step (fs->sdbInsertStmt);
-    if (SQLITE_DONE != status) {
-        free (data);
-        return fileServiceFailedSDB (fs, needLock, status);
+    // Read the entity from buffer
+    void *entity = handler->reader (handler->context, fs, entityBytes, entityBytesCount);
+    if (NULL == entity) {
+        fileServiceFailedEntity (fs, releaseLock, bufferToFree, NULL, entityType->type, "reader");
+        return NULL;
     }
 
-    // Ensure the 'implicit DB transaction' is committed.
-    sqlite3_reset (fs->sdbInsertStmt);
+    *current = (version == entityType->currentVersion &&
+                headerVersion == currentHeaderFormatVersion);
+    return entity;
+}
 
-    if (needLock)
-        pthread_mutex_unlock (&fs->lock);
+// Return a save of `entity` in the current versions, or NULL if there is no current handler.
+static BRFileServicePendingWrite *
+_fileServiceUpdate (BRFileService fs,
+                    BRFileServiceEntityType *entityType,
+                    const void *entity) {
+    BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler (entityType, entityType->currentVersion);
+    if (NULL == handler) return NULL;
+
+    BRFileServicePendingWrite *update = malloc (sizeof (BRFileServicePendingWrite));
+    update->fs         = fs;
+    update->entityType = entityType;
+    update->identifier = handler->identifier (handler->context, fs, entity);
+    update->keyValues  = fileServiceEntityTypeKeyValues (fs, entityType, entity);
+    update->data       = _fileServiceEncode (fs, entityType, handler, entity, &update->dataCount);
+    return update;
+}
 
-    free (data);
-    return 1;
+// Add to `updates` a save of `entity`, read from the row with `identifier`, in the current versions
+// and, if the current version identifies it differently, a removal of that row.
+static void
+_fileServiceAddUpdate (BRFileService fs,
+                       BRFileServiceEntityType *entityType,
+                       const void *entity,
+                       UInt256 identifier,
+                       BRArrayOf(BRFileServicePendingWrite*) *updates) {
+    BRFileServicePendingWrite *update = _fileServiceUpdate (fs, entityType, entity);
+    if (NULL == update) return;
+    array_add (*updates, update);
+
+    if (!UInt256Eq (update->identifier, identifier)) {
+        BRFileServicePendingWrite *removal = calloc (1, sizeof (BRFileServicePendingWrite));
+        removal->fs         = fs;
+        removal->entityType = entityType;
+        removal->identifier = identifier;
+        array_add (*updates, removal);
+    }
 }
 
-extern int
-fileServiceSave (BRFileService fs,
-                 const char *type,  /* block, peers, transactions, logs, ... */
-                 const void *entity) {     /* BRMerkleBlock*, BRTransaction, BREthereumTransaction, ... */
-    return _fileServiceSave (fs, type, entity, 1);
+// Return true if `entity` must be saved again: if read in an older version or, as when saved
+// before its type had them, with stale keys.
+static int
+_fileServiceNeedsUpdate (BRFileService fs,
+                         BRFileServiceEntityType *entityType,
+                         const void *entity,
+                         int current,
+                         const BRFileServiceKeyValue *keyValues) {
+    if (!current) return 1;
+    if (0 == array_count (entityType->keys)) return 0;
+
+    BRFileServiceKeyValue *entityKeyValues = fileServiceEntityTypeKeyValues (fs, entityType, entity);
+    int equal = fileServiceKeyValuesEqual (entityType, keyValues, entityKeyValues);
+    fileServiceKeyValuesRelease (array_count (entityType->keys), entityKeyValues);
+
+    return !equal;
 }
 
-/// MARK: - Load
+static void
+_fileServiceUpdatesRelease (BRArrayOf(BRFileServicePendingWrite*) updates) {
+    for (size_t index = 0; index < array_count (updates); index++)
+        fileServicePendingWriteRelease (updates[index]);
+    array_free (updates);
+}
 
 extern int
 fileServiceLoad (BRFileService fs,
@@ -646,18 +1443,17 @@ fileServiceLoad (BRFileService fs,
     BRFileServiceEntityHandler *entityHandlerCurrent = fileServiceEntityTypeLookupHandler(entityType, entityType->currentVersion);
     if (NULL == entityHandlerCurrent) return fileServiceFailedImpl (fs,  0, NULL, NULL, "missed type handler");
 
-    sqlite3_status_code status;
+    sqlite3_stmt *stmt = entityType->sdbSelectAllStmt;
+    size_t keysCount = array_count (entityType->keys);
 
-    pthread_mutex_lock (&fs->lock);
+    pthread_mutex_lock (&fs->store->lock);
     if (fs->sdbClosed)
         return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
 
-    sqlite3_reset (fs->sdbSelectAllStmt);
-    sqlite3_clear_bindings (fs->sdbSelectAllStmt);
+    // Load what has been saved, including any pending writes.
+    _fileServiceFlushPending (fs->store);
 
-    status = sqlite3_bind_text (fs->sdbSelectAllStmt, 1, type, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status)
-        return fileServiceFailedSDB (fs, 1, status);
+    sqlite3_reset (stmt);
 
     uint8_t  dataBytesBuffer[8196];
     uint8_t *dataBytes = dataBytesBuffer;
@@ -667,97 +1463,389 @@ fileServiceLoad (BRFileService fs,
     // to dereferencing uninitialized memory.  We accept this minimal, extraneous function call.
     memset(dataBytes, 0, dataBytesCount);
 
-    while (SQLITE_ROW == sqlite3_step(fs->sdbSelectAllStmt)) {
-        const char *hash = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 0);
-        const char *data = (const char *) sqlite3_column_text (fs->sdbSelectAllStmt, 1);
+    // Entities to update are saved after the query; saving them during it, with new keys, could
+    // move them ahead in the query.
+    BRArrayOf(BRFileServicePendingWrite*) updates;
+    array_new (updates, 10);
 
-        if (NULL == hash || NULL == data)
+    while (SQLITE_ROW == sqlite3_step(stmt)) {
+        const uint8_t *hash = sqlite3_column_blob (stmt, 0);
+        const uint8_t *data = sqlite3_column_blob (stmt, 1);
+        size_t dataCount = (size_t) sqlite3_column_bytes (stmt, 1);
+
+        if (NULL == hash || NULL == data) {
+            _fileServiceUpdatesRelease (updates);
             return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
                                           "missed query `hash` or `data`");
+        }
 
-        assert (64 == strlen (hash));
-        
-        // Ensure `dataBytes` is large enough for hex-decoded `data`
-        size_t dataCount = strlen (data);
-        assert (0 == dataCount % 2);  // Surely 'even'
-        if ((dataCount/2) > dataBytesCount) {
+        assert (sizeof (UInt256) == sqlite3_column_bytes (stmt, 0));
+
+        UInt256 identifier;
+        memcpy (identifier.u8, hash, sizeof (UInt256));
+
+        // Ensure `dataBytes` is large enough for `data`
+        if (dataCount > dataBytesCount) {
             if (dataBytes != dataBytesBuffer) free (dataBytes);
-            dataBytesCount = dataCount/2;
+            dataBytesCount = dataCount;
             dataBytes = malloc (dataBytesCount);
         }
 
-        // Actually decode `data` into `dataBytes`
-        hexDecode (dataBytes, dataCount/2, data, dataCount);
+        // Copy `data`; readers may modify their bytes
+        memcpy (dataBytes, data, dataCount);
 
-        size_t offset = 0;
-        BRFileServiceVersion version;
-        uint32_t  entityBytesCount;
-        uint8_t  *entityBytes;
+        int current;
+        void *entity = _fileServiceDecode (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes),
+                                           entityType, dataBytes, dataCount, &current);
+        if (NULL == entity) { _fileServiceUpdatesRelease (updates); return 0; }
 
-        BRFileServiceHeaderFormatVersion headerVersion = dataBytes[offset];
-        offset += 1;
-
-        switch (headerVersion) {
-            case HEADER_FORMAT_1:
-                version = dataBytes[offset];
-                offset += 1;
+        // Update restuls with the newly restored entity
+        BRSetAdd (results, entity);
 
-                entityBytesCount = UInt32GetBE (&dataBytes[offset]);
-                offset += sizeof (uint32_t);
+        // If the read version is not the current version, or the keys are stale, update
+        if (updateVersion) {
+            BRFileServiceKeyValue *keyValues = fileServiceEntityTypeColumnKeyValues (entityType, stmt, 2);
 
-                break;
+            if (_fileServiceNeedsUpdate (fs, entityType, entity, current, keyValues))
+                _fileServiceAddUpdate (fs, entityType, entity, identifier, &updates);
+            fileServiceKeyValuesRelease (keysCount, keyValues);
         }
+    }
 
-        // Assert entityBytesCount remain in dataBytes
-        if (offset + entityBytesCount > dataBytesCount) {
-            assert (0); // In DEBUG builds.
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed bytes count");
+    // Ensure the 'implicit DB transaction' is committed.
+    sqlite3_reset (stmt);
+
+    // This could signal an error.  Perhaps we should test the return result and if not
+    // SQLITE_DONE skip out here?  We won't - we couldn't save the entities in the new format
+    // but we'll continue and will try next time we load them.
+    _fileServiceWrite (fs->store, updates, array_count (updates));
+    array_free (updates);
+
+    pthread_mutex_unlock (&fs->store->lock);
+
+    if (dataBytes != dataBytesBuffer) free (dataBytes);
+
+    return 1;
+}
+
+/// MARK: - Load Cursor
+
+// The most rows read from the DB at once by a cursor
+#define FILE_SERVICE_CURSOR_PAGE_COUNT      (256)
+
+typedef struct {
+    UInt256 identifier;
+    BRFileServiceKeyValue *keyValues;
+    uint8_t *data;
+    size_t dataCount;
+} BRFileServiceCursorRow;
+
+struct BRFileServiceCursorRecord {
+    BRFileService fs;
+    BRFileServiceEntityType *entityType;
+    const BRFileServiceEntityKey *key;      // the key to order by; NULL for the identifier
+    size_t   keyIndex;
+    BRFileServiceOrder order;
+    int updateVersion;
+
+    // The key's range, if any: integer keys in [lower, upper] or text keys equal to `match`
+    int      ranged;
+    int64_t  lower;
+    int64_t  upper;
+    char    *match;
+
+    // The page statements, prepared with the first page, hold a read on the DB only while a page
+    // is read; between pages, the cursor resumes after the last row read, by (key, Hash).
+    sqlite3_stmt *firstStmt;
+    sqlite3_stmt *nextStmt;
+    int      started;
+    int      exhausted;         // no rows remain in the DB
+    int      failed;
+    BRFileServiceKeyValue lastKeyValue;
+    UInt256  lastIdentifier;
+    size_t   remaining;         // entities yet to return, per the limit
+
+    BRArrayOf(BRFileServiceCursorRow) rows;
+    size_t   rowsIndex;
+
+    // Entities in older versions, or with stale keys, are written back once the cursor is done;
+    // updating them as they are read could move them ahead of the cursor.
+    BRArrayOf(BRFileServicePendingWrite*) updates;
+};
+
+extern BRFileServiceCursor
+fileServiceLoadCursor (BRFileService fs,
+                       const char *type,
+                       const char *key,
+                       BRFileServiceOrder order,
+                       size_t limit,
+                       int updateVersion) {
+    BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
+    if (NULL == entityType) { fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type"); return NULL; }
+
+    BRFileServiceCursor cursor = calloc (1, sizeof (struct BRFileServiceCursorRecord));
+    cursor->fs         = fs;
+    cursor->entityType = entityType;
+    cursor->order      = order;
+    cursor->updateVersion = updateVersion;
+    cursor->remaining     = (0 == limit ? SIZE_MAX : limit);
+
+    for (size_t index = 0; NULL != key && index < array_count (entityType->keys); index++)
+        if (0 == strcmp (key, entityType->keys[index].name)) {
+            cursor->key      = &entityType->keys[index];
+            cursor->keyIndex = index;
         }
 
-        entityBytes = &dataBytes[offset];
+    if (NULL != key && NULL == cursor->key) {
+        free (cursor);
+        fileServiceFailedImpl (fs, 0, NULL, NULL, "missed key");
+        return NULL;
+    }
 
-        switch (headerVersion) {
-            case HEADER_FORMAT_1:
-                // compute then compare checksum
-                break;
+    array_new (cursor->rows, FILE_SERVICE_CURSOR_PAGE_COUNT);
+    array_new (cursor->updates, 10);
+
+    return cursor;
+}
+
+extern int
+fileServiceLoadCursorRange (BRFileServiceCursor cursor,
+                            int64_t lower,
+                            int64_t upper) {
+    if (cursor->started || NULL == cursor->key || FILE_SERVICE_KEY_INTEGER != cursor->key->type)
+        return fileServiceFailedImpl (cursor->fs, 0, NULL, NULL, "missed integer key");
+
+    cursor->ranged = 1;
+    cursor->lower  = lower;
+    cursor->upper  = upper;
+    return 1;
+}
+
+extern int
+fileServiceLoadCursorMatch (BRFileServiceCursor cursor,
+                            const char *value) {
+    if (cursor->started || NULL == cursor->key || FILE_SERVICE_KEY_TEXT != cursor->key->type)
+        return fileServiceFailedImpl (cursor->fs, 0, NULL, NULL, "missed text key");
+
+    if (NULL != cursor->match) free (cursor->match);
+    cursor->ranged = 1;
+    cursor->match  = strdup (value);
+    return 1;
+}
+
+// Prepare the page statements, per the cursor's key, order and range.  The lock must be held.
+static sqlite3_status_code
+fileServiceLoadCursorPrepare (BRFileServiceCursor cursor) {
+    BRFileService fs = cursor->fs;
+    BRFileServiceEntityType *entityType = cursor->entityType;
+    int descending = (FILE_SERVICE_ORDER_DESCENDING == cursor->order);
+    char where[2 * FILE_SERVICE_KEY_NAME_LIMIT + 32], after[FILE_SERVICE_KEY_NAME_LIMIT + 48];
+    char orderBy[2 * FILE_SERVICE_KEY_NAME_LIMIT + 32], columns[sizeof (FileServiceSQL) / 2];
+
+    fileServiceEntityTypeColumns (entityType, columns, NULL);
+
+    if (NULL == cursor->key) {
+        strcpy  (where, "1");
+        sprintf (after, " AND Hash %s ?4", (descending ? "<" : ">"));
+        sprintf (orderBy, "Hash%s", (descending ? " DESC" : ""));
+    }
+    else {
+        const char *name = cursor->key->name;
+
+        if (!cursor->ranged) strcpy (where, "1");
+        else if (FILE_SERVICE_KEY_INTEGER == cursor->key->type)
+            sprintf (where, "\"%s\" BETWEEN ?1 AND ?2", name);
+        else sprintf (where, "\"%s\" = ?1", name);
+
+        sprintf (after, " AND (\"%s\", Hash) %s (?3, ?4)", name, (descending ? "<" : ">"));
+        sprintf (orderBy, "\"%s\"%s, Hash%s", name, (descending ? " DESC" : ""), (descending ? " DESC" : ""));
+    }
+
+    FileServiceSQL firstSQL, nextSQL;
+    sprintf (firstSQL, FILE_SERVICE_SDB_QUERY_PAGE_ENTITY, columns, entityType->table, where, "",    orderBy);
+    sprintf (nextSQL,  FILE_SERVICE_SDB_QUERY_PAGE_ENTITY, columns, entityType->table, where, after, orderBy);
+
+    sqlite3_status_code status = sqlite3_prepare_v2 (fs->store->sdb, firstSQL, -1, &cursor->firstStmt, NULL);
+    if (SQLITE_OK == status)
+        status = sqlite3_prepare_v2 (fs->store->sdb, nextSQL, -1, &cursor->nextStmt, NULL);
+    return status;
+}
+
+// Read the next page of rows.  Returns 0, with the failure reported, on an error.
+static int
+fileServiceLoadCursorPage (BRFileServiceCursor cursor) {
+    BRFileService fs = cursor->fs;
+    BRFileServiceEntityType *entityType = cursor->entityType;
+    size_t pageCount = (cursor->remaining < FILE_SERVICE_CURSOR_PAGE_COUNT
+                        ? cursor->remaining
+                        : FILE_SERVICE_CURSOR_PAGE_COUNT);
+    sqlite3_status_code status = SQLITE_OK;
+
+    pthread_mutex_lock (&fs->store->lock);
+    if (fs->sdbClosed)
+        return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
+
+    // Load what has been saved, including any pending writes.
+    if (!cursor->started) {
+        _fileServiceFlushPending (fs->store);
+        status = fileServiceLoadCursorPrepare (cursor);
+    }
+
+    sqlite3_stmt *stmt = (cursor->started ? cursor->nextStmt : cursor->firstStmt);
+
+    if (SQLITE_OK == status) {
+        sqlite3_reset (stmt);
+        sqlite3_clear_bindings (stmt);
+    }
+
+    if (SQLITE_OK == status && cursor->ranged) {
+        if (NULL != cursor->match)
+            status = sqlite3_bind_text (stmt, 1, cursor->match, -1, SQLITE_STATIC);
+        else {
+            status = sqlite3_bind_int64 (stmt, 1, cursor->lower);
+            if (SQLITE_OK == status)
+                status = sqlite3_bind_int64 (stmt, 2, cursor->upper);
         }
+    }
 
-        // Look up the entity handler
-        BRFileServiceEntityHandler *handler = fileServiceEntityTypeLookupHandler(entityType, version);
-        if (NULL == handler)
-            return fileServiceFailedImpl (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                          "missed type handler");
+    if (SQLITE_OK == status && cursor->started && NULL != cursor->key)
+        status = (FILE_SERVICE_KEY_INTEGER == cursor->key->type
+                  ? sqlite3_bind_int64 (stmt, 3, cursor->lastKeyValue.integer)
+                  : sqlite3_bind_text  (stmt, 3, cursor->lastKeyValue.text, -1, SQLITE_TRANSIENT));
+    if (SQLITE_OK == status && cursor->started)
+        status = sqlite3_bind_blob (stmt, 4, cursor->lastIdentifier.u8, sizeof (UInt256), SQLITE_TRANSIENT);
+    if (SQLITE_OK == status)
+        status = sqlite3_bind_int64 (stmt, 5, (sqlite3_int64) pageCount);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
 
-        // Read the entity from buffer and add to results.
-        void *entity = handler->reader (handler->context, fs, entityBytes, entityBytesCount);
-        if (NULL == entity)
-            return fileServiceFailedEntity (fs, 1, (dataBytes == dataBytesBuffer ? NULL : dataBytes), NULL,
-                                            type, "reader");
+    array_clear (cursor->rows);
+    cursor->rowsIndex = 0;
 
-        // Update restuls with the newly restored entity
-        BRSetAdd (results, entity);
+    while (SQLITE_ROW == (status = sqlite3_step (stmt))) {
+        const uint8_t *hash = sqlite3_column_blob (stmt, 0);
+        const uint8_t *data = sqlite3_column_blob (stmt, 1);
+
+        if (NULL == hash || NULL == data || sizeof (UInt256) != sqlite3_column_bytes (stmt, 0)) {
+            sqlite3_reset (stmt);
+            return fileServiceFailedImpl (fs, 1, NULL, NULL, "missed query `hash` or `data`");
+        }
 
-        // If the read version is not the current version, update
-        if (updateVersion &&
-            (version != entityType->currentVersion ||
-             headerVersion != currentHeaderFormatVersion))
-            // This could signal an error.  Perhaps we should test the return result and
-            // if `0` skip out here?  We won't - we couldn't save the entity in the new format
-            // but we'll continue and will try next time we load it.
-            _fileServiceSave (fs, type, entity, 0);
+        BRFileServiceCursorRow row;
+        memcpy (row.identifier.u8, hash, sizeof (UInt256));
+        row.keyValues = fileServiceEntityTypeColumnKeyValues (entityType, stmt, 2);
+        row.dataCount = (size_t) sqlite3_column_bytes (stmt, 1);
+        row.data      = malloc (row.dataCount);
+        memcpy (row.data, data, row.dataCount);
+        array_add (cursor->rows, row);
+
+        cursor->lastIdentifier = row.identifier;
+        if (NULL != cursor->key) {
+            if (NULL != cursor->lastKeyValue.text) free (cursor->lastKeyValue.text);
+            cursor->lastKeyValue.integer = row.keyValues[cursor->keyIndex].integer;
+            cursor->lastKeyValue.text    = (NULL == row.keyValues[cursor->keyIndex].text
+                                            ? NULL
+                                            : strdup (row.keyValues[cursor->keyIndex].text));
+        }
     }
 
     // Ensure the 'implicit DB transaction' is committed.
-    sqlite3_reset (fs->sdbSelectAllStmt);
+    sqlite3_reset (stmt);
 
-    pthread_mutex_unlock (&fs->lock);
+    if (SQLITE_DONE != status)
+        return fileServiceFailedSDB (fs, 1, status);
 
-    if (dataBytes != dataBytesBuffer) free (dataBytes);
+    pthread_mutex_unlock (&fs->store->lock);
 
+    cursor->started   = 1;
+    cursor->exhausted = array_count (cursor->rows) < pageCount;
     return 1;
 }
 
+// Write back the entities read in older versions, or with stale keys.
+static void
+fileServiceLoadCursorUpdate (BRFileServiceCursor cursor) {
+    BRFileService fs = cursor->fs;
+    size_t updatesCount = array_count (cursor->updates);
+    if (0 == updatesCount) return;
+
+    pthread_mutex_lock (&fs->store->lock);
+    sqlite3_status_code status = _fileServiceWrite (fs->store, cursor->updates, updatesCount);
+    array_clear (cursor->updates);
+
+    // As with `fileServiceLoad()`, a failed update is tried again on the next load.
+    if (SQLITE_DONE != status) fileServiceFailedSDB (fs, 1, status);
+    else pthread_mutex_unlock (&fs->store->lock);
+}
+
+extern void *
+fileServiceLoadNext (BRFileServiceCursor cursor) {
+    BRFileService fs = cursor->fs;
+    BRFileServiceEntityType *entityType = cursor->entityType;
+
+    if (cursor->failed) return NULL;
+
+    while (cursor->rowsIndex == array_count (cursor->rows)) {
+        if (cursor->exhausted || 0 == cursor->remaining) {
+            fileServiceLoadCursorUpdate (cursor);
+            return NULL;
+        }
+
+        if (!fileServiceLoadCursorPage (cursor)) {
+            cursor->failed = 1;
+            return NULL;
+        }
+    }
+
+    BRFileServiceCursorRow *row = &cursor->rows[cursor->rowsIndex++];
+
+    int current;
+    void *entity = _fileServiceDecode (fs, 0, NULL, entityType, row->data, row->dataCount, &current);
+
+    if (NULL != entity) {
+        cursor->remaining -= 1;
+
+        if (cursor->updateVersion &&
+            _fileServiceNeedsUpdate (fs, entityType, entity, current, row->keyValues))
+            _fileServiceAddUpdate (fs, entityType, entity, row->identifier, &cursor->updates);
+    }
+    else cursor->failed = 1;
+
+    free (row->data);
+    row->data = NULL;
+    fileServiceKeyValuesRelease (array_count (entityType->keys), row->keyValues);
+    row->keyValues = NULL;
+
+    return entity;
+}
+
+extern int
+fileServiceLoadCursorRelease (BRFileServiceCursor cursor) {
+    BRFileService fs = cursor->fs;
+    int success = !cursor->failed;
+
+    // Entities read so far are written back, even if the cursor was not run to the end.
+    fileServiceLoadCursorUpdate (cursor);
+
+    pthread_mutex_lock (&fs->store->lock);
+    _fileServiceFinalizeStmt (fs, &cursor->firstStmt);
+    _fileServiceFinalizeStmt (fs, &cursor->nextStmt);
+    pthread_mutex_unlock (&fs->store->lock);
+
+    for (size_t index = cursor->rowsIndex; index < array_count (cursor->rows); index++) {
+        free (cursor->rows[index].data);
+        fileServiceKeyValuesRelease (array_count (cursor->entityType->keys), cursor->rows[index].keyValues);
+    }
+    array_free (cursor->rows);
+    array_free (cursor->updates);
+
+    if (NULL != cursor->lastKeyValue.text) free (cursor->lastKeyValue.text);
+    if (NULL != cursor->match) free (cursor->match);
+    free (cursor);
+
+    return success;
+}
+
 /// MARK: - Remove, Clear
 
 extern int
@@ -768,34 +1856,21 @@ fileServiceRemove (BRFileService fs,
     if (NULL == entityType)
         return fileServiceFailedImpl (fs, 0, NULL, NULL, "missed type");
 
-    // Hex-Encode identifier
-    const char *hash = u256hex(identifier);
+    // In write-behind mode, the writer thread will remove it.
+    if (_fileServiceQueue (fs, entityType, identifier, NULL, 0, NULL))
+        return 1;
 
     sqlite3_status_code status;
 
-    pthread_mutex_lock (&fs->lock);
+    pthread_mutex_lock (&fs->store->lock);
     if (fs->sdbClosed)
         return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
 
-    sqlite3_reset (fs->sdbDeleteStmt);
-    sqlite3_clear_bindings (fs->sdbDeleteStmt);
-
-    status = sqlite3_bind_text (fs->sdbDeleteStmt, 1, type, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status)
-        return fileServiceFailedSDB (fs, 1, status);
-
-    status = sqlite3_bind_text (fs->sdbDeleteStmt, 2, hash, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status)
-        return fileServiceFailedSDB (fs, 1, status);
-
-    status = sqlite3_step (fs->sdbDeleteStmt);
+    status = _fileServiceDelete (fs, entityType, identifier);
     if (SQLITE_DONE != status)
         return fileServiceFailedSDB (fs, 1, status);
 
-    // Ensure the 'implicit DB transaction' is committed.
-    sqlite3_reset (fs->sdbDeleteStmt);
-
-    pthread_mutex_unlock (&fs->lock);
+    pthread_mutex_unlock (&fs->store->lock);
 
     return 1;
 }
@@ -804,29 +1879,26 @@ static int
 fileServiceClearForType (BRFileService fs,
                          BRFileServiceEntityType *entityType,
                          int needLock) {
-    const char *type = entityType->type;
-
+    sqlite3_stmt *stmt = entityType->sdbDeleteAllStmt;
     sqlite3_status_code status;
 
-    if (needLock) pthread_mutex_lock (&fs->lock);
+    if (needLock) pthread_mutex_lock (&fs->store->lock);
     if (fs->sdbClosed)
         return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
 
-    sqlite3_reset (fs->sdbDeleteAllTypeStmt);
-    sqlite3_clear_bindings (fs->sdbDeleteAllTypeStmt);
+    // Pending writes precede the clear
+    if (needLock) _fileServiceFlushPending (fs->store);
 
-    status = sqlite3_bind_text (fs->sdbDeleteAllTypeStmt, 1, type, -1, SQLITE_STATIC);
-    if (SQLITE_OK != status)
-        return fileServiceFailedSDB (fs, 1, status);
+    sqlite3_reset (stmt);
 
-    status = sqlite3_step (fs->sdbDeleteAllTypeStmt);
+    status = sqlite3_step (stmt);
     if (SQLITE_DONE != status)
         return fileServiceFailedSDB (fs, 1, status);
 
     // Ensure the 'implicit DB transaction' is committed.
-    sqlite3_reset (fs->sdbDeleteAllTypeStmt);
+    sqlite3_reset (stmt);
 
-    if (needLock) pthread_mutex_unlock (&fs->lock);
+    if (needLock) pthread_mutex_unlock (&fs->store->lock);
 
     return 1;
 }
@@ -846,13 +1918,13 @@ fileServiceClearAll (BRFileService fs) {
     int success = 1;
     size_t typeCount = array_count(fs->entityTypes);
     for (size_t index = 0; index < typeCount; index++)
-        success &= fileServiceClearForType (fs, &fs->entityTypes[index], 1);
+        success &= fileServiceClearForType (fs, fs->entityTypes[index], 1);
     return success;
 }
 
 static int
 fileServiceReplaceFailed (BRFileService fs, int needUnlock) {
-    if (needUnlock) pthread_mutex_unlock (&fs->lock);
+    if (needUnlock) pthread_mutex_unlock (&fs->store->lock);
     return 0;
 }
 
@@ -867,11 +1939,14 @@ fileServiceReplace (BRFileService fs,
 
     sqlite3_status_code status;
 
-    pthread_mutex_lock (&fs->lock);
+    pthread_mutex_lock (&fs->store->lock);
     if (fs->sdbClosed)
         return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
 
-    status = sqlite3_exec (fs->sdb, "BEGIN", NULL, NULL, NULL);
+    // Pending writes precede the replace
+    _fileServiceFlushPending (fs->store);
+
+    status = sqlite3_exec (fs->store->sdb, "BEGIN", NULL, NULL, NULL);
     if (SQLITE_OK != status)
         return fileServiceFailedSDB (fs, 1, status);
 
@@ -882,19 +1957,206 @@ fileServiceReplace (BRFileService fs,
         if (0 == _fileServiceSave (fs, type, entities[index], 0))
             return fileServiceReplaceFailed (fs, 1);
 
-    status = sqlite3_exec (fs->sdb, "COMMIT", NULL, NULL, NULL);
+    status = sqlite3_exec (fs->store->sdb, "COMMIT", NULL, NULL, NULL);
     if (SQLITE_OK != status)
         return fileServiceFailedSDB (fs, 1, status);
 
-    pthread_mutex_unlock (&fs->lock);
+    pthread_mutex_unlock (&fs->store->lock);
 
     return 1;
 }
 
+/// MARK: - Write Behind
+
+// Write `writes`, in one DB transaction if more than one, and free them.  Returns SQLITE_DONE on
+// success.  The lock must be held.
+static sqlite3_status_code
+_fileServiceWrite (BRFileServiceStore store,
+                   BRFileServicePendingWrite **writes,
+                   size_t writesCount) {
+    sqlite3_status_code status = SQLITE_DONE;
+
+    if (NULL == store->sdb) status = SQLITE_MISUSE;
+    else {
+        if (writesCount > 1) {
+            status = sqlite3_exec (store->sdb, "BEGIN", NULL, NULL, NULL);
+            if (SQLITE_OK == status) status = SQLITE_DONE;
+        }
+
+        for (size_t index = 0; SQLITE_DONE == status && index < writesCount; index++) {
+            BRFileServicePendingWrite *write = writes[index];
+
+            // A write queued as its service closed is dropped, not failed, lest the rollback
+            // discard the other services' writes.
+            if (write->fs->sdbClosed) continue;
+
+            status = (NULL != write->data
+                      ? _fileServiceInsert (write->fs, write->entityType, write->identifier,
+                                            write->data, write->dataCount, write->keyValues)
+                      : _fileServiceDelete (write->fs, write->entityType, write->identifier));
+        }
+
+        if (writesCount > 1) {
+            if (SQLITE_DONE == status) {
+                status = sqlite3_exec (store->sdb, "COMMIT", NULL, NULL, NULL);
+                if (SQLITE_OK == status) status = SQLITE_DONE;
+            }
+            else sqlite3_exec (store->sdb, "ROLLBACK", NULL, NULL, NULL);
+        }
+    }
+
+    for (size_t index = 0; index < writesCount; index++)
+        fileServicePendingWriteRelease (writes[index]);
+
+    return status;
+}
+
+// Write all pending saves and removes, of every service in the store, in one DB transaction.  The
+// lock must be held.
+static int
+_fileServiceFlushPending (BRFileServiceStore store) {
+    sqlite3_status_code status = SQLITE_DONE;
+
+    pthread_mutex_lock (&store->pendingLock);
+    size_t writesCount = BRSetCount (store->pending);
+    BRFileServicePendingWrite **writes = NULL;
+
+    if (writesCount > 0) {
+        writes = malloc (writesCount * sizeof (BRFileServicePendingWrite*));
+        writesCount = BRSetAll (store->pending, (void **) writes, writesCount);
+        BRSetClear (store->pending);
+    }
+    pthread_mutex_unlock (&store->pendingLock);
+
+    if (0 == writesCount) return 1;
+
+    // The services with writes; if the writes fail, each is told.
+    BRArrayOf(BRFileService) services;
+    array_new (services, 1);
+
+    for (size_t index = 0; index < writesCount; index++) {
+        size_t sindex = 0;
+        while (sindex < array_count (services) && services[sindex] != writes[index]->fs) sindex++;
+        if (sindex == array_count (services)) array_add (services, writes[index]->fs);
+    }
+
+    status = _fileServiceWrite (store, writes, writesCount);
+    free (writes);
+
+    // The writes are lost; the handler decides how to recover (typically with a full sync).
+    if (SQLITE_DONE != status)
+        for (size_t index = 0; index < array_count (services); index++)
+            fileServiceFailedSDB (services[index], 0, status);
+
+    array_free (services);
+    return SQLITE_DONE == status;
+}
+
+static int
+fileServiceStoreFlush (BRFileServiceStore store) {
+    pthread_mutex_lock (&store->lock);
+    int success = _fileServiceFlushPending (store);
+    pthread_mutex_unlock (&store->lock);
+    return success;
+}
+
+extern int
+fileServiceFlush (BRFileService fs) {
+    return fileServiceStoreFlush (fs->store);
+}
+
+static void *
+fileServiceWriterThread (BRFileServiceStore store) {
+#if defined (__ANDROID__)
+    pthread_setname_np (pthread_self(), "Core File Service Writer");
+#else
+    pthread_setname_np ("Core File Service Writer");
+#endif
+
+    pthread_mutex_lock (&store->pendingLock);
+
+    while (!store->writerQuit) {
+        size_t pendingCount = BRSetCount (store->pending);
+        double flushTime    = store->pendingTime + store->pendingDelay;
+
+        if (0 == pendingCount)
+            pthread_cond_wait (&store->pendingCond, &store->pendingLock);
+
+        else if (pendingCount >= store->pendingLimit || fileServiceTime() >= flushTime) {
+            pthread_mutex_unlock (&store->pendingLock);
+            fileServiceStoreFlush (store);
+            pthread_mutex_lock (&store->pendingLock);
+        }
+
+        else {
+            struct timespec timeout = { (time_t) flushTime, (long) ((flushTime - (time_t) flushTime) * 1000000000) };
+            pthread_cond_timedwait (&store->pendingCond, &store->pendingLock, &timeout);
+        }
+    }
+
+    pthread_mutex_unlock (&store->pendingLock);
+    return NULL;
+}
+
+// Leave write-behind mode, waiting for the writer thread to finish.  Pending writes remain pending.
+static void
+fileServiceStopWriter (BRFileServiceStore store) {
+    pthread_mutex_lock (&store->pendingLock);
+    int writerRunning = store->writerRunning;
+    store->pendingLimit  = 0;
+    store->writerQuit    = 1;
+    pthread_cond_signal (&store->pendingCond);
+    pthread_mutex_unlock (&store->pendingLock);
+
+    if (writerRunning) pthread_join (store->writer, NULL);
+
+    pthread_mutex_lock (&store->pendingLock);
+    store->writerRunning = 0;
+    store->writerQuit    = 0;
+    pthread_mutex_unlock (&store->pendingLock);
+}
+
+extern void
+fileServiceSetWriteBehind (BRFileService fs,
+                           size_t pendingLimit,
+                           double pendingDelay) {
+    BRFileServiceStore store = fs->store;
+
+    if (0 == pendingLimit) {
+        fileServiceStopWriter (store);
+        fileServiceStoreFlush (store);
+        return;
+    }
+
+    pthread_mutex_lock (&store->pendingLock);
+    store->pendingLimit = pendingLimit;
+    store->pendingDelay = pendingDelay;
+    pthread_cond_signal (&store->pendingCond);
+
+    if (!store->writerRunning) {
+        pthread_attr_t attr;
+        pthread_attr_init (&attr);
+        pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_JOINABLE);
+        pthread_attr_setstacksize (&attr, 1024 * 1024);
+
+        // If the thread can't be created, stay with writing on the calling thread.
+        if (0 == pthread_create (&store->writer, &attr, (void* (*) (void*)) fileServiceWriterThread, store))
+            store->writerRunning = 1;
+        else store->pendingLimit = 0;
+
+        pthread_attr_destroy (&attr);
+    }
+    pthread_mutex_unlock (&store->pendingLock);
+}
+
 extern int
 fileServiceWipe (const char *basePath,
                  const char *currency,
                  const char *network) {
+    // Wipe the namespace in the installed store, if any, and any DB of the service's own.
+    BRFileServiceStore store = fileServiceStoreTakeInstalled ();
+    int wiped = (NULL == store || fileServiceStoreWipe (store, basePath, currency, network));
+    if (NULL != store) fileServiceStoreRelease (store);
 
     // Locate the SQLITE Database
     char *sdbPath = fileServiceCreateFilePath (basePath, currency, network, FILE_SERVICE_SDB_FILENAME);
@@ -902,6 +2164,8 @@ fileServiceWipe (const char *basePath,
     // Remove it.
     int   result  = 0 == remove (sdbPath) ? 0 : errno;
     free (sdbPath);
+
+    if (NULL != store) return (wiped ? 0 : EIO);
     return result;
 }
 
@@ -919,6 +2183,149 @@ fileServiceGetIdentifier (BRFileService fs,
     return handler->identifier (handler->context, fs, entity);
 }
 
+/// MARK: - Types
+
+// Return true if `name` is an SQL identifier, of at most `limit` characters.
+static int
+fileServiceIsValidName (const char *name,
+                        size_t limit) {
+    size_t length = (NULL == name ? 0 : strlen (name));
+    if (0 == length || length > limit) return 0;
+
+    for (size_t index = 0; index < length; index++) {
+        char c = name[index];
+        if (!(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || '_' == c ||
+              (index > 0 && '0' <= c && c <= '9')))
+            return 0;
+    }
+    return 1;
+}
+
+// Return true if the type's table has the column `name`.  The lock must be held.
+static int
+fileServiceEntityTypeHasColumn (BRFileService fs,
+                                BRFileServiceEntityType *entityType,
+                                const char *name,
+                                sqlite3_status_code *status) {
+    FileServiceSQL sql;
+    sqlite3_stmt *stmt;
+    int found = 0;
+
+    sprintf (sql, FILE_SERVICE_SDB_QUERY_TYPE_COLUMNS, entityType->table);
+    *status = sqlite3_prepare_v2 (fs->store->sdb, sql, -1, &stmt, NULL);
+    if (SQLITE_OK != *status) return 0;
+
+    // The column name is the second column of `table_info`.
+    while (!found && SQLITE_ROW == sqlite3_step (stmt)) {
+        const char *column = (const char *) sqlite3_column_text (stmt, 1);
+        found = (NULL != column && 0 == sqlite3_stricmp (column, name));
+    }
+
+    sqlite3_finalize (stmt);
+    return found;
+}
+
+// Create the type's table, with an indexed column per key, adding columns for keys not already
+// there; move the type's rows from the legacy `Entity` table; prepare the type's statements.
+// Entities saved before a key existed have the key's default (0 or '') until saved again.
+static int
+fileServiceEntityTypePrepare (BRFileService fs,
+                              BRFileServiceEntityType *entityType) {
+    const char *type  = entityType->type;
+    const char *table = entityType->table;
+    FileServiceSQL sql, columns, placeholders;
+    sqlite3_status_code status;
+
+    pthread_mutex_lock (&fs->store->lock);
+    if (fs->sdbClosed)
+        return fileServiceFailedImpl (fs, 1, NULL, NULL, "closed");
+
+    // Pending writes hold values for the type's current keys; write them first
+    _fileServiceFlushPending (fs->store);
+
+    _fileServiceFinalizeStmt (fs, &entityType->sdbInsertStmt);
+    _fileServiceFinalizeStmt (fs, &entityType->sdbSelectAllStmt);
+    _fileServiceFinalizeStmt (fs, &entityType->sdbDeleteStmt);
+    _fileServiceFinalizeStmt (fs, &entityType->sdbDeleteAllStmt);
+
+    status = sqlite3_exec (fs->store->sdb, "BEGIN", NULL, NULL, NULL);
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
+
+    sprintf (sql, FILE_SERVICE_SDB_TYPE_TABLE, table);
+    status = sqlite3_exec (fs->store->sdb, sql, NULL, NULL, NULL);
+
+    for (size_t index = 0; SQLITE_OK == status && index < array_count (entityType->keys); index++) {
+        const BRFileServiceEntityKey *key = &entityType->keys[index];
+
+        if (!fileServiceEntityTypeHasColumn (fs, entityType, key->name, &status) && SQLITE_OK == status) {
+            sprintf (sql, (FILE_SERVICE_KEY_INTEGER == key->type
+                           ? FILE_SERVICE_SDB_TYPE_ADD_INTEGER_KEY
+                           : FILE_SERVICE_SDB_TYPE_ADD_TEXT_KEY),
+                     table, key->name);
+            status = sqlite3_exec (fs->store->sdb, sql, NULL, NULL, NULL);
+        }
+
+        if (SQLITE_OK == status) {
+            sprintf (sql, FILE_SERVICE_SDB_TYPE_KEY_INDEX, table, key->name, table, key->name);
+            status = sqlite3_exec (fs->store->sdb, sql, NULL, NULL, NULL);
+        }
+    }
+
+    if (SQLITE_OK == status && fs->store->sdbLegacy) {
+        sqlite3_stmt *stmt;
+        int empty = 0;
+
+        sprintf (sql, FILE_SERVICE_SDB_MOVE_LEGACY_ENTITY, table, type, type);
+        status = sqlite3_exec (fs->store->sdb, sql, NULL, NULL, NULL);
+
+        if (SQLITE_OK == status)
+            status = sqlite3_prepare_v2 (fs->store->sdb, FILE_SERVICE_SDB_QUERY_LEGACY_ENTITY_EMPTY, -1, &stmt, NULL);
+        if (SQLITE_OK == status) {
+            if (SQLITE_ROW == sqlite3_step (stmt)) empty = (0 == sqlite3_column_int (stmt, 0));
+            sqlite3_finalize (stmt);
+        }
+
+        if (SQLITE_OK == status && empty)
+            status = sqlite3_exec (fs->store->sdb, "DROP TABLE Entity;", NULL, NULL, NULL);
+        if (SQLITE_OK == status && empty)
+            fs->store->sdbLegacy = 0;
+    }
+
+    if (SQLITE_OK == status)
+        status = sqlite3_exec (fs->store->sdb, "COMMIT", NULL, NULL, NULL);
+    else
+        sqlite3_exec (fs->store->sdb, "ROLLBACK", NULL, NULL, NULL);
+
+    fileServiceEntityTypeColumns (entityType, columns, placeholders);
+
+    if (SQLITE_OK == status) {
+        sprintf (sql, FILE_SERVICE_SDB_INSERT_ENTITY, table, columns, placeholders);
+        status = sqlite3_prepare_v2 (fs->store->sdb, sql, -1, &entityType->sdbInsertStmt, NULL);
+    }
+
+    if (SQLITE_OK == status) {
+        sprintf (sql, FILE_SERVICE_SDB_QUERY_ALL_ENTITY, columns, table);
+        status = sqlite3_prepare_v2 (fs->store->sdb, sql, -1, &entityType->sdbSelectAllStmt, NULL);
+    }
+
+    if (SQLITE_OK == status) {
+        sprintf (sql, FILE_SERVICE_SDB_DELETE_ENTITY, table);
+        status = sqlite3_prepare_v2 (fs->store->sdb, sql, -1, &entityType->sdbDeleteStmt, NULL);
+    }
+
+    if (SQLITE_OK == status) {
+        sprintf (sql, FILE_SERVICE_SDB_DELETE_ALL_TYPE_ENTITY, table);
+        status = sqlite3_prepare_v2 (fs->store->sdb, sql, -1, &entityType->sdbDeleteAllStmt, NULL);
+    }
+
+    if (SQLITE_OK != status)
+        return fileServiceFailedSDB (fs, 1, status);
+
+    pthread_mutex_unlock (&fs->store->lock);
+    return 1;
+}
+
 extern int
 fileServiceDefineType (BRFileService fs,
                        const char *type,
@@ -926,9 +2333,30 @@ fileServiceDefineType (BRFileService fs,
                        BRFileServiceContext context,
                        BRFileServiceIdentifier identifier,
                        BRFileServiceReader reader,
-                       BRFileServiceWriter writer) {
+                       BRFileServiceWriter writer,
+                       size_t keysCount,
+                       const BRFileServiceKey *keys) {
+    // Names are used in SQL
+    if (!fileServiceIsValidName (type, FILE_SERVICE_TYPE_NAME_LIMIT))
+        return fileServiceFailedImpl (fs, 0, NULL, NULL, "invalid type");
+
+    if (keysCount > FILE_SERVICE_TYPE_SPECIFICATION_NUMBER_OF_KEYS_LIMIT)
+        return fileServiceFailedImpl (fs, 0, NULL, NULL, "invalid key");
+
+    for (size_t index = 0; index < keysCount; index++) {
+        if (!fileServiceIsValidName (keys[index].name, FILE_SERVICE_KEY_NAME_LIMIT) ||
+            0 == sqlite3_stricmp (keys[index].name, "Hash") ||
+            0 == sqlite3_stricmp (keys[index].name, "Data"))
+            return fileServiceFailedImpl (fs, 0, NULL, NULL, "invalid key");
+
+        for (size_t oindex = 0; oindex < index; oindex++)
+            if (0 == sqlite3_stricmp (keys[index].name, keys[oindex].name))
+                return fileServiceFailedImpl (fs, 0, NULL, NULL, "invalid key");
+    }
+
     // Lookup the entityType for `type`
     BRFileServiceEntityType *entityType = fileServiceLookupType (fs, type);
+    int needPrepare = (NULL == entityType || keysCount > 0);
 
     // If there isn't an entityType, create one.
     if (NULL == entityType)
@@ -955,7 +2383,24 @@ fileServiceDefineType (BRFileService fs,
         fileServiceEntityTypeAddHandler (entityType, &newEntityHander);
     }
 
-    return 1;
+    // Replace the keys, if any are given
+    if (keysCount > 0) {
+        fileServiceEntityTypeReleaseKeys (entityType);
+        for (size_t index = 0; index < keysCount; index++) {
+            BRFileServiceEntityKey key = {
+                strdup (keys[index].name),
+                keys[index].type,
+                context
+            };
+            switch (keys[index].type) {
+                case FILE_SERVICE_KEY_INTEGER: key.u.integer = keys[index].u.integer; break;
+                case FILE_SERVICE_KEY_TEXT:    key.u.text    = keys[index].u.text;    break;
+            }
+            array_add (entityType->keys, key);
+        }
+    }
+
+    return (needPrepare ? fileServiceEntityTypePrepare (fs, entityType) : 1);
 }
 
 extern int
@@ -996,13 +2441,16 @@ fileServiceCreateFromTypeSpecfications (const char *basePath,
     for (size_t index = 0; index < specificationsCount; index++) {
         BRFileServiceTypeSpecification *specification = &specfications[index];
         for (size_t vindex = 0; vindex < specification->versionsCount; vindex++) {
+            // The keys apply to every version; define them once.
             success &= fileServiceDefineType (fileService,
                                               specification->type,
                                               specification->versions[vindex].version,
                                               context,
                                               specification->versions[vindex].identifier,
                                               specification->versions[vindex].reader,
-                                              specification->versions[vindex].writer);
+                                              specification->versions[vindex].writer,
+                                              (0 == vindex ? specification->keysCount : 0),
+                                              specification->keys);
             if (!success) break;
         }
 
@@ -83,6 +83,39 @@ typedef void
 /// This *must* be the same fixed size type forever.  It is uint8_t.
 typedef uint8_t BRFileServiceVersion;
 
+/**
+ * A store holds the DB, and the writer thread for write-behind mode, of file services.  Each
+ * file service has its own store, in its own DB file, unless a shared store is installed, with
+ * `fileServiceStoreInstall()`.  Then file services created, by `fileServiceCreate()`, use the
+ * shared store: one DB, in WAL mode, with one writer thread, in which each service's tables are
+ * kept in a namespace of its own, for {basePath, currency, network}.  Open files, page caches and
+ * threads then scale with the number of stores rather than with the number of services.
+ *
+ * A service's existing DB file is not read by a shared store; its entities start out empty.
+ */
+typedef struct BRFileServiceStoreRecord *BRFileServiceStore;
+
+/**
+ * Create a shared store, in `basePath`/entities.db.
+ *
+ * @return the store or NULL on an error.
+ */
+extern BRFileServiceStore
+fileServiceStoreCreate (const char *basePath);
+
+/**
+ * Release `store`.  The store remains open while it is installed or used by a service.
+ */
+extern void
+fileServiceStoreRelease (BRFileServiceStore store);
+
+/**
+ * Install `store`, replacing any installed store, for use by file services created afterwards;
+ * NULL to uninstall.  Existing services keep the store they were created with.
+ */
+extern void
+fileServiceStoreInstall (BRFileServiceStore store);
+
 /// TODO: There are limitations on `currency`, `network`, and `type`.
 extern BRFileService
 fileServiceCreate (const char *basePath,
@@ -128,6 +161,79 @@ fileServiceLoad (BRFileService fs,
                  const char *type,   /* blocks, peers, transactions, logs, ... */
                  int updateVersion);
 
+typedef enum {
+    FILE_SERVICE_ORDER_ASCENDING,       // by key, then identifier
+    FILE_SERVICE_ORDER_DESCENDING       // by key, then identifier, both descending
+} BRFileServiceOrder;
+
+typedef struct BRFileServiceCursorRecord *BRFileServiceCursor;
+
+/**
+ * Create a cursor to load entities of `type` one at a time, with `fileServiceLoadNext()`.  Entities
+ * are read from the DB in pages, so only a page is held in memory and other uses of `fs`, such as
+ * saves, may proceed between calls; those made to entities ahead of the cursor may be seen.  The
+ * cursor must be released, with `fileServiceLoadCursorRelease()`, before `fs` is closed.
+ *
+ * Entities are ordered by `key`, one of the keys of `type`, or by identifier if `key` is NULL.
+ * The entities loaded can be restricted to a range of, or a value of, `key` with
+ * `fileServiceLoadCursorRange()` or `fileServiceLoadCursorMatch()`.  The keys of `type` must not
+ * be redefined while the cursor exists.
+ *
+ * @param fs The fileService
+ * @param type The type to restore
+ * @param key The key by which to order entities, or NULL for the identifier
+ * @param order The order in which to load entities
+ * @param limit The most entities to load; if 0 then all of them.
+ * @param updateVersion If true (1) update old versions with newer ones, once the cursor is done.
+ *
+ * @return the cursor or NULL, after invoking the error handler, on an error.
+ */
+extern BRFileServiceCursor
+fileServiceLoadCursor (BRFileService fs,
+                       const char *type,
+                       const char *key,
+                       BRFileServiceOrder order,
+                       size_t limit,
+                       int updateVersion);
+
+/**
+ * Restrict `cursor` to entities with an integer key in [lower, upper].  Must be called before
+ * the first `fileServiceLoadNext()`.
+ *
+ * @return true (1) if success, false (0) otherwise, such as if the key isn't an integer key.
+ */
+extern int
+fileServiceLoadCursorRange (BRFileServiceCursor cursor,
+                            int64_t lower,
+                            int64_t upper);
+
+/**
+ * Restrict `cursor` to entities with a text key equal to `value`.  Must be called before the
+ * first `fileServiceLoadNext()`.
+ *
+ * @return true (1) if success, false (0) otherwise, such as if the key isn't a text key.
+ */
+extern int
+fileServiceLoadCursorMatch (BRFileServiceCursor cursor,
+                            const char *value);
+
+/**
+ * Load the next entity from `cursor`.  You own the entity.
+ *
+ * @return the entity or NULL if there are no more or, after invoking the error handler, on an
+ *    error.
+ */
+extern void *
+fileServiceLoadNext (BRFileServiceCursor cursor);
+
+/**
+ * Release `cursor`, first updating old versions of the entities loaded, if requested.
+ *
+ * @return true (1) if every entity was loaded without error, false (0) otherwise
+ */
+extern int
+fileServiceLoadCursorRelease (BRFileServiceCursor cursor);
+
 extern int  // 1 -> success, 0 -> failure
 fileServiceSave (BRFileService fs,
                  const char *type,  /* block, peers, transactions, logs, ... */
@@ -151,6 +257,40 @@ fileServiceClear (BRFileService fs,
 extern int
 fileServiceClearAll (BRFileService fs);
 
+/**
+ * Enable write-behind mode.  Entities are still serialized by `fileServiceSave()`, on the calling
+ * thread, but then saves and removes are queued, keeping only the latest for each entity, and
+ * written in a single DB transaction by a writer thread once `pendingLimit` are queued or the
+ * oldest has been queued for `pendingDelay` seconds.  Errors are then reported to the error handler
+ * from the writer thread.
+ *
+ * Loads, clears and replaces first write anything pending, as does closing `fs`.
+ *
+ * This sets the mode of the store of `fs`; in a shared store, that of all its services.  Writes
+ * then queue, and are written, across services.
+ *
+ * @param fs The fileService
+ * @param pendingLimit The number of queued writes that triggers a write; if 0 then leave
+ *     write-behind mode, after writing anything pending.
+ * @param pendingDelay The most seconds a queued write waits
+ */
+extern void
+fileServiceSetWriteBehind (BRFileService fs,
+                           size_t pendingLimit,
+                           double pendingDelay);
+
+/**
+ * Write any saves and removes queued in write-behind mode, returning once they are in the DB.
+ *
+ * @return true (1) if success, false (0) otherwise
+ */
+extern int
+fileServiceFlush (BRFileService fs);
+
+/// Write-behind settings used by the wallet managers
+#define FILE_SERVICE_WRITE_BEHIND_PENDING_LIMIT     (1000)
+#define FILE_SERVICE_WRITE_BEHIND_PENDING_DELAY     (1.0)
+
 extern UInt256
 fileServiceGetIdentifier (BRFileService fs,
                           const char *type,
@@ -184,7 +324,41 @@ typedef uint8_t*
                         const void* entity,
                         uint32_t *bytesCount);
 
-/// TODO: There is a limitation on `type`.
+typedef enum {
+    FILE_SERVICE_KEY_INTEGER,
+    FILE_SERVICE_KEY_TEXT
+} BRFileServiceKeyType;
+
+/**
+ * A function type to produce an integer key from an entity, such as a block height or a
+ * timestamp.  The key is saved, in an indexed column, along with the entity each time the entity
+ * is saved.
+ */
+typedef int64_t
+(*BRFileServiceIntegerKey) (BRFileServiceContext context,
+                            BRFileService fs,
+                            const void* entity);
+
+/**
+ * A function type to produce a text key from an entity, such as an address.  You own the text;
+ * NULL is saved as "".
+ */
+typedef char *
+(*BRFileServiceTextKey) (BRFileServiceContext context,
+                         BRFileService fs,
+                         const void* entity);
+
+typedef struct {
+    const char *name;
+    BRFileServiceKeyType type;
+    union {
+        BRFileServiceIntegerKey integer;
+        BRFileServiceTextKey text;
+    } u;
+} BRFileServiceKey;
+
+/// A `type` or key name must be an SQL identifier ([A-Za-z_][A-Za-z0-9_]*), of at most 64 or 32
+/// characters, respectively; a key can't be named `Hash` or `Data`.
 
 /**
  * Define a 'type', such as {block, peer, transaction, logs, etc}, that is to be stored in the
@@ -197,6 +371,9 @@ typedef uint8_t*
  * @param identifier the function that produces the identifier
  * @param reader the function the produces an entity from a byte array
  * @param writer the function that produces a byte array from an entity.
+ * @param keysCount the number of keys; if 0 then the type's keys, if any, are unchanged.
+ * @param keys the keys, each saved in an indexed column, by which a cursor can select and order
+ *     entities.  Entities saved before a key was defined have a key of 0 or "" until saved again.
  *
  * @return true (1) if success, false (0) otherwise
  */
@@ -207,7 +384,9 @@ fileServiceDefineType (BRFileService fs,
                        BRFileServiceContext context,
                        BRFileServiceIdentifier identifier,
                        BRFileServiceReader reader,
-                       BRFileServiceWriter writer);
+                       BRFileServiceWriter writer,
+                       size_t keysCount,
+                       const BRFileServiceKey *keys);
 
 extern int
 fileServiceDefineCurrentVersion (BRFileService fs,
@@ -216,6 +395,7 @@ fileServiceDefineCurrentVersion (BRFileService fs,
 
 // Version limit can increase with maximum number of version, historically.
 #define FILE_SERVICE_TYPE_SPECIFICATION_NUMBER_OF_VERSION_LIMIT   (5)
+#define FILE_SERVICE_TYPE_SPECIFICATION_NUMBER_OF_KEYS_LIMIT      (4)
 
 typedef struct {
     const char *type;
@@ -227,6 +407,8 @@ typedef struct {
         BRFileServiceReader reader;
         BRFileServiceWriter writer;
     } versions [FILE_SERVICE_TYPE_SPECIFICATION_NUMBER_OF_VERSION_LIMIT];
+    size_t keysCount;
+    BRFileServiceKey keys [FILE_SERVICE_TYPE_SPECIFICATION_NUMBER_OF_KEYS_LIMIT];
 } BRFileServiceTypeSpecification;
 
 extern BRFileService
@@ -239,7 +421,7 @@ fileServiceCreateFromTypeSpecfications (const char *basePath,
                                         BRFileServiceTypeSpecification *specfications);
 
 ///
-/// Deletes file system data
+/// Deletes file system data; with a shared store installed, also the namespace's tables in it.
 ///
 /// @param basePath
 /// @param currency